@@ -0,0 +1,1425 @@
+/* pngapng.c
+ *
+ * Copyright (c) 2026 Cosmin Truta
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * Test APNG reading and writing.  The animations are generated in memory with
+ * the low-level write API and the results checked against a straightforward
+ * implementation of the APNG frame composition rules.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_CONFIG_H) && !defined(PNG_NO_CONFIG_H)
+#  include <config.h>
+#endif
+
+#ifdef PNG_FREESTANDING_TESTS
+#  include <png.h>
+#else
+#  include "../../png.h"
+#endif
+
+/* 1.6.1 added support for the configure test harness, which uses 77 to indicate
+ * a skipped test, in earlier versions we need to succeed on a skipped test, so:
+ */
+#if defined(HAVE_CONFIG_H)
+#  define SKIP 77
+#else
+#  define SKIP 0
+#endif
+
+#if defined(PNG_WRITE_APNG_SUPPORTED) && defined(PNG_READ_APNG_SUPPORTED) &&\
+    defined(PNG_SIMPLIFIED_READ_SUPPORTED)
+
+#define CANVAS_WIDTH  23
+#define CANVAS_HEIGHT 17
+
+typedef struct
+{
+   png_uint_32 x, y, width, height;
+   png_byte dispose_op, blend_op;
+} frame_def;
+
+/* An animation exercising every dispose_op and blend_op combination, with
+ * frames that touch the canvas edges and overlap each other.
+ */
+static const frame_def test_frames[] =
+{
+   {  0,  0, CANVAS_WIDTH, CANVAS_HEIGHT,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE },
+   {  3,  2,  9,  7,
+      PNG_fcTL_DISPOSE_OP_PREVIOUS, PNG_fcTL_BLEND_OP_OVER },
+   {  0,  0, 11, 10,
+      PNG_fcTL_DISPOSE_OP_BACKGROUND, PNG_fcTL_BLEND_OP_OVER },
+   { 12,  5, 11, 12,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE },
+   {  1,  1,  1,  1,
+      PNG_fcTL_DISPOSE_OP_PREVIOUS, PNG_fcTL_BLEND_OP_SOURCE },
+   {  5,  4, 14,  9,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_OVER },
+   { 20, 14,  3,  3,
+      PNG_fcTL_DISPOSE_OP_BACKGROUND, PNG_fcTL_BLEND_OP_OVER }
+};
+
+#define NUM_TEST_FRAMES ((sizeof test_frames)/(sizeof test_frames[0]))
+
+typedef struct
+{
+   png_byte *data;
+   size_t size;
+   size_t allocated;
+} memory_buffer;
+
+static void PNGCBAPI
+buffer_write(png_structp png_ptr, png_bytep data, size_t length)
+{
+   memory_buffer *buffer = (memory_buffer *)png_get_io_ptr(png_ptr);
+
+   if (buffer->size + length > buffer->allocated)
+   {
+      size_t allocated = 2 * (buffer->size + length);
+      png_byte *data_new = (png_byte *)realloc(buffer->data, allocated);
+
+      if (data_new == NULL)
+         png_error(png_ptr, "out of memory");
+
+      buffer->data = data_new;
+      buffer->allocated = allocated;
+   }
+
+   memcpy(buffer->data + buffer->size, data, length);
+   buffer->size += length;
+}
+
+static void PNGCBAPI
+buffer_flush(png_structp png_ptr)
+{
+   (void)png_ptr;
+}
+
+/* Deterministic pixel data; the alpha values include plenty of 0 and 255 as
+ * well as intermediate values.
+ */
+static png_uint_32 random_state = 12345;
+
+static png_byte
+random_byte(void)
+{
+   random_state = random_state * 1103515245U + 12345U;
+   return (png_byte)(random_state >> 16);
+}
+
+static void
+make_pixels(png_byte *pixels, png_uint_32 count, unsigned int channels)
+{
+   png_uint_32 i;
+
+   for (i = 0; i < count; ++i, pixels += channels)
+   {
+      unsigned int c;
+      png_byte a = random_byte();
+
+      for (c = 0; c + 1 < channels; ++c)
+         pixels[c] = random_byte();
+
+      if (a < 64)
+         a = 0;
+
+      else if (a >= 160)
+         a = 255;
+
+      pixels[channels - 1] = a;
+   }
+}
+
+/* Write an animation of 'nframes' frames with the given pixel data, which is
+ * in PNG order (gray-alpha or RGBA.)  If 'hidden' is set a default image that
+ * is not part of the animation is written first.  If 'precompress' is set all
+ * of the frames are compressed with png_compress_frame, last first, before any
+ * is written; the output must be the same.
+ */
+static int
+write_apng(memory_buffer *buffer, int color_type, int interlace, int hidden,
+    const frame_def *frames, unsigned int nframes, png_byte **pixels,
+    int precompress)
+{
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_bytep *rows = NULL;
+   png_byte *default_image = NULL;
+   png_compressed_frame **compressed = NULL;
+   unsigned int channels = color_type == PNG_COLOR_TYPE_RGB_ALPHA ? 4 : 2;
+   unsigned int ncompressed = nframes + (hidden != 0);
+   unsigned int i;
+
+   /* Allocated here so that it is not changed after the setjmp. */
+   if (precompress)
+   {
+      compressed = (png_compressed_frame **)calloc(ncompressed,
+          sizeof *compressed);
+      if (compressed == NULL)
+         return 1;
+   }
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+   if (png_ptr == NULL)
+   {
+      free(compressed);
+      return 1;
+   }
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL)
+   {
+      png_destroy_write_struct(&png_ptr, NULL);
+      free(compressed);
+      return 1;
+   }
+
+   if (setjmp(png_jmpbuf(png_ptr)))
+   {
+      if (compressed != NULL)
+         for (i = 0; i < ncompressed; ++i)
+            png_free_compressed_frame(png_ptr, compressed[i]);
+
+      free(compressed);
+      free(rows);
+      free(default_image);
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      return 1;
+   }
+
+   rows = (png_bytep *)malloc(CANVAS_HEIGHT * (sizeof *rows));
+   if (rows == NULL)
+      png_error(png_ptr, "out of memory");
+
+   png_set_write_fn(png_ptr, buffer, buffer_write, buffer_flush);
+   png_set_IHDR(png_ptr, info_ptr, CANVAS_WIDTH, CANVAS_HEIGHT, 8, color_type,
+       interlace, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+   png_set_acTL(png_ptr, info_ptr, nframes + (hidden != 0), 0);
+   png_set_first_frame_is_hidden(png_ptr, info_ptr, (png_byte)(hidden != 0));
+   png_write_info(png_ptr, info_ptr);
+
+   if (hidden)
+   {
+      png_uint_32 y;
+
+      default_image = (png_byte *)malloc(
+          CANVAS_WIDTH * CANVAS_HEIGHT * channels);
+      if (default_image == NULL)
+         png_error(png_ptr, "out of memory");
+
+      make_pixels(default_image, CANVAS_WIDTH * CANVAS_HEIGHT, channels);
+
+      for (y = 0; y < CANVAS_HEIGHT; ++y)
+         rows[y] = default_image + y * CANVAS_WIDTH * channels;
+
+      if (precompress)
+      {
+         compressed[0] = png_compress_frame(png_ptr, rows, CANVAS_WIDTH,
+             CANVAS_HEIGHT);
+         if (compressed[0] == NULL)
+            png_error(png_ptr, "png_compress_frame failed");
+      }
+
+      else
+      {
+         png_write_frame_head(png_ptr, info_ptr, NULL, CANVAS_WIDTH,
+             CANVAS_HEIGHT, 0, 0, 1, 10, PNG_fcTL_DISPOSE_OP_NONE,
+             PNG_fcTL_BLEND_OP_SOURCE);
+         png_write_image(png_ptr, rows);
+         png_write_frame_tail(png_ptr, info_ptr);
+      }
+   }
+
+   if (precompress)
+   {
+      for (i = nframes; i-- > 0;)
+      {
+         const frame_def *f = frames + i;
+         png_compressed_frame **c = compressed + i + (hidden != 0);
+         png_uint_32 y;
+
+         for (y = 0; y < f->height; ++y)
+            rows[y] = pixels[i] + y * f->width * channels;
+
+         *c = png_compress_frame(png_ptr, rows, f->width, f->height);
+         if (*c == NULL)
+            png_error(png_ptr, "png_compress_frame failed");
+      }
+
+      if (hidden)
+         png_write_compressed_frame(png_ptr, info_ptr, compressed[0], 0, 0,
+             1, 10, PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE);
+   }
+
+   for (i = 0; i < nframes; ++i)
+   {
+      const frame_def *f = frames + i;
+      png_uint_32 y;
+
+      if (precompress)
+      {
+         png_write_compressed_frame(png_ptr, info_ptr,
+             compressed[i + (hidden != 0)], f->x, f->y, (png_uint_16)(i + 1),
+             100, f->dispose_op, f->blend_op);
+         continue;
+      }
+
+      for (y = 0; y < f->height; ++y)
+         rows[y] = pixels[i] + y * f->width * channels;
+
+      png_write_frame_head(png_ptr, info_ptr, NULL, f->width, f->height,
+          f->x, f->y, (png_uint_16)(i + 1), 100, f->dispose_op, f->blend_op);
+      png_write_image(png_ptr, rows);
+      png_write_frame_tail(png_ptr, info_ptr);
+   }
+
+   png_write_end(png_ptr, info_ptr);
+
+   if (compressed != NULL)
+      for (i = 0; i < ncompressed; ++i)
+         png_free_compressed_frame(png_ptr, compressed[i]);
+
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+   free(compressed);
+   free(rows);
+   free(default_image);
+   return 0;
+}
+
+/* Reference composition of frame 'index' over 'canvas', in PNG channel order.
+ * 'saved' holds a copy of the whole canvas for DISPOSE_OP_PREVIOUS.
+ */
+static void
+compose_frame(png_byte *canvas, png_byte *saved, const frame_def *frames,
+    unsigned int index, png_byte **pixels, unsigned int channels)
+{
+   const frame_def *f = frames + index;
+   png_byte dispose_op = f->dispose_op;
+   png_uint_32 x, y;
+
+   if (index > 0)
+   {
+      const frame_def *p = frames + index - 1;
+      png_byte previous_op = p->dispose_op;
+
+      if (index == 1 && previous_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)
+         previous_op = PNG_fcTL_DISPOSE_OP_BACKGROUND;
+
+      if (previous_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)
+         memcpy(canvas, saved, CANVAS_WIDTH * CANVAS_HEIGHT * channels);
+
+      else if (previous_op == PNG_fcTL_DISPOSE_OP_BACKGROUND)
+         for (y = p->y; y < p->y + p->height; ++y)
+            memset(canvas + (y * CANVAS_WIDTH + p->x) * channels, 0,
+                p->width * channels);
+   }
+
+   if (dispose_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)
+      memcpy(saved, canvas, CANVAS_WIDTH * CANVAS_HEIGHT * channels);
+
+   for (y = 0; y < f->height; ++y)
+   {
+      for (x = 0; x < f->width; ++x)
+      {
+         const png_byte *sp = pixels[index] + (y * f->width + x) * channels;
+         png_byte *dp = canvas + ((f->y + y) * CANVAS_WIDTH + f->x + x) *
+            channels;
+         unsigned int c;
+
+         if (f->blend_op == PNG_fcTL_BLEND_OP_SOURCE || index == 0)
+            memcpy(dp, sp, channels);
+
+         else
+         {
+            double sa = sp[channels - 1] / 255.;
+            double da = dp[channels - 1] / 255.;
+            double a = sa + da * (1 - sa);
+
+            if (a > 0)
+            {
+               for (c = 0; c + 1 < channels; ++c)
+                  dp[c] = (png_byte)((sp[c] * sa + dp[c] * da * (1 - sa)) / a +
+                      .5);
+
+               dp[channels - 1] = (png_byte)(a * 255 + .5);
+            }
+         }
+      }
+   }
+}
+
+/* Check png_image_read_frame on an animation; 'format' selects the output
+ * channel order.
+ */
+static int
+test_read_frames(int color_type, int interlace, int hidden, png_uint_32 format,
+    int negative_stride)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte *pixels[NUM_TEST_FRAMES];
+   png_byte *reference = NULL, *saved = NULL, *canvas = NULL;
+   unsigned int channels = color_type == PNG_COLOR_TYPE_RGB_ALPHA ? 4 : 2;
+   unsigned int out_channels = PNG_IMAGE_SAMPLE_CHANNELS(format);
+   unsigned int map[4];
+   png_image image;
+   png_image_frame frame;
+   png_int_32 row_stride;
+   unsigned int i;
+   int result = 1;
+
+   memset(pixels, 0, sizeof pixels);
+
+   /* map[c] is the output position of PNG channel c. */
+   for (i = 0; i < channels; ++i)
+      map[i] = i;
+
+   if ((format & PNG_FORMAT_FLAG_AFIRST) != 0)
+      for (i = 0; i < channels; ++i)
+         map[i] = (i + 1) % channels;
+
+   if ((format & PNG_FORMAT_FLAG_BGR) != 0)
+   {
+      unsigned int t = map[0];
+      map[0] = map[2];
+      map[2] = t;
+   }
+
+   if (out_channels != channels)
+      return 1;
+
+   for (i = 0; i < NUM_TEST_FRAMES; ++i)
+   {
+      png_uint_32 count = test_frames[i].width * test_frames[i].height;
+
+      pixels[i] = (png_byte *)malloc(count * channels);
+      if (pixels[i] == NULL)
+         goto done;
+
+      make_pixels(pixels[i], count, channels);
+   }
+
+   reference = (png_byte *)calloc(CANVAS_WIDTH * CANVAS_HEIGHT, channels);
+   saved = (png_byte *)calloc(CANVAS_WIDTH * CANVAS_HEIGHT, channels);
+   canvas = (png_byte *)malloc(CANVAS_WIDTH * CANVAS_HEIGHT * channels);
+   if (reference == NULL || saved == NULL || canvas == NULL)
+      goto done;
+
+   if (write_apng(&buffer, color_type, interlace, hidden, test_frames,
+       NUM_TEST_FRAMES, pixels, 0) != 0)
+   {
+      fprintf(stderr, "pngapng: failed to write the test animation\n");
+      goto done;
+   }
+
+   memset(&image, 0, sizeof image);
+   image.version = PNG_IMAGE_VERSION;
+
+   if (!png_image_begin_read_from_memory(&image, buffer.data, buffer.size))
+   {
+      fprintf(stderr, "pngapng: begin_read: %s\n", image.message);
+      goto done;
+   }
+
+   image.format = format;
+   row_stride = (png_int_32)(CANVAS_WIDTH * channels);
+   if (negative_stride)
+      row_stride = -row_stride;
+
+   for (i = 0; i < NUM_TEST_FRAMES; ++i)
+   {
+      const frame_def *f = test_frames + i;
+      png_uint_32 x, y;
+
+      if (!png_image_read_frame(&image, canvas, row_stride, &frame))
+      {
+         fprintf(stderr, "pngapng: frame %u: %s\n", i, image.message);
+         goto done;
+      }
+
+      if (frame.index != i || frame.num_frames != NUM_TEST_FRAMES ||
+          frame.num_plays != 0 || frame.x_offset != f->x ||
+          frame.y_offset != f->y || frame.width != f->width ||
+          frame.height != f->height || frame.delay_num != i + 1 ||
+          frame.delay_den != 100)
+      {
+         fprintf(stderr, "pngapng: frame %u: incorrect frame information\n",
+             i);
+         png_image_free(&image);
+         goto done;
+      }
+
+      compose_frame(reference, saved, test_frames, i, pixels, channels);
+
+      for (y = 0; y < CANVAS_HEIGHT; ++y)
+      {
+         const png_byte *row = canvas + (negative_stride ?
+             (CANVAS_HEIGHT - 1 - y) : y) * CANVAS_WIDTH * channels;
+
+         for (x = 0; x < CANVAS_WIDTH; ++x)
+         {
+            const png_byte *ref = reference + (y * CANVAS_WIDTH + x) *
+               channels;
+            const png_byte *out = row + x * channels;
+            unsigned int c;
+
+            for (c = 0; c < channels; ++c)
+            {
+               int diff = out[map[c]] - ref[c];
+
+               /* Allow for rounding in the integer blend. */
+               if (diff < -1 || diff > 1)
+               {
+                  fprintf(stderr,
+                      "pngapng: frame %u (%lu,%lu)[%u]: got %d, expected %d\n",
+                      i, (unsigned long)x, (unsigned long)y, c, out[map[c]],
+                      ref[c]);
+                  png_image_free(&image);
+                  goto done;
+               }
+            }
+         }
+      }
+   }
+
+   /* There are no more frames; this is an error and frees the image. */
+   if (png_image_read_frame(&image, canvas, row_stride, &frame))
+   {
+      fprintf(stderr, "pngapng: read past the last frame\n");
+      png_image_free(&image);
+      goto done;
+   }
+
+   if (image.opaque != NULL)
+   {
+      fprintf(stderr, "pngapng: image not freed after error\n");
+      png_image_free(&image);
+      goto done;
+   }
+
+   result = 0;
+
+done:
+   for (i = 0; i < NUM_TEST_FRAMES; ++i)
+      free(pixels[i]);
+
+   free(reference);
+   free(saved);
+   free(canvas);
+   free(buffer.data);
+   return result;
+}
+
+/* A PNG without acTL is a single frame animation. */
+static int
+test_read_still(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_byte pixels[4 * 3 * 4];
+   png_byte canvas[4 * 3 * 4];
+   png_bytep rows[3];
+   png_image image;
+   png_image_frame frame;
+   int y;
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      return 1;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      free(buffer.data);
+      return 1;
+   }
+
+   make_pixels(pixels, 4 * 3, 4);
+   for (y = 0; y < 3; ++y)
+      rows[y] = pixels + y * 4 * 4;
+
+   png_set_write_fn(png_ptr, &buffer, buffer_write, buffer_flush);
+   png_set_IHDR(png_ptr, info_ptr, 4, 3, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+       PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+   png_write_info(png_ptr, info_ptr);
+   png_write_image(png_ptr, rows);
+   png_write_end(png_ptr, info_ptr);
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+
+   memset(&image, 0, sizeof image);
+   image.version = PNG_IMAGE_VERSION;
+
+   if (!png_image_begin_read_from_memory(&image, buffer.data, buffer.size))
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+   image.format = PNG_FORMAT_RGBA;
+
+   if (!png_image_read_frame(&image, canvas, 0, &frame) ||
+       frame.index != 0 || frame.num_frames != 1 || frame.width != 4 ||
+       frame.height != 3 || memcmp(canvas, pixels, sizeof pixels) != 0)
+   {
+      png_image_free(&image);
+      free(buffer.data);
+      return 1;
+   }
+
+   png_image_free(&image);
+   free(buffer.data);
+   return 0;
+}
+
+/* The test animation followed by a full frame, which is a keyframe, and a full
+ * frame disposed to the background, which makes the frame after it one too.
+ */
+static const frame_def seek_frames[] =
+{
+   {  0,  0, CANVAS_WIDTH, CANVAS_HEIGHT,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE },
+   {  3,  2,  9,  7,
+      PNG_fcTL_DISPOSE_OP_PREVIOUS, PNG_fcTL_BLEND_OP_OVER },
+   {  0,  0, 11, 10,
+      PNG_fcTL_DISPOSE_OP_BACKGROUND, PNG_fcTL_BLEND_OP_OVER },
+   { 12,  5, 11, 12,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE },
+   {  1,  1,  1,  1,
+      PNG_fcTL_DISPOSE_OP_PREVIOUS, PNG_fcTL_BLEND_OP_SOURCE },
+   {  5,  4, 14,  9,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_OVER },
+   { 20, 14,  3,  3,
+      PNG_fcTL_DISPOSE_OP_BACKGROUND, PNG_fcTL_BLEND_OP_OVER },
+   {  0,  0, CANVAS_WIDTH, CANVAS_HEIGHT,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE },
+   {  4,  4,  5,  5,
+      PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_OVER },
+   {  0,  0, CANVAS_WIDTH, CANVAS_HEIGHT,
+      PNG_fcTL_DISPOSE_OP_BACKGROUND, PNG_fcTL_BLEND_OP_OVER },
+   {  2,  3,  6,  4,
+      PNG_fcTL_DISPOSE_OP_PREVIOUS, PNG_fcTL_BLEND_OP_OVER }
+};
+
+#define NUM_SEEK_FRAMES ((sizeof seek_frames)/(sizeof seek_frames[0]))
+
+static const png_uint_32 seek_keyframes[NUM_SEEK_FRAMES] =
+   { 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 10 };
+
+/* A memory reader with a seek function for the low-level API. */
+typedef struct
+{
+   const png_byte *data;
+   size_t size;
+   size_t position;
+} memory_reader;
+
+static void PNGCBAPI
+reader_read(png_structp png_ptr, png_bytep data, size_t length)
+{
+   memory_reader *reader = (memory_reader *)png_get_io_ptr(png_ptr);
+
+   if (length > reader->size - reader->position)
+      png_error(png_ptr, "read beyond end of data");
+
+   memcpy(data, reader->data + reader->position, length);
+   reader->position += length;
+}
+
+static int PNGCBAPI
+reader_seek(png_structp png_ptr, size_t offset)
+{
+   memory_reader *reader = (memory_reader *)png_get_io_ptr(png_ptr);
+
+   if (offset > reader->size)
+      return 0;
+
+   reader->position = offset;
+   return 1;
+}
+
+/* Check the frame index with the low-level API, then decode the keyframe in
+ * the middle of the animation directly.
+ */
+static int
+check_frame_index(const memory_buffer *buffer, png_byte **pixels)
+{
+   memory_reader reader;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_bytep rows[CANVAS_HEIGHT];
+   png_byte *frame = NULL;
+   unsigned int i;
+
+   reader.data = buffer->data;
+   reader.size = buffer->size;
+   reader.position = 0;
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      return 1;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+      free(frame);
+      return 1;
+   }
+
+   png_set_read_fn(png_ptr, &reader, reader_read);
+   png_set_read_seek_fn(png_ptr, reader_seek);
+   png_read_info(png_ptr, info_ptr);
+
+   if (png_read_frame_index(png_ptr, info_ptr) != NUM_SEEK_FRAMES)
+      png_error(png_ptr, "wrong number of frames indexed");
+
+   for (i = 0; i < NUM_SEEK_FRAMES; ++i)
+      if (png_get_keyframe(png_ptr, i) != seek_keyframes[i])
+         png_error(png_ptr, "wrong keyframe");
+
+   frame = (png_byte *)malloc(CANVAS_WIDTH * CANVAS_HEIGHT * 4);
+   if (frame == NULL)
+      png_error(png_ptr, "out of memory");
+
+   for (i = 0; i < CANVAS_HEIGHT; ++i)
+      rows[i] = frame + i * CANVAS_WIDTH * 4;
+
+   png_seek_frame(png_ptr, info_ptr, 7);
+   png_read_frame_head(png_ptr, info_ptr);
+
+   if (png_get_next_frame_width(png_ptr, info_ptr) != CANVAS_WIDTH ||
+       png_get_next_frame_height(png_ptr, info_ptr) != CANVAS_HEIGHT ||
+       png_get_next_frame_delay_num(png_ptr, info_ptr) != 8)
+      png_error(png_ptr, "wrong fcTL after seek");
+
+   png_read_image(png_ptr, rows);
+
+   if (memcmp(frame, pixels[7], CANVAS_WIDTH * CANVAS_HEIGHT * 4) != 0)
+      png_error(png_ptr, "wrong pixels after seek");
+
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+   free(frame);
+   return 0;
+}
+
+/* png_image_seek_frame must give exactly the frames a sequential read does. */
+static int
+test_seek_frames(int interlace, int hidden, int use_stdio)
+{
+   static const png_uint_32 order[] = { 10, 3, 0, 8, 6, 6, 1, 9, 2, 7 };
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte *pixels[NUM_SEEK_FRAMES];
+   png_byte *sequential = NULL, *canvas = NULL;
+   size_t canvas_size = CANVAS_WIDTH * CANVAS_HEIGHT * 4;
+   FILE *fp = NULL;
+   png_image image;
+   png_image_frame frame;
+   unsigned int i;
+   int result = 1;
+
+   memset(pixels, 0, sizeof pixels);
+   memset(&image, 0, sizeof image);
+
+   for (i = 0; i < NUM_SEEK_FRAMES; ++i)
+   {
+      png_uint_32 count = seek_frames[i].width * seek_frames[i].height;
+
+      pixels[i] = (png_byte *)malloc(count * 4);
+      if (pixels[i] == NULL)
+         goto done;
+
+      make_pixels(pixels[i], count, 4);
+   }
+
+   sequential = (png_byte *)malloc(NUM_SEEK_FRAMES * canvas_size);
+   canvas = (png_byte *)malloc(canvas_size);
+   if (sequential == NULL || canvas == NULL)
+      goto done;
+
+   if (write_apng(&buffer, PNG_COLOR_TYPE_RGB_ALPHA, interlace, hidden,
+       seek_frames, NUM_SEEK_FRAMES, pixels, 0) != 0)
+      goto done;
+
+   if (!hidden && interlace == PNG_INTERLACE_NONE &&
+       check_frame_index(&buffer, pixels) != 0)
+   {
+      fprintf(stderr, "pngapng: low-level frame index failed\n");
+      goto done;
+   }
+
+   image.version = PNG_IMAGE_VERSION;
+
+   if (!png_image_begin_read_from_memory(&image, buffer.data, buffer.size))
+      goto done;
+
+   image.format = PNG_FORMAT_RGBA;
+
+   for (i = 0; i < NUM_SEEK_FRAMES; ++i)
+   {
+      if (!png_image_read_frame(&image, canvas, 0, &frame))
+      {
+         fprintf(stderr, "pngapng: frame %u: %s\n", i, image.message);
+         goto done;
+      }
+
+      memcpy(sequential + i * canvas_size, canvas, canvas_size);
+   }
+
+   png_image_free(&image);
+   memset(&image, 0, sizeof image);
+   image.version = PNG_IMAGE_VERSION;
+
+   if (use_stdio)
+   {
+      fp = tmpfile();
+
+      if (fp == NULL)
+      {
+         result = 0; /* nothing to test */
+         goto done;
+      }
+
+      if (fwrite(buffer.data, 1, buffer.size, fp) != buffer.size ||
+          fseek(fp, 0, SEEK_SET) != 0 ||
+          !png_image_begin_read_from_stdio(&image, fp))
+         goto done;
+   }
+
+   else if (!png_image_begin_read_from_memory(&image, buffer.data,
+       buffer.size))
+      goto done;
+
+   image.format = PNG_FORMAT_RGBA;
+
+   for (i = 0; i < (sizeof order)/(sizeof order[0]); ++i)
+   {
+      png_uint_32 target = order[i];
+      int next;
+
+      /* After each seek read on sequentially for one more frame. */
+      for (next = 0; next < 2 && target + next < NUM_SEEK_FRAMES; ++next)
+      {
+         if ((next == 0 && !png_image_seek_frame(&image, target)) ||
+             !png_image_read_frame(&image, canvas, 0, &frame))
+         {
+            fprintf(stderr, "pngapng: seek to %lu: %s\n",
+                (unsigned long)target, image.message);
+            goto done;
+         }
+
+         if (frame.index != target + next ||
+             memcmp(canvas, sequential + (target + next) * canvas_size,
+                canvas_size) != 0)
+         {
+            fprintf(stderr, "pngapng: seek to %lu: frame %lu differs\n",
+                (unsigned long)target, (unsigned long)(target + next));
+            goto done;
+         }
+      }
+   }
+
+   if (png_image_seek_frame(&image, NUM_SEEK_FRAMES))
+   {
+      fprintf(stderr, "pngapng: seek past the last frame\n");
+      goto done;
+   }
+
+   result = 0;
+
+done:
+   png_image_free(&image);
+
+   if (fp != NULL)
+      fclose(fp);
+
+   for (i = 0; i < NUM_SEEK_FRAMES; ++i)
+      free(pixels[i]);
+
+   free(sequential);
+   free(canvas);
+   free(buffer.data);
+   return result;
+}
+
+/* png_write_canvas_frame: a sprite moving over a background, a repeated frame,
+ * an area cleared to transparent black, a partly transparent change, a return
+ * to the first frame and two opaque pixels changed far apart.  The canvases
+ * are in PNG order with one byte per sample; 'depth' limits the sample values.
+ */
+#define NUM_CANVAS_FRAMES 8
+
+static void
+make_canvases(png_byte **canvas, unsigned int channels, int alpha,
+    unsigned int depth)
+{
+   size_t size = CANVAS_WIDTH * CANVAS_HEIGHT * channels;
+   png_byte mask = (png_byte)((1U << depth) - 1);
+   png_uint_32 i, x, y;
+
+   for (i = 0; i < NUM_CANVAS_FRAMES; ++i)
+   {
+      png_uint_32 sx = 0, sy = 0, sw = 0, sh = 0;
+      int opaque = 1;
+
+      switch (i)
+      {
+         case 0:
+            for (x = 0; x < size; ++x)
+               canvas[i][x] = (png_byte)(random_byte() & mask);
+            break;
+
+         case 1: case 2:
+            memcpy(canvas[i], canvas[0], size);
+            sx = i == 1 ? 2 : 5, sy = i + 1, sw = 4, sh = 3;
+            break;
+
+         case 3:
+            memcpy(canvas[i], canvas[2], size);
+            break;
+
+         case 4:
+            memcpy(canvas[i], canvas[3], size);
+            for (y = 8; y < 13; ++y)
+               memset(canvas[i] + (y * CANVAS_WIDTH + 10) * channels, 0,
+                   6 * channels);
+            break;
+
+         case 5:
+            memcpy(canvas[i], canvas[4], size);
+            sx = 0, sy = 14, sw = 3, sh = 3, opaque = 0;
+            break;
+
+         case 6:
+            memcpy(canvas[i], canvas[0], size);
+            break;
+
+         case 7:
+            memcpy(canvas[i], canvas[6], size);
+            sx = 1, sy = 1, sw = 1, sh = 1;
+            break;
+      }
+
+      for (y = sy; y < sy + sh; ++y)
+      {
+         png_byte *p = canvas[i] + (y * CANVAS_WIDTH + sx) * channels;
+
+         for (x = 0; x < sw * channels; ++x)
+            p[x] = (png_byte)(random_byte() & mask);
+
+         if (alpha && opaque)
+            for (x = channels - 1; x < sw * channels; x += channels)
+               p[x] = mask;
+      }
+
+      /* Frame 7 changes two opaque pixels far apart. */
+      if (i == 7)
+         memcpy(canvas[i] + (15 * CANVAS_WIDTH + 20) * channels,
+             canvas[i] + (CANVAS_WIDTH + 1) * channels, channels);
+   }
+}
+
+/* Check that png_write_canvas_frame followed by png_image_read_frame gives
+ * back every canvas unchanged.  Gray is written with 'depth' bits per pixel.
+ */
+static int
+test_write_canvas(int color_type, unsigned int depth, int interlace,
+    int hidden)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte *canvas[NUM_CANVAS_FRAMES];
+   png_byte *packed = NULL, *output = NULL;
+   png_bytep rows[CANVAS_HEIGHT];
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_image image;
+   png_image_frame frame;
+   int alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0;
+   unsigned int channels = (color_type & PNG_COLOR_MASK_COLOR ? 3 : 1) +
+      (alpha != 0);
+   size_t rowbytes = (CANVAS_WIDTH * channels * depth + 7) / 8;
+   unsigned int i;
+   int failed = 1;
+
+   memset(canvas, 0, sizeof canvas);
+
+   for (i = 0; i < NUM_CANVAS_FRAMES; ++i)
+      if ((canvas[i] = (png_byte *)malloc(
+          CANVAS_WIDTH * CANVAS_HEIGHT * channels)) == NULL)
+         goto done;
+
+   packed = (png_byte *)malloc(rowbytes * CANVAS_HEIGHT);
+   output = (png_byte *)malloc(CANVAS_WIDTH * CANVAS_HEIGHT * 4);
+   if (packed == NULL || output == NULL)
+      goto done;
+
+   make_canvases(canvas, channels, alpha, depth);
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      goto done;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      goto done;
+   }
+
+   png_set_write_fn(png_ptr, &buffer, buffer_write, buffer_flush);
+   png_set_IHDR(png_ptr, info_ptr, CANVAS_WIDTH, CANVAS_HEIGHT, (int)depth,
+       color_type, interlace, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+   png_set_acTL(png_ptr, info_ptr, NUM_CANVAS_FRAMES + (hidden != 0), 0);
+   png_set_first_frame_is_hidden(png_ptr, info_ptr, (png_byte)(hidden != 0));
+   png_write_info(png_ptr, info_ptr);
+
+   for (i = 0; i < CANVAS_HEIGHT; ++i)
+      rows[i] = packed + i * rowbytes;
+
+   if (hidden)
+   {
+      for (i = 0; i < rowbytes * CANVAS_HEIGHT; ++i)
+         packed[i] = random_byte();
+
+      png_write_frame_head(png_ptr, info_ptr, NULL, CANVAS_WIDTH,
+          CANVAS_HEIGHT, 0, 0, 1, 10, PNG_fcTL_DISPOSE_OP_NONE,
+          PNG_fcTL_BLEND_OP_SOURCE);
+      png_write_image(png_ptr, rows);
+      png_write_frame_tail(png_ptr, info_ptr);
+   }
+
+   for (i = 0; i < NUM_CANVAS_FRAMES; ++i)
+   {
+      size_t j;
+
+      if (depth == 8)
+         memcpy(packed, canvas[i], rowbytes * CANVAS_HEIGHT);
+
+      else
+      {
+         unsigned int ppb = 8 / depth;
+
+         memset(packed, 0, rowbytes * CANVAS_HEIGHT);
+
+         for (j = 0; j < CANVAS_WIDTH * CANVAS_HEIGHT; ++j)
+         {
+            size_t x = j % CANVAS_WIDTH, y = j / CANVAS_WIDTH;
+
+            packed[y * rowbytes + x / ppb] |= (png_byte)(canvas[i][j] <<
+                (8 - depth * (x % ppb + 1)));
+         }
+      }
+
+      png_write_canvas_frame(png_ptr, info_ptr, rows, (png_uint_16)(i + 1),
+          100);
+   }
+
+   png_write_end(png_ptr, info_ptr);
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+
+   memset(&image, 0, sizeof image);
+   image.version = PNG_IMAGE_VERSION;
+
+   if (!png_image_begin_read_from_memory(&image, buffer.data, buffer.size))
+      goto done;
+
+   image.format = PNG_FORMAT_RGBA;
+
+   for (i = 0; i < NUM_CANVAS_FRAMES; ++i)
+   {
+      size_t j;
+
+      if (!png_image_read_frame(&image, output, 0, &frame) ||
+          frame.index != i || frame.delay_num != i + 1)
+      {
+         fprintf(stderr, "pngapng: canvas frame %u: %s\n", i, image.message);
+         png_image_free(&image);
+         goto done;
+      }
+
+      for (j = 0; j < CANVAS_WIDTH * CANVAS_HEIGHT; ++j)
+      {
+         const png_byte *sp = canvas[i] + j * channels;
+         unsigned int scale = 255 / ((1U << depth) - 1);
+         png_byte expected[4];
+
+         if (channels >= 3)
+            memcpy(expected, sp, 3);
+         else
+            expected[0] = expected[1] = expected[2] = (png_byte)(sp[0] * scale);
+
+         expected[3] = alpha ? sp[channels - 1] : 255;
+
+         /* A fully transparent pixel has no color. */
+         if (expected[3] == 0 && output[j * 4 + 3] == 0)
+            continue;
+
+         if (memcmp(output + j * 4, expected, 4) != 0)
+         {
+            fprintf(stderr, "pngapng: canvas frame %u differs at %lu\n", i,
+                (unsigned long)j);
+            png_image_free(&image);
+            goto done;
+         }
+      }
+
+      /* Frame 2 only moves the sprite of frame 1, so disposing of frame 1 to
+       * the previous canvas leaves just the sprite to write, frame 3 repeats
+       * frame 2 and so needs no more than a single pixel.
+       */
+      if ((i == 2 && frame.width * frame.height > 24) ||
+          (i == 3 && frame.width * frame.height != 1))
+      {
+         fprintf(stderr, "pngapng: canvas frame %u is %lux%lu\n", i,
+             (unsigned long)frame.width, (unsigned long)frame.height);
+         png_image_free(&image);
+         goto done;
+      }
+   }
+
+   png_image_free(&image);
+   failed = 0;
+
+done:
+   for (i = 0; i < NUM_CANVAS_FRAMES; ++i)
+      free(canvas[i]);
+   free(packed);
+   free(output);
+   free(buffer.data);
+   return failed;
+}
+
+/* Frames compressed out of order with png_compress_frame must give exactly the
+ * same file as the same frames written with png_write_row.
+ */
+static int
+test_compress_frames(int color_type, int interlace, int hidden)
+{
+   memory_buffer sequential = { NULL, 0, 0 };
+   memory_buffer compressed = { NULL, 0, 0 };
+   png_byte *pixels[NUM_TEST_FRAMES];
+   unsigned int channels = color_type == PNG_COLOR_TYPE_RGB_ALPHA ? 4 : 2;
+   png_uint_32 state;
+   unsigned int i;
+   int result = 1;
+
+   memset(pixels, 0, sizeof pixels);
+
+   for (i = 0; i < NUM_TEST_FRAMES; ++i)
+   {
+      png_uint_32 count = test_frames[i].width * test_frames[i].height;
+
+      pixels[i] = (png_byte *)malloc(count * channels);
+      if (pixels[i] == NULL)
+         goto done;
+
+      make_pixels(pixels[i], count, channels);
+   }
+
+   /* The hidden default image is made from the next random pixels. */
+   state = random_state;
+
+   if (write_apng(&sequential, color_type, interlace, hidden, test_frames,
+       NUM_TEST_FRAMES, pixels, 0) != 0)
+      goto done;
+
+   random_state = state;
+
+   if (write_apng(&compressed, color_type, interlace, hidden, test_frames,
+       NUM_TEST_FRAMES, pixels, 1) != 0)
+   {
+      fprintf(stderr, "pngapng: failed to write compressed frames\n");
+      goto done;
+   }
+
+   if (compressed.size != sequential.size ||
+       memcmp(compressed.data, sequential.data, sequential.size) != 0)
+   {
+      fprintf(stderr, "pngapng: compressed frames differ (%lu/%lu bytes)\n",
+          (unsigned long)compressed.size, (unsigned long)sequential.size);
+      goto done;
+   }
+
+   result = 0;
+
+done:
+   for (i = 0; i < NUM_TEST_FRAMES; ++i)
+      free(pixels[i]);
+
+   free(sequential.data);
+   free(compressed.data);
+   return result;
+}
+
+/* Called for the errors test_compress_first_frame expects. */
+static void PNGCBAPI
+expected_error(png_structp png_ptr, png_const_charp message)
+{
+   (void)message;
+   png_longjmp(png_ptr, 1);
+}
+
+/* Unless it is hidden the first frame written with png_write_compressed_frame
+ * is the IDAT image, so one that does not cover the whole canvas at (0,0) must
+ * be rejected before anything is written.
+ */
+static int
+test_compress_first_frame(png_uint_32 width, png_uint_32 x_offset)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_byte *pixels;
+   png_bytep rows[CANVAS_HEIGHT];
+   png_compressed_frame *volatile frame = NULL;
+   volatile size_t header_size = 0;
+   png_uint_32 y;
+   int result;
+
+   pixels = (png_byte *)malloc(CANVAS_WIDTH * CANVAS_HEIGHT * 4);
+   if (pixels == NULL)
+      return 1;
+
+   make_pixels(pixels, CANVAS_WIDTH * CANVAS_HEIGHT, 4);
+
+   for (y = 0; y < CANVAS_HEIGHT; ++y)
+      rows[y] = pixels + y * width * 4;
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,
+       expected_error, NULL);
+   info_ptr = png_ptr == NULL ? NULL : png_create_info_struct(png_ptr);
+
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      /* Nothing after the header may have been written. */
+      result = frame == NULL || buffer.size != header_size;
+
+      if (result != 0)
+         fprintf(stderr, "pngapng: mis-sized first frame not rejected\n");
+   }
+
+   else
+   {
+      png_set_write_fn(png_ptr, &buffer, buffer_write, buffer_flush);
+      png_set_IHDR(png_ptr, info_ptr, CANVAS_WIDTH, CANVAS_HEIGHT, 8,
+          PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+          PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+      png_set_acTL(png_ptr, info_ptr, 1, 0);
+      png_write_info(png_ptr, info_ptr);
+      header_size = buffer.size;
+
+      frame = png_compress_frame(png_ptr, rows, width, CANVAS_HEIGHT);
+      if (frame != NULL)
+         png_write_compressed_frame(png_ptr, info_ptr, frame, x_offset, 0,
+             1, 10, PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE);
+
+      fprintf(stderr, "pngapng: mis-sized first frame written\n");
+      result = 1;
+   }
+
+   if (png_ptr != NULL)
+      png_free_compressed_frame(png_ptr, frame);
+
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+   free(pixels);
+   free(buffer.data);
+   return result;
+}
+
+
+/* A three frame 8x4 palette animation with PLTE, tRNS, gAMA and acTL chunks;
+ * every frame is the same.
+ */
+static int
+write_palette_apng(memory_buffer *buffer)
+{
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_color palette[4];
+   png_byte trans[4] = { 0, 85, 170, 255 };
+   png_byte indices[8 * 4];
+   png_bytep rows[4];
+   int i;
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      return 1;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      return 1;
+   }
+
+   for (i = 0; i < 4; ++i)
+   {
+      palette[i].red = (png_byte)(60 * i + 10);
+      palette[i].green = (png_byte)(200 - 50 * i);
+      palette[i].blue = (png_byte)(30 * i + 100);
+      rows[i] = indices + 8 * i;
+   }
+
+   for (i = 0; i < 8 * 4; ++i)
+      indices[i] = (png_byte)((i * 7) & 3);
+
+   png_set_write_fn(png_ptr, buffer, buffer_write, buffer_flush);
+   png_set_IHDR(png_ptr, info_ptr, 8, 4, 8, PNG_COLOR_TYPE_PALETTE,
+       PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+   png_set_PLTE(png_ptr, info_ptr, palette, 4);
+   png_set_tRNS(png_ptr, info_ptr, trans, 4, NULL);
+   png_set_gAMA_fixed(png_ptr, info_ptr, PNG_FP_1);
+   png_set_acTL(png_ptr, info_ptr, 3, 1);
+   png_write_info(png_ptr, info_ptr);
+
+   for (i = 0; i < 3; ++i)
+   {
+      png_write_frame_head(png_ptr, info_ptr, NULL, 8, 4, 0, 0, 1, 10,
+          PNG_fcTL_DISPOSE_OP_NONE, PNG_fcTL_BLEND_OP_SOURCE);
+      png_write_image(png_ptr, rows);
+      png_write_frame_tail(png_ptr, info_ptr);
+   }
+
+   png_write_end(png_ptr, info_ptr);
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+   return 0;
+}
+
+/* Palette gamma correction is applied once, not once per frame; each frame of
+ * this animation is the same as the first.
+ */
+static int
+test_read_palette_gamma(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte first[8 * 4 * 4];
+   png_byte canvas[8 * 4 * 4];
+   png_image image;
+   png_image_frame frame;
+   int i;
+
+   if (write_palette_apng(&buffer))
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+   memset(&image, 0, sizeof image);
+   image.version = PNG_IMAGE_VERSION;
+
+   if (!png_image_begin_read_from_memory(&image, buffer.data, buffer.size))
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+   image.format = PNG_FORMAT_RGBA;
+
+   for (i = 0; i < 3; ++i)
+   {
+      if (!png_image_read_frame(&image, canvas, 0, &frame) ||
+          frame.num_frames != 3 || frame.num_plays != 1)
+      {
+         free(buffer.data);
+         return 1;
+      }
+
+      if (i == 0)
+         memcpy(first, canvas, sizeof canvas);
+
+      else if (memcmp(first, canvas, sizeof canvas) != 0)
+      {
+         fprintf(stderr, "pngapng: palette frame %d differs\n", i);
+         png_image_free(&image);
+         free(buffer.data);
+         return 1;
+      }
+   }
+
+   png_image_free(&image);
+   free(buffer.data);
+   return 0;
+}
+
+static int
+run_test(const char *name, int failed)
+{
+   printf("Testing %s... %s\n", name, failed ? "FAIL" : "PASS");
+   fflush(stdout);
+   return failed;
+}
+
+int
+main(void)
+{
+   int result = 0;
+
+   result |= run_test("RGBA animation",
+       test_read_frames(PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 0,
+          PNG_FORMAT_RGBA, 0));
+   result |= run_test("interlaced RGBA animation",
+       test_read_frames(PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_ADAM7, 0,
+          PNG_FORMAT_RGBA, 0));
+   result |= run_test("RGBA animation with hidden default image",
+       test_read_frames(PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 1,
+          PNG_FORMAT_RGBA, 0));
+   result |= run_test("interlaced gray-alpha animation, bottom-up",
+       test_read_frames(PNG_COLOR_TYPE_GRAY_ALPHA, PNG_INTERLACE_ADAM7, 1,
+          PNG_FORMAT_GA, 1));
+#ifdef PNG_FORMAT_BGR_SUPPORTED
+   result |= run_test("BGRA animation",
+       test_read_frames(PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 0,
+          PNG_FORMAT_BGRA, 0));
+#endif
+#ifdef PNG_FORMAT_AFIRST_SUPPORTED
+   result |= run_test("ARGB animation",
+       test_read_frames(PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_ADAM7, 0,
+          PNG_FORMAT_ARGB, 0));
+#endif
+   result |= run_test("palette animation with gAMA",
+       test_read_palette_gamma());
+   result |= run_test("single frame PNG", test_read_still());
+   result |= run_test("frame seeking",
+       test_seek_frames(PNG_INTERLACE_NONE, 0, 0));
+   result |= run_test("interlaced frame seeking with hidden default image",
+       test_seek_frames(PNG_INTERLACE_ADAM7, 1, 0));
+#ifdef PNG_STDIO_SUPPORTED
+   result |= run_test("frame seeking in a file",
+       test_seek_frames(PNG_INTERLACE_NONE, 1, 1));
+#endif
+   result |= run_test("RGBA canvas frames",
+       test_write_canvas(PNG_COLOR_TYPE_RGB_ALPHA, 8, PNG_INTERLACE_NONE, 0));
+   result |= run_test("interlaced RGB canvas frames",
+       test_write_canvas(PNG_COLOR_TYPE_RGB, 8, PNG_INTERLACE_ADAM7, 0));
+   result |= run_test("gray-alpha canvas frames with hidden default image",
+       test_write_canvas(PNG_COLOR_TYPE_GRAY_ALPHA, 8, PNG_INTERLACE_NONE, 1));
+   result |= run_test("2-bit gray canvas frames",
+       test_write_canvas(PNG_COLOR_TYPE_GRAY, 2, PNG_INTERLACE_NONE, 0));
+   result |= run_test("precompressed frames",
+       test_compress_frames(PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 0));
+   result |= run_test("interlaced precompressed frames with hidden image",
+       test_compress_frames(PNG_COLOR_TYPE_GRAY_ALPHA, PNG_INTERLACE_ADAM7, 1));
+   result |= run_test("precompressed first frame smaller than the canvas",
+       test_compress_first_frame(CANVAS_WIDTH - 1, 0));
+   result |= run_test("precompressed first frame with an offset",
+       test_compress_first_frame(CANVAS_WIDTH, 1));
+
+   return result;
+}
+#else /* !(WRITE_APNG && READ_APNG && SIMPLIFIED_READ) */
+int
+main(void)
+{
+   fprintf(stderr, "pngapng: test skipped: APNG support not available\n");
+   return SKIP;
+}
+#endif
@@ -0,0 +1,1874 @@
+/* pngfeatures.c
+ *
+ * Copyright (c) 2026 Cosmin Truta
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * Test the optional memory, input/output, chunk and instrumentation features
+ * on ordinary PNG files.  The files are generated in memory; each test depends
+ * only on the options it exercises.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_CONFIG_H) && !defined(PNG_NO_CONFIG_H)
+#  include <config.h>
+#endif
+
+/* png_malloc_default and png_free_default are deprecated, but still tested. */
+#define PNG_DEPRECATED
+
+#ifdef PNG_FREESTANDING_TESTS
+#  include <png.h>
+#else
+#  include "../../png.h"
+#endif
+
+#ifdef PNG_ZLIB_HEADER
+#  include PNG_ZLIB_HEADER
+#else
+#  include <zlib.h>   /* For compress and crc32 */
+#endif
+
+/* 1.6.1 added support for the configure test harness, which uses 77 to indicate
+ * a skipped test, in earlier versions we need to succeed on a skipped test, so:
+ */
+#if defined(HAVE_CONFIG_H)
+#  define SKIP 77
+#else
+#  define SKIP 0
+#endif
+
+#if defined(PNG_SEQUENTIAL_READ_SUPPORTED) && defined(PNG_WRITE_SUPPORTED)
+
+#define IMAGE_WIDTH  37
+#define IMAGE_HEIGHT 23
+#define IMAGE_SIZE   (IMAGE_WIDTH * IMAGE_HEIGHT * 4)
+
+typedef struct
+{
+   png_byte *data;
+   size_t size;
+   size_t allocated;
+} memory_buffer;
+
+static void PNGCBAPI
+buffer_write(png_structp png_ptr, png_bytep data, size_t length)
+{
+   memory_buffer *buffer = (memory_buffer *)png_get_io_ptr(png_ptr);
+
+   if (buffer->size + length > buffer->allocated)
+   {
+      size_t allocated = 2 * (buffer->size + length);
+      png_byte *data_new = (png_byte *)realloc(buffer->data, allocated);
+
+      if (data_new == NULL)
+         png_error(png_ptr, "out of memory");
+
+      buffer->data = data_new;
+      buffer->allocated = allocated;
+   }
+
+   memcpy(buffer->data + buffer->size, data, length);
+   buffer->size += length;
+}
+
+static void PNGCBAPI
+buffer_flush(png_structp png_ptr)
+{
+   (void)png_ptr;
+}
+
+/* Deterministic RGBA pixel data. */
+static png_uint_32 random_state = 12345;
+
+static png_byte
+random_byte(void)
+{
+   random_state = random_state * 1103515245U + 12345U;
+   return (png_byte)(random_state >> 16);
+}
+
+static void
+make_pixels(png_byte *pixels, size_t size)
+{
+   size_t i;
+
+   for (i = 0; i < size; ++i)
+      pixels[i] = random_byte();
+}
+
+/* Write 'pixels' as an 8-bit RGBA PNG with png_ptr, which must already have a
+ * write function.  The png_struct is left for the caller to destroy.  Returns 0
+ * on success.
+ */
+static int
+write_png(png_structp png_ptr, const png_byte *pixels, int interlace)
+{
+   png_infop info_ptr;
+   png_bytep rows[IMAGE_HEIGHT];
+   int y;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_info_struct(png_ptr, &info_ptr);
+      return 1;
+   }
+
+   for (y = 0; y < IMAGE_HEIGHT; ++y)
+      rows[y] = (png_bytep)pixels + y * IMAGE_WIDTH * 4;
+
+   png_set_IHDR(png_ptr, info_ptr, IMAGE_WIDTH, IMAGE_HEIGHT, 8,
+       PNG_COLOR_TYPE_RGB_ALPHA, interlace, PNG_COMPRESSION_TYPE_BASE,
+       PNG_FILTER_TYPE_BASE);
+   png_write_info(png_ptr, info_ptr);
+   png_write_image(png_ptr, rows);
+   png_write_end(png_ptr, info_ptr);
+   png_destroy_info_struct(png_ptr, &info_ptr);
+   return 0;
+}
+
+/* Write 'pixels' to 'buffer' with a new png_struct. */
+static int
+write_buffer(memory_buffer *buffer, const png_byte *pixels, int interlace)
+{
+   png_structp png_ptr;
+   int result;
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      return 1;
+
+   png_set_write_fn(png_ptr, buffer, buffer_write, buffer_flush);
+   result = write_png(png_ptr, pixels, interlace);
+   png_destroy_write_struct(&png_ptr, NULL);
+   return result;
+}
+
+/* Read an 8-bit RGBA PNG into 'pixels' with png_ptr, which must already have a
+ * read function.  The png_struct is left for the caller to examine and
+ * destroy.  Returns 0 on success.
+ */
+static int
+read_png(png_structp png_ptr, png_byte *pixels)
+{
+   png_infop info_ptr;
+   png_bytep rows[IMAGE_HEIGHT];
+   int y;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_info_struct(png_ptr, &info_ptr);
+      return 1;
+   }
+
+   for (y = 0; y < IMAGE_HEIGHT; ++y)
+      rows[y] = pixels + y * IMAGE_WIDTH * 4;
+
+   png_read_info(png_ptr, info_ptr);
+
+   if (png_get_image_width(png_ptr, info_ptr) != IMAGE_WIDTH ||
+       png_get_image_height(png_ptr, info_ptr) != IMAGE_HEIGHT ||
+       png_get_bit_depth(png_ptr, info_ptr) != 8 ||
+       png_get_color_type(png_ptr, info_ptr) != PNG_COLOR_TYPE_RGB_ALPHA)
+      png_error(png_ptr, "unexpected IHDR");
+
+#ifdef PNG_READ_INTERLACING_SUPPORTED
+   (void)png_set_interlace_handling(png_ptr);
+#endif
+   png_read_image(png_ptr, rows);
+   png_read_end(png_ptr, NULL);
+   png_destroy_info_struct(png_ptr, &info_ptr);
+   return 0;
+}
+
+typedef struct
+{
+   const png_byte *data;
+   size_t size;
+   size_t position;
+} memory_reader;
+
+static void PNGCBAPI
+reader_read(png_structp png_ptr, png_bytep data, size_t length)
+{
+   memory_reader *reader = (memory_reader *)png_get_io_ptr(png_ptr);
+
+   if (length > reader->size - reader->position)
+      png_error(png_ptr, "read beyond end of data");
+
+   memcpy(data, reader->data + reader->position, length);
+   reader->position += length;
+}
+
+#ifdef PNG_USER_MEM_SUPPORTED
+/* Read 'buffer' with png_ptr, which is destroyed, and compare the result with
+ * 'pixels'.  Returns 0 if they are the same.
+ */
+static int
+read_buffer(png_structp png_ptr, const memory_buffer *buffer,
+    const png_byte *pixels)
+{
+   memory_reader reader;
+   png_byte *image;
+   int result = 1;
+
+   image = (png_byte *)malloc(IMAGE_SIZE);
+
+   if (png_ptr != NULL && image != NULL)
+   {
+      reader.data = buffer->data;
+      reader.size = buffer->size;
+      reader.position = 0;
+      png_set_read_fn(png_ptr, &reader, reader_read);
+      result = read_png(png_ptr, image) != 0 ||
+         memcmp(image, pixels, IMAGE_SIZE) != 0;
+   }
+
+   png_destroy_read_struct(&png_ptr, NULL, NULL);
+   free(image);
+   return result;
+}
+#endif /* USER_MEM */
+
+/* An 8x4 palette PNG with PLTE and, where they can be written, tRNS and gAMA
+ * chunks.
+ */
+static int
+write_palette_png(memory_buffer *buffer)
+{
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_color palette[4];
+   png_byte indices[8 * 4];
+   png_bytep rows[4];
+   int i;
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      return 1;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      return 1;
+   }
+
+   for (i = 0; i < 4; ++i)
+   {
+      palette[i].red = (png_byte)(60 * i + 10);
+      palette[i].green = (png_byte)(200 - 50 * i);
+      palette[i].blue = (png_byte)(30 * i + 100);
+      rows[i] = indices + 8 * i;
+   }
+
+   for (i = 0; i < 8 * 4; ++i)
+      indices[i] = (png_byte)((i * 7) & 3);
+
+   png_set_write_fn(png_ptr, buffer, buffer_write, buffer_flush);
+   png_set_IHDR(png_ptr, info_ptr, 8, 4, 8, PNG_COLOR_TYPE_PALETTE,
+       PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+   png_set_PLTE(png_ptr, info_ptr, palette, 4);
+#  ifdef PNG_WRITE_tRNS_SUPPORTED
+   {
+      png_byte trans[4] = { 0, 85, 170, 255 };
+
+      png_set_tRNS(png_ptr, info_ptr, trans, 4, NULL);
+   }
+#  endif
+#  ifdef PNG_WRITE_gAMA_SUPPORTED
+   png_set_gAMA_fixed(png_ptr, info_ptr, PNG_FP_1);
+#  endif
+   png_write_info(png_ptr, info_ptr);
+   png_write_image(png_ptr, rows);
+   png_write_end(png_ptr, info_ptr);
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+   return 0;
+}
+
+/* Probe every prefix of a palette PNG.  The chunk offsets are checked against
+ * a separate walk of the chunk list.
+ */
+static int
+test_probe_header(void)
+{
+   static const char probe_names[PNG_PROBE_CHUNK_COUNT][5] =
+   {
+      "PLTE", "tRNS", "gAMA", "cHRM", "sRGB", "iCCP", "cICP", "mDCV", "cLLI",
+      "eXIf", "pHYs", "acTL", "IDAT"
+   };
+   memory_buffer buffer = { NULL, 0, 0 };
+   size_t expect[PNG_PROBE_CHUNK_COUNT];
+   size_t idat, offset, size;
+   png_probe probe;
+   int i, result;
+
+   if (write_palette_png(&buffer))
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+   memset(expect, 0, sizeof expect);
+
+   for (offset = 8;; offset += png_get_uint_32(buffer.data + offset) + 12)
+   {
+      for (i = 0; i < PNG_PROBE_CHUNK_COUNT; ++i)
+         if (memcmp(buffer.data + offset + 4, probe_names[i], 4) == 0 &&
+             expect[i] == 0)
+            expect[i] = offset;
+
+      if (memcmp(buffer.data + offset + 4, "IDAT", 4) == 0)
+         break;
+   }
+
+   idat = offset;
+
+   if (expect[PNG_PROBE_CHUNK_PLTE] == 0)
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+   for (size = 0; size <= buffer.size; ++size)
+   {
+      result = png_probe_header(&probe, buffer.data, size);
+
+      if (size < 33)
+      {
+         if (result != PNG_PROBE_NEED_MORE || probe.bytes_needed != 33)
+            break;
+
+         continue;
+      }
+
+      if (probe.width != 8 || probe.height != 4 || probe.bit_depth != 8 ||
+          probe.color_type != PNG_COLOR_TYPE_PALETTE ||
+          probe.interlace_method != PNG_INTERLACE_NONE ||
+          probe.num_frames != 0)
+         break;
+
+      if (size < idat + 8)
+      {
+         /* Each answer must ask for more than it was given, and no more than
+          * is needed to reach the IDAT chunk header.
+          */
+         if (result != PNG_PROBE_HEADER || probe.bytes_needed <= size ||
+             probe.bytes_needed > idat + 8)
+            break;
+      }
+
+      else
+      {
+         if (result != PNG_PROBE_COMPLETE || probe.bytes_needed != 0 ||
+             memcmp(probe.chunk_offset, expect, sizeof expect) != 0)
+            break;
+      }
+   }
+
+   if (size <= buffer.size)
+   {
+      fprintf(stderr, "pngfeatures: probe of %lu bytes failed (%d)\n",
+          (unsigned long)size, result);
+      free(buffer.data);
+      return 1;
+   }
+
+   /* Damage: a bad signature is seen in the first byte, a bad IHDR CRC and a
+    * bad chunk name are errors.
+    */
+   result = 0;
+   buffer.data[0] ^= 1;
+   result |= png_probe_header(&probe, buffer.data, 1) != PNG_PROBE_ERROR;
+   buffer.data[0] ^= 1;
+   buffer.data[20] ^= 1;
+   result |= png_probe_header(&probe, buffer.data, buffer.size) !=
+      PNG_PROBE_ERROR;
+   buffer.data[20] ^= 1;
+   buffer.data[expect[PNG_PROBE_CHUNK_PLTE] + 4] = '$';
+   result |= png_probe_header(&probe, buffer.data, buffer.size) !=
+      PNG_PROBE_ERROR;
+
+   free(buffer.data);
+   return result;
+}
+
+#ifdef PNG_READ_SEEK_SUPPORTED
+static int PNGCBAPI
+reader_seek(png_structp png_ptr, size_t offset)
+{
+   memory_reader *reader = (memory_reader *)png_get_io_ptr(png_ptr);
+
+   if (offset > reader->size)
+      return 0;
+
+   reader->position = offset;
+   return 1;
+}
+#endif /* READ_SEEK */
+
+#if defined(PNG_READ_SEEK_SUPPORTED) || defined(PNG_READ_AHEAD_SUPPORTED)
+/* A memory reader that counts the bytes read and the calls made. */
+typedef struct
+{
+   memory_reader reader;
+   size_t bytes_read;
+   unsigned int calls;
+} counting_reader;
+
+static void PNGCBAPI
+counting_read(png_structp png_ptr, png_bytep data, size_t length)
+{
+   counting_reader *counter = (counting_reader *)png_get_io_ptr(png_ptr);
+
+   counter->bytes_read += length;
+   ++counter->calls;
+   reader_read(png_ptr, data, length);
+}
+
+#define SKIP_CHUNK_SIZE 262144U
+
+/* Return a copy of the PNG in 'buffer' with a private chunk full of zeros
+ * after the IHDR, or NULL if out of memory; its size is returned in 'size'.
+ * The CRC of the chunk is deliberately wrong.
+ */
+static png_byte *
+add_skip_chunk(const memory_buffer *buffer, size_t *size)
+{
+   png_byte *data;
+
+   *size = buffer->size + SKIP_CHUNK_SIZE + 12;
+   data = (png_byte *)calloc(*size, 1);
+
+   if (data != NULL)
+   {
+      memcpy(data, buffer->data, 33);
+      png_save_uint_32(data + 33, SKIP_CHUNK_SIZE);
+      memcpy(data + 37, "prVt", 4);
+      memcpy(data + 33 + SKIP_CHUNK_SIZE + 12, buffer->data + 33,
+          buffer->size - 33);
+   }
+
+   return data;
+}
+
+/* Read 'data' with the ancillary chunk CRC check off, with and without a seek
+ * function and optionally with read-ahead, and return the number of bytes
+ * read.  The image is returned in 'indices' and the number of calls to the
+ * read function in 'calls'.
+ */
+static size_t
+read_skipping(const png_byte *data, size_t size, int seek, size_t ahead,
+    png_byte *indices, unsigned int *calls)
+{
+   counting_reader counter;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_bytep rows[4];
+   int y;
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      return 0;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+      return 0;
+   }
+
+   counter.reader.data = data;
+   counter.reader.size = size;
+   counter.reader.position = 0;
+   counter.bytes_read = 0;
+   counter.calls = 0;
+
+   png_set_read_fn(png_ptr, &counter, counting_read);
+#  ifdef PNG_READ_SEEK_SUPPORTED
+   if (seek)
+      png_set_read_seek_fn(png_ptr, reader_seek);
+#  else
+   (void)seek;
+#  endif
+
+#  ifdef PNG_READ_AHEAD_SUPPORTED
+   png_set_read_ahead(png_ptr, ahead);
+#  else
+   (void)ahead;
+#  endif
+
+   png_set_crc_action(png_ptr, PNG_CRC_DEFAULT, PNG_CRC_QUIET_USE);
+
+   for (y = 0; y < 4; ++y)
+      rows[y] = indices + 8 * y;
+
+   png_read_info(png_ptr, info_ptr);
+   png_read_image(png_ptr, rows);
+   png_read_end(png_ptr, NULL);
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+   *calls = counter.calls;
+   return counter.bytes_read;
+}
+#endif /* READ_SEEK || READ_AHEAD */
+
+#ifdef PNG_READ_SEEK_SUPPORTED
+/* An unknown chunk which is not CRC checked is skipped with the seek function
+ * rather than read.
+ */
+static int
+test_skip_chunks(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte indices[2][8 * 4];
+   png_byte *data;
+   size_t size, read_size, seek_size;
+   unsigned int calls;
+
+   if (write_palette_png(&buffer))
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+   data = add_skip_chunk(&buffer, &size);
+   free(buffer.data);
+
+   if (data == NULL)
+      return 1;
+
+   read_size = read_skipping(data, size, 0, 0, indices[0], &calls);
+   seek_size = read_skipping(data, size, 1, 0, indices[1], &calls);
+   free(data);
+
+   if (read_size != size || seek_size == 0 ||
+       seek_size > size - SKIP_CHUNK_SIZE ||
+       memcmp(indices[0], indices[1], sizeof indices[0]) != 0)
+   {
+      fprintf(stderr, "pngfeatures: read %lu bytes, %lu with seeking, of %lu\n",
+          (unsigned long)read_size, (unsigned long)seek_size,
+          (unsigned long)size);
+      return 1;
+   }
+
+   return 0;
+}
+#endif /* READ_SEEK */
+
+#ifdef PNG_READ_AHEAD_SUPPORTED
+/* Read-ahead gives the same image from the same bytes with at most half the
+ * calls to the read function, and a chunk too large for the buffer is still
+ * read, or skipped with the seek function.
+ */
+static int
+test_read_ahead(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte indices[3][8 * 4];
+   png_byte *data;
+   size_t size, read_size, ahead_size, skip_size;
+   unsigned int read_calls, ahead_calls, skip_calls;
+   int ok;
+
+   if (write_palette_png(&buffer))
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+   read_size = read_skipping(buffer.data, buffer.size, 0, 0, indices[0],
+       &read_calls);
+   ahead_size = read_skipping(buffer.data, buffer.size, 0, 65536, indices[1],
+       &ahead_calls);
+
+   data = add_skip_chunk(&buffer, &size);
+   if (data == NULL)
+   {
+      free(buffer.data);
+      return 1;
+   }
+
+#  ifdef PNG_READ_SEEK_SUPPORTED
+   skip_size = read_skipping(data, size, 1, 65536, indices[2], &skip_calls);
+   ok = skip_size != 0 && skip_size <= size - SKIP_CHUNK_SIZE;
+#  else
+   skip_size = read_skipping(data, size, 0, 65536, indices[2], &skip_calls);
+   ok = skip_size == size;
+#  endif
+   free(data);
+
+   if (read_size != buffer.size || ahead_size != buffer.size ||
+       2 * ahead_calls > read_calls || !ok ||
+       memcmp(indices[0], indices[1], sizeof indices[0]) != 0 ||
+       memcmp(indices[0], indices[2], sizeof indices[0]) != 0)
+   {
+      fprintf(stderr, "pngfeatures: read-ahead: %lu bytes in %u calls, %lu in"
+          " %u calls without, %lu of %lu with a large chunk\n",
+          (unsigned long)ahead_size, ahead_calls, (unsigned long)read_size,
+          read_calls, (unsigned long)skip_size, (unsigned long)size);
+      free(buffer.data);
+      return 1;
+   }
+
+   free(buffer.data);
+   return 0;
+}
+#endif /* READ_AHEAD */
+
+#if defined(PNG_READ_DEFER_DECOMPRESSION_SUPPORTED) &&\
+    defined(PNG_READ_zTXt_SUPPORTED) && defined(PNG_READ_iTXt_SUPPORTED) &&\
+    defined(PNG_READ_iCCP_SUPPORTED) && defined(PNG_WRITE_zTXt_SUPPORTED) &&\
+    defined(PNG_WRITE_iTXt_SUPPORTED) && defined(PNG_WRITE_iCCP_SUPPORTED)
+#  define TEST_DEFER_DECOMPRESSION
+#endif
+
+#if defined(PNG_READ_ICC_CACHE_SUPPORTED) || defined(TEST_DEFER_DECOMPRESSION)
+#define PROFILE_SIZE 2048U
+
+/* A minimal RGB display profile with one tag, padded with random bytes. */
+static void
+make_profile(png_byte *profile)
+{
+   static const png_byte d50[12] =
+      { 0, 0, 0xf6, 0xd6, 0, 1, 0, 0, 0, 0, 0xd3, 0x2d };
+   size_t i;
+
+   for (i = 0; i < PROFILE_SIZE; ++i)
+      profile[i] = random_byte();
+
+   memset(profile, 0, 132);
+   png_save_uint_32(profile, PROFILE_SIZE);
+   profile[8] = 4;
+   memcpy(profile + 12, "mntrRGB XYZ ", 12);
+   memcpy(profile + 36, "acsp", 4);
+   memcpy(profile + 68, d50, 12);
+   png_save_uint_32(profile + 128, 1);
+   memcpy(profile + 132, "desc", 4);
+   png_save_uint_32(profile + 136, 144);
+   png_save_uint_32(profile + 140, 64);
+}
+#endif /* READ_ICC_CACHE || TEST_DEFER_DECOMPRESSION */
+
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+/* The palette PNG with an iCCP chunk holding 'profile' after the IHDR.  The
+ * chunk is made here so that writing iCCP chunks need not be supported.
+ */
+static int
+write_icc_png(memory_buffer *buffer, const png_byte *profile)
+{
+   memory_buffer plain = { NULL, 0, 0 };
+   uLongf zsize = compressBound(PROFILE_SIZE);
+   png_byte *chunk;
+   size_t length;
+   int result = 1;
+
+   chunk = (png_byte *)malloc(18 + zsize);
+
+   if (chunk != NULL && write_palette_png(&plain) == 0 &&
+       compress(chunk + 14, &zsize, profile, PROFILE_SIZE) == Z_OK)
+   {
+      length = 6 + zsize; /* name, terminator, method and zlib stream */
+      png_save_uint_32(chunk, (png_uint_32)length);
+      memcpy(chunk + 4, "iCCPtest", 9);
+      chunk[13] = 0; /* compression method */
+      png_save_uint_32(chunk + 8 + length,
+          (png_uint_32)crc32(0, chunk + 4, (uInt)(length + 4)));
+
+      buffer->allocated = buffer->size = plain.size + length + 12;
+      buffer->data = (png_byte *)malloc(buffer->size);
+
+      if (buffer->data != NULL)
+      {
+         memcpy(buffer->data, plain.data, 33);
+         memcpy(buffer->data + 33, chunk, length + 12);
+         memcpy(buffer->data + 45 + length, plain.data + 33, plain.size - 33);
+         result = 0;
+      }
+   }
+
+   free(plain.data);
+   free(chunk);
+   return result;
+}
+
+static void PNGCBAPI
+icc_warning(png_structp png_ptr, png_const_charp message)
+{
+   (void)png_ptr;
+   (void)message;
+}
+
+/* Read the header of 'buffer' with 'cache' and check the profile against
+ * 'profile'.  A non-zero 'limit' is set with png_set_chunk_malloc_max.
+ * Returns 0 if the profile is the same, 1 if there is no profile and 2 if it
+ * differs or the read fails.
+ */
+static int
+read_icc_png(const memory_buffer *buffer, png_icc_cache *cache,
+    const png_byte *profile, png_alloc_size_t limit)
+{
+   memory_reader reader;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_bytep read_profile;
+   png_uint_32 proflen;
+   char *name;
+   int compression, valid;
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+       icc_warning);
+   if (png_ptr == NULL)
+      return 2;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+      return 2;
+   }
+
+   reader.data = buffer->data;
+   reader.size = buffer->size;
+   reader.position = 0;
+   png_set_read_fn(png_ptr, &reader, reader_read);
+   png_set_icc_cache(png_ptr, cache);
+#  ifdef PNG_SET_USER_LIMITS_SUPPORTED
+      if (limit != 0)
+         png_set_chunk_malloc_max(png_ptr, limit);
+#  else
+      (void)limit;
+#  endif
+   png_read_info(png_ptr, info_ptr);
+
+   if (png_get_iCCP(png_ptr, info_ptr, &name, &compression, &read_profile,
+       &proflen) != PNG_INFO_iCCP)
+      valid = 1;
+
+   else if (strcmp(name, "test") == 0 && proflen == PROFILE_SIZE &&
+       memcmp(read_profile, profile, PROFILE_SIZE) == 0)
+      valid = 0;
+
+   else
+      valid = 2;
+
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+   return valid;
+}
+
+/* A profile found in an ICC cache reads back the same as one that was checked,
+ * and a profile that differs in one byte of its compressed data is not taken
+ * from the cache.
+ */
+static int
+test_icc_cache(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte profile[PROFILE_SIZE];
+   png_icc_cache *cache;
+   png_uint_32 hits[3] = { 0, 0, 0 };
+   int result = 1;
+
+   make_profile(profile);
+   cache = png_create_icc_cache();
+
+   if (cache == NULL || write_icc_png(&buffer, profile) != 0 ||
+       read_icc_png(&buffer, cache, profile, 0) != 0)
+      goto done;
+
+   hits[0] = png_get_icc_cache_hits(cache);
+
+   if (read_icc_png(&buffer, cache, profile, 0) != 0)
+      goto done;
+
+   hits[1] = png_get_icc_cache_hits(cache);
+
+   /* Change the last profile byte; it is outside the tag table, so the new
+    * profile is valid but must not match the cached one.
+    */
+   free(buffer.data);
+   buffer.data = NULL;
+   profile[PROFILE_SIZE-1] ^= 1;
+
+   if (write_icc_png(&buffer, profile) != 0 ||
+       read_icc_png(&buffer, cache, profile, 0) != 0)
+      goto done;
+
+   hits[2] = png_get_icc_cache_hits(cache);
+
+   if (hits[0] == 0 && hits[1] == 1 && hits[2] == 1)
+      result = 0;
+
+done:
+   if (result != 0)
+      fprintf(stderr, "pngfeatures: ICC cache hits %lu %lu %lu\n",
+          (unsigned long)hits[0], (unsigned long)hits[1],
+          (unsigned long)hits[2]);
+
+   png_destroy_icc_cache(cache);
+   free(buffer.data);
+   return result;
+}
+
+#ifdef PNG_SET_USER_LIMITS_SUPPORTED
+/* A profile found in the cache is still rejected by a png_struct whose chunk
+ * limit is lower than the profile length.
+ */
+static int
+test_icc_cache_limit(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte profile[PROFILE_SIZE];
+   png_icc_cache *cache;
+   png_uint_32 hits = 0;
+   int limited = -1;
+   int result = 1;
+
+   /* Zero everything after the tag data so that the compressed chunk is well
+    * inside the limit and only the profile length exceeds it.
+    */
+   make_profile(profile);
+   memset(profile + 208, 0, PROFILE_SIZE - 208);
+   cache = png_create_icc_cache();
+
+   if (cache == NULL || write_icc_png(&buffer, profile) != 0 ||
+       read_icc_png(&buffer, cache, profile, 0) != 0)
+      goto done;
+
+   limited = read_icc_png(&buffer, cache, profile, PROFILE_SIZE/2);
+   hits = png_get_icc_cache_hits(cache);
+
+   if (limited == 1 && hits == 1)
+      result = 0;
+
+done:
+   if (result != 0)
+      fprintf(stderr, "pngfeatures: limited ICC cache read %d, %lu hits\n",
+          limited, (unsigned long)hits);
+
+   png_destroy_icc_cache(cache);
+   free(buffer.data);
+   return result;
+}
+#endif /* SET_USER_LIMITS */
+#endif /* READ_ICC_CACHE */
+
+#ifdef TEST_DEFER_DECOMPRESSION
+static png_byte defer_profile[PROFILE_SIZE];
+static char defer_words[4000];
+static int defer_warnings;
+
+static void
+make_defer_data(void)
+{
+   size_t i;
+
+   make_profile(defer_profile);
+
+   for (i = 0; i + 1 < sizeof defer_words; ++i)
+      defer_words[i] = "lorem ipsum dolor sit amet "[i % 27];
+
+   defer_words[i] = 0;
+}
+
+static void PNGCBAPI
+defer_warning(png_structp png_ptr, png_const_charp message)
+{
+   (void)png_ptr;
+   (void)message;
+   ++defer_warnings;
+}
+
+/* Write an 8x4 palette image with an iCCP profile and tEXt, zTXt and
+ * compressed iTXt chunks, or, if 'source' is given, whatever it holds.
+ */
+static int
+write_text_png(memory_buffer *buffer, png_infop source)
+{
+   png_structp png_ptr;
+   png_infop info_ptr = NULL;
+   png_color palette[4];
+   png_byte indices[8 * 4];
+   png_bytep rows[4];
+   png_text text[3];
+   int i;
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      return 1;
+
+   if (source == NULL)
+      info_ptr = png_create_info_struct(png_ptr);
+
+   if ((source == NULL && info_ptr == NULL) || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      return 1;
+   }
+
+   for (i = 0; i < 4; ++i)
+   {
+      palette[i].red = palette[i].green = palette[i].blue = (png_byte)(80 * i);
+      rows[i] = indices + 8 * i;
+   }
+
+   for (i = 0; i < 8 * 4; ++i)
+      indices[i] = (png_byte)(i & 3);
+
+   png_set_write_fn(png_ptr, buffer, buffer_write, buffer_flush);
+
+   if (source == NULL)
+   {
+      memset(text, 0, sizeof text);
+      text[0].compression = PNG_TEXT_COMPRESSION_NONE;
+      text[0].key = (char *)"Title";
+      text[0].text = (char *)"deferred";
+      text[1].compression = PNG_TEXT_COMPRESSION_zTXt;
+      text[1].key = (char *)"Comment";
+      text[1].text = defer_words;
+      text[2].compression = PNG_ITXT_COMPRESSION_zTXt;
+      text[2].key = (char *)"XML:com.adobe.xmp";
+      text[2].text = defer_words + 1000;
+      text[2].lang = (char *)"en";
+      text[2].lang_key = (char *)"XMP";
+
+      png_set_IHDR(png_ptr, info_ptr, 8, 4, 8, PNG_COLOR_TYPE_PALETTE,
+          PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+      png_set_PLTE(png_ptr, info_ptr, palette, 4);
+      png_set_iCCP(png_ptr, info_ptr, "test", PNG_COMPRESSION_TYPE_BASE,
+          defer_profile, PROFILE_SIZE);
+      png_set_text(png_ptr, info_ptr, text, 3);
+      png_write_info(png_ptr, info_ptr);
+   }
+
+   else
+      png_write_info(png_ptr, source);
+
+   png_write_image(png_ptr, rows);
+   png_write_end(png_ptr, NULL);
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+   return 0;
+}
+
+/* Read the header of 'buffer', optionally deferring decompression, and check
+ * the text and profile against the originals.  If 'copy' is given the
+ * png_info is instead written to it without being looked at; writing marks the
+ * text as written so it cannot be checked afterwards.  Returns 0 on success.
+ */
+static int
+read_text_png(const memory_buffer *buffer, int defer, memory_buffer *copy)
+{
+   memory_reader reader;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_textp text;
+   png_bytep profile;
+   png_uint_32 proflen;
+   char *name;
+   int compression, num_text, result = 1;
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+       defer_warning);
+   if (png_ptr == NULL)
+      return 1;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+      return 1;
+   }
+
+   reader.data = buffer->data;
+   reader.size = buffer->size;
+   reader.position = 0;
+   png_set_read_fn(png_ptr, &reader, reader_read);
+   png_set_defer_decompression(png_ptr, defer);
+   png_read_info(png_ptr, info_ptr);
+
+   if (copy != NULL)
+   {
+      result = write_text_png(copy, info_ptr);
+      goto done;
+   }
+
+   num_text = png_get_text(png_ptr, info_ptr, &text, NULL);
+
+   if (num_text != 3 ||
+       text[0].compression != PNG_TEXT_COMPRESSION_NONE ||
+       strcmp(text[0].text, "deferred") != 0 ||
+       text[1].compression != PNG_TEXT_COMPRESSION_zTXt ||
+       strcmp(text[1].key, "Comment") != 0 ||
+       text[1].text_length != strlen(defer_words) ||
+       strcmp(text[1].text, defer_words) != 0 ||
+       text[2].compression != PNG_ITXT_COMPRESSION_zTXt ||
+       strcmp(text[2].lang, "en") != 0 ||
+       strcmp(text[2].lang_key, "XMP") != 0 ||
+       text[2].itxt_length != strlen(defer_words + 1000) ||
+       strcmp(text[2].text, defer_words + 1000) != 0)
+      goto done;
+
+   if (png_get_iCCP(png_ptr, info_ptr, &name, &compression, &profile,
+       &proflen) != PNG_INFO_iCCP || strcmp(name, "test") != 0 ||
+       proflen != PROFILE_SIZE ||
+       memcmp(profile, defer_profile, PROFILE_SIZE) != 0)
+      goto done;
+
+   result = 0;
+
+done:
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+   return result;
+}
+
+/* zTXt, iTXt and iCCP chunks read with deferred decompression are the same as
+ * those read normally, and still the same after being written from the
+ * png_info without having been looked at.  Damaged compressed text is only
+ * noticed when it is asked for.
+ */
+static int
+test_defer_decompression(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   memory_buffer copy = { NULL, 0, 0 };
+   memory_reader reader;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_textp text;
+   size_t offset;
+   int result = 1, warnings = -1, num_text = -1;
+
+   make_defer_data();
+
+   if (write_text_png(&buffer, NULL) != 0 ||
+       read_text_png(&buffer, 0, NULL) != 0 ||
+       read_text_png(&buffer, 1, NULL) != 0 ||
+       read_text_png(&buffer, 1, &copy) != 0 ||
+       read_text_png(&copy, 0, NULL) != 0)
+      goto done;
+
+   /* Damage the compressed data of the zTXt chunk; the CRC check is turned off
+    * below.
+    */
+   for (offset = 8;; offset += png_get_uint_32(buffer.data + offset) + 12)
+   {
+      if (memcmp(buffer.data + offset + 4, "IDAT", 4) == 0)
+         goto done;
+
+      if (memcmp(buffer.data + offset + 4, "zTXt", 4) == 0)
+         break;
+   }
+
+   buffer.data[offset + 8 + sizeof "Comment" + 1] ^= 0x55;
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+       defer_warning);
+   if (png_ptr == NULL)
+      goto done;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+      goto done;
+   }
+
+   reader.data = buffer.data;
+   reader.size = buffer.size;
+   reader.position = 0;
+   png_set_read_fn(png_ptr, &reader, reader_read);
+   png_set_crc_action(png_ptr, PNG_CRC_DEFAULT, PNG_CRC_QUIET_USE);
+   png_set_defer_decompression(png_ptr, 1);
+   defer_warnings = 0;
+   png_read_info(png_ptr, info_ptr);
+   warnings = defer_warnings;
+   num_text = png_get_text(png_ptr, info_ptr, &text, NULL);
+
+   if (warnings == 0 && defer_warnings == 1 && num_text == 2 &&
+       strcmp(text[1].key, "XML:com.adobe.xmp") == 0)
+      result = 0;
+
+   png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+done:
+   if (result != 0)
+      fprintf(stderr, "pngfeatures: deferred text: %d warnings, %d texts\n",
+          warnings, num_text);
+
+   free(buffer.data);
+   free(copy.data);
+   return result;
+}
+
+#endif /* TEST_DEFER_DECOMPRESSION */
+
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+/* An output buffer that counts the calls to the vectored write function. */
+typedef struct
+{
+   memory_buffer buffer;
+   unsigned int calls;
+} vector_buffer;
+
+static void PNGCBAPI
+buffer_write_v(png_structp png_ptr, const png_iovec *vec, int count)
+{
+   vector_buffer *vectored = (vector_buffer *)png_get_io_ptr(png_ptr);
+   int i;
+
+   ++vectored->calls;
+
+   for (i = 0; i < count; ++i)
+      buffer_write(png_ptr, (png_bytep)vec[i].data, vec[i].length);
+}
+
+/* A vectored write function gets the same bytes as png_set_write_fn, with one
+ * call for the signature and one for each chunk, since every chunk of these
+ * files is written whole.
+ */
+static int
+test_write_vector(int interlace)
+{
+   memory_buffer plain = { NULL, 0, 0 };
+   vector_buffer vectored;
+   png_byte pixels[IMAGE_SIZE];
+   png_structp png_ptr;
+   unsigned int chunks = 0;
+   size_t offset;
+   int result = 1;
+
+   memset(&vectored, 0, sizeof vectored);
+   make_pixels(pixels, sizeof pixels);
+
+   if (write_buffer(&plain, pixels, interlace) != 0)
+      goto done;
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr == NULL)
+      goto done;
+
+   png_set_write_fn_v(png_ptr, &vectored, buffer_write_v, buffer_flush);
+   result = write_png(png_ptr, pixels, interlace);
+   png_destroy_write_struct(&png_ptr, NULL);
+
+   if (result != 0)
+      goto done;
+
+   for (offset = 8; offset + 12 <= plain.size;
+        offset += png_get_uint_32(plain.data + offset) + 12)
+      ++chunks;
+
+   if (vectored.buffer.size != plain.size ||
+       memcmp(vectored.buffer.data, plain.data, plain.size) != 0 ||
+       vectored.calls != chunks + 1)
+   {
+      fprintf(stderr, "pngfeatures: vectored write: %lu/%lu bytes, %u calls"
+          " for %u chunks\n", (unsigned long)vectored.buffer.size,
+          (unsigned long)plain.size, vectored.calls, chunks);
+      result = 1;
+   }
+
+done:
+   free(plain.data);
+   free(vectored.buffer.data);
+   return result;
+}
+#endif /* WRITE_VECTOR */
+
+#ifdef PNG_PROGRESSIVE_READ_SUPPORTED
+typedef struct
+{
+   const png_byte *pixels;
+   png_uint_32 rows;
+   int errors;
+} push_state;
+
+static void PNGCBAPI
+push_info(png_structp png_ptr, png_infop info_ptr)
+{
+   (void)info_ptr;
+   png_start_read_image(png_ptr);
+}
+
+static void PNGCBAPI
+push_row(png_structp png_ptr, png_bytep row, png_uint_32 row_num, int pass)
+{
+   push_state *state = (push_state *)png_get_progressive_ptr(png_ptr);
+
+   (void)pass;
+
+   if (row == NULL || row_num >= IMAGE_HEIGHT ||
+       memcmp(row, state->pixels + row_num * IMAGE_WIDTH * 4,
+          IMAGE_WIDTH * 4) != 0)
+      state->errors++;
+
+   state->rows++;
+}
+
+/* Decode the non-interlaced PNG in 'buffer' seven bytes at a time with
+ * png_ptr, checking each row against 'pixels'.  The png_struct is left for the
+ * caller to examine and destroy.  Returns 0 on success.
+ */
+static int
+push_decode(png_structp png_ptr, const memory_buffer *buffer,
+    const png_byte *pixels)
+{
+   png_infop info_ptr;
+   push_state state;
+   size_t offset;
+
+   memset(&state, 0, sizeof state);
+   state.pixels = pixels;
+
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+   {
+      png_destroy_info_struct(png_ptr, &info_ptr);
+      return 1;
+   }
+
+   png_set_progressive_read_fn(png_ptr, &state, push_info, push_row, NULL);
+
+   for (offset = 0; offset < buffer->size; offset += 7)
+   {
+      size_t size = buffer->size - offset;
+
+      if (size > 7)
+         size = 7;
+
+      png_process_data(png_ptr, info_ptr, buffer->data + offset, size);
+   }
+
+   png_destroy_info_struct(png_ptr, &info_ptr);
+
+   if (state.errors != 0 || state.rows != IMAGE_HEIGHT)
+   {
+      fprintf(stderr, "pngfeatures: progressive read: %d bad rows of %lu\n",
+          state.errors, (unsigned long)state.rows);
+      return 1;
+   }
+
+   return 0;
+}
+
+#ifdef PNG_SET_OPTION_SUPPORTED
+/* Progressive reading with and without PNG_LEAN_MEMORY must give the same rows
+ * and the lean decoder must hold less memory once the image has been read.
+ */
+static int
+test_lean_memory(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   png_byte pixels[IMAGE_SIZE];
+   png_alloc_size_t footprint[2];
+   int lean, result = 1;
+
+   make_pixels(pixels, sizeof pixels);
+
+   if (write_buffer(&buffer, pixels, PNG_INTERLACE_NONE) != 0)
+      goto done;
+
+   for (lean = 0; lean < 2; ++lean)
+   {
+      png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+          NULL, NULL, NULL);
+
+      if (png_ptr == NULL)
+         goto done;
+
+      if (lean)
+         png_set_option(png_ptr, PNG_LEAN_MEMORY, PNG_OPTION_ON);
+
+      footprint[lean] = push_decode(png_ptr, &buffer, pixels) == 0 ?
+         png_get_memory_footprint(png_ptr) : 0;
+      png_destroy_read_struct(&png_ptr, NULL, NULL);
+
+      if (footprint[lean] == 0)
+         goto done;
+   }
+
+   /* The inflate state and the row buffers must have gone. */
+   if (2 * footprint[1] > footprint[0])
+   {
+      fprintf(stderr, "pngfeatures: lean footprint %lu, normal %lu\n",
+          (unsigned long)footprint[1], (unsigned long)footprint[0]);
+      goto done;
+   }
+
+   result = 0;
+
+done:
+   free(buffer.data);
+   return result;
+}
+#endif /* SET_OPTION */
+#endif /* PROGRESSIVE_READ */
+
+#ifdef PNG_USER_MEM_SUPPORTED
+/* Arena png_structs must write the same file as normal ones and must read it
+ * both from a caller supplied block, which is too small for everything, and
+ * from malloc'd slabs.
+ */
+static int
+test_arena(int interlace)
+{
+   memory_buffer normal = { NULL, 0, 0 };
+   memory_buffer arena = { NULL, 0, 0 };
+   union { double align; png_byte bytes[8192]; } block;
+   png_byte pixels[IMAGE_SIZE];
+   png_structp png_ptr;
+   int result = 1;
+
+   make_pixels(pixels, sizeof pixels);
+
+   if (write_buffer(&normal, pixels, interlace) != 0)
+      goto done;
+
+   png_ptr = png_create_write_struct_arena(PNG_LIBPNG_VER_STRING, NULL, NULL,
+       NULL, NULL, 4096);
+   if (png_ptr == NULL)
+      goto done;
+
+   png_set_write_fn(png_ptr, &arena, buffer_write, buffer_flush);
+   result = write_png(png_ptr, pixels, interlace);
+   png_destroy_write_struct(&png_ptr, NULL);
+
+   if (result != 0 || arena.size != normal.size ||
+       memcmp(arena.data, normal.data, normal.size) != 0)
+   {
+      fprintf(stderr, "pngfeatures: arena write differs\n");
+      result = 1;
+      goto done;
+   }
+
+   /* The block size is deliberately not a multiple of the alignment. */
+   result = read_buffer(png_create_read_struct_arena(PNG_LIBPNG_VER_STRING,
+          NULL, NULL, NULL, block.bytes + 1, sizeof block - 1), &arena,
+          pixels) != 0 ||
+      read_buffer(png_create_read_struct_arena(PNG_LIBPNG_VER_STRING, NULL,
+          NULL, NULL, NULL, 4096), &arena, pixels) != 0;
+
+#  ifdef PNG_PROGRESSIVE_READ_SUPPORTED
+   if (result == 0 && interlace == PNG_INTERLACE_NONE)
+   {
+      png_ptr = png_create_read_struct_arena(PNG_LIBPNG_VER_STRING, NULL,
+          NULL, NULL, NULL, 4096);
+      result = png_ptr == NULL || push_decode(png_ptr, &arena, pixels) != 0;
+      png_destroy_read_struct(&png_ptr, NULL, NULL);
+   }
+#  endif
+
+   if (result != 0)
+      fprintf(stderr, "pngfeatures: arena read failed\n");
+
+done:
+   free(normal.data);
+   free(arena.data);
+   return result;
+}
+
+static void PNGCBAPI
+arena_error(png_structp png_ptr, png_const_charp message)
+{
+   (void)message;
+   png_longjmp(png_ptr, 1);
+}
+
+/* png_free on an arena png_struct accepts memory from anywhere in the arena,
+ * including a slab of its own, and rejects memory from another png_struct.
+ */
+static int
+test_arena_free(void)
+{
+   png_structp png_ptr, other;
+   void *foreign = NULL;
+   int result = 1;
+
+   png_ptr = png_create_write_struct_arena(PNG_LIBPNG_VER_STRING, NULL,
+       arena_error, NULL, NULL, 4096);
+   other = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+   if (png_ptr != NULL && other != NULL)
+   {
+      foreign = png_malloc_warn(other, 16);
+
+      if (foreign != NULL && setjmp(png_jmpbuf(png_ptr)) == 0)
+      {
+         void *older = png_malloc(png_ptr, 16);
+         void *big;
+
+         png_free(png_ptr, png_malloc(png_ptr, 16));
+         png_free(png_ptr, older);
+         big = png_malloc(png_ptr, 8192);
+         png_free(png_ptr, big);
+         png_free(png_ptr, foreign);
+         fprintf(stderr, "pngfeatures: arena freed a foreign pointer\n");
+      }
+
+      else if (foreign != NULL)
+         result = 0;
+   }
+
+   png_destroy_write_struct(&png_ptr, NULL);
+   png_free(other, foreign);
+   png_destroy_write_struct(&other, NULL);
+   return result;
+}
+
+typedef struct
+{
+   int use_default;  /* allocate with png_malloc_default rather than malloc */
+   long outstanding; /* allocations not yet freed */
+} memory_counter;
+
+static png_voidp PNGCBAPI
+counted_malloc(png_structp png_ptr, png_alloc_size_t size)
+{
+   memory_counter *counter = (memory_counter *)png_get_mem_ptr(png_ptr);
+   png_voidp ptr;
+
+   if (counter->use_default)
+      ptr = png_malloc_default(png_ptr, size);
+
+   else
+      ptr = malloc((size_t)size);
+
+   if (ptr != NULL)
+      ++counter->outstanding;
+
+   return ptr;
+}
+
+static void PNGCBAPI
+counted_free(png_structp png_ptr, png_voidp ptr)
+{
+   memory_counter *counter = (memory_counter *)png_get_mem_ptr(png_ptr);
+
+   if (ptr != NULL)
+      --counter->outstanding;
+
+   png_free_default(png_ptr, ptr);
+}
+
+/* Memory functions that use the default allocator, or malloc with the default
+ * free, must write and read a file and free everything they allocate.
+ */
+static int
+test_default_memory(int use_default)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   memory_counter counter;
+   png_byte pixels[IMAGE_SIZE];
+   png_structp png_ptr;
+   int result = 1;
+
+   counter.use_default = use_default;
+   counter.outstanding = 0;
+   make_pixels(pixels, sizeof pixels);
+
+   png_ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL,
+       &counter, counted_malloc, counted_free);
+   if (png_ptr != NULL)
+   {
+      png_set_write_fn(png_ptr, &buffer, buffer_write, buffer_flush);
+      result = write_png(png_ptr, pixels, PNG_INTERLACE_NONE);
+      png_destroy_write_struct(&png_ptr, NULL);
+   }
+
+   if (result == 0)
+      result = read_buffer(png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
+          NULL, NULL, NULL, &counter, counted_malloc, counted_free), &buffer,
+          pixels);
+
+   if (result == 0 && counter.outstanding != 0)
+   {
+      fprintf(stderr, "pngfeatures: %ld allocations not freed\n",
+          counter.outstanding);
+      result = 1;
+   }
+
+   free(buffer.data);
+   return result;
+}
+#endif /* USER_MEM */
+
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+/* The allocation statistics of a png_struct that has decoded image data must
+ * add up and must include the zlib state and the row buffers.
+ */
+static int
+check_alloc_stats(const png_struct *png_ptr)
+{
+   png_alloc_stats stats;
+   png_alloc_size_t count = 0, current = 0;
+   int i;
+
+   if (!png_get_alloc_stats(png_ptr, &stats))
+      return 0;
+
+   for (i = 0; i < PNG_ALLOC_OWNERS; ++i)
+   {
+      const png_alloc_counts *owner = stats.owner + i;
+
+      if (owner->current > owner->peak || owner->largest > owner->peak)
+         return 0;
+
+      count += owner->count;
+      current += owner->current;
+   }
+
+   return count == stats.total.count && current == stats.total.current &&
+      stats.total.peak >= stats.total.current &&
+      stats.owner[PNG_ALLOC_ZLIB].count > 0 &&
+      stats.owner[PNG_ALLOC_ROWS].count > 0 &&
+      stats.owner[PNG_ALLOC_CHUNK_DATA].count > 0;
+}
+
+static int
+test_alloc_stats(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   memory_reader reader;
+   png_byte pixels[IMAGE_SIZE];
+   png_byte image[IMAGE_SIZE];
+   png_structp png_ptr;
+   int result = 1;
+
+   make_pixels(pixels, sizeof pixels);
+
+   if (write_buffer(&buffer, pixels, PNG_INTERLACE_NONE) == 0)
+   {
+      png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+          NULL);
+      if (png_ptr != NULL)
+      {
+         reader.data = buffer.data;
+         reader.size = buffer.size;
+         reader.position = 0;
+         png_set_read_fn(png_ptr, &reader, reader_read);
+         result = read_png(png_ptr, image) != 0 ||
+            memcmp(image, pixels, IMAGE_SIZE) != 0 ||
+            !check_alloc_stats(png_ptr);
+         png_destroy_read_struct(&png_ptr, NULL, NULL);
+      }
+   }
+
+   free(buffer.data);
+   return result;
+}
+#endif /* ALLOC_STATS */
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+/* The stages every read or write of an image goes through must have been
+ * counted.
+ */
+static int
+check_perf_counters(const png_struct *png_ptr, int write)
+{
+   static const int read_stages[] =
+      { PNG_PERF_READ_DATA, PNG_PERF_CRC, PNG_PERF_INFLATE };
+   static const int write_stages[] = { PNG_PERF_FILTER, PNG_PERF_DEFLATE };
+   png_perf_counter counters[PNG_PERF_STAGES];
+   const int *stages = write ? write_stages : read_stages;
+   int nstages = write ? 2 : 3;
+   int i;
+
+   if (!png_get_perf_counters(png_ptr, counters))
+      return 0;
+
+   for (i = 0; i < nstages; ++i)
+   {
+      const png_perf_counter *counter = counters + stages[i];
+
+      if (counter->calls == 0 || counter->bytes == 0 || counter->ticks < 0)
+         return 0;
+   }
+
+   return 1;
+}
+
+static int
+test_perf_counters(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   memory_reader reader;
+   png_byte pixels[IMAGE_SIZE];
+   png_byte image[IMAGE_SIZE];
+   png_structp png_ptr;
+   int result = 1;
+
+   make_pixels(pixels, sizeof pixels);
+
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+   if (png_ptr != NULL)
+   {
+      png_set_write_fn(png_ptr, &buffer, buffer_write, buffer_flush);
+      result = write_png(png_ptr, pixels, PNG_INTERLACE_NONE) != 0 ||
+         !check_perf_counters(png_ptr, 1);
+      png_destroy_write_struct(&png_ptr, NULL);
+   }
+
+   if (result == 0)
+   {
+      png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+          NULL);
+      result = png_ptr == NULL;
+
+      if (png_ptr != NULL)
+      {
+         reader.data = buffer.data;
+         reader.size = buffer.size;
+         reader.position = 0;
+         png_set_read_fn(png_ptr, &reader, reader_read);
+         result = read_png(png_ptr, image) != 0 ||
+            memcmp(image, pixels, IMAGE_SIZE) != 0 ||
+            !check_perf_counters(png_ptr, 0);
+         png_destroy_read_struct(&png_ptr, NULL, NULL);
+      }
+   }
+
+   free(buffer.data);
+   return result;
+}
+#endif /* PERF_COUNTERS */
+
+#ifdef PNG_READ_TRACE_SUPPORTED
+/* Checks each trace event against the chunks in the input as it arrives. */
+typedef struct
+{
+   const memory_buffer *buffer;
+   size_t chunk_start;  /* of the current chunk */
+   size_t chunk_end;    /* of the last complete chunk */
+   size_t idat_end;     /* of the last IDAT chunk */
+   unsigned int counts[PNG_TRACE_FRAME_END + 1];
+   int errors;
+} trace_log;
+
+static void PNGCBAPI
+trace_event(png_structp png_ptr, const png_trace_event *event)
+{
+   trace_log *log = (trace_log *)png_get_trace_ptr(png_ptr);
+   const png_byte *chunk = log->buffer->data + log->chunk_start;
+   size_t offset = event->offset;
+   int ok = 0;
+
+   if (event->event < PNG_TRACE_CHUNK_START ||
+       event->event > PNG_TRACE_FRAME_END)
+   {
+      log->errors++;
+      return;
+   }
+
+   log->counts[event->event]++;
+
+   switch (event->event)
+   {
+      case PNG_TRACE_CHUNK_START:
+         ok = offset == log->chunk_end && offset + 8 <= log->buffer->size &&
+            png_get_uint_32(log->buffer->data + offset + 4) ==
+            event->chunk_name;
+         log->chunk_start = offset;
+         break;
+
+      case PNG_TRACE_CHUNK_END:
+         ok = offset == log->chunk_start + 12 + png_get_uint_32(chunk);
+         log->chunk_end = offset;
+
+         if (memcmp(chunk + 4, "IDAT", 4) == 0)
+            log->idat_end = offset;
+         break;
+
+      case PNG_TRACE_IDAT_START:
+         ok = offset == log->chunk_start && memcmp(chunk + 4, "IDAT", 4) == 0;
+         break;
+
+      case PNG_TRACE_IDAT_END:
+         ok = offset == log->idat_end;
+         break;
+
+      case PNG_TRACE_ROW:
+         ok = event->frame == 0 && event->row < IMAGE_HEIGHT;
+         break;
+
+      default: /* frame events; there are no frames */
+         break;
+   }
+
+   if (!ok)
+   {
+      fprintf(stderr, "pngfeatures: bad trace event %d at %lu\n",
+          event->event, (unsigned long)offset);
+      log->errors++;
+   }
+}
+
+static void
+trace_init(trace_log *log, const memory_buffer *buffer)
+{
+   memset(log, 0, sizeof *log);
+   log->buffer = buffer;
+   log->chunk_end = 8; /* the signature */
+}
+
+/* Every chunk must be traced once, the image data must be bracketed once and
+ * every row must be seen.
+ */
+static int
+trace_check(const trace_log *log, const char *reader)
+{
+   const memory_buffer *buffer = log->buffer;
+   unsigned int chunks = 0;
+   size_t offset;
+
+   for (offset = 8; offset < buffer->size; ++chunks)
+      offset += 12 + png_get_uint_32(buffer->data + offset);
+
+   if (log->errors == 0 && log->chunk_end == buffer->size &&
+       log->counts[PNG_TRACE_CHUNK_START] == chunks &&
+       log->counts[PNG_TRACE_CHUNK_END] == chunks &&
+       log->counts[PNG_TRACE_IDAT_START] == 1 &&
+       log->counts[PNG_TRACE_IDAT_END] == 1 &&
+       log->counts[PNG_TRACE_ROW] == IMAGE_HEIGHT)
+      return 0;
+
+   fprintf(stderr, "pngfeatures: %s trace: %d errors, %u/%u chunks, %u rows\n",
+       reader, log->errors, log->counts[PNG_TRACE_CHUNK_START], chunks,
+       log->counts[PNG_TRACE_ROW]);
+   return 1;
+}
+
+/* The sequential and progressive readers must report the same events. */
+static int
+test_trace(void)
+{
+   memory_buffer buffer = { NULL, 0, 0 };
+   memory_reader reader;
+   png_byte pixels[IMAGE_SIZE];
+   png_byte image[IMAGE_SIZE];
+   png_structp png_ptr;
+   trace_log log;
+   int result = 1;
+
+   make_pixels(pixels, sizeof pixels);
+
+   if (write_buffer(&buffer, pixels, PNG_INTERLACE_NONE) == 0)
+   {
+      png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+          NULL);
+      if (png_ptr != NULL)
+      {
+         reader.data = buffer.data;
+         reader.size = buffer.size;
+         reader.position = 0;
+         trace_init(&log, &buffer);
+         png_set_read_fn(png_ptr, &reader, reader_read);
+         png_set_trace_fn(png_ptr, &log, trace_event);
+         result = read_png(png_ptr, image) != 0 ||
+            memcmp(image, pixels, IMAGE_SIZE) != 0 ||
+            trace_check(&log, "sequential") != 0;
+         png_destroy_read_struct(&png_ptr, NULL, NULL);
+      }
+   }
+
+#  ifdef PNG_PROGRESSIVE_READ_SUPPORTED
+   if (result == 0)
+   {
+      png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+          NULL);
+      result = png_ptr == NULL;
+
+      if (png_ptr != NULL)
+      {
+         trace_init(&log, &buffer);
+         png_set_trace_fn(png_ptr, &log, trace_event);
+         result = push_decode(png_ptr, &buffer, pixels) != 0 ||
+            trace_check(&log, "progressive") != 0;
+         png_destroy_read_struct(&png_ptr, NULL, NULL);
+      }
+   }
+#  endif
+
+   free(buffer.data);
+   return result;
+}
+#endif /* READ_TRACE */
+
+static int
+run_test(const char *name, int failed)
+{
+   printf("Testing %s... %s\n", name, failed ? "FAIL" : "PASS");
+   fflush(stdout);
+   return failed;
+}
+
+int
+main(void)
+{
+   int result = 0;
+
+   result |= run_test("header probe", test_probe_header());
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+   result |= run_test("vectored chunk output",
+       test_write_vector(PNG_INTERLACE_NONE));
+   result |= run_test("interlaced vectored chunk output",
+       test_write_vector(PNG_INTERLACE_ADAM7));
+#endif
+#ifdef PNG_READ_SEEK_SUPPORTED
+   result |= run_test("chunk skipping with a seek function",
+       test_skip_chunks());
+#endif
+#ifdef PNG_READ_AHEAD_SUPPORTED
+   result |= run_test("read-ahead buffering", test_read_ahead());
+#endif
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+   result |= run_test("ICC profile cache", test_icc_cache());
+#endif
+#if defined(PNG_READ_ICC_CACHE_SUPPORTED) &&\
+    defined(PNG_SET_USER_LIMITS_SUPPORTED)
+   result |= run_test("ICC profile cache with a lower chunk limit",
+       test_icc_cache_limit());
+#endif
+#ifdef TEST_DEFER_DECOMPRESSION
+   result |= run_test("deferred text and profile decompression",
+       test_defer_decompression());
+#endif
+#if defined(PNG_PROGRESSIVE_READ_SUPPORTED) && defined(PNG_SET_OPTION_SUPPORTED)
+   result |= run_test("progressive read with PNG_LEAN_MEMORY",
+       test_lean_memory());
+#endif
+#ifdef PNG_USER_MEM_SUPPORTED
+   result |= run_test("arena allocation", test_arena(PNG_INTERLACE_NONE));
+   result |= run_test("interlaced arena allocation",
+       test_arena(PNG_INTERLACE_ADAM7));
+   result |= run_test("arena png_free", test_arena_free());
+   result |= run_test("default allocator in memory functions",
+       test_default_memory(1));
+   result |= run_test("malloc with default free", test_default_memory(0));
+#endif
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+   result |= run_test("allocation statistics", test_alloc_stats());
+#endif
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   result |= run_test("performance counters", test_perf_counters());
+#endif
+#ifdef PNG_READ_TRACE_SUPPORTED
+   result |= run_test("chunk and row tracing", test_trace());
+#endif
+
+   return result;
+}
+#else /* !(SEQUENTIAL_READ && WRITE) */
+int
+main(void)
+{
+   fprintf(stderr, "pngfeatures: test skipped: read or write not supported\n");
+   return SKIP;
+}
+#endif
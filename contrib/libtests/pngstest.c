@@ -34,6 +34,12 @@
 #  include "../../png.h"
 #endif
 
+#ifdef PNG_ZLIB_HEADER
+#  include PNG_ZLIB_HEADER
+#else
+#  include <zlib.h>   /* For validate_memory */
+#endif
+
 /* 1.6.1 added support for the configure test harness, which uses 77 to indicate
  * a skipped test, in earlier versions we need to succeed on a skipped test, so:
  */
@@ -336,6 +342,9 @@ compare_16bit(int v1, int v2, int error_limit, int multiple_algorithms)
 #define GBG_ERROR 1024       /* do not ignore the gamma+background_rgb_to_gray
                               * warning. */
 #define NEGATIVE_STRIDE 2048 /* negate row stride for bottom-up layout */
+#define ENCODE_SPEED_SHIFT 12
+#define ENCODE_SPEED_MASK (15U << ENCODE_SPEED_SHIFT) /* speed+1, 0 if unset */
+#define REDUCE_WRITE 65536   /* write with PNG_IMAGE_FLAG_REDUCE */
 
 static void
 print_opts(png_uint_32 opts)
@@ -364,6 +373,11 @@ print_opts(png_uint_32 opts)
       printf(" --fault-gbg-warning");
    if (opts & NEGATIVE_STRIDE)
       printf(" --negative-stride");
+   if (opts & ENCODE_SPEED_MASK)
+      printf(" --encode-speed %u",
+         ((opts & ENCODE_SPEED_MASK) >> ENCODE_SPEED_SHIFT) - 1);
+   if (opts & REDUCE_WRITE)
+      printf(" --reduce");
 }
 
 #define FORMAT_NO_CHANGE 0x80000000 /* additional flag */
@@ -2979,6 +2993,334 @@ compare_two_images(Image *a, Image *b, int via_linear,
    return 1;
 }
 
+/* The ways damage_idat changes the image data: */
+#define DAMAGE_FILTER 0 /* the first filter byte is invalid */
+#define DAMAGE_SHORT  1 /* the last byte of the last row is missing */
+#define DAMAGE_LONG   2 /* there is an extra byte after the last row */
+#define DAMAGE_COUNT  3
+
+/* png_save_uint_32 is only there when writing is supported. */
+static void
+put_uint_32(png_byte *buf, png_uint_32 value)
+{
+   buf[0] = (png_byte)(value >> 24);
+   buf[1] = (png_byte)(value >> 16);
+   buf[2] = (png_byte)(value >> 8);
+   buf[3] = (png_byte)value;
+}
+
+/* Return a copy of the PNG in memory with the image data inflated, damaged as
+ * 'damage' says and deflated again into a single IDAT chunk, or NULL if this
+ * fails.  The chunks after the IDAT chunks are copied unchanged.
+ */
+static png_byte *
+damage_idat(const Image *image, int damage, size_t *damaged_size)
+{
+   const png_byte *png = voidcast(const png_byte*, image->input_memory);
+   size_t size = image->input_memory_size;
+   size_t offset = 8, idat_start = 0, idat_end = 0;
+   png_byte *zdata, *data = NULL, *damaged = NULL;
+   uLong zsize = 0;
+   uLongf data_size = 0, out_size;
+
+   zdata = voidcast(png_byte*, malloc(size));
+
+   if (zdata == NULL)
+      return NULL;
+
+   while (size - offset >= 12)
+   {
+      png_uint_32 length = png_get_uint_32(png + offset);
+
+      if (length > size - offset - 12)
+         break;
+
+      if (memcmp(png + offset + 4, "IDAT", 4) == 0)
+      {
+         if (idat_start == 0)
+            idat_start = offset;
+
+         memcpy(zdata + zsize, png + offset + 8, length);
+         zsize += length;
+         idat_end = offset + length + 12;
+      }
+
+      else if (idat_start != 0)
+         break;
+
+      offset += length + 12;
+   }
+
+   /* The image data size is not known, so grow the buffer until it fits; one
+    * extra byte is allowed for DAMAGE_LONG.
+    */
+   out_size = idat_start != 0 ? 4*zsize + 1024 : 0;
+
+   while (out_size > 0)
+   {
+      int ret;
+
+      free(data);
+      data = voidcast(png_byte*, malloc(out_size + 1));
+
+      if (data == NULL)
+         break;
+
+      data_size = out_size;
+      ret = uncompress(data, &data_size, zdata, zsize);
+
+      if (ret == Z_OK)
+         break;
+
+      else if (ret == Z_BUF_ERROR)
+         out_size *= 2;
+
+      else
+      {
+         free(data);
+         data = NULL;
+         break;
+      }
+   }
+
+   if (data != NULL && data_size > 0)
+   {
+      switch (damage)
+      {
+         case DAMAGE_FILTER:
+            data[0] = PNG_FILTER_VALUE_LAST;
+            break;
+
+         case DAMAGE_SHORT:
+            --data_size;
+            break;
+
+         default:
+            data[data_size++] = 0;
+            break;
+      }
+
+      out_size = compressBound(data_size);
+      *damaged_size = idat_start + 12 + out_size + (size - idat_end);
+      damaged = voidcast(png_byte*, malloc(*damaged_size));
+
+      if (damaged != NULL && compress(damaged + idat_start + 8, &out_size,
+            data, data_size) == Z_OK)
+      {
+         png_byte *idat = damaged + idat_start;
+
+         memcpy(damaged, png, idat_start);
+         put_uint_32(idat, (png_uint_32)out_size);
+         memcpy(idat + 4, "IDAT", 4);
+         put_uint_32(idat + 8 + out_size,
+            (png_uint_32)crc32(0, idat + 4, (uInt)(out_size + 4)));
+         memcpy(idat + 12 + out_size, png + idat_end, size - idat_end);
+         *damaged_size = idat_start + 12 + out_size + (size - idat_end);
+      }
+
+      else
+      {
+         free(damaged);
+         damaged = NULL;
+      }
+   }
+
+   free(data);
+   free(zdata);
+   return damaged;
+}
+
+/* A PNG that png_image_finish_read has just read must pass png_image_validate
+ * and must fail it once the CRC of the IEND chunk is damaged.
+ */
+static int
+validate_memory(Image *image)
+{
+   png_image copy;
+   png_byte *damaged;
+   size_t size = image->input_memory_size;
+
+   memset(&copy, 0, sizeof copy);
+   copy.version = PNG_IMAGE_VERSION;
+
+   if (!png_image_begin_read_from_memory(&copy, image->input_memory, size))
+      return logerror(image, "validate: ", copy.message, "");
+
+   if (!png_image_validate(&copy))
+      return logerror(image, image->file_name, ": validate: ", copy.message);
+
+   damaged = voidcast(png_byte*, malloc(size));
+
+   if (damaged == NULL)
+      return logerror(image, image->file_name, ": validate: out of memory",
+         "");
+
+   memcpy(damaged, image->input_memory, size);
+   damaged[size-1] ^= 1;
+
+   memset(&copy, 0, sizeof copy);
+   copy.version = PNG_IMAGE_VERSION;
+
+   if (png_image_begin_read_from_memory(&copy, damaged, size) &&
+       png_image_validate(&copy))
+   {
+      free(damaged);
+      return logerror(image, image->file_name,
+         ": validate: IEND CRC error not detected", "");
+   }
+
+   free(damaged);
+   return 1;
+}
+
+/* png_image_validate must also fail when a row has an invalid filter byte or
+ * the image data is too short or too long, while
+ * png_image_begin_read_from_memory, which stops before the image data, must
+ * still succeed.  This is only done once for each original file.
+ */
+static int
+validate_image_data(Image *image)
+{
+   static const char *const damage_name[DAMAGE_COUNT] =
+   {
+      "invalid filter byte", "short image data", "long image data"
+   };
+   int damage;
+
+   for (damage = 0; damage < DAMAGE_COUNT; ++damage)
+   {
+      png_image copy;
+      png_byte *damaged;
+      size_t damaged_size;
+
+      damaged = damage_idat(image, damage, &damaged_size);
+
+      if (damaged == NULL)
+         return logerror(image, image->file_name,
+            ": validate: cannot damage image data: ", damage_name[damage]);
+
+      memset(&copy, 0, sizeof copy);
+      copy.version = PNG_IMAGE_VERSION;
+
+      if (!png_image_begin_read_from_memory(&copy, damaged, damaged_size))
+      {
+         free(damaged);
+         return logerror(image, image->file_name,
+            ": validate: header rejected with ", damage_name[damage]);
+      }
+
+      if (png_image_validate(&copy))
+      {
+         free(damaged);
+         return logerror(image, image->file_name,
+            ": validate: not detected: ", damage_name[damage]);
+      }
+
+      free(damaged);
+   }
+
+   return 1;
+}
+
+/* Read the PNG in memory again a few rows at a time with
+ * png_image_read_rows; the rows and color-map must match those just read by
+ * png_image_finish_read.  Interlaced images are composed on black, not the
+ * buffer, so the check is skipped when the buffer is the background.
+ */
+static int
+read_in_bands(Image *image, const png_color *background, png_uint_32 in_format)
+{
+   png_image copy;
+   png_uint_32 format = image->image.format;
+   ptrdiff_t stride = image->stride;
+   size_t row_bytes = PNG_IMAGE_ROW_STRIDE(image->image) *
+      PNG_IMAGE_PIXEL_COMPONENT_SIZE(format);
+   const png_byte *expected = image->buffer+16;
+   png_byte *band;
+   png_uint_16 colormap[256*4];
+   png_uint_32 y = 0;
+
+   if (background == NULL && (in_format & PNG_FORMAT_FLAG_ALPHA) != 0 &&
+       (format & (PNG_FORMAT_FLAG_ALPHA|PNG_FORMAT_FLAG_LINEAR|
+          PNG_FORMAT_FLAG_COLORMAP)) == 0)
+      return 1;
+
+   if ((format & (PNG_FORMAT_FLAG_LINEAR|PNG_FORMAT_FLAG_COLORMAP)) ==
+         PNG_FORMAT_FLAG_LINEAR)
+      stride *= 2;
+
+   if (stride < 0)
+      expected += (image->image.height-1) * (-stride);
+
+   memset(&copy, 0, sizeof copy);
+   copy.version = PNG_IMAGE_VERSION;
+
+   if (!png_image_begin_read_from_memory(&copy, image->input_memory,
+         image->input_memory_size))
+      return logerror(image, "bands", ": init: ", copy.message);
+
+   copy.flags = image->image.flags;
+   copy.format = format;
+
+   band = voidcast(png_byte *, malloc(5 * row_bytes));
+   if (band == NULL)
+   {
+      png_image_free(&copy);
+      return logerror(image, "bands", ": out of memory", "");
+   }
+
+   if (!png_image_read_rows_begin(&copy, background, colormap))
+   {
+      free(band);
+      return logerror(image, "bands", ": begin: ", copy.message);
+   }
+
+   if ((format & PNG_FORMAT_FLAG_COLORMAP) != 0 &&
+       memcmp(colormap, image->colormap, PNG_IMAGE_COLORMAP_SIZE(copy)) != 0)
+   {
+      png_image_free(&copy);
+      free(band);
+      return logerror(image, "bands", ": color-map differs", "");
+   }
+
+   while (y < image->image.height)
+   {
+      png_uint_32 count = image->image.height - y;
+      png_uint_32 i;
+
+      if (count > 5)
+         count = 5;
+
+      memset(band, BUFFER_INIT8, 5 * row_bytes);
+
+      if (!png_image_read_rows(&copy, band, 0, count))
+      {
+         free(band);
+         return logerror(image, "bands", ": rows: ", copy.message);
+      }
+
+      for (i = 0; i < count; ++i, ++y)
+      {
+         if (memcmp(band + i * row_bytes, expected, row_bytes) != 0)
+         {
+            png_image_free(&copy);
+            free(band);
+            return logerror(image, "bands", ": rows differ", "");
+         }
+
+         if (y+1 < image->image.height)
+            expected += stride;
+      }
+   }
+
+   free(band);
+
+   if (copy.opaque != NULL)
+      return logerror(image, "bands", ": image not freed", "");
+
+   return 1;
+}
+
 /* Read the file; how the read gets done depends on which of input_file and
  * input_memory have been set.
  */
@@ -3075,7 +3417,16 @@ read_file(Image *image, png_uint_32 format, const png_color *background)
       checkbuffer(image, image->file_name);
 
       if (result)
-         return checkopaque(image);
+      {
+         if (!checkopaque(image))
+            return 0;
+
+         if (image->input_memory != NULL)
+            return validate_memory(image) &&
+               read_in_bands(image, background, image_format);
+
+         return 1;
+      }
 
       else
          return logerror(image, image->file_name, ": image read failed", "");
@@ -3165,16 +3516,168 @@ read_one_file(Image *image)
             strerror(errno));
    }
 
-   return read_file(image, FORMAT_NO_CHANGE, NULL);
+   if (!read_file(image, FORMAT_NO_CHANGE, NULL))
+      return 0;
+
+   return image->input_memory == NULL || validate_image_data(image);
 }
 
 #ifdef PNG_SIMPLIFIED_WRITE_SUPPORTED
+/* Output for png_image_write_begin: checks each byte against the PNG written
+ * by png_image_write_to_memory.
+ */
+typedef struct
+{
+   const png_byte *expected;
+   png_alloc_size_t size;
+   png_alloc_size_t written;
+} stream_check;
+
+static int
+stream_write(void *context, const void *data, size_t size)
+{
+   stream_check *check = voidcast(stream_check*, context);
+
+   if (size > check->size - check->written ||
+       memcmp(check->expected + check->written, data, size) != 0)
+      return 0;
+
+   check->written += size;
+   return 1;
+}
+
+/* Write the image again a few rows at a time; the result must be the same. */
+static int
+write_in_bands(Image *image, int convert_to_8bit, const png_byte *expected,
+   png_alloc_size_t size)
+{
+   png_image copy = image->image;
+   const png_byte *row = image->buffer+16;
+   ptrdiff_t stride = image->stride;
+   png_uint_32 y = 0;
+   stream_check check;
+
+   check.expected = expected;
+   check.size = size;
+   check.written = 0;
+   copy.opaque = NULL;
+
+   if ((copy.format & (PNG_FORMAT_FLAG_LINEAR|PNG_FORMAT_FLAG_COLORMAP)) ==
+         PNG_FORMAT_FLAG_LINEAR)
+      stride *= 2;
+
+   if (stride < 0)
+      row += (copy.height-1) * (-stride);
+
+   if (!png_image_write_begin(&copy, stream_write, &check, convert_to_8bit,
+         image->colormap))
+      return logerror(image, "stream", ": begin: ", copy.message);
+
+   while (y < copy.height)
+   {
+      png_uint_32 count = copy.height - y;
+
+      if (count > 5)
+         count = 5;
+
+      if (!png_image_write_rows(&copy, row, (png_int_32)image->stride, count))
+         return logerror(image, "stream", ": rows: ", copy.message);
+
+      row += count * stride;
+      y += count;
+   }
+
+   if (!png_image_write_end(&copy))
+      return logerror(image, "stream", ": end: ", copy.message);
+
+   if (check.written != size)
+      return logerror(image, "stream", ": output truncated", "");
+
+   return 1;
+}
+
+/* Get the color type and bit depth of a PNG in memory; returns 1 if it has a
+ * tRNS chunk, 0 if not and -1 if the chunks can't be followed.
+ */
+static int
+memory_format(const png_byte *png, size_t size, int *color_type,
+   int *bit_depth)
+{
+   size_t offset = 8;
+
+   if (size < 33)
+      return -1;
+
+   *bit_depth = png[24];
+   *color_type = png[25];
+
+   while (offset + 8 <= size)
+   {
+      png_uint_32 length = png_get_uint_32(png + offset);
+
+      if (memcmp(png + offset + 4, "tRNS", 4) == 0)
+         return 1;
+
+      if (memcmp(png + offset + 4, "IDAT", 4) == 0)
+         return 0;
+
+      if (size - offset < 12 || length > size - offset - 12)
+         return -1;
+
+      offset += length + 12;
+   }
+
+   return -1;
+}
+
+/* An 8-bit image written with PNG_IMAGE_FLAG_REDUCE from a gray original
+ * without tRNS must be gray at no more than the original bit depth, or use a
+ * palette with a smaller bit depth; 'image' holds the original file.
+ */
+static int
+check_reduced(Image *image, Image *output)
+{
+   int in_type, in_depth, out_type, out_depth;
+
+   if ((image->image.format &
+         (PNG_FORMAT_FLAG_LINEAR|PNG_FORMAT_FLAG_COLORMAP)) != 0 ||
+      image->input_memory == NULL ||
+      memory_format(voidcast(const png_byte *, image->input_memory),
+         image->input_memory_size, &in_type, &in_depth) != 0 ||
+      in_type != PNG_COLOR_TYPE_GRAY)
+      return 1;
+
+   if (memory_format(voidcast(const png_byte *, output->input_memory),
+         output->input_memory_size, &out_type, &out_depth) < 0)
+      return logerror(image, "memory", ": reduced PNG unreadable", "");
+
+   if (out_type == PNG_COLOR_TYPE_GRAY ? out_depth <= in_depth :
+         (out_type == PNG_COLOR_TYPE_PALETTE && out_depth < in_depth))
+      return 1;
+
+   {
+      char msg[32];
+
+      sprintf(msg, "%d-bit type %d", out_depth, out_type);
+      return logerror(image, image->file_name, ": reduced to ", msg);
+   }
+}
+
 static int
 write_one_file(Image *output, Image *image, int convert_to_8bit)
 {
    if (image->opts & FAST_WRITE)
       image->image.flags |= PNG_IMAGE_FLAG_FAST;
 
+#ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+   if (image->opts & ENCODE_SPEED_MASK)
+      image->image.flags |= PNG_IMAGE_FLAG_ENCODE_SPEED(
+         ((image->opts & ENCODE_SPEED_MASK) >> ENCODE_SPEED_SHIFT) - 1);
+#endif
+
+   if (image->opts & REDUCE_WRITE)
+      image->image.flags |= PNG_IMAGE_FLAG_REDUCE;
+
    if (image->opts & USE_STDIO)
    {
 #ifdef PNG_SIMPLIFIED_WRITE_STDIO_SUPPORTED
@@ -3304,6 +3807,39 @@ write_one_file(Image *output, Image *image, int convert_to_8bit)
 
             else
                return logerror(image, "memory", ": write failed", "");
+
+            if ((image->opts & REDUCE_WRITE) &&
+                !check_reduced(image, output))
+               return 0;
+
+            /* The single pass write must produce exactly the same PNG: */
+            {
+               void *memory;
+               png_alloc_size_t memory_size;
+
+               if (png_image_write_to_memory_alloc(&image->image, &memory,
+                     &memory_size, convert_to_8bit, image->buffer+16,
+                     (png_int_32)image->stride, image->colormap, NULL, NULL))
+               {
+                  int differs = memory_size != size ||
+                     memcmp(memory, output->input_memory, size) != 0;
+
+                  free(memory);
+
+                  if (differs)
+                     return logerror(image, "memory", ": alloc write differs",
+                        "");
+               }
+
+               else
+                  return logerror(image, "memory", ": alloc write failed", "");
+            }
+
+            /* The streaming write does not reduce the format: */
+            if (!(image->opts & REDUCE_WRITE) &&
+                !write_in_bands(image, convert_to_8bit, output->input_memory,
+                  size))
+               return 0;
          }
 
          else
@@ -3319,9 +3855,12 @@ write_one_file(Image *output, Image *image, int convert_to_8bit)
     * format was written unmodified unless 'convert_to_8bit' was specified.
     * However, if the original image was color-mapped, a simple read will zap
     * the linear, color and maybe alpha flags, this will cause spurious failures
-    * under some circumstances.
+    * under some circumstances.  A reduced image is read back in the format it
+    * was written from.
     */
-   if (read_file(output, image->image.format | FORMAT_NO_CHANGE, NULL))
+   if (read_file(output, (image->opts & REDUCE_WRITE) ?
+      image->image.format & ~(convert_to_8bit ? PNG_FORMAT_FLAG_LINEAR : 0U) :
+      image->image.format | FORMAT_NO_CHANGE, NULL))
    {
       png_uint_32 original_format = image->image.format;
 
@@ -3608,6 +4147,38 @@ main(int argc, char **argv)
          opts |= GBG_ERROR;
       else if (strcmp(arg, "--negative-stride") == 0)
          opts |= NEGATIVE_STRIDE;
+      else if (strcmp(arg, "--reduce") == 0)
+         opts |= REDUCE_WRITE;
+      else if (strcmp(arg, "--encode-speed") == 0)
+      {
+         if (c+1 < argc)
+         {
+            char *ep;
+            unsigned long val = strtoul(argv[++c], &ep, 0);
+
+            if (ep > argv[c] && *ep == 0 && val <= 9)
+            {
+               opts &= ~ENCODE_SPEED_MASK;
+               opts |= (png_uint_32)(val+1) << ENCODE_SPEED_SHIFT;
+            }
+
+            else
+            {
+               fflush(stdout);
+               fprintf(stderr, "%s: bad argument for --encode-speed: %s\n",
+                  argv[0], argv[c]);
+               exit(99);
+            }
+         }
+
+         else
+         {
+            fflush(stdout);
+            fprintf(stderr, "%s: missing argument for --encode-speed\n",
+               argv[0]);
+            exit(99);
+         }
+      }
       else if (strcmp(arg, "--stride-extra") == 0)
       {
          if (c+1 < argc)
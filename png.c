@@ -102,6 +102,7 @@ png_zalloc,(voidpf png_ptr, uInt items, uInt size),
     PNG_ALLOCATED)
 {
    png_alloc_size_t num_bytes = size;
+   voidpf ret;
 
    if (png_ptr == NULL)
       return NULL;
@@ -120,14 +121,29 @@ png_zalloc,(voidpf png_ptr, uInt items, uInt size),
    }
 
    num_bytes *= items;
-   return png_malloc_warn(png_voidcast(png_struct *, png_ptr), num_bytes);
+
+   /* png_malloc_sized records the size so that png_zfree can take it back off
+    * the zstream memory reported by png_get_memory_footprint.
+    */
+   png_alloc_owner(png_voidcast(png_struct *, png_ptr), PNG_ALLOC_ZLIB);
+   ret = png_malloc_sized(png_voidcast(png_struct *, png_ptr), num_bytes);
+
+   if (ret == NULL)
+   {
+      png_warning(png_voidcast(png_struct *, png_ptr), "Out of memory");
+      return NULL;
+   }
+
+   ((png_struct *)png_ptr)->zstream_memory += num_bytes;
+   return ret;
 }
 
 /* Function to free memory for zlib */
 void /* PRIVATE */
 png_zfree(voidpf png_ptr, voidpf ptr)
 {
-   png_free(png_voidcast(const png_struct *,png_ptr), ptr);
+   ((png_struct *)png_ptr)->zstream_memory -=
+       png_free_sized(png_voidcast(const png_struct *,png_ptr), ptr);
 }
 
 /* Reset the CRC variable to 32 bits of 1's.  Care must be taken
@@ -171,6 +187,10 @@ png_calculate_crc(png_struct *png_ptr, const png_byte *ptr, size_t length)
    if (need_crc != 0 && length > 0)
    {
       uLong crc = png_ptr->crc; /* Should never issue a warning */
+#     ifdef PNG_PERF_COUNTERS_SUPPORTED
+         double perf_start = PNG_PERF_CLOCK();
+         size_t perf_bytes = length;
+#     endif
 
       do
       {
@@ -193,9 +213,25 @@ png_calculate_crc(png_struct *png_ptr, const png_byte *ptr, size_t length)
 
       /* And the following is always safe because the crc is only 32 bits. */
       png_ptr->crc = (png_uint_32)crc;
+
+#     ifdef PNG_PERF_COUNTERS_SUPPORTED
+         png_perf_count(png_ptr, PNG_PERF_CRC, perf_start, perf_bytes);
+#     endif
    }
 }
 
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+void /* PRIVATE */
+png_perf_count(png_struct *png_ptr, int stage, double start, size_t bytes)
+{
+   png_perf_counter *counter = png_ptr->perf_counters + stage;
+
+   counter->ticks += PNG_PERF_CLOCK() - start;
+   counter->bytes += bytes;
+   counter->calls++;
+}
+#endif
+
 /* Check a user supplied version number, called from both read and write
  * functions that create a png_struct.
  */
@@ -443,10 +479,17 @@ png_info_init_3,(png_info **ptr_ptr, size_t png_info_struct_size),
 
    if ((sizeof (png_info)) > png_info_struct_size)
    {
+      /* png_free and png_malloc_base, rather than free and malloc, keep any
+       * header the memory functions add in step; the fake png_struct has no
+       * user memory functions so the C library is still used.
+       */
+      png_struct dummy_struct;
+
+      memset(&dummy_struct, 0, (sizeof dummy_struct));
       *ptr_ptr = NULL;
       /* The following line is why this API should not be used: */
-      free(info_ptr);
-      info_ptr = png_voidcast(png_info *, png_malloc_base(NULL,
+      png_free(&dummy_struct, info_ptr);
+      info_ptr = png_voidcast(png_info *, png_malloc_base(&dummy_struct,
           (sizeof *info_ptr)));
       if (info_ptr == NULL)
          return;
@@ -565,6 +608,9 @@ png_free_data(const png_struct *png_ptr, png_info *info_ptr, png_uint_32 mask,
       png_free(png_ptr, info_ptr->iccp_profile);
       info_ptr->iccp_name = NULL;
       info_ptr->iccp_profile = NULL;
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+      info_ptr->iccp_deferred = 0;
+#endif
       info_ptr->valid &= ~PNG_INFO_iCCP;
    }
 #endif
@@ -1810,6 +1856,109 @@ png_icc_check_tag_table(const png_struct *png_ptr, const char *name,
 
    return 1; /* success, maybe with warnings */
 }
+
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+png_icc_cache * PNGAPI
+png_create_icc_cache(void)
+{
+   png_icc_cache *cache = png_voidcast(png_icc_cache *, malloc(sizeof *cache));
+
+   if (cache != NULL)
+      memset(cache, 0, (sizeof *cache));
+
+   return cache;
+}
+
+void PNGAPI
+png_destroy_icc_cache(png_icc_cache *cache)
+{
+   if (cache != NULL)
+   {
+      unsigned int i;
+
+      for (i = 0; i < PNG_ICC_CACHE_SIZE; ++i)
+         free(cache->entry[i].data);
+
+      free(cache);
+   }
+}
+
+png_uint_32 PNGAPI
+png_get_icc_cache_hits(const png_icc_cache *cache)
+{
+   return cache != NULL ? cache->hits : 0;
+}
+
+static png_uint_32
+png_icc_cache_hash(const png_byte *data, png_uint_32 size)
+{
+   uLong crc = crc32(0, Z_NULL, 0);
+
+   while (size > 0)
+   {
+      uInt avail = ZLIB_IO_MAX;
+
+      if (avail > size)
+         avail = (uInt)size;
+
+      crc = crc32(crc, data, avail);
+      data += avail;
+      size -= avail;
+   }
+
+   return (png_uint_32)(crc & 0xffffffffU);
+}
+
+png_uint_32 /* PRIVATE */
+png_icc_cache_find(png_icc_cache *cache, const png_byte *data,
+   png_uint_32 size, int color_type)
+{
+   png_uint_32 hash = png_icc_cache_hash(data, size);
+   png_byte color = (png_byte)(color_type & PNG_COLOR_MASK_COLOR);
+   unsigned int i;
+
+   for (i = 0; i < PNG_ICC_CACHE_SIZE; ++i)
+   {
+      const png_icc_cache_entry *entry = cache->entry + i;
+
+      /* The hash only narrows the search; the data itself must match or a
+       * crafted profile could borrow the result of another one.
+       */
+      if (entry->data != NULL && entry->hash == hash && entry->size == size &&
+          entry->color == color && memcmp(entry->data, data, size) == 0)
+      {
+         ++cache->hits;
+         return entry->profile_length;
+      }
+   }
+
+   return 0;
+}
+
+void /* PRIVATE */
+png_icc_cache_add(png_icc_cache *cache, const png_byte *data,
+   png_uint_32 size, int color_type, png_uint_32 profile_length)
+{
+   png_icc_cache_entry *entry = cache->entry + cache->next;
+   png_byte *copy = png_voidcast(png_byte *, malloc(size));
+
+   /* The cache is only an optimization; if the copy can't be made the profile
+    * will just be checked again next time.
+    */
+   if (copy == NULL)
+      return;
+
+   memcpy(copy, data, size);
+   free(entry->data);
+   entry->data = copy;
+   entry->size = size;
+   entry->hash = png_icc_cache_hash(data, size);
+   entry->profile_length = profile_length;
+   entry->color = (png_byte)(color_type & PNG_COLOR_MASK_COLOR);
+
+   cache->next = (cache->next + 1) % PNG_ICC_CACHE_SIZE;
+}
+#endif /* READ_ICC_CACHE */
 #endif /* READ_iCCP */
 
 #ifdef PNG_READ_RGB_TO_GRAY_SUPPORTED
@@ -3364,13 +3513,18 @@ png_build_16bit_table(png_struct *png_ptr, png_uint_16 ***ptable,
    unsigned int max = (1U << (16U - shift)) - 1U;
    unsigned int max_by_2 = 1U << (15U - shift);
    unsigned int i;
+   png_uint_16 **table;
 
-   png_uint_16 **table = *ptable =
+   png_alloc_owner(png_ptr, PNG_ALLOC_GAMMA);
+   table = *ptable =
        (png_uint_16 **)png_calloc(png_ptr, num * (sizeof (png_uint_16 *)));
 
    for (i = 0; i < num; i++)
    {
-      png_uint_16 *sub_table = table[i] =
+      png_uint_16 *sub_table;
+
+      png_alloc_owner(png_ptr, PNG_ALLOC_GAMMA);
+      sub_table = table[i] =
           (png_uint_16 *)png_malloc(png_ptr, 256 * (sizeof (png_uint_16)));
 
       /* The 'threshold' test is repeated here because it can arise for one of
@@ -3434,8 +3588,10 @@ png_build_16to8_table(png_struct *png_ptr, png_uint_16 ***ptable,
    unsigned int max = (1U << (16U - shift))-1U;
    unsigned int i;
    png_uint_32 last;
+   png_uint_16 **table;
 
-   png_uint_16 **table = *ptable =
+   png_alloc_owner(png_ptr, PNG_ALLOC_GAMMA);
+   table = *ptable =
        (png_uint_16 **)png_calloc(png_ptr, num * (sizeof (png_uint_16 *)));
 
    /* 'num' is the number of tables and also the number of low bits of low
@@ -3443,8 +3599,11 @@ png_build_16to8_table(png_struct *png_ptr, png_uint_16 ***ptable,
     * itself indexed by the high 8 bits of the value.
     */
    for (i = 0; i < num; i++)
+   {
+      png_alloc_owner(png_ptr, PNG_ALLOC_GAMMA);
       table[i] = (png_uint_16 *)png_malloc(png_ptr,
           256 * (sizeof (png_uint_16)));
+   }
 
    /* 'gamma_val' is set to the reciprocal of the value calculated above, so
     * pow(out,g) is an *input* value.  'last' is the last input value set.
@@ -3499,7 +3658,10 @@ png_build_8bit_table(png_struct *png_ptr, png_byte **ptable,
     png_fixed_point gamma_val)
 {
    unsigned int i;
-   png_byte *table = *ptable = (png_byte *)png_malloc(png_ptr, 256);
+   png_byte *table;
+
+   png_alloc_owner(png_ptr, PNG_ALLOC_GAMMA);
+   table = *ptable = (png_byte *)png_malloc(png_ptr, 256);
 
    if (png_gamma_significant(gamma_val) != 0)
       for (i=0; i<256; i++)
@@ -3954,6 +4116,27 @@ png_image_free_function(void *argument)
       }
 #  endif
 
+#  if defined(PNG_SIMPLIFIED_READ_SUPPORTED) && defined(PNG_READ_APNG_SUPPORTED)
+      png_free(cp->png_ptr, cp->frame_restore);
+      cp->frame_restore = NULL;
+      png_free(cp->png_ptr, cp->frame_rows);
+      cp->frame_rows = NULL;
+#  endif
+
+#  ifdef PNG_SIMPLIFIED_READ_SUPPORTED
+      png_free(cp->png_ptr, cp->read_stream);
+      cp->read_stream = NULL;
+      png_free(cp->png_ptr, cp->read_buffer);
+      cp->read_buffer = NULL;
+#  endif
+
+#  ifdef PNG_SIMPLIFIED_WRITE_SUPPORTED
+      png_free(cp->png_ptr, cp->write_stream);
+      cp->write_stream = NULL;
+      png_free(cp->png_ptr, cp->write_row);
+      cp->write_row = NULL;
+#  endif
+
    /* Copy the control structure so that the original, allocated, version can be
     * safely freed.  Notice that a png_error here stops the remainder of the
     * cleanup, but this is probably fine because that would indicate bad memory
@@ -726,6 +726,28 @@ typedef PNG_CALLBACK(void, *png_read_status_ptr,
 typedef PNG_CALLBACK(void, *png_write_status_ptr,
    (png_struct *, png_uint_32, int));
 
+#ifdef PNG_READ_SEEK_SUPPORTED
+/* Move the input to the given offset from the start of the PNG signature;
+ * return 0 on failure.
+ */
+typedef PNG_CALLBACK(int, *png_seek_ptr, (png_struct *, size_t));
+#endif
+
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+/* One piece of the output given to a png_write_v_ptr function. */
+typedef struct png_iovec_struct
+{
+   const png_byte *data;
+   size_t length;
+} png_iovec;
+
+/* Write 'count' pieces of output in order; like png_rw_ptr it must not modify
+ * the data.
+ */
+typedef PNG_CALLBACK(void, *png_write_v_ptr,
+   (png_struct *, const png_iovec *, int));
+#endif
+
 #ifdef PNG_PROGRESSIVE_READ_SUPPORTED
 typedef PNG_CALLBACK(void, *png_progressive_info_ptr,
    (png_struct *, png_info *));
@@ -3131,6 +3153,28 @@ typedef png_image *png_imagep; /* [Deprecated] */
     * because that call initializes the 'flags' field.
     */
 
+#define PNG_IMAGE_FLAG_REDUCE 0x08
+   /* On write of an 8-bit image that is not color-mapped, scan the image first
+    * and store it in the smallest PNG format that holds the same pixels: an
+    * alpha channel that is always opaque is dropped, color images where every
+    * pixel is gray are written as gray, gray values are stored in 1, 2 or 4
+    * bits when no precision is lost and images with 256 or fewer distinct
+    * colors (including alpha) are written with a palette when that is smaller.
+    * The simplified read API returns the original pixels in the original
+    * format.  The flag has no effect on 16-bit (linear) or color-mapped data
+    * and is ignored by png_image_write_begin, which does not see the whole
+    * image before writing the header.
+    */
+
+#define PNG_IMAGE_FLAG_ENCODE_SPEED_MASK 0xf0
+#define PNG_IMAGE_FLAG_ENCODE_SPEED(speed) ((((speed) + 1) & 0x0f) << 4)
+   /* On write select one of the png_set_encode_speed presets, 0 (smallest
+    * output) to 9 (fastest), instead of the default compression settings.  The
+    * speed is stored in the four bits of PNG_IMAGE_FLAG_ENCODE_SPEED_MASK and
+    * takes precedence over PNG_IMAGE_FLAG_FAST.  The flag is ignored if libpng
+    * was built without PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED.
+    */
+
 #ifdef PNG_SIMPLIFIED_READ_SUPPORTED
 /* READ APIs
  * ---------
@@ -3405,7 +3449,10 @@ PNG_EXPORT(int, png_image_write_to_memory,
 #  define PNG_IGNORE_ADLER32 8
 #endif
 
-#define PNG_OPTION_NEXT 10
+/* SOFTWARE: Free working memory as soon as it is not needed */
+#define PNG_LEAN_MEMORY 10
+
+#define PNG_OPTION_NEXT 12
 
 /* Return values: NOTE: there are four values and 'off' is *not* zero */
 #define PNG_OPTION_UNSET   0 /* Unset - defaults as above */
@@ -3495,6 +3542,517 @@ PNG_EXPORT(void, png_write_frame_tail,
 #endif /* PNG_WRITE_APNG_SUPPORTED */
 #endif /* PNG_APNG_SUPPORTED */
 
+#ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+/* Select the row filters, zlib compression level, strategy and memory level
+ * from a table of presets measured with typical photographic and synthetic
+ * images.  'speed' ranges from PNG_ENCODE_SPEED_SMALLEST (slowest, smallest
+ * output) to PNG_ENCODE_SPEED_FASTEST; PNG_ENCODE_SPEED_DEFAULT restores the
+ * normal libpng defaults.  The preset actually used depends on the color type
+ * and bit depth of the image so it is applied when the IHDR chunk is written;
+ * calls to png_set_filter or png_set_compression_* made *after* png_write_info
+ * override individual parameters of the preset.
+ */
+#define PNG_ENCODE_SPEED_DEFAULT  (-1)
+#define PNG_ENCODE_SPEED_SMALLEST   0
+#define PNG_ENCODE_SPEED_FASTEST    9
+
+PNG_EXPORT(void, png_set_encode_speed,
+   (png_struct *png_ptr, int speed));
+#endif /* WRITE_CUSTOMIZE_COMPRESSION */
+
+#if defined(PNG_SIMPLIFIED_READ_SUPPORTED) && defined(PNG_READ_APNG_SUPPORTED)
+/* Simplified reading of APNG animations.  After png_image_begin_read_from_*
+ * set image->format to an 8-bit format with an alpha channel (for example
+ * PNG_FORMAT_RGBA) and call png_image_read_frame repeatedly, passing the same
+ * buffer and row_stride each time.  The buffer is the animation canvas; it must
+ * be PNG_IMAGE_SIZE(*image) bytes and its contents must not be changed between
+ * calls.  Each successful call leaves the fully composited frame in the buffer,
+ * having applied the dispose_op of the previous frame and the blend_op of the
+ * current one, and fills in 'frame'.  At most one extra buffer, the size of the
+ * largest frame using PNG_fcTL_DISPOSE_OP_PREVIOUS, is allocated internally.
+ *
+ * A PNG without an acTL chunk is returned as a single frame and a hidden
+ * default image is skipped.  The image is not freed when the last frame has
+ * been read; call png_image_free when done.  On error the image is freed and
+ * 0 is returned, as for png_image_finish_read.
+ */
+typedef struct
+{
+   png_uint_32 index;      /* Frame number, 0 for the first displayed frame */
+   png_uint_32 num_frames; /* Number of displayed frames in the animation */
+   png_uint_32 num_plays;  /* From acTL, 0 means play indefinitely */
+   png_uint_32 x_offset;   /* The part of the canvas updated by this frame */
+   png_uint_32 y_offset;
+   png_uint_32 width;
+   png_uint_32 height;
+   png_uint_16 delay_num;  /* Display time, delay_num/delay_den seconds; a */
+   png_uint_16 delay_den;  /* delay_den of 0 means 100 */
+} png_image_frame;
+
+PNG_EXPORT(int, png_image_read_frame,
+   (png_image *image, void *buffer, png_int_32 row_stride,
+    png_image_frame *frame));
+#endif /* SIMPLIFIED_READ && READ_APNG */
+
+#ifdef PNG_WRITE_APNG_SUPPORTED
+/* Write an APNG frame given the whole canvas, in the same row format as
+ * png_write_row takes, rather than a region chosen by the application.  libpng
+ * writes only the bounding box of the pixels that differ from the canvas the
+ * decoder will have, choosing the blend_op of each frame and, by looking at the
+ * next frame, the dispose_op that leaves the least to write.  Where every
+ * changed pixel is opaque APNG_BLEND_OP_OVER is used with the unchanged pixels
+ * written as transparent black.
+ *
+ * The frame is held until the next call or png_write_end, which must be given
+ * the info_ptr.  Once this has been used all of the remaining frames must be
+ * written this way; a hidden default image must be written first with
+ * png_write_frame_head/png_write_frame_tail.
+ */
+PNG_EXPORT(void, png_write_canvas_frame,
+   (png_struct *png_ptr, png_info *info_ptr, png_byte **row_pointers,
+    png_uint_16 delay_num, png_uint_16 delay_den));
+#endif /* WRITE_APNG */
+
+#ifdef PNG_READ_SEEK_SUPPORTED
+/* Seekable input.  With a seek function the sequential reader jumps over the
+ * data of chunks it neither uses nor CRC checks, such as unknown or ignored
+ * chunks once png_set_crc_action has turned off the ancillary chunk CRC check,
+ * instead of reading it; png_seek_frame also needs one.
+ *
+ * The standard I/O functions seek with fseek; applications using
+ * png_set_read_fn must call png_set_read_seek_fn afterwards.
+ */
+PNG_EXPORT(void, png_set_read_seek_fn,
+   (png_struct *png_ptr, png_seek_ptr seek_data_fn));
+#endif
+
+#ifdef PNG_READ_APNG_SUPPORTED
+/* Random access to APNG frames.  png_read_frame_index, called after
+ * png_read_info, scans the chunks once, skipping the image data with the seek
+ * function, and returns the number of frames in the animation (not counting a
+ * hidden default image.)  png_seek_frame then positions the input so that the
+ * next png_read_frame_head reads the given frame.  png_get_keyframe returns the
+ * nearest frame at or before 'frame' which can be drawn on a transparent black
+ * canvas without decoding any earlier frame; to show 'frame' start there and
+ * decode the frames up to it.  Frames before 'frame' with a dispose_op of
+ * PREVIOUS need not be decoded at all and those with BACKGROUND just clear
+ * their area.  The input must be seekable, see png_set_read_seek_fn.
+ */
+PNG_EXPORT(png_uint_32, png_read_frame_index,
+   (png_struct *png_ptr, png_info *info_ptr));
+PNG_EXPORT(png_uint_32, png_get_keyframe,
+   (png_struct *png_ptr, png_uint_32 frame));
+PNG_EXPORT(void, png_seek_frame,
+   (png_struct *png_ptr, png_info *info_ptr, png_uint_32 frame));
+
+#ifdef PNG_SIMPLIFIED_READ_SUPPORTED
+/* Make the next png_image_read_frame return frame 'index' of the animation,
+ * fully composited; only the frames from the nearest keyframe that affect it
+ * are decoded.  Works with images read from memory or a stdio FILE.
+ */
+PNG_EXPORT(int, png_image_seek_frame,
+   (png_image *image, png_uint_32 index));
+#endif
+#endif /* READ_APNG */
+
+#if defined(PNG_WRITE_APNG_SUPPORTED) && defined(PNG_SETJMP_SUPPORTED)
+/* Compress APNG frames concurrently.  png_compress_frame filters and deflates
+ * one frame, in the format given to png_write_row without any transformations,
+ * into a buffer of its own using a private z_stream and row buffers.  It only
+ * reads the IHDR and compression settings from png_ptr, so any number of calls
+ * may run at once on different threads once png_write_info has been called.
+ * It returns NULL on error, including when png_ptr has write transformations
+ * set, and never calls the png_ptr error handler.
+ *
+ * png_write_compressed_frame then writes the fcTL and fdAT (or IDAT, for the
+ * first frame) chunks with the next sequence numbers, so frames must be passed
+ * to it in order, from the application thread.  It may run while other frames
+ * are still being compressed.  libpng has no thread pool of its own; the
+ * application supplies the workers.
+ */
+typedef struct png_compressed_frame_def png_compressed_frame;
+
+PNG_EXPORT(png_compressed_frame *, png_compress_frame,
+   (const png_struct *png_ptr, png_byte **row_pointers,
+    png_uint_32 width, png_uint_32 height));
+PNG_EXPORT(void, png_write_compressed_frame,
+   (png_struct *png_ptr, png_info *info_ptr,
+    const png_compressed_frame *frame,
+    png_uint_32 x_offset, png_uint_32 y_offset,
+    png_uint_16 delay_num, png_uint_16 delay_den,
+    png_byte dispose_op, png_byte blend_op));
+PNG_EXPORT(void, png_free_compressed_frame,
+   (const png_struct *png_ptr, png_compressed_frame *frame));
+#endif /* WRITE_APNG && SETJMP */
+
+/* Return the number of bytes libpng currently holds for png_ptr itself: the
+ * png_struct, the zlib state and window, row buffers and the read, save and
+ * compression buffers.  Memory in png_info structures and data handed to the
+ * application are not included.  Setting the PNG_LEAN_MEMORY option reduces
+ * this between calls on a reading png_struct: the zlib state and the row
+ * buffers are freed when the image data (or a compressed chunk) has been read,
+ * chunk data is freed before the next chunk, and the progressive reader frees
+ * its save buffer whenever it is empty.  Everything is reallocated on demand.
+ */
+PNG_EXPORT(png_alloc_size_t, png_get_memory_footprint,
+   (const png_struct *png_ptr));
+
+#ifdef PNG_USER_MEM_SUPPORTED
+/* Create a png_struct whose memory all comes from an arena.  Allocations are
+ * made by advancing a pointer and png_free is (almost) a no-op; the whole
+ * arena, png_struct included, is released by png_destroy_read_struct or
+ * png_destroy_write_struct.  If 'arena' is not NULL it is a block of
+ * 'arena_size' bytes owned by the caller, which must stay valid until the
+ * png_struct is destroyed; otherwise the arena is allocated with malloc and
+ * 'arena_size' is the slab size (0 for a default of 64KB).  When the current
+ * slab is full another one is obtained from malloc.
+ *
+ * An arena is meant for one decode or encode: memory that libpng frees and
+ * reallocates along the way is not reused, so PNG_LEAN_MEMORY has little
+ * effect.  png_set_mem_fn cannot be used on an arena png_struct, png_free of
+ * memory that did not come from the arena is an error and the png_struct
+ * must only be used from one thread at a time.  NULL is returned if the block
+ * is too small for the arena state or the png_struct.
+ */
+PNG_EXPORTA(png_struct *, png_create_read_struct_arena,
+   (const char *user_png_ver, void *error_ptr, png_error_ptr error_fn,
+    png_error_ptr warn_fn, void *arena, size_t arena_size),
+   PNG_ALLOCATED);
+PNG_EXPORTA(png_struct *, png_create_write_struct_arena,
+   (const char *user_png_ver, void *error_ptr, png_error_ptr error_fn,
+    png_error_ptr warn_fn, void *arena, size_t arena_size),
+   PNG_ALLOCATED);
+#endif /* USER_MEM */
+
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+/* Allocation statistics, only present in builds with the ALLOC_STATS option.
+ * Every allocation libpng makes for a png_struct is counted, in total and by
+ * owner; png_get_alloc_stats copies the counts to 'stats' and returns 1, or
+ * returns 0 if either argument is NULL.  Sizes are those requested, excluding
+ * any overhead added by libpng or the allocator.  'current' can be below the
+ * true value if the application frees memory allocated for another png_struct
+ * through this one.  The option puts a header in front of the memory the
+ * memory functions return, so memory from png_malloc must be freed with
+ * png_free and memory from png_malloc_default with png_free_default.
+ */
+#define PNG_ALLOC_OTHER       0 /* structures, chunk contents, anything else */
+#define PNG_ALLOC_ZLIB        1 /* zlib state, windows and write buffers */
+#define PNG_ALLOC_ROWS        2 /* row and filter buffers */
+#define PNG_ALLOC_CHUNK_DATA  3 /* the buffer chunks are read into */
+#define PNG_ALLOC_GAMMA       4 /* gamma tables */
+#define PNG_ALLOC_SAVE_BUFFER 5 /* progressive reader save buffer */
+#define PNG_ALLOC_OWNERS      6
+
+typedef struct
+{
+   png_alloc_size_t current;  /* bytes allocated now */
+   png_alloc_size_t peak;     /* the highest value of 'current' */
+   png_alloc_size_t largest;  /* the largest single allocation */
+   png_alloc_size_t count;    /* the number of allocations made */
+} png_alloc_counts;
+
+typedef struct
+{
+   png_alloc_counts total;
+   png_alloc_counts owner[PNG_ALLOC_OWNERS]; /* indexed by PNG_ALLOC_ */
+} png_alloc_stats;
+
+PNG_EXPORT(int, png_get_alloc_stats,
+   (const png_struct *png_ptr, png_alloc_stats *stats));
+#endif /* ALLOC_STATS */
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+/* Per-stage performance counters, only present in builds with the
+ * PERF_COUNTERS option.  Each stage accumulates the clock ticks spent in it
+ * (CPU cycles on x86, clock() units elsewhere), the bytes it processed and
+ * the number of times it ran.  png_get_perf_counters copies the PNG_PERF_STAGES
+ * counters, indexed by the values below, to 'counters' and returns 1, or
+ * returns 0 if either argument is NULL.
+ */
+#define PNG_PERF_READ_DATA       0 /* the read callback; bytes read */
+#define PNG_PERF_CRC             1 /* chunk CRC calculation; bytes checked */
+#define PNG_PERF_INFLATE         2 /* inflate; bytes produced */
+#define PNG_PERF_UNFILTER_SUB    3 /* row unfiltering, by filter type; */
+#define PNG_PERF_UNFILTER_UP     4 /*    row bytes */
+#define PNG_PERF_UNFILTER_AVG    5
+#define PNG_PERF_UNFILTER_PAETH  6
+#define PNG_PERF_READ_TRANSFORM  7 /* read transformations; row bytes */
+#define PNG_PERF_WRITE_TRANSFORM 8 /* write transformations; row bytes */
+#define PNG_PERF_FILTER          9 /* write filter selection; row bytes */
+#define PNG_PERF_DEFLATE        10 /* deflate of image data; bytes consumed */
+#define PNG_PERF_STAGES         11
+
+typedef struct
+{
+   double ticks;
+   png_alloc_size_t bytes;
+   png_alloc_size_t calls;
+} png_perf_counter;
+
+PNG_EXPORT(int, png_get_perf_counters,
+   (const png_struct *png_ptr, png_perf_counter *counters));
+#endif /* PERF_COUNTERS */
+
+#ifdef PNG_READ_TRACE_SUPPORTED
+/* Read event tracing.  The trace function is called synchronously as the
+ * reader, sequential or progressive, reaches each of the events below, so it
+ * can take its own timestamps.  'offset' is the position in the input,
+ * counted from the start of the PNG signature, at which the event happens:
+ * the first byte of the chunk for PNG_TRACE_CHUNK_START and
+ * PNG_TRACE_IDAT_START and the byte after the CRC of the last chunk read for
+ * the others.  The image data events cover the IDAT or fdAT chunks of one
+ * image; the frame events bracket each APNG frame from its fcTL chunk to the
+ * end of its image data.  'row' and 'pass' are those of the row just decoded
+ * (within the pass for interlaced images) and 'frame' is the APNG frame
+ * number as passed to the progressive frame callbacks, or 0.
+ */
+#define PNG_TRACE_CHUNK_START 1
+#define PNG_TRACE_CHUNK_END   2
+#define PNG_TRACE_IDAT_START  3
+#define PNG_TRACE_IDAT_END    4
+#define PNG_TRACE_ROW         5
+#define PNG_TRACE_FRAME_START 6
+#define PNG_TRACE_FRAME_END   7
+
+typedef struct
+{
+   int event;              /* PNG_TRACE_ value */
+   png_uint_32 chunk_name; /* the current or most recent chunk */
+   png_uint_32 row;
+   int pass;
+   png_uint_32 frame;
+   size_t offset;
+} png_trace_event;
+
+typedef PNG_CALLBACK(void, *png_trace_ptr,
+   (png_struct *, const png_trace_event *));
+
+/* A NULL trace_fn turns tracing off; set the function before reading the
+ * signature so that no event is missed.
+ */
+PNG_EXPORT(void, png_set_trace_fn,
+   (png_struct *png_ptr, void *trace_ptr, png_trace_ptr trace_fn));
+
+PNG_EXPORT(void *, png_get_trace_ptr,
+   (const png_struct *png_ptr));
+#endif /* READ_TRACE */
+
+#ifdef PNG_SIMPLIFIED_WRITE_SUPPORTED
+/* Reallocate 'memory' to 'size' bytes, preserving its contents as realloc()
+ * does, or free it when 'size' is 0.  'memory' is NULL on the first call.
+ */
+typedef PNG_CALLBACK(void *, *png_image_realloc_ptr,
+   (void *context, void *memory, png_alloc_size_t size));
+
+PNG_EXPORT(int, png_image_write_to_memory_alloc,
+   (png_image *image, void **memory, png_alloc_size_t *memory_bytes,
+    int convert_to_8_bit, const void *buffer, png_int_32 row_stride,
+    const void *colormap, png_image_realloc_ptr realloc_fn,
+    void *realloc_context));
+   /* Write the image to memory in a single pass.  The output buffer is grown
+    * as the PNG is written with realloc_fn, which is passed realloc_context,
+    * or with the C library realloc() if realloc_fn is NULL.  On success
+    * *memory is the buffer, which the caller must free (with free() if
+    * realloc_fn was NULL), and *memory_bytes is the exact size of the PNG;
+    * the buffer may be larger.  On failure *memory is NULL, *memory_bytes is 0
+    * and nothing remains allocated.  Unlike png_image_write_to_memory this
+    * never needs a second call to size the output.
+    */
+
+/* Streaming simplified write.  png_image_write_begin writes the PNG header for
+ * the image described by 'image', exactly as png_image_write_to_memory would,
+ * and png_image_write_rows then accepts the rows in order, any number at a
+ * time, so the whole image need never be in memory.  The format conversions,
+ * sRGB and linear handling and color-maps of the other write APIs are all
+ * supported; 'colormap' is only used by png_image_write_begin.
+ *
+ * The output is passed to write_fn, which returns 0 on a write error, with
+ * write_context.  If write_fn is NULL write_context must be a stdio FILE.
+ *
+ * 'rows' points to the first (top) of the 'count' rows passed; row_stride is
+ * the distance from one row to the next, in components, and may be negative,
+ * or 0 for packed rows.  png_image_write_end writes the end of the PNG once all
+ * image->height rows have been written and frees the image.  Each function
+ * returns false on error, after which the image has already been freed;
+ * png_image_free abandons an incomplete write.
+ */
+typedef PNG_CALLBACK(int, *png_image_write_ptr,
+   (void *context, const void *data, size_t size));
+
+PNG_EXPORT(int, png_image_write_begin,
+   (png_image *image, png_image_write_ptr write_fn, void *write_context,
+    int convert_to_8_bit, const void *colormap));
+PNG_EXPORT(int, png_image_write_rows,
+   (png_image *image, const void *rows, png_int_32 row_stride,
+    png_uint_32 count));
+PNG_EXPORT(int, png_image_write_end,
+   (png_image *image));
+#endif /* SIMPLIFIED_WRITE */
+
+#ifdef PNG_SIMPLIFIED_READ_SUPPORTED
+/* Streaming simplified read.  After png_image_begin_read_from_* and with
+ * image->format set, png_image_read_rows_begin sets up the same conversion as
+ * png_image_finish_read, which it replaces, and png_image_read_rows then
+ * returns the rows in order, any number at a time, so only the rows asked for
+ * need to be in memory.  'background' and 'colormap' are as for
+ * png_image_finish_read; the color-map is filled in by
+ * png_image_read_rows_begin.  When 'background' is NULL and the image has to
+ * be composed the rows passed to png_image_read_rows are the background.
+ *
+ * The rows of an interlaced PNG are not complete until the last pass has been
+ * read, so for these png_image_read_rows_begin decodes the whole image into
+ * an internal buffer and, if 'background' is NULL, composes it on black.
+ *
+ * 'buffer' points to the first (top) of the 'count' rows to read; row_stride
+ * is the distance from one row to the next, in components, and may be
+ * negative, or 0 for packed rows.  The image is freed once all image->height
+ * rows have been read.  Each function returns false on error, after which the
+ * image has already been freed; png_image_free abandons an incomplete read.
+ */
+PNG_EXPORT(int, png_image_read_rows_begin,
+   (png_image *image, const png_color *background, void *colormap));
+PNG_EXPORT(int, png_image_read_rows,
+   (png_image *image, void *buffer, png_int_32 row_stride, png_uint_32 count));
+
+/* Check the rest of a PNG after png_image_begin_read_from_* without decoding
+ * the pixels; this replaces png_image_finish_read.  The image data is inflated
+ * one row at a time and the filter byte of each row, the length of the data,
+ * the end of the zlib stream and the CRC of every remaining chunk up to IEND
+ * are checked, but the rows are not unfiltered and no image buffer is needed.
+ * Problems that would normally only be warnings, such as extra compressed
+ * data or a CRC error in an ancillary chunk, are errors here; warnings from
+ * png_image_begin_read_from_* are left in image->warning_or_error.  Returns
+ * true if the PNG is valid.  The image is freed in either case.
+ */
+PNG_EXPORT(int, png_image_validate, (png_image *image));
+#endif /* SIMPLIFIED_READ */
+
+#ifdef PNG_READ_SUPPORTED
+/* Header probe.  png_probe_header looks at the first 'size' bytes of a PNG in
+ * memory without creating a png_struct or allocating anything.  It checks the
+ * signature and the IHDR chunk, including its CRC, and then walks the chunk
+ * headers up to the first IDAT, skipping the chunk data, to record where the
+ * chunks listed below start and, from acTL, the number of APNG frames.  The
+ * CRCs of the other chunks are not checked.
+ *
+ * The result is one of the PNG_PROBE_ values.  When more data is needed
+ * 'bytes_needed' is the length of the prefix required to make progress; with
+ * PNG_PROBE_HEADER the IHDR fields are valid but chunks beyond the prefix have
+ * not been seen.  Each chunk_offset entry is the file offset of the first
+ * chunk of that type, or 0 if none was seen.
+ */
+#define PNG_PROBE_ERROR     (-1) /* not a PNG, or a damaged header or chunk */
+#define PNG_PROBE_NEED_MORE   0  /* the IHDR is incomplete */
+#define PNG_PROBE_HEADER      1  /* IHDR valid, the first IDAT not reached */
+#define PNG_PROBE_COMPLETE    2  /* every chunk before the first IDAT seen */
+
+#define PNG_PROBE_CHUNK_PLTE  0
+#define PNG_PROBE_CHUNK_tRNS  1
+#define PNG_PROBE_CHUNK_gAMA  2
+#define PNG_PROBE_CHUNK_cHRM  3
+#define PNG_PROBE_CHUNK_sRGB  4
+#define PNG_PROBE_CHUNK_iCCP  5
+#define PNG_PROBE_CHUNK_cICP  6
+#define PNG_PROBE_CHUNK_mDCV  7
+#define PNG_PROBE_CHUNK_cLLI  8
+#define PNG_PROBE_CHUNK_eXIf  9
+#define PNG_PROBE_CHUNK_pHYs 10
+#define PNG_PROBE_CHUNK_acTL 11
+#define PNG_PROBE_CHUNK_IDAT 12
+#define PNG_PROBE_CHUNK_COUNT 13
+
+typedef struct
+{
+   png_uint_32 width;
+   png_uint_32 height;
+   png_byte    bit_depth;
+   png_byte    color_type;
+   png_byte    compression_method;
+   png_byte    filter_method;
+   png_byte    interlace_method;
+   png_uint_32 num_frames;      /* From acTL, 0 if no acTL has been seen */
+   png_uint_32 num_plays;       /* From acTL */
+   size_t      bytes_needed;    /* Prefix length needed to continue, or 0 */
+   size_t      chunk_offset[PNG_PROBE_CHUNK_COUNT];
+} png_probe;
+
+PNG_EXPORT(int, png_probe_header,
+   (png_probe *probe, const void *data, size_t size));
+#endif /* READ */
+
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+/* Deferred decompression of zTXt, iTXt and iCCP chunks.  With 'defer' set the
+ * read functions check these chunks as far as they can without inflating them
+ * (for iCCP this includes the profile header and tag table) and store the
+ * compressed data.  It is inflated when png_get_text or png_get_iCCP first
+ * asks for it, or when the png_info is passed to a write function.  Data that
+ * then turns out to be damaged is dropped with a warning rather than being
+ * reported while reading.  The data is inflated in the png_info itself, so
+ * png_write_info and png_write_info_before_PLTE change their const png_info
+ * argument in this case.
+ */
+PNG_EXPORT(void, png_set_defer_decompression,
+   (png_struct *png_ptr, int defer));
+#endif
+
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+/* Vectored output.  This replaces png_set_write_fn with a function that is
+ * given several pieces of output in one call, and libpng then passes a whole
+ * chunk (header, data and CRC) to it at once when it has all the data, as it
+ * does for IDAT, fdAT and most small chunks; other output, such as the
+ * signature or chunks written a piece at a time, still arrives as single
+ * pieces.  png_get_io_state reports PNG_IO_CHUNK_HDR for a call that starts a
+ * chunk.  If the compression buffer size still has its default value it is
+ * raised to PNG_WRITE_VECTOR_ZBUF_SIZE, giving larger IDAT chunks and so fewer
+ * calls; png_set_compression_buffer_size can change it afterwards.
+ * png_set_write_fn removes the vectored function again.
+ */
+PNG_EXPORT(void, png_set_write_fn_v,
+   (png_struct *png_ptr, void *io_ptr, png_write_v_ptr write_v_fn,
+    png_flush_ptr output_flush_fn));
+#endif
+
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+/* A cache of iCCP profiles that have passed libpng's checks.  A png_struct
+ * given a cache with png_set_icc_cache looks the compressed data of each iCCP
+ * chunk up in it and, when the same data was seen before on an image of the
+ * same kind (colour or grayscale), skips checking the profile header and tag
+ * table; with png_set_defer_decompression the profile is then not inflated at
+ * all while reading.  Warnings the checks gave the first time are not
+ * repeated.  The cache holds the last few distinct profiles and is allocated
+ * with malloc, not the png_struct memory functions.
+ *
+ * Any number of png_structs may share a cache, but libpng does no locking:
+ * reads that use the same cache must not run at the same time.  The cache must
+ * stay alive until every png_struct using it has been destroyed or given
+ * another cache.  png_create_icc_cache returns NULL if out of memory.
+ */
+typedef struct png_icc_cache_def png_icc_cache;
+
+PNG_EXPORTA(png_icc_cache *, png_create_icc_cache, (void),
+   PNG_ALLOCATED);
+PNG_EXPORT(void, png_destroy_icc_cache, (png_icc_cache *cache));
+PNG_EXPORT(void, png_set_icc_cache,
+   (png_struct *png_ptr, png_icc_cache *cache));
+/* The number of iCCP chunks found in the cache so far: */
+PNG_EXPORT(png_uint_32, png_get_icc_cache_hits, (const png_icc_cache *cache));
+#endif
+
+#ifdef PNG_READ_AHEAD_SUPPORTED
+/* Read-ahead for the sequential reader.  With a non-zero 'size' libpng reads
+ * the input in blocks of up to 'size' bytes through a buffer of its own, so
+ * that a chunk's data and CRC and the header of the next chunk are usually
+ * fetched with a single call to the read function instead of one call for
+ * each.  libpng only asks for input it knows must exist, from the lengths of
+ * the chunks already read, so the read function still never has to return
+ * less than it was asked for.  Reads larger than the buffer go straight to the
+ * read function.  A seek drops the buffer, unless the target is inside it.
+ * Call this before reading starts; 0 turns read-ahead off.  It has no effect
+ * on the progressive reader.
+ */
+PNG_EXPORT(void, png_set_read_ahead, (png_struct *png_ptr, size_t size));
+#endif
+
 /* Maintainer: Put new public prototypes here ^, in libpng.3, in project
  * defs, and in scripts/symbols.def.
  */
@@ -721,6 +721,10 @@ png_get_iCCP(const png_struct *png_ptr, png_info *info_ptr,
 {
    png_debug1(1, "in %s retrieval function", "iCCP");
 
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+   png_inflate_deferred(png_constcast(png_struct *, png_ptr), info_ptr);
+#endif
+
    if (png_ptr != NULL && info_ptr != NULL &&
        (info_ptr->valid & PNG_INFO_iCCP) != 0 &&
        name != NULL && profile != NULL && proflen != NULL)
@@ -1158,6 +1162,10 @@ int
 png_get_text(const png_struct *png_ptr, png_info *info_ptr,
     png_text **text_ptr, int *num_text)
 {
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+   png_inflate_deferred(png_constcast(png_struct *, png_ptr), info_ptr);
+#endif
+
    if (png_ptr != NULL && info_ptr != NULL && info_ptr->num_text > 0)
    {
       png_debug1(1, "in text retrieval function, chunk typeid = 0x%lx",
@@ -1517,5 +1525,106 @@ png_get_first_frame_is_hidden(png_struct *png_ptr, png_info *info_ptr)
 
    return 0;
 }
+
+#ifdef PNG_READ_APNG_SUPPORTED
+png_uint_32 PNGAPI
+png_get_keyframe(png_struct *png_ptr, png_uint_32 frame)
+{
+   png_debug(1, "in png_get_keyframe");
+
+   if (png_ptr != NULL && frame < png_ptr->frame_index_size)
+      return png_ptr->frame_index[frame].keyframe;
+
+   return 0;
+}
+#endif
 #endif /* PNG_APNG_SUPPORTED */
+
+png_alloc_size_t PNGAPI
+png_get_memory_footprint(const png_struct *png_ptr)
+{
+   png_alloc_size_t size;
+
+   png_debug(1, "in png_get_memory_footprint");
+
+   if (png_ptr == NULL)
+      return 0;
+
+   size = (sizeof *png_ptr) + png_ptr->zstream_memory;
+
+#ifdef PNG_READ_SUPPORTED
+   if ((png_ptr->mode & PNG_IS_READ_STRUCT) != 0)
+   {
+      if (png_ptr->big_row_buf != NULL)
+         size += 2 * png_ptr->old_big_row_buf_size; /* and big_prev_row */
+
+      size += png_ptr->read_buffer_size;
+
+#ifdef PNG_READ_AHEAD_SUPPORTED
+      if (png_ptr->read_ahead != NULL)
+         size += png_ptr->read_ahead_size;
+#endif
+
+#ifdef PNG_PROGRESSIVE_READ_SUPPORTED
+      size += png_ptr->save_buffer_max;
+#endif
+   }
+#endif
+
+#ifdef PNG_WRITE_SUPPORTED
+   if ((png_ptr->mode & PNG_IS_READ_STRUCT) == 0)
+   {
+      const png_compression_buffer *list = png_ptr->zbuffer_list;
+      size_t row_size =
+         PNG_ROWBYTES(png_ptr->maximum_pixel_depth, png_ptr->width) + 1;
+
+      for (; list != NULL; list = list->next)
+         size += PNG_COMPRESSION_BUFFER_SIZE(png_ptr);
+
+      if (png_ptr->row_buf != NULL)
+         size += row_size;
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+      if (png_ptr->prev_row != NULL)
+         size += row_size;
+
+      if (png_ptr->try_row != NULL)
+         size += row_size;
+
+      if (png_ptr->tst_row != NULL)
+         size += row_size;
+#endif
+   }
+#endif
+
+   return size;
+}
+
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+int PNGAPI
+png_get_alloc_stats(const png_struct *png_ptr, png_alloc_stats *stats)
+{
+   png_debug(1, "in png_get_alloc_stats");
+
+   if (png_ptr == NULL || stats == NULL)
+      return 0;
+
+   *stats = png_ptr->alloc_stats;
+   return 1;
+}
+#endif
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+int PNGAPI
+png_get_perf_counters(const png_struct *png_ptr, png_perf_counter *counters)
+{
+   png_debug(1, "in png_get_perf_counters");
+
+   if (png_ptr == NULL || counters == NULL)
+      return 0;
+
+   memcpy(counters, png_ptr->perf_counters, sizeof png_ptr->perf_counters);
+   return 1;
+}
+#endif
 #endif /* READ || WRITE */
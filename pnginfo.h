@@ -76,6 +76,10 @@ struct png_info_def
    char *iccp_name;           /* profile name */
    png_byte *iccp_profile;    /* International Color Consortium profile data */
    png_uint_32 iccp_proflen;  /* ICC profile data length */
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+   png_uint_32 iccp_deferred; /* compressed length if iccp_profile is still
+                               * compressed, else 0 */
+#endif
 #endif
 
 #ifdef PNG_cLLI_SUPPORTED
@@ -110,6 +114,13 @@ struct png_info_def
    png_text *text; /* array of comments read or comments to write */
 #endif /* TEXT */
 
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+   /* Set when a text entry or the iCCP profile has been stored compressed by
+    * png_set_defer_decompression; see png_inflate_deferred.
+    */
+   int deferred;
+#endif
+
 #ifdef PNG_tIME_SUPPORTED
    /* The tIME chunk holds the last time the displayed image data was
     * modified.  See the png_time struct for the contents of this struct.
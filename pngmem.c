@@ -36,6 +36,14 @@ png_destroy_png_struct(png_struct *png_ptr)
          /* We may have a jmp_buf left to deallocate. */
          png_free_jmpbuf(&dummy_struct);
 #     endif
+
+#     ifdef PNG_USER_MEM_SUPPORTED
+         /* Everything allocated from an arena, including the png_struct
+          * itself, goes in one shot.
+          */
+         if (dummy_struct.arena != NULL)
+            png_arena_destroy(dummy_struct.arena);
+#     endif
    }
 }
 
@@ -59,6 +67,52 @@ png_calloc,(const png_struct *png_ptr, png_alloc_size_t size),
    return ret;
 }
 
+/* This header in front of an allocation records its size and, with
+ * ALLOC_STATS, its owner.  With ALLOC_STATS png_malloc_base puts one in front
+ * of everything allocated for a png_struct and png_free reads it back;
+ * otherwise only png_malloc_sized adds one.  The memory functions see the
+ * start of the header.
+ */
+typedef union
+{
+   struct
+   {
+      png_alloc_size_t size;     /* as requested */
+      unsigned int owner;        /* PNG_ALLOC_ value */
+   } info;
+   double align_double;
+   void *align_pointer;
+}
+png_alloc_header;
+
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+static void
+png_alloc_count(png_alloc_counts *counts, png_alloc_size_t size)
+{
+   counts->count++;
+   counts->current += size;
+
+   if (counts->current > counts->peak)
+      counts->peak = counts->current;
+
+   if (size > counts->largest)
+      counts->largest = size;
+}
+
+static void
+png_alloc_uncount(png_alloc_counts *counts, png_alloc_size_t size)
+{
+   /* Memory may be freed by a png_struct other than the one that allocated it,
+    * for example a png_compressed_frame.
+    */
+   if (size < counts->current)
+      counts->current -= size;
+
+   else
+      counts->current = 0;
+}
+#endif /* ALLOC_STATS */
+
 /* png_malloc_base, an internal function added at libpng 1.6.0, does the work of
  * allocating memory, taking into account limits and PNG_USER_MEM_SUPPORTED.
  * Checking and error handling must happen outside this routine; it returns NULL
@@ -87,6 +141,42 @@ png_malloc_base,(const png_struct *png_ptr, png_alloc_size_t size),
     */
    if (size > PNG_SIZE_MAX) return NULL;
 
+#  ifdef PNG_ALLOC_STATS_SUPPORTED
+      if (png_ptr != NULL)
+      {
+         png_struct *stats_ptr = png_constcast(png_struct *,png_ptr);
+         unsigned int owner = png_ptr->alloc_owner;
+         png_alloc_header *header;
+         size_t total;
+
+         if (size > PNG_SIZE_MAX - (sizeof *header)) return NULL;
+
+         total = (sizeof *header) + (size_t)/*SAFE*/size;
+
+         /* The owner applies to one allocation only. */
+         stats_ptr->alloc_owner = PNG_ALLOC_OTHER;
+
+#        ifdef PNG_USER_MEM_SUPPORTED
+            if (png_ptr->malloc_fn != NULL)
+               header = png_voidcast(png_alloc_header *,
+                   png_ptr->malloc_fn(stats_ptr, total));
+
+            else
+#        endif
+            header = png_voidcast(png_alloc_header *, malloc(total));
+
+         if (header == NULL)
+            return NULL;
+
+         header->info.size = size;
+         header->info.owner = owner;
+         png_alloc_count(&stats_ptr->alloc_stats.total, size);
+         png_alloc_count(&stats_ptr->alloc_stats.owner[owner], size);
+
+         return header + 1;
+      }
+#  endif /* ALLOC_STATS */
+
 #  ifdef PNG_USER_MEM_SUPPORTED
       if (png_ptr != NULL && png_ptr->malloc_fn != NULL)
          return png_ptr->malloc_fn(png_constcast(png_struct *,png_ptr), size);
@@ -98,6 +188,54 @@ png_malloc_base,(const png_struct *png_ptr, png_alloc_size_t size),
    return malloc((size_t)/*SAFE*/size); /* checked for truncation above */
 }
 
+/* Allocate memory for which png_free_sized returns the size requested; zlib
+ * memory comes from here so that png_get_memory_footprint can include it.  With
+ * ALLOC_STATS png_malloc_base has already recorded the size, so the same header
+ * serves both.  Returns NULL on failure.
+ */
+PNG_FUNCTION(void * /* PRIVATE */,
+png_malloc_sized,(const png_struct *png_ptr, png_alloc_size_t size),
+    PNG_ALLOCATED)
+{
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+   return png_malloc_base(png_ptr, size);
+#else
+   png_alloc_header *header;
+
+   if (size > PNG_SIZE_MAX - (sizeof *header))
+      return NULL;
+
+   header = png_voidcast(png_alloc_header *,
+       png_malloc_base(png_ptr, (sizeof *header) + size));
+
+   if (header == NULL)
+      return NULL;
+
+   header->info.size = size;
+   header->info.owner = 0;
+
+   return header + 1;
+#endif
+}
+
+png_alloc_size_t /* PRIVATE */
+png_free_sized(const png_struct *png_ptr, void *ptr)
+{
+   png_alloc_header *header = png_voidcast(png_alloc_header *, ptr);
+   png_alloc_size_t size;
+
+   --header;
+   size = header->info.size;
+
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+   png_free(png_ptr, ptr);
+#else
+   png_free(png_ptr, header);
+#endif
+
+   return size;
+}
+
 #if defined(PNG_TEXT_SUPPORTED) || defined(PNG_sPLT_SUPPORTED) ||\
    defined(PNG_STORE_UNKNOWN_CHUNKS_SUPPORTED)
 /* This is really here only to work round a spurious warning in GCC 4.6 and 4.7
@@ -236,6 +374,21 @@ png_free(const png_struct *png_ptr, void *ptr)
    if (png_ptr == NULL || ptr == NULL)
       return;
 
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+   {
+      png_struct *stats_ptr = png_constcast(png_struct *,png_ptr);
+      png_alloc_header *header = png_voidcast(png_alloc_header *, ptr);
+
+      --header;
+      png_alloc_uncount(&stats_ptr->alloc_stats.total, header->info.size);
+      png_alloc_uncount(&stats_ptr->alloc_stats.owner[header->info.owner],
+          header->info.size);
+
+      /* The memory functions returned the start of the header. */
+      ptr = header;
+   }
+#endif /* ALLOC_STATS */
+
 #ifdef PNG_USER_MEM_SUPPORTED
    if (png_ptr->free_fn != NULL)
       png_ptr->free_fn(png_constcast(png_struct *,png_ptr), ptr);
@@ -265,6 +418,12 @@ png_set_mem_fn(png_struct *png_ptr, void *mem_ptr,
 {
    if (png_ptr != NULL)
    {
+      if (png_ptr->arena != NULL)
+      {
+         png_app_error(png_ptr, "png_set_mem_fn: png_struct uses an arena");
+         return;
+      }
+
       png_ptr->mem_ptr = mem_ptr;
       png_ptr->malloc_fn = malloc_fn;
       png_ptr->free_fn = free_fn;
@@ -283,5 +442,254 @@ png_get_mem_ptr(const png_struct *png_ptr)
 
    return png_ptr->mem_ptr;
 }
+
+/* Arena allocation.  A png_struct made by png_create_read_struct_arena or
+ * png_create_write_struct_arena has an arena installed as its memory
+ * functions: every allocation, including the png_struct itself, is carved out
+ * of the current slab by advancing a pointer.  png_free only gives back the
+ * most recent allocation; the rest of the arena stays until
+ * png_destroy_png_struct releases it as a whole, and memory from outside the
+ * arena is an error.  The first slab is the caller's block if one was
+ * supplied, later slabs come from malloc.
+ */
+#ifndef PNG_ARENA_SLAB_SIZE
+#  define PNG_ARENA_SLAB_SIZE 65536U
+#endif
+
+/* Every allocation is rounded to a multiple of the size of this union so that
+ * the next one is suitably aligned for anything libpng stores.
+ */
+typedef union
+{
+   png_alloc_size_t size;
+   void *pointer;
+   double number;
+}
+png_arena_align;
+
+#define PNG_ARENA_ALIGN (sizeof (png_arena_align))
+#define png_arena_round(size)\
+   (((size) + (PNG_ARENA_ALIGN-1)) & ~(size_t)(PNG_ARENA_ALIGN-1))
+
+/* Header of a malloc'd slab; the usable memory follows it. */
+typedef union png_arena_slab
+{
+   png_arena_align align;
+   struct
+   {
+      union png_arena_slab *next;  /* previously allocated slab */
+      png_byte *end;               /* end of the usable memory */
+   } link;
+}
+png_arena_slab;
+
+struct png_arena_def
+{
+   png_byte *start;           /* start of the current slab */
+   png_byte *next;            /* first free byte in the current slab */
+   png_byte *end;             /* end of the current slab */
+   png_byte *last;            /* most recent allocation, or NULL */
+   png_arena_slab *slabs;     /* malloc'd slabs, most recent first */
+   png_byte *block;           /* caller supplied block, or NULL */
+   png_byte *block_end;
+   size_t slab_size;          /* usable size of a new slab */
+};
+
+static png_arena_slab *
+png_arena_new_slab(png_arena *arena, size_t size)
+{
+   png_arena_slab *slab;
+
+   if (size > PNG_SIZE_MAX - (sizeof *slab))
+      return NULL;
+
+   slab = png_voidcast(png_arena_slab *, malloc((sizeof *slab) + size));
+
+   if (slab != NULL)
+   {
+      slab->link.next = arena != NULL ? arena->slabs : NULL;
+      slab->link.end = (png_byte *)(slab + 1) + size;
+
+      if (arena != NULL)
+         arena->slabs = slab;
+   }
+
+   return slab;
+}
+
+png_arena * /* PRIVATE */
+png_arena_create(void *block, size_t block_size)
+{
+   const size_t state_size = png_arena_round(sizeof (png_arena));
+   png_arena *arena;
+   png_byte *start, *end;
+
+   if (block != NULL)
+   {
+      size_t misalign;
+
+      start = png_voidcast(png_byte *, block);
+      misalign = (size_t)start & (PNG_ARENA_ALIGN-1);
+
+      if (misalign != 0)
+      {
+         misalign = PNG_ARENA_ALIGN - misalign;
+
+         if (block_size < misalign)
+            return NULL;
+
+         start += misalign;
+         block_size -= misalign;
+      }
+
+      /* The arena state lives at the start of the block. */
+      if (block_size < state_size)
+         return NULL;
+
+      end = start + block_size;
+      arena = png_aligncast(png_arena *, start);
+      arena->slabs = NULL;
+      arena->block = start;
+      arena->block_end = end;
+      arena->slab_size = PNG_ARENA_SLAB_SIZE;
+   }
+
+   else
+   {
+      png_arena_slab *slab;
+
+      if (block_size == 0)
+         block_size = PNG_ARENA_SLAB_SIZE;
+
+      block_size = png_arena_round(block_size);
+
+      if (block_size > PNG_SIZE_MAX - state_size)
+         return NULL;
+
+      slab = png_arena_new_slab(NULL, state_size + block_size);
+
+      if (slab == NULL)
+         return NULL;
+
+      start = (png_byte *)(slab + 1);
+      end = slab->link.end;
+      arena = png_aligncast(png_arena *, start);
+      arena->slabs = slab;
+      arena->block = NULL;
+      arena->block_end = NULL;
+      arena->slab_size = block_size;
+   }
+
+   arena->start = start;
+   arena->next = start + state_size;
+   arena->end = end;
+   arena->last = NULL;
+
+   return arena;
+}
+
+void /* PRIVATE */
+png_arena_destroy(png_arena *arena)
+{
+   /* The state may be in the first slab, so read the list before freeing. */
+   png_arena_slab *slab = arena->slabs;
+
+   while (slab != NULL)
+   {
+      png_arena_slab *next = slab->link.next;
+
+      free(slab);
+      slab = next;
+   }
+}
+
+png_struct * /* PRIVATE */
+png_arena_attach(png_struct *png_ptr, png_arena *arena)
+{
+   if (png_ptr != NULL)
+      png_ptr->arena = arena;
+
+   else
+      png_arena_destroy(arena);
+
+   return png_ptr;
+}
+
+PNG_FUNCTION(void * /* PRIVATE */,
+png_arena_malloc,(png_struct *png_ptr, png_alloc_size_t size),
+    PNG_ALLOCATED)
+{
+   png_arena *arena = png_voidcast(png_arena *, png_ptr->mem_ptr);
+   png_byte *ret;
+
+   if (size > PNG_SIZE_MAX - PNG_ARENA_ALIGN)
+      return NULL;
+
+   /* Zero sized requests still get a distinct pointer. */
+   size = size > 0 ? png_arena_round(size) : PNG_ARENA_ALIGN;
+
+   if ((size_t)(arena->end - arena->next) < size)
+   {
+      png_arena_slab *slab;
+
+      if (size > arena->slab_size / 2)
+      {
+         /* Big requests get a slab of their own and leave the current slab
+          * alone; there is most likely more small stuff to come.
+          */
+         slab = png_arena_new_slab(arena, (size_t)size);
+
+         return slab != NULL ? slab + 1 : NULL;
+      }
+
+      slab = png_arena_new_slab(arena, arena->slab_size);
+
+      if (slab == NULL)
+         return NULL;
+
+      arena->start = arena->next = (png_byte *)(slab + 1);
+      arena->end = slab->link.end;
+   }
+
+   ret = arena->next;
+   arena->next += size;
+   arena->last = ret;
+
+   return ret;
+}
+
+void /* PRIVATE */
+png_arena_free(png_struct *png_ptr, void *ptr)
+{
+   png_arena *arena = png_voidcast(png_arena *, png_ptr->mem_ptr);
+   png_byte *p = png_voidcast(png_byte *, ptr);
+   png_arena_slab *slab;
+
+   /* Freeing the most recent allocation gives the space back; this makes the
+    * common allocate, use and free pattern of temporary buffers cheap.
+    */
+   if (p == arena->last)
+   {
+      arena->next = p;
+      arena->last = NULL;
+      return;
+   }
+
+   /* Anything else in the arena is released with the arena; most frees are of
+    * recent allocations, so the current slab is checked first.
+    */
+   if (p >= arena->start && p < arena->next)
+      return;
+
+   if (arena->block != NULL && p >= arena->block && p < arena->block_end)
+      return;
+
+   for (slab = arena->slabs; slab != NULL; slab = slab->link.next)
+      if (p >= (png_byte *)(slab + 1) && p < slab->link.end)
+         return;
+
+   /* The pointer came from some other allocator, which libpng cannot know. */
+   png_error(png_ptr, "png_free: pointer not allocated from the arena");
+}
 #endif /* USER_MEM */
 #endif /* READ || WRITE */
@@ -53,12 +53,25 @@ png_process_data(png_struct *png_ptr, png_info *info_ptr,
    if (png_ptr == NULL || info_ptr == NULL)
       return;
 
+   /* Offsets are counted from the start of the signature. */
+   if (png_ptr->push_offset == 0)
+      png_ptr->push_offset = png_ptr->sig_bytes;
+
+   png_ptr->push_offset += buffer_size;
    png_push_restore_buffer(png_ptr, buffer, buffer_size);
 
    while (png_ptr->buffer_size)
    {
       png_process_some_data(png_ptr, info_ptr);
    }
+
+   if (png_lean_memory(png_ptr) && png_ptr->save_buffer_size == 0 &&
+       png_ptr->save_buffer != NULL)
+   {
+      png_free(png_ptr, png_ptr->save_buffer);
+      png_ptr->save_buffer = png_ptr->save_buffer_ptr = NULL;
+      png_ptr->save_buffer_max = 0;
+   }
 }
 
 size_t
@@ -81,7 +94,12 @@ png_process_data_pause(png_struct *png_ptr, int save)
           * is actually 'saved', in which case we just return 0
           */
          if (png_ptr->save_buffer_size < remaining)
-            return remaining - png_ptr->save_buffer_size;
+         {
+            /* The caller supplies these again. */
+            remaining -= png_ptr->save_buffer_size;
+            png_ptr->push_offset -= remaining;
+            return remaining;
+         }
       }
    }
 
@@ -460,41 +478,37 @@ png_push_fill_buffer(png_struct *png_ptr, png_byte *buffer, size_t length)
    }
 }
 
+/* Keep the unread input for the next call to png_process_data.  The saved data
+ * is only moved to the start of save_buffer when the new data would not fit
+ * after it, and the buffer grows geometrically, so input delivered in small
+ * pieces costs a bounded number of copies per byte rather than one per call.
+ */
 void /* PRIVATE */
 png_push_save_buffer(png_struct *png_ptr)
 {
-   if (png_ptr->save_buffer_size != 0)
-   {
-      if (png_ptr->save_buffer_ptr != png_ptr->save_buffer)
-      {
-         size_t i, istop;
-         png_byte *sp;
-         png_byte *dp;
+   size_t save_size = png_ptr->save_buffer_size;
+   size_t current_size = png_ptr->current_buffer_size;
+   size_t offset = 0;
 
-         istop = png_ptr->save_buffer_size;
-         for (i = 0, sp = png_ptr->save_buffer_ptr, dp = png_ptr->save_buffer;
-             i < istop; i++, sp++, dp++)
-         {
-            *dp = *sp;
-         }
-      }
-   }
-   if (png_ptr->save_buffer_size + png_ptr->current_buffer_size >
-       png_ptr->save_buffer_max)
+   if (save_size != 0)
+      offset = (size_t)(png_ptr->save_buffer_ptr - png_ptr->save_buffer);
+
+   if (save_size > PNG_SIZE_MAX - (current_size + 256))
+      png_error(png_ptr, "Potential overflow of save_buffer");
+
+   if (save_size + current_size > png_ptr->save_buffer_max)
    {
-      size_t new_max;
+      size_t new_max = save_size + current_size + 256;
       png_byte *old_buffer;
 
-      if (png_ptr->save_buffer_size > PNG_SIZE_MAX -
-          (png_ptr->current_buffer_size + 256))
-      {
-         png_error(png_ptr, "Potential overflow of save_buffer");
-      }
+      if (png_ptr->save_buffer_max <= PNG_SIZE_MAX/2 &&
+          new_max < 2 * png_ptr->save_buffer_max)
+         new_max = 2 * png_ptr->save_buffer_max;
 
-      new_max = png_ptr->save_buffer_size + png_ptr->current_buffer_size + 256;
       old_buffer = png_ptr->save_buffer;
-      png_ptr->save_buffer = (png_byte *)png_malloc_warn(png_ptr,
-          (size_t)new_max);
+      png_alloc_owner(png_ptr, PNG_ALLOC_SAVE_BUFFER);
+      png_ptr->save_buffer = png_voidcast(png_byte *,
+          png_malloc_warn(png_ptr, new_max));
 
       if (png_ptr->save_buffer == NULL)
       {
@@ -502,21 +516,38 @@ png_push_save_buffer(png_struct *png_ptr)
          png_error(png_ptr, "Insufficient memory for save_buffer");
       }
 
-      if (old_buffer)
-         memcpy(png_ptr->save_buffer, old_buffer, png_ptr->save_buffer_size);
-      else if (png_ptr->save_buffer_size)
-         png_error(png_ptr, "save_buffer error");
+      if (save_size != 0)
+      {
+         if (old_buffer == NULL)
+            png_error(png_ptr, "save_buffer error");
+
+         memcpy(png_ptr->save_buffer, old_buffer + offset, save_size);
+      }
+
       png_free(png_ptr, old_buffer);
       png_ptr->save_buffer_max = new_max;
+      offset = 0;
    }
-   if (png_ptr->current_buffer_size)
+
+   else if (offset > png_ptr->save_buffer_max - (save_size + current_size))
    {
-      memcpy(png_ptr->save_buffer + png_ptr->save_buffer_size,
-         png_ptr->current_buffer_ptr, png_ptr->current_buffer_size);
-      png_ptr->save_buffer_size += png_ptr->current_buffer_size;
-      png_ptr->current_buffer_size = 0;
+      memmove(png_ptr->save_buffer, png_ptr->save_buffer + offset, save_size);
+      offset = 0;
    }
+
    png_ptr->save_buffer_ptr = png_ptr->save_buffer;
+
+   if (offset != 0)
+      png_ptr->save_buffer_ptr += offset;
+
+   if (current_size != 0)
+   {
+      memcpy(png_ptr->save_buffer_ptr + save_size,
+         png_ptr->current_buffer_ptr, current_size);
+      png_ptr->save_buffer_size += current_size;
+      png_ptr->current_buffer_size = 0;
+   }
+
    png_ptr->buffer_size = 0;
 }
 
@@ -550,6 +581,7 @@ png_push_read_IDAT(png_struct *png_ptr)
       png_crc_read(png_ptr, chunk_tag, 4);
       png_ptr->chunk_name = PNG_CHUNK_FROM_STRING(chunk_tag);
       png_ptr->mode |= PNG_HAVE_CHUNK_HEADER;
+      png_read_trace(png_ptr, PNG_TRACE_CHUNK_START);
 
 #ifdef PNG_READ_APNG_SUPPORTED
       if (png_ptr->chunk_name != png_fdAT && png_ptr->num_frames_read > 0)
@@ -557,6 +589,7 @@ png_push_read_IDAT(png_struct *png_ptr)
          if (png_ptr->flags & PNG_FLAG_ZSTREAM_ENDED)
          {
             png_ptr->process_mode = PNG_READ_CHUNK_MODE;
+            png_read_image_end(png_ptr);
             if (png_ptr->frame_end_fn != NULL)
                (*(png_ptr->frame_end_fn))(png_ptr, png_ptr->num_frames_read);
             png_ptr->num_frames_read++;
@@ -590,6 +623,8 @@ png_push_read_IDAT(png_struct *png_ptr)
          if ((png_ptr->flags & PNG_FLAG_ZSTREAM_ENDED) == 0)
             png_error(png_ptr, "Not enough compressed data");
 
+         png_read_image_end(png_ptr);
+
 #ifdef PNG_READ_APNG_SUPPORTED
          if (png_ptr->frame_end_fn != NULL)
             (*(png_ptr->frame_end_fn))(png_ptr, png_ptr->num_frames_read);
@@ -1086,6 +1121,8 @@ png_push_have_end(png_struct *png_ptr, png_info *info_ptr)
 void /* PRIVATE */
 png_push_have_row(png_struct *png_ptr, png_byte *row)
 {
+   png_read_trace(png_ptr, PNG_TRACE_ROW);
+
    if (png_ptr->row_fn != NULL)
       (*(png_ptr->row_fn))(png_ptr, row, png_ptr->row_number,
           (int)png_ptr->pass);
@@ -343,6 +343,24 @@
 #if defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
 #  include <windows.h>
 #endif
+
+/* The clock used by the performance counters.  It is read at the start and end
+ * of every counted stage so it must be cheap; the default is the time stamp
+ * counter where the compiler provides it, otherwise clock().  A build can
+ * define PNG_PERF_CLOCK() as any other monotonic counter returning a double.
+ */
+#if defined(PNG_PERF_COUNTERS_SUPPORTED) && !defined(PNG_PERF_CLOCK)
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#     include <x86intrin.h>
+#     define PNG_PERF_CLOCK() ((double)__rdtsc())
+#  elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#     include <intrin.h>
+#     define PNG_PERF_CLOCK() ((double)__rdtsc())
+#  else
+#     include <time.h>
+#     define PNG_PERF_CLOCK() ((double)clock())
+#  endif
+#endif
 #endif /* PNG_VERSION_INFO_ONLY */
 
 /* Moved here around 1.5.0beta36 from pngconf.h */
@@ -701,6 +719,7 @@
 /* For png_struct.apng_flags: */
 #define PNG_FIRST_FRAME_HIDDEN       0x0001U
 #define PNG_APNG_APP                 0x0002U
+#define PNG_APNG_TRANSFORMS_SET      0x0004U /* read transforms initialized */
 #endif
 
 /* The following will work on (signed char*) strings, whereas the get_uint_32
@@ -915,6 +934,10 @@ PNG_INTERNAL_FUNCTION(int, png_user_version_check,
 #else                               /* modern system limit SIZE_MAX (C99) */
 #  define png_chunk_max(png_ptr) ((void)png_ptr, PNG_SIZE_MAX)
 #endif
+
+/* True if the application set the PNG_LEAN_MEMORY option. */
+#define png_lean_memory(png_ptr)\
+   ((((png_ptr)->options >> PNG_LEAN_MEMORY) & 3) == PNG_OPTION_ON)
 #endif /* READ */
 
 /* Internal base allocator - no messages, NULL on failure to allocate.  This
@@ -925,6 +948,16 @@ PNG_INTERNAL_FUNCTION(void *, png_malloc_base,
    (const png_struct *png_ptr, png_alloc_size_t size),
    PNG_ALLOCATED);
 
+/* The same, but the size is recorded with the memory and png_free_sized, which
+ * must be used to free it, returns the size.
+ */
+PNG_INTERNAL_FUNCTION(void *, png_malloc_sized,
+   (const png_struct *png_ptr, png_alloc_size_t size),
+   PNG_ALLOCATED);
+
+PNG_INTERNAL_FUNCTION(png_alloc_size_t, png_free_sized,
+   (const png_struct *png_ptr, void *ptr), PNG_EMPTY);
+
 #if defined(PNG_TEXT_SUPPORTED) || defined(PNG_sPLT_SUPPORTED) ||\
    defined(PNG_STORE_UNKNOWN_CHUNKS_SUPPORTED)
 /* Internal array allocator, outputs no error or warning messages on failure,
@@ -957,6 +990,25 @@ PNG_INTERNAL_FUNCTION(png_struct *, png_create_png_struct,
     void *mem_ptr, png_malloc_ptr malloc_fn, png_free_ptr free_fn),
    PNG_ALLOCATED);
 
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+/* Add the time since 'start', a PNG_PERF_CLOCK() value, and 'bytes' to the
+ * counter for 'stage', a PNG_PERF_ value.
+ */
+PNG_INTERNAL_FUNCTION(void, png_perf_count,
+   (png_struct *png_ptr, int stage, double start, size_t bytes),
+   PNG_EMPTY);
+#endif
+
+/* Attribute the next allocation made for png_ptr (only) to 'owner', one of the
+ * PNG_ALLOC_ values, in the png_get_alloc_stats counts.
+ */
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+#  define png_alloc_owner(pp, owner)\
+   ((void)(png_constcast(png_struct *,pp)->alloc_owner = (owner)))
+#else
+#  define png_alloc_owner(pp, owner) ((void)0)
+#endif
+
 /* Free memory from internal libpng struct */
 PNG_INTERNAL_FUNCTION(void, png_destroy_png_struct,
    (png_struct *png_ptr),
@@ -967,6 +1019,34 @@ PNG_INTERNAL_FUNCTION(void, png_free_jmpbuf,
    (png_struct *png_ptr),
    PNG_EMPTY);
 
+#ifdef PNG_USER_MEM_SUPPORTED
+/* Arena allocation for png_create_*_struct_arena.  png_arena_create returns
+ * NULL if the state does not fit in the block or malloc fails;
+ * png_arena_attach records the arena in a new png_struct, or destroys it if
+ * the struct could not be created.  The other two are the memory functions
+ * installed in the png_struct.
+ */
+PNG_INTERNAL_FUNCTION(png_arena *, png_arena_create,
+   (void *block, size_t block_size),
+   PNG_EMPTY);
+
+PNG_INTERNAL_FUNCTION(void, png_arena_destroy,
+   (png_arena *arena),
+   PNG_EMPTY);
+
+PNG_INTERNAL_FUNCTION(png_struct *, png_arena_attach,
+   (png_struct *png_ptr, png_arena *arena),
+   PNG_EMPTY);
+
+PNG_INTERNAL_CALLBACK(void *, png_arena_malloc,
+   (png_struct *png_ptr, png_alloc_size_t size),
+   PNG_ALLOCATED);
+
+PNG_INTERNAL_CALLBACK(void, png_arena_free,
+   (png_struct *png_ptr, void *ptr),
+   PNG_EMPTY);
+#endif /* USER_MEM */
+
 /* Function to allocate memory for zlib. */
 PNG_INTERNAL_FUNCTION(voidpf, png_zalloc,
    (voidpf png_ptr, uInt items, uInt size),
@@ -982,6 +1062,34 @@ PNG_INTERNAL_FUNCTION(void, png_default_read_data,
    (png_struct *png_ptr, png_byte *data, size_t length),
    PNG_EMPTY);
 
+#ifdef PNG_READ_SEEK_SUPPORTED
+/* Move the input to an offset from the start of the PNG signature; the first
+ * returns 0 on failure, the second makes it an error.
+ */
+PNG_INTERNAL_FUNCTION(int, png_read_seek_data,
+   (png_struct *png_ptr, size_t offset),
+   PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void, png_read_seek,
+   (png_struct *png_ptr, size_t offset),
+   PNG_EMPTY);
+#endif
+
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+/* Added to png_text::compression of a text entry whose data is still
+ * compressed; the compressed data follows the empty text string and its length
+ * is in text_length (zTXt) or itxt_length (iTXt).
+ */
+#define PNG_TEXT_DEFERRED 0x100
+
+/* Inflate the text entries and iCCP profile in info_ptr that were stored
+ * compressed.  Damaged data is dropped with a warning.  This does not use
+ * png_ptr->zstream, so it works at any time and with a write png_struct.
+ */
+PNG_INTERNAL_FUNCTION(void, png_inflate_deferred,
+   (png_struct *png_ptr, png_info *info_ptr),
+   PNG_EMPTY);
+#endif
+
 #ifdef PNG_PROGRESSIVE_READ_SUPPORTED
 /* Internal callback. */
 PNG_INTERNAL_FUNCTION(void, png_push_fill_buffer,
@@ -1013,6 +1121,15 @@ PNG_INTERNAL_FUNCTION(void, png_write_data,
    (png_struct *png_ptr, const png_byte *data, size_t length),
    PNG_EMPTY);
 
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+/* Write several pieces of output, with one call if the application gave a
+ * vectored write function:
+ */
+PNG_INTERNAL_FUNCTION(void, png_write_data_v,
+   (png_struct *png_ptr, const png_iovec *vec, int count),
+   PNG_EMPTY);
+#endif
+
 /* Read and check the PNG file signature */
 PNG_INTERNAL_FUNCTION(void, png_read_sig,
    (png_struct *png_ptr, png_info *info_ptr),
@@ -1063,6 +1180,13 @@ PNG_INTERNAL_FUNCTION(void, png_write_IHDR,
     int compression_method, int filter_method, int interlace_method),
    PNG_EMPTY);
 
+#ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+PNG_INTERNAL_FUNCTION(void, png_write_encode_speed,
+   (png_struct *png_ptr),
+   PNG_EMPTY);
+   /* Apply the png_set_encode_speed preset (if any) for the IHDR values */
+#endif
+
 PNG_INTERNAL_FUNCTION(void, png_write_PLTE,
    (png_struct *png_ptr,
     const png_color *palette, png_uint_32 num_pal),
@@ -1377,6 +1501,44 @@ PNG_INTERNAL_FUNCTION(void, png_read_start_row,
    (png_struct *png_ptr),
    PNG_EMPTY);
 
+/* Release the zstream; with PNG_LEAN_MEMORY the inflate state is freed. */
+PNG_INTERNAL_FUNCTION(void, png_inflate_release,
+   (png_struct *png_ptr),
+   PNG_EMPTY);
+
+/* Free png_struct::read_buffer. */
+PNG_INTERNAL_FUNCTION(void, png_read_free_buffer,
+   (png_struct *png_ptr),
+   PNG_EMPTY);
+
+/* Called once all of the image data has been read: ends the image data and
+ * frame trace events and, with PNG_LEAN_MEMORY, frees the row buffers and the
+ * inflate state.
+ */
+PNG_INTERNAL_FUNCTION(void, png_read_image_end,
+   (png_struct *png_ptr),
+   PNG_EMPTY);
+
+#ifdef PNG_READ_TRACE_SUPPORTED
+/* png_struct::trace_state */
+#define PNG_TRACE_IN_IDAT   0x01 /* between IDAT_START and IDAT_END */
+#define PNG_TRACE_IDAT_DONE 0x02 /* IDAT_END seen, no fcTL since */
+#define PNG_TRACE_IN_FRAME  0x04 /* between FRAME_START and FRAME_END */
+
+/* Report a PNG_TRACE_ event to the trace function, which must be set.
+ * PNG_TRACE_CHUNK_START, called after a chunk header has been read, also
+ * reports PNG_TRACE_IDAT_START at the first image data chunk and
+ * PNG_TRACE_IDAT_END reports PNG_TRACE_FRAME_END if a frame was started.
+ */
+PNG_INTERNAL_FUNCTION(void, png_trace,
+   (png_struct *png_ptr, int event),
+   PNG_EMPTY);
+#  define png_read_trace(pp, event)\
+   ((pp)->trace_fn != NULL ? png_trace(pp, event) : (void)0)
+#else
+#  define png_read_trace(pp, event) ((void)0)
+#endif
+
 PNG_INTERNAL_FUNCTION(int, png_zlib_inflate,
    (png_struct *png_ptr, int flush),
    PNG_EMPTY);
@@ -1589,6 +1751,10 @@ PNG_INTERNAL_FUNCTION(void, png_write_reinit,
    (png_struct *png_ptr, png_info *info_ptr,
     png_uint_32 width, png_uint_32 height),
    PNG_EMPTY);
+/* Write the frame held back by png_write_canvas_frame: */
+PNG_INTERNAL_FUNCTION(void, png_write_canvas_pending,
+   (png_struct *png_ptr, png_info *info_ptr, png_byte dispose_op),
+   PNG_EMPTY);
 #endif /* PNG_WRITE_APNG_SUPPORTED */
 #endif /* PNG_APNG_SUPPORTED */
 
@@ -1610,6 +1776,19 @@ PNG_INTERNAL_FUNCTION(int, png_icc_check_tag_table,
     const char *name, png_uint_32 profile_length,
     const png_byte *profile /* header plus whole tag table */),
    PNG_EMPTY);
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+/* Return the profile length of a cached profile with the given compressed data
+ * or 0 if there is none, and add a profile that passed the checks above:
+ */
+PNG_INTERNAL_FUNCTION(png_uint_32, png_icc_cache_find,
+   (png_icc_cache *cache, const png_byte *data, png_uint_32 size,
+    int color_type),
+   PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void, png_icc_cache_add,
+   (png_icc_cache *cache, const png_byte *data, png_uint_32 size,
+    int color_type, png_uint_32 profile_length),
+   PNG_EMPTY);
+#endif /* READ_ICC_CACHE */
 #endif /* iCCP */
 
 #ifdef PNG_READ_RGB_TO_GRAY_SUPPORTED
@@ -2004,6 +2183,35 @@ struct png_control_def
 
    unsigned int for_write       :1; /* Otherwise it is a read structure */
    unsigned int owned_file      :1; /* We own the file in io_ptr */
+
+#if defined(PNG_SIMPLIFIED_READ_SUPPORTED) && defined(PNG_READ_APNG_SUPPORTED)
+   /* png_image_read_frame state; the dispose_* fields describe the previous
+    * frame, which is disposed of before the next one is composited.
+    */
+   png_byte   *frame_restore;       /* Canvas saved for DISPOSE_OP_PREVIOUS */
+   png_alloc_size_t frame_restore_size;
+   png_byte   *frame_rows;          /* Decoded rows for BLEND_OP_OVER */
+   png_alloc_size_t frame_rows_size;
+   png_uint_32 frame_index;         /* Next frame to be returned */
+   png_uint_32 dispose_x, dispose_y, dispose_width, dispose_height;
+   png_byte    dispose_op;
+   png_uint_32 seek_frame;          /* Set by png_image_seek_frame */
+   unsigned int frame_local_scale :1; /* Interlaced 16-to-8 bit conversion */
+   unsigned int frame_setup       :1; /* The transforms have been set */
+   unsigned int seek_pending      :1; /* seek_frame is to be read next */
+#endif
+
+#ifdef PNG_SIMPLIFIED_READ_SUPPORTED
+   /* png_image_read_rows_begin state, both allocated with png_malloc */
+   void       *read_stream;         /* See png_image_read_stream in pngread.c */
+   void       *read_buffer;         /* Row buffer, or the interlaced image */
+#endif
+
+#ifdef PNG_SIMPLIFIED_WRITE_SUPPORTED
+   /* png_image_write_begin state, both allocated with png_malloc */
+   void       *write_stream;        /* See png_image_write_stream */
+   void       *write_row;           /* Row buffer for transformed rows */
+#endif
 };
 
 /* Return the pointer to the jmp_buf from a png_control: necessary because C
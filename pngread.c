@@ -88,6 +88,24 @@ png_create_read_struct_2,(const char *user_png_ver, void *error_ptr,
    return png_ptr;
 }
 
+#ifdef PNG_USER_MEM_SUPPORTED
+/* Create a read structure that allocates everything from an arena. */
+PNG_FUNCTION(png_struct *,
+png_create_read_struct_arena,(const char *user_png_ver, void *error_ptr,
+    png_error_ptr error_fn, png_error_ptr warn_fn, void *arena,
+    size_t arena_size),
+    PNG_ALLOCATED)
+{
+   png_arena *state = png_arena_create(arena, arena_size);
+
+   if (state == NULL)
+      return NULL;
+
+   return png_arena_attach(png_create_read_struct_2(user_png_ver, error_ptr,
+       error_fn, warn_fn, state, png_arena_malloc, png_arena_free), state);
+}
+#endif /* USER_MEM */
+
 
 #ifdef PNG_SEQUENTIAL_READ_SUPPORTED
 /* Read the information before the actual image data.  This has been
@@ -253,6 +271,213 @@ png_read_frame_head(png_struct *png_ptr, png_info *info_ptr)
       }
    }
 }
+
+/* Scan the whole stream, without decompressing anything, to record where each
+ * frame starts and which frames are keyframes: those that can be drawn without
+ * decoding an earlier frame because the canvas before them is either
+ * transparent black or entirely replaced.  Chunk data other than fcTL is
+ * skipped with the seek function.  The current position is restored.
+ */
+png_uint_32 PNGAPI
+png_read_frame_index(png_struct *png_ptr, png_info *info_ptr)
+{
+   png_uint_32 count = 0, allocated = 0, i;
+   size_t saved_offset, offset;
+   int have_idat = 0;
+
+   png_debug(1, "in png_read_frame_index");
+
+   if (png_ptr == NULL || info_ptr == NULL)
+      return 0;
+
+   if (png_ptr->frame_index_size > 0)
+      return png_ptr->frame_index_size;
+
+   if (!(png_ptr->mode & PNG_HAVE_acTL))
+      png_error(png_ptr, "Cannot index APNG frames: missing acTL");
+
+   saved_offset = png_ptr->read_offset;
+   offset = 8; /* the signature */
+
+   for (;;)
+   {
+      png_byte buf[26];
+      png_uint_32 length, chunk_name;
+
+      png_read_seek(png_ptr, offset);
+      png_read_data(png_ptr, buf, 8);
+      length = png_get_uint_31(png_ptr, buf);
+      chunk_name = PNG_CHUNK_FROM_STRING(buf+4);
+
+      if (chunk_name == png_IEND)
+         break;
+
+      else if (chunk_name == png_IDAT && have_idat == 0)
+      {
+         have_idat = 1;
+         png_ptr->idat_offset = offset + 8;
+         png_ptr->idat_length = length;
+
+         if (count == 1)
+            png_ptr->frame_index[0].is_idat = 1;
+      }
+
+      else if (chunk_name == png_fcTL)
+      {
+         png_frame_index_entry *entry;
+
+         if (length != 26)
+            png_error(png_ptr, "Invalid fcTL in APNG frame index");
+
+         if (count == allocated)
+         {
+            png_frame_index_entry *old = png_ptr->frame_index;
+            png_frame_index_entry *new_index;
+
+            if (allocated >= PNG_UINT_31_MAX / 2 / (sizeof *new_index))
+               png_error(png_ptr, "Too many APNG frames");
+
+            allocated = allocated > 0 ? 2 * allocated : 16;
+            new_index = png_voidcast(png_frame_index_entry *,
+                png_malloc(png_ptr, allocated * (sizeof *new_index)));
+
+            if (count > 0)
+               memcpy(new_index, old, count * (sizeof *new_index));
+
+            png_ptr->frame_index = new_index;
+            png_free(png_ptr, old);
+         }
+
+         png_read_data(png_ptr, buf, 26);
+         entry = png_ptr->frame_index + count++;
+         entry->offset = offset;
+         entry->sequence_number = png_get_uint_31(png_ptr, buf);
+         entry->width = png_get_uint_31(png_ptr, buf + 4);
+         entry->height = png_get_uint_31(png_ptr, buf + 8);
+         entry->x_offset = png_get_uint_31(png_ptr, buf + 12);
+         entry->y_offset = png_get_uint_31(png_ptr, buf + 16);
+         entry->delay_num = png_get_uint_16(buf + 20);
+         entry->delay_den = png_get_uint_16(buf + 22);
+         entry->dispose_op = buf[24];
+         entry->blend_op = buf[25];
+         entry->is_idat = 0;
+
+         if (entry->x_offset > png_ptr->first_frame_width ||
+             entry->y_offset > png_ptr->first_frame_height ||
+             entry->width == 0 || entry->height == 0 ||
+             entry->width > png_ptr->first_frame_width - entry->x_offset ||
+             entry->height > png_ptr->first_frame_height - entry->y_offset ||
+             entry->dispose_op > PNG_fcTL_DISPOSE_OP_PREVIOUS ||
+             entry->blend_op > PNG_fcTL_BLEND_OP_OVER)
+            png_error(png_ptr, "Invalid fcTL in APNG frame index");
+      }
+
+      if (length > PNG_SIZE_MAX - 12 - offset)
+         png_error(png_ptr, "APNG stream too long to index");
+
+      offset += 12 + (size_t)length; /* header, data and CRC */
+   }
+
+   if (count == 0 || have_idat == 0)
+      png_error(png_ptr, "No APNG frames to index");
+
+   for (i = 0; i < count; ++i)
+   {
+      png_frame_index_entry *entry = png_ptr->frame_index + i;
+      int keyframe = i == 0;
+
+      if (entry->blend_op == PNG_fcTL_BLEND_OP_SOURCE &&
+          entry->width == png_ptr->first_frame_width &&
+          entry->height == png_ptr->first_frame_height)
+         keyframe = 1;
+
+      if (i > 0)
+      {
+         const png_frame_index_entry *previous = entry - 1;
+
+         /* DISPOSE_OP_PREVIOUS on the first frame means BACKGROUND. */
+         if (previous->width == png_ptr->first_frame_width &&
+             previous->height == png_ptr->first_frame_height &&
+             (previous->dispose_op == PNG_fcTL_DISPOSE_OP_BACKGROUND ||
+              (i == 1 && previous->dispose_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)))
+            keyframe = 1;
+      }
+
+      entry->keyframe = keyframe ? i : entry[-1].keyframe;
+   }
+
+   png_read_seek(png_ptr, saved_offset);
+   png_ptr->frame_index_size = count;
+
+   return count;
+}
+
+/* Position the input at the start of 'frame', counting from the first frame
+ * of the animation, so that png_read_frame_head reads it next.  Any partly
+ * read frame is abandoned.
+ */
+void PNGAPI
+png_seek_frame(png_struct *png_ptr, png_info *info_ptr, png_uint_32 frame)
+{
+   const png_frame_index_entry *entry;
+
+   png_debug1(1, "in png_seek_frame %lu", (unsigned long)frame);
+
+   if (png_ptr == NULL || info_ptr == NULL)
+      return;
+
+   if (png_read_frame_index(png_ptr, info_ptr) <= frame)
+      png_error(png_ptr, "png_seek_frame: no such frame");
+
+   entry = png_ptr->frame_index + frame;
+
+   if (png_ptr->zowner == png_IDAT)
+   {
+      png_ptr->zstream.next_in = NULL;
+      png_ptr->zstream.avail_in = 0;
+      png_ptr->zowner = 0;
+   }
+
+   png_read_reset(png_ptr);
+   png_ptr->flags &= ~PNG_FLAG_ROW_INIT;
+   png_ptr->mode &= ~(PNG_HAVE_fcTL | PNG_HAVE_IEND);
+   png_ptr->idat_size = 0;
+#ifdef PNG_READ_TRACE_SUPPORTED
+   png_ptr->trace_state = 0; /* the current frame is abandoned */
+#endif
+
+   if (entry->is_idat != 0)
+   {
+      /* png_read_frame_head does nothing for the default image, so set up the
+       * state png_read_info leaves at the first IDAT.
+       */
+      static const png_byte png_IDAT_string[4] = { 73, 68, 65, 84 };
+
+      png_set_next_frame_fcTL(png_ptr, info_ptr, entry->width, entry->height,
+          entry->x_offset, entry->y_offset, entry->delay_num, entry->delay_den,
+          entry->dispose_op, entry->blend_op);
+      png_read_reinit(png_ptr, info_ptr);
+
+      png_read_seek(png_ptr, png_ptr->idat_offset);
+      png_ptr->chunk_name = png_IDAT;
+      png_reset_crc(png_ptr);
+      png_calculate_crc(png_ptr, png_IDAT_string, 4);
+      png_ptr->idat_size = png_ptr->idat_length;
+      png_ptr->mode |= PNG_HAVE_IDAT | PNG_HAVE_fcTL;
+      png_ptr->next_seq_num = entry->sequence_number + 1;
+      png_ptr->num_frames_read = 0;
+      png_read_trace(png_ptr, PNG_TRACE_FRAME_START);
+      png_read_trace(png_ptr, PNG_TRACE_CHUNK_START);
+   }
+
+   else
+   {
+      png_read_seek(png_ptr, entry->offset);
+      png_ptr->next_seq_num = entry->sequence_number;
+      png_ptr->num_frames_read = frame +
+         ((png_ptr->apng_flags & PNG_FIRST_FRAME_HIDDEN) != 0);
+   }
+}
 #endif /* PNG_READ_APNG_SUPPORTED */
 
 /* Optional call to update the users info_ptr structure */
@@ -605,6 +830,8 @@ png_read_row(png_struct *png_ptr, png_byte *row, png_byte *dsp_row)
       if (dsp_row != NULL)
          png_combine_row(png_ptr, dsp_row, -1/*ignored*/);
    }
+
+   png_read_trace(png_ptr, PNG_TRACE_ROW);
    png_read_finish_row(png_ptr);
 
    if (png_ptr->read_row_fn != NULL)
@@ -860,6 +1087,17 @@ png_read_destroy(png_struct *png_ptr)
    png_free(png_ptr, png_ptr->read_buffer);
    png_ptr->read_buffer = NULL;
 
+#ifdef PNG_READ_AHEAD_SUPPORTED
+   png_free(png_ptr, png_ptr->read_ahead);
+   png_ptr->read_ahead = NULL;
+#endif
+
+#ifdef PNG_READ_APNG_SUPPORTED
+   png_free(png_ptr, png_ptr->frame_index);
+   png_ptr->frame_index = NULL;
+   png_ptr->frame_index_size = 0;
+#endif
+
 #ifdef PNG_READ_QUANTIZE_SUPPORTED
    png_free(png_ptr, png_ptr->palette_lookup);
    png_ptr->palette_lookup = NULL;
@@ -948,6 +1186,27 @@ png_set_read_status_fn(png_struct *png_ptr, png_read_status_ptr read_row_fn)
    png_ptr->read_row_fn = read_row_fn;
 }
 
+#ifdef PNG_READ_TRACE_SUPPORTED
+void
+png_set_trace_fn(png_struct *png_ptr, void *trace_ptr, png_trace_ptr trace_fn)
+{
+   if (png_ptr == NULL)
+      return;
+
+   png_ptr->trace_fn = trace_fn;
+   png_ptr->trace_ptr = trace_ptr;
+}
+
+void *
+png_get_trace_ptr(const png_struct *png_ptr)
+{
+   if (png_ptr == NULL)
+      return NULL;
+
+   return png_ptr->trace_ptr;
+}
+#endif /* READ_TRACE */
+
 
 #ifdef PNG_SEQUENTIAL_READ_SUPPORTED
 #ifdef PNG_INFO_IMAGE_SUPPORTED
@@ -1188,6 +1447,16 @@ png_read_png(png_struct *png_ptr, png_info *info_ptr,
 #define PNG_CMAP_RGB_BACKGROUND       256
 #define PNG_CMAP_RGB_ALPHA_BACKGROUND 216
 
+/* The row processing, if any, done by the simplified API after libpng has
+ * transformed a row; png_image_read_rows_internal uses this to select one of
+ * the routines below.
+ */
+#define PNG_LOCAL_NONE       0 /* libpng reads the rows into the output */
+#define PNG_LOCAL_MAP        1 /* png_image_read_and_map */
+#define PNG_LOCAL_COMPOSE    2 /* png_image_read_composite */
+#define PNG_LOCAL_BACKGROUND 3 /* png_image_read_background */
+#define PNG_LOCAL_SCALE      4 /* png_image_read_direct_scaled */
+
 typedef struct
 {
    /* Arguments */
@@ -1201,9 +1470,15 @@ typedef struct
    void *local_row;
    void *first_row;
    ptrdiff_t row_step;              /* step between rows */
+   png_uint_32 row_count;           /* rows to read to first_row */
+   int passes;                      /* rows are read passes*row_count times */
+   int local_processing;            /* PNG_LOCAL_ values below */
    int file_encoding;               /* E_ values above */
    png_fixed_point gamma_to_linear; /* For P_FILE, reciprocal of gamma */
    int colormap_processing;         /* PNG_CMAP_ values above */
+#ifdef PNG_READ_APNG_SUPPORTED
+   png_image_frame *frame;          /* png_image_read_frame result */
+#endif
 } png_image_read_control;
 
 /* Do all the *safe* initialization - 'safe' means that png_error won't be
@@ -1519,6 +1794,24 @@ png_image_memory_read(png_struct *png_ptr, png_byte *out, size_t need)
    }
 }
 
+#ifdef PNG_READ_SEEK_SUPPORTED
+static int
+png_image_memory_seek(png_struct *png_ptr, size_t offset)
+{
+   png_image *image = png_voidcast(png_image *, png_ptr->io_ptr);
+   png_control *cp = image->opaque;
+   size_t end = png_ptr->read_offset + cp->size;
+
+   if (offset > end)
+      return 0;
+
+   /* cp->memory is read_offset bytes from the start of the PNG. */
+   cp->memory = cp->memory - png_ptr->read_offset + offset;
+   cp->size = end - offset;
+   return 1;
+}
+#endif
+
 int png_image_begin_read_from_memory(png_image *image,
     const void *memory, size_t size)
 {
@@ -1536,6 +1829,9 @@ int png_image_begin_read_from_memory(png_image *image,
             image->opaque->size = size;
             image->opaque->png_ptr->io_ptr = image;
             image->opaque->png_ptr->read_data_fn = png_image_memory_read;
+#ifdef PNG_READ_SEEK_SUPPORTED
+            image->opaque->png_ptr->seek_data_fn = png_image_memory_seek;
+#endif
 
             return png_safe_execute(image, png_image_read_header, image);
          }
@@ -2924,7 +3220,7 @@ png_image_read_and_map(void *argument)
    }
 
    {
-      png_uint_32 height = image->height;
+      png_uint_32 height = display->row_count;
       png_uint_32 width = image->width;
       int proc = display->colormap_processing;
       png_byte *first_row = png_voidcast(png_byte *, display->first_row);
@@ -3085,11 +3381,13 @@ png_image_read_and_map(void *argument)
    return 1;
 }
 
-static int
-png_image_read_colormapped(void *argument)
+/* Set up the transforms for a color-mapped read, after png_image_read_colormap
+ * has built the color-map, and check the result.  This sets display->passes and
+ * display->local_processing for png_image_read_rows_internal.
+ */
+static void
+png_image_set_colormapped_transforms(png_image_read_control *display)
 {
-   png_image_read_control *display = png_voidcast(png_image_read_control*,
-       argument);
    png_image *image = display->image;
    png_control *control = image->opaque;
    png_struct *png_ptr = control->png_ptr;
@@ -3161,58 +3459,16 @@ png_image_read_colormapped(void *argument)
          png_error(png_ptr, "bad color-map processing (internal error)");
    }
 
-   /* Now read the rows.  Do this here if it is possible to read directly into
-    * the output buffer, otherwise allocate a local row buffer of the maximum
-    * size libpng requires and call the relevant processing routine safely.
-    */
-   {
-      void *first_row = display->buffer;
-      ptrdiff_t row_step = display->row_stride;
-
-      /* The following adjustment is to ensure that calculations are correct,
-       * regardless whether row_step is positive or negative.
-       */
-      if (row_step < 0)
-      {
-         char *ptr = png_voidcast(char*, first_row);
-         ptr += (image->height-1) * (-row_step);
-         first_row = png_voidcast(void *, ptr);
-      }
-
-      display->first_row = first_row;
-      display->row_step = row_step;
-   }
-
    if (passes == 0)
    {
-      int result;
-      void *row = png_malloc(png_ptr, png_get_rowbytes(png_ptr, info_ptr));
-
-      display->local_row = row;
-      result = png_safe_execute(image, png_image_read_and_map, display);
-      display->local_row = NULL;
-      png_free(png_ptr, row);
-
-      return result;
+      display->passes = 1;
+      display->local_processing = PNG_LOCAL_MAP;
    }
 
    else
    {
-      ptrdiff_t row_step = display->row_step;
-
-      while (--passes >= 0)
-      {
-         png_uint_32 y = image->height;
-         png_byte *row = png_voidcast(png_byte *, display->first_row);
-
-         for (; y > 0; --y)
-         {
-            png_read_row(png_ptr, row, NULL);
-            row += row_step;
-         }
-      }
-
-      return 1;
+      display->passes = passes;
+      display->local_processing = PNG_LOCAL_NONE;
    }
 }
 
@@ -3249,7 +3505,7 @@ png_image_read_direct_scaled(void *argument)
    /* Read each pass using local_row as intermediate buffer. */
    while (--passes >= 0)
    {
-      png_uint_32 y = image->height;
+      png_uint_32 y = display->row_count;
       png_byte *output_row = first_row;
 
       for (; y > 0; --y)
@@ -3296,7 +3552,7 @@ png_image_read_composite(void *argument)
    }
 
    {
-      png_uint_32 height = image->height;
+      png_uint_32 height = display->row_count;
       png_uint_32 width = image->width;
       ptrdiff_t row_step = display->row_step;
       unsigned int channels =
@@ -3342,67 +3598,107 @@ png_image_read_composite(void *argument)
             outrow += y * row_step;
             row_end = outrow + width * channels;
 
-            /* Now do the composition on each pixel in this row. */
+            /* Now do the composition on each pixel in this row.  Opaque and
+             * transparent pixels, usually most of them, need no arithmetic so
+             * they are dealt with first; the choice of composition is made
+             * once per row, not per component.
+             */
             outrow += startx;
-            for (; outrow < row_end; outrow += stepx)
+            if (optimize_alpha != 0)
             {
-               png_byte alpha = inrow[channels];
-
-               if (alpha > 0) /* else no change to the output */
+               for (; outrow < row_end; outrow += stepx, inrow += channels+1)
                {
+                  png_uint_32 alpha = inrow[channels];
+                  png_uint_32 back;
                   unsigned int c;
 
-                  for (c=0; c<channels; ++c)
+                  if (alpha == 255)
                   {
-                     png_uint_32 component = inrow[c];
+                     outrow[0] = inrow[0];
 
-                     if (alpha < 255) /* else just use component */
+                     if (channels == 3)
                      {
-                        if (optimize_alpha != 0)
-                        {
-                           /* This is PNG_OPTIMIZED_ALPHA, the component value
-                            * is a linear 8-bit value.  Combine this with the
-                            * current outrow[c] value which is sRGB encoded.
-                            * Arithmetic here is 16-bits to preserve the output
-                            * values correctly.
-                            */
-                           component *= 257*255; /* =65535 */
-                           component += (255-alpha)*png_sRGB_table[outrow[c]];
+                        outrow[1] = inrow[1];
+                        outrow[2] = inrow[2];
+                     }
 
-                           /* Clamp to the valid range to defend against
-                            * unforeseen cases where the data might be sRGB
-                            * instead of linear premultiplied.
-                            * (Belt-and-suspenders for CVE-2025-66293.)
-                            */
-                           if (component > 255*65535)
-                              component = 255*65535;
+                     continue;
+                  }
 
-                           /* So 'component' is scaled by 255*65535 and is
-                            * therefore appropriate for the sRGB-to-linear
-                            * conversion table.
-                            */
-                           component = PNG_sRGB_FROM_LINEAR(component);
-                        }
-                        else
-                        {
-                           /* Compositing was already done on the palette
-                            * entries.  The data is sRGB premultiplied on black.
-                            * Composite with the background in sRGB space.
-                            * This is not gamma-correct, but matches what was
-                            * done to the palette.
-                            */
-                           png_uint_32 background = outrow[c];
-                           component += ((255-alpha) * background + 127) / 255;
-                           if (component > 255)
-                              component = 255;
-                        }
+                  if (alpha == 0) /* no change to the output */
+                     continue;
+
+                  back = 255-alpha;
+
+                  for (c=0; c<channels; ++c)
+                  {
+                     /* This is PNG_OPTIMIZED_ALPHA, the component value is a
+                      * linear 8-bit value.  Combine this with the current
+                      * outrow[c] value which is sRGB encoded.  Arithmetic here
+                      * is 16-bits to preserve the output values correctly.
+                      */
+                     png_uint_32 component = inrow[c] * (257*255) +
+                        back * png_sRGB_table[outrow[c]];
+
+                     /* Clamp to the valid range to defend against unforeseen
+                      * cases where the data might be sRGB instead of linear
+                      * premultiplied.
+                      * (Belt-and-suspenders for CVE-2025-66293.)
+                      */
+                     if (component > 255*65535)
+                        component = 255*65535;
+
+                     /* So 'component' is scaled by 255*65535 and is therefore
+                      * appropriate for the sRGB-to-linear conversion table.
+                      */
+                     outrow[c] = (png_byte)PNG_sRGB_FROM_LINEAR(component);
+                  }
+               }
+            }
+
+            else
+            {
+               for (; outrow < row_end; outrow += stepx, inrow += channels+1)
+               {
+                  png_uint_32 alpha = inrow[channels];
+                  png_uint_32 back;
+                  unsigned int c;
+
+                  if (alpha == 255)
+                  {
+                     outrow[0] = inrow[0];
+
+                     if (channels == 3)
+                     {
+                        outrow[1] = inrow[1];
+                        outrow[2] = inrow[2];
                      }
 
+                     continue;
+                  }
+
+                  if (alpha == 0) /* no change to the output */
+                     continue;
+
+                  back = 255-alpha;
+
+                  for (c=0; c<channels; ++c)
+                  {
+                     /* Compositing was already done on the palette entries.
+                      * The data is sRGB premultiplied on black.  Composite
+                      * with the background in sRGB space.  This is not
+                      * gamma-correct, but matches what was done to the
+                      * palette.
+                      */
+                     png_uint_32 component = inrow[c] +
+                        (back * outrow[c] + 127) / 255;
+
+                     if (component > 255)
+                        component = 255;
+
                      outrow[c] = (png_byte)component;
                   }
                }
-
-               inrow += channels+1; /* components and alpha channel */
             }
          }
       }
@@ -3432,7 +3728,7 @@ png_image_read_background(void *argument)
    png_image *image = display->image;
    png_struct *png_ptr = image->opaque->png_ptr;
    png_info *info_ptr = image->opaque->info_ptr;
-   png_uint_32 height = image->height;
+   png_uint_32 height = display->row_count;
    png_uint_32 width = image->width;
    int pass, passes;
 
@@ -3700,12 +3996,16 @@ png_image_read_background(void *argument)
    return 1;
 }
 
-/* The guts of png_image_finish_read as a png_safe_execute callback. */
+/* Set up the transforms required to produce image->format from the PNG data,
+ * call png_read_update_info and check that the result is as required.  The
+ * return value is the number of passes to read; the out parameters say which of
+ * the local (non-libpng) row processing steps below the caller must perform.
+ */
 static int
-png_image_read_direct(void *argument)
+png_image_set_direct_transforms(png_image_read_control *display,
+    int *do_local_compose_ptr, int *do_local_background_ptr,
+    int *do_local_scale_ptr)
 {
-   png_image_read_control *display = png_voidcast(png_image_read_control*,
-       argument);
    png_image *image = display->image;
    png_struct *png_ptr = image->opaque->png_ptr;
    png_info *info_ptr = image->opaque->info_ptr;
@@ -4081,70 +4381,122 @@ png_image_read_direct(void *argument)
          png_error(png_ptr, "png_read_image: invalid transformations");
    }
 
-   /* Now read the rows.  If do_local_compose is set then it is necessary to use
-    * a local row buffer.  The output will be GA, RGBA or BGRA and must be
-    * converted to G, RGB or BGR as appropriate.  The 'local_row' member of the
-    * display acts as a flag.
+   *do_local_compose_ptr = do_local_compose;
+   *do_local_background_ptr = do_local_background;
+   *do_local_scale_ptr = do_local_scale;
+
+   return passes;
+}
+
+/* Select the row processing for a direct (not color-mapped) read. */
+static void
+png_image_set_direct_processing(png_image_read_control *display)
+{
+   int do_local_compose;
+   int do_local_background;
+   int do_local_scale;
+
+   display->passes = png_image_set_direct_transforms(display, &do_local_compose,
+       &do_local_background, &do_local_scale);
+
+   /* If do_local_compose is set then it is necessary to use a local row
+    * buffer.  The output will be GA, RGBA or BGRA and must be converted to G,
+    * RGB or BGR as appropriate.
+    */
+   if (do_local_compose != 0)
+      display->local_processing = PNG_LOCAL_COMPOSE;
+
+   else if (do_local_background == 2)
+      display->local_processing = PNG_LOCAL_BACKGROUND;
+
+   /* For interlaced 16-to-8 conversion, use an intermediate row buffer to
+    * avoid buffer overflows in png_combine_row. The local_row is sized for the
+    * transformed (8-bit) output, preventing the overflow that would occur if
+    * png_combine_row wrote 16-bit data directly to the user buffer.
+    */
+   else if (do_local_scale != 0)
+      display->local_processing = PNG_LOCAL_SCALE;
+
+   else
+      display->local_processing = PNG_LOCAL_NONE;
+}
+
+/* Set display->first_row and display->row_step from the png_image_finish_read
+ * arguments, where a negative row_stride means that the top row is the last
+ * one in 'buffer'.
+ */
+static void
+png_image_set_first_row(png_image_read_control *display)
+{
+   png_image *image = display->image;
+   void *first_row = display->buffer;
+   ptrdiff_t row_step = display->row_stride;
+
+   if ((image->format & (PNG_FORMAT_FLAG_COLORMAP | PNG_FORMAT_FLAG_LINEAR)) ==
+       PNG_FORMAT_FLAG_LINEAR)
+      row_step *= 2;
+
+   /* The following adjustment is to ensure that calculations are correct,
+    * regardless whether row_step is positive or negative.
     */
+   if (row_step < 0)
    {
-      void *first_row = display->buffer;
-      ptrdiff_t row_step = display->row_stride;
+      char *ptr = png_voidcast(char*, first_row);
+      ptr += (display->row_count - 1) * (-row_step);
+      first_row = png_voidcast(void *, ptr);
+   }
 
-      if (linear != 0)
-         row_step *= 2;
+   display->first_row = first_row;
+   display->row_step = row_step;
+}
 
-      /* The following adjustment is to ensure that calculations are correct,
-       * regardless whether row_step is positive or negative.
-       */
-      if (row_step < 0)
-      {
-         char *ptr = png_voidcast(char*, first_row);
-         ptr += (image->height - 1) * (-row_step);
-         first_row = png_voidcast(void *, ptr);
-      }
+/* Read the next display->row_count rows of each pass to display->first_row.
+ * Local processing needs a row buffer of the maximum size libpng requires;
+ * display->local_row is used if set, otherwise one is allocated here.
+ */
+static int
+png_image_read_rows_internal(png_image_read_control *display)
+{
+   png_image *image = display->image;
+   png_struct *png_ptr = image->opaque->png_ptr;
+   int (*row_fn)(void *);
+
+   switch (display->local_processing)
+   {
+      case PNG_LOCAL_MAP:
+         row_fn = png_image_read_and_map;
+         break;
+
+      case PNG_LOCAL_COMPOSE:
+         row_fn = png_image_read_composite;
+         break;
+
+      case PNG_LOCAL_BACKGROUND:
+         row_fn = png_image_read_background;
+         break;
 
-      display->first_row = first_row;
-      display->row_step = row_step;
+      case PNG_LOCAL_SCALE:
+         row_fn = png_image_read_direct_scaled;
+         break;
+
+      default:
+         row_fn = NULL;
+         break;
    }
 
-   if (do_local_compose != 0)
+   if (row_fn != NULL)
    {
       int result;
-      void *row = png_malloc(png_ptr, png_get_rowbytes(png_ptr, info_ptr));
+      void *row;
+
+      if (display->local_row != NULL)
+         return png_safe_execute(image, row_fn, display);
+
+      row = png_malloc(png_ptr, png_get_rowbytes(png_ptr,
+          image->opaque->info_ptr));
 
       display->local_row = row;
-      result = png_safe_execute(image, png_image_read_composite, display);
-      display->local_row = NULL;
-      png_free(png_ptr, row);
-
-      return result;
-   }
-
-   else if (do_local_background == 2)
-   {
-      int result;
-      void *row = png_malloc(png_ptr, png_get_rowbytes(png_ptr, info_ptr));
-
-      display->local_row = row;
-      result = png_safe_execute(image, png_image_read_background, display);
-      display->local_row = NULL;
-      png_free(png_ptr, row);
-
-      return result;
-   }
-
-   else if (do_local_scale != 0)
-   {
-      /* For interlaced 16-to-8 conversion, use an intermediate row buffer
-       * to avoid buffer overflows in png_combine_row. The local_row is sized
-       * for the transformed (8-bit) output, preventing the overflow that would
-       * occur if png_combine_row wrote 16-bit data directly to the user buffer.
-       */
-      int result;
-      void *row = png_malloc(png_ptr, png_get_rowbytes(png_ptr, info_ptr));
-
-      display->local_row = row;
-      result = png_safe_execute(image, png_image_read_direct_scaled, display);
+      result = png_safe_execute(image, row_fn, display);
       display->local_row = NULL;
       png_free(png_ptr, row);
 
@@ -4154,10 +4506,11 @@ png_image_read_direct(void *argument)
    else
    {
       ptrdiff_t row_step = display->row_step;
+      int passes = display->passes;
 
       while (--passes >= 0)
       {
-         png_uint_32 y = image->height;
+         png_uint_32 y = display->row_count;
          png_byte *row = png_voidcast(png_byte *, display->first_row);
 
          for (; y > 0; --y)
@@ -4171,6 +4524,32 @@ png_image_read_direct(void *argument)
    }
 }
 
+/* The rows of a color-mapped png_image_finish_read. */
+static int
+png_image_read_colormapped(void *argument)
+{
+   png_image_read_control *display = png_voidcast(png_image_read_control*,
+       argument);
+
+   png_image_set_colormapped_transforms(display);
+   png_image_set_first_row(display);
+
+   return png_image_read_rows_internal(display);
+}
+
+/* The guts of png_image_finish_read as a png_safe_execute callback. */
+static int
+png_image_read_direct(void *argument)
+{
+   png_image_read_control *display = png_voidcast(png_image_read_control*,
+       argument);
+
+   png_image_set_direct_processing(display);
+   png_image_set_first_row(display);
+
+   return png_image_read_rows_internal(display);
+}
+
 int
 png_image_finish_read(png_image *image, const png_color *background,
     void *buffer, png_int_32 row_stride, void *colormap)
@@ -4241,6 +4620,7 @@ png_image_finish_read(png_image *image, const png_color *background,
                   display.colormap = colormap;
                   display.background = background;
                   display.local_row = NULL;
+                  display.row_count = image->height;
 
                   /* Choose the correct 'end' routine; for the color-map case
                    * all the setup has already been done.
@@ -4288,5 +4668,817 @@ png_image_finish_read(png_image *image, const png_color *background,
    return 0;
 }
 
+/* State kept in png_control::read_stream between png_image_read_rows_begin and
+ * the png_image_read_rows call that returns the last row.
+ */
+typedef struct
+{
+   png_image_read_control display;
+   png_color background;       /* From png_image_read_rows_begin */
+   png_uint_32 rows_read;
+   size_t row_bytes;           /* Bytes in one output row */
+   int interlaced;             /* control->read_buffer holds the whole image */
+} png_image_read_stream;
+
+static int
+png_image_read_rows_begin_function(void *argument)
+{
+   png_image_read_stream *stream = png_voidcast(png_image_read_stream*,
+       argument);
+   png_image_read_control *display = &stream->display;
+   png_image *image = display->image;
+   png_control *control = image->opaque;
+   png_struct *png_ptr = control->png_ptr;
+
+   if (image->width > 0x7fffffffU/PNG_IMAGE_PIXEL_CHANNELS(image->format))
+      png_error(png_ptr, "image row stride too large");
+
+   stream->row_bytes = PNG_IMAGE_PIXEL_SIZE(image->format) *
+      (size_t)image->width;
+
+   if ((image->format & PNG_FORMAT_FLAG_COLORMAP) != 0)
+   {
+      if (png_image_read_colormap(display) == 0)
+         return 0;
+
+      png_image_set_colormapped_transforms(display);
+   }
+
+   else
+      png_image_set_direct_processing(display);
+
+   /* The rows of an interlaced image are not complete until the last pass has
+    * been read, so such an image is decoded in full here and the rows are
+    * returned from the copy.
+    */
+   if (png_ptr->interlaced != PNG_INTERLACE_NONE)
+   {
+      if (image->height > PNG_SIZE_MAX/stream->row_bytes)
+         png_error(png_ptr, "image too large");
+
+      control->read_buffer = png_malloc(png_ptr,
+          image->height * stream->row_bytes);
+      memset(control->read_buffer, 0, image->height * stream->row_bytes);
+
+      stream->interlaced = 1;
+      display->first_row = control->read_buffer;
+      display->row_step = (ptrdiff_t)/*SAFE*/stream->row_bytes;
+      display->row_count = image->height;
+
+      return png_image_read_rows_internal(display);
+   }
+
+   /* Otherwise only the local processing row buffer is required. */
+   if (display->local_processing != PNG_LOCAL_NONE)
+   {
+      control->read_buffer = png_malloc(png_ptr,
+          png_get_rowbytes(png_ptr, control->info_ptr));
+      display->local_row = control->read_buffer;
+   }
+
+   return 1;
+}
+
+int
+png_image_read_rows_begin(png_image *image, const png_color *background,
+    void *colormap)
+{
+   /* Set up the transforms and prepare to return rows. */
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      if (image->opaque != NULL && image->opaque->read_stream == NULL)
+      {
+         if ((image->format & PNG_FORMAT_FLAG_COLORMAP) == 0 ||
+            (image->colormap_entries > 0 && colormap != NULL))
+         {
+            png_control *control = image->opaque;
+            png_image_read_stream *stream =
+               png_voidcast(png_image_read_stream*,
+                  png_malloc_warn(control->png_ptr, (sizeof *stream)));
+
+            if (stream == NULL)
+               return png_image_error(image,
+                   "png_image_read_rows_begin: out of memory");
+
+            memset(stream, 0, (sizeof *stream));
+            control->read_stream = stream;
+            stream->display.image = image;
+            stream->display.colormap = colormap;
+
+            if (background != NULL)
+            {
+               stream->background = *background;
+               stream->display.background = &stream->background;
+            }
+
+            return png_safe_execute(image, png_image_read_rows_begin_function,
+                stream);
+         }
+
+         else
+            return png_image_error(image,
+                "png_image_read_rows_begin[color-map]: no color-map");
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_read_rows_begin: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_read_rows_begin: damaged PNG_IMAGE_VERSION");
+
+   return 0;
+}
+
+static int
+png_image_read_rows_function(void *argument)
+{
+   png_image_read_stream *stream = png_voidcast(png_image_read_stream*,
+       argument);
+   png_image_read_control *display = &stream->display;
+
+   if (stream->interlaced != 0)
+   {
+      const png_byte *in = png_voidcast(const png_byte *,
+          display->image->opaque->read_buffer);
+      png_byte *out = png_voidcast(png_byte *, display->first_row);
+      png_uint_32 y = display->row_count;
+
+      in += stream->rows_read * stream->row_bytes;
+
+      for (; y > 0; --y)
+      {
+         memcpy(out, in, stream->row_bytes);
+         in += stream->row_bytes;
+         out += display->row_step;
+      }
+
+      return 1;
+   }
+
+   return png_image_read_rows_internal(display);
+}
+
+int
+png_image_read_rows(png_image *image, void *buffer, png_int_32 row_stride,
+    png_uint_32 count)
+{
+   /* Read the next 'count' rows, buffer is the first (top) row. */
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      png_image_read_stream *stream = image->opaque != NULL ?
+         png_voidcast(png_image_read_stream*, image->opaque->read_stream) :
+         NULL;
+
+      if (stream != NULL && buffer != NULL)
+      {
+         png_image_read_control *display = &stream->display;
+         png_uint_32 png_row_stride =
+            image->width * PNG_IMAGE_PIXEL_CHANNELS(image->format);
+         png_uint_32 check;
+
+         if (row_stride == 0)
+            row_stride = (png_int_32)/*SAFE*/png_row_stride;
+
+         if (row_stride < 0)
+            check = -(png_uint_32)row_stride;
+
+         else
+            check = (png_uint_32)row_stride;
+
+         if (check < png_row_stride)
+            return png_image_error(image,
+                "png_image_read_rows: supplied row stride too small");
+
+         if (count > image->height - stream->rows_read)
+            return png_image_error(image,
+                "png_image_read_rows: too many rows");
+
+         display->first_row = buffer;
+         display->row_step = row_stride;
+         display->row_count = count;
+
+         if ((image->format & (PNG_FORMAT_FLAG_COLORMAP |
+             PNG_FORMAT_FLAG_LINEAR)) == PNG_FORMAT_FLAG_LINEAR)
+            display->row_step *= 2;
+
+         if (png_safe_execute(image, png_image_read_rows_function, stream))
+         {
+            stream->rows_read += count;
+
+            /* As png_image_finish_read the image is freed after the last
+             * row.
+             */
+            if (stream->rows_read == image->height)
+               png_image_free(image);
+
+            return 1;
+         }
+
+         return 0;
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_read_rows: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_read_rows: damaged PNG_IMAGE_VERSION");
+
+   return 0;
+}
+
+static int
+png_image_validate_function(void *argument)
+{
+   png_image *image = png_voidcast(png_image *, argument);
+   png_struct *png_ptr = image->opaque->png_ptr;
+
+   /* png_image_read_header allowed these; the rest of the PNG must be right.
+    * By default a CRC error in an ancillary chunk, or IEND, is only a warning.
+    */
+#ifdef PNG_BENIGN_ERRORS_SUPPORTED
+   png_set_benign_errors(png_ptr, 0/*error*/);
+#endif
+   png_set_crc_action(png_ptr, PNG_CRC_ERROR_QUIT, PNG_CRC_ERROR_QUIT);
+
+   /* With no transformations set this just sets up the row buffers for the
+    * first pass and claims the zstream.
+    */
+   if ((png_ptr->flags & PNG_FLAG_ROW_INIT) == 0)
+      png_read_start_row(png_ptr);
+
+   /* Inflate each row, including the rows of each interlace pass, into the
+    * row buffer and check the filter byte; png_read_finish_row checks the end
+    * of the zlib stream and releases it after the last row.
+    */
+   do
+   {
+      size_t row_bytes = PNG_ROWBYTES(png_ptr->pixel_depth, png_ptr->iwidth);
+
+      png_ptr->row_buf[0] = 255; /* to force error if no data was found */
+      png_read_IDAT_data(png_ptr, png_ptr->row_buf, row_bytes + 1);
+
+      if (png_ptr->row_buf[0] >= PNG_FILTER_VALUE_LAST)
+         png_error(png_ptr, "bad adaptive filter value");
+
+      png_read_finish_row(png_ptr);
+   }
+   while (png_ptr->zowner == png_IDAT);
+
+   /* Check the chunks after the image data up to and including IEND; the
+    * info_ptr is not needed.
+    */
+   png_read_end(png_ptr, NULL);
+
+   return 1;
+}
+
+int
+png_image_validate(png_image *image)
+{
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      if (image->opaque != NULL && image->opaque->read_stream == NULL)
+      {
+         int result = png_safe_execute(image, png_image_validate_function,
+             image);
+
+         png_image_free(image);
+         return result;
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_validate: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_validate: damaged PNG_IMAGE_VERSION");
+
+   return 0;
+}
+
+#ifdef PNG_READ_APNG_SUPPORTED
+/* APNG frame compositing for png_image_read_frame.  The canvas is the
+ * application buffer and the format always has 8-bit, non-premultiplied alpha,
+ * so BLEND_OP_OVER is performed directly on the encoded values as described in
+ * the APNG specification.
+ */
+static void
+png_image_blend_row(png_byte *dp, const png_byte *sp, png_uint_32 width,
+    unsigned int channels, unsigned int alpha)
+{
+   while (width > 0)
+   {
+      png_uint_32 run = 0;
+
+      /* Sprite-like frames are mostly runs of opaque or fully transparent
+       * pixels; copy the former with one memcpy and skip the latter.
+       */
+      while (run < width && sp[run * channels + alpha] == 255)
+         ++run;
+
+      if (run > 0)
+         memcpy(dp, sp, run * channels);
+
+      else
+      {
+         while (run < width && sp[run * channels + alpha] == 0)
+            ++run;
+
+         if (run == 0)
+         {
+            /* 0 < source alpha < 255, so 'a' cannot be zero. */
+            png_uint_32 u = sp[alpha] * 255U;
+            png_uint_32 v = (255U - sp[alpha]) * dp[alpha];
+            png_uint_32 a = u + v;
+            unsigned int c;
+
+            for (c = 0; c < channels; ++c)
+            {
+               if (c != alpha)
+                  dp[c] = (png_byte)((sp[c] * u + dp[c] * v + (a >> 1)) / a);
+            }
+
+            dp[alpha] = (png_byte)((a + 127U) / 255U);
+            run = 1;
+         }
+      }
+
+      dp += run * channels;
+      sp += run * channels;
+      width -= run;
+   }
+}
+
+/* Return the address of pixel (x,y) of the canvas. */
+static png_byte *
+png_image_canvas_pixel(const png_image_read_control *display, png_uint_32 x,
+    png_uint_32 y)
+{
+   png_byte *row = png_voidcast(png_byte *, display->first_row);
+
+   return row + (ptrdiff_t)y * display->row_step +
+      (size_t)x * PNG_IMAGE_PIXEL_CHANNELS(display->image->format);
+}
+
+#define PNG_CANVAS_CLEAR   0 /* to transparent black */
+#define PNG_CANVAS_SAVE    1 /* to 'buffer' */
+#define PNG_CANVAS_RESTORE 2 /* from 'buffer' */
+
+static void
+png_image_canvas_region(const png_image_read_control *display, int op,
+    png_byte *buffer, png_uint_32 x, png_uint_32 y, png_uint_32 width,
+    png_uint_32 height)
+{
+   png_byte *row = png_image_canvas_pixel(display, x, y);
+   size_t row_bytes =
+      (size_t)width * PNG_IMAGE_PIXEL_CHANNELS(display->image->format);
+
+   for (; height > 0; --height)
+   {
+      switch (op)
+      {
+         case PNG_CANVAS_CLEAR:
+            memset(row, 0, row_bytes);
+            break;
+
+         case PNG_CANVAS_SAVE:
+            memcpy(buffer, row, row_bytes);
+            break;
+
+         default:
+            memcpy(row, buffer, row_bytes);
+            break;
+      }
+
+      row += display->row_step;
+      buffer += row_bytes; /* unused for PNG_CANVAS_CLEAR */
+   }
+}
+
+/* Return a buffer of at least 'size' bytes, reusing *buffer if possible. */
+static png_byte *
+png_image_frame_buffer(png_struct *png_ptr, png_byte **buffer,
+    png_alloc_size_t *buffer_size, png_alloc_size_t size)
+{
+   if (*buffer == NULL || *buffer_size < size)
+   {
+      png_byte *old = *buffer;
+
+      *buffer = NULL;
+      *buffer_size = 0;
+      png_free(png_ptr, old);
+      *buffer = png_voidcast(png_byte *, png_malloc(png_ptr, size));
+      *buffer_size = size;
+   }
+
+   return *buffer;
+}
+
+/* Apply the dispose_op of the previous frame. */
+static void
+png_image_dispose_frame(const png_image_read_control *display)
+{
+   png_control *control = display->image->opaque;
+
+   if (control->dispose_op == PNG_fcTL_DISPOSE_OP_BACKGROUND)
+      png_image_canvas_region(display, PNG_CANVAS_CLEAR, NULL,
+          control->dispose_x, control->dispose_y, control->dispose_width,
+          control->dispose_height);
+
+   else if (control->dispose_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)
+      png_image_canvas_region(display, PNG_CANVAS_RESTORE,
+          control->frame_restore, control->dispose_x, control->dispose_y,
+          control->dispose_width, control->dispose_height);
+
+   control->dispose_op = PNG_fcTL_DISPOSE_OP_NONE;
+}
+
+/* Read frame control->frame_index and composite it onto the canvas. */
+static void
+png_image_composite_frame(png_image_read_control *display)
+{
+   png_image *image = display->image;
+   png_control *control = image->opaque;
+   png_struct *png_ptr = control->png_ptr;
+   png_info *info_ptr = control->info_ptr;
+   unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(image->format);
+   unsigned int alpha =
+      (image->format & PNG_FORMAT_FLAG_AFIRST) != 0 ? 0 : channels - 1;
+   int animated = png_get_valid(png_ptr, info_ptr, PNG_INFO_acTL) != 0;
+   png_uint_32 x = 0, y = 0, width = image->width, height = image->height;
+   png_uint_16 delay_num = 0, delay_den = 0;
+   png_byte dispose_op = PNG_fcTL_DISPOSE_OP_NONE;
+   png_byte blend_op = PNG_fcTL_BLEND_OP_SOURCE;
+   size_t row_bytes;
+   int passes = png_set_interlace_handling(png_ptr);
+
+   if (animated)
+   {
+      png_read_frame_head(png_ptr, info_ptr);
+
+      if (png_get_valid(png_ptr, info_ptr, PNG_INFO_fcTL) != 0)
+         png_get_next_frame_fcTL(png_ptr, info_ptr, &width, &height, &x, &y,
+             &delay_num, &delay_den, &dispose_op, &blend_op);
+   }
+
+   if (width > image->width || x > image->width - width ||
+       height > image->height || y > image->height - height)
+      png_error(png_ptr, "png_image_read_frame: frame outside image");
+
+   row_bytes = (size_t)width * channels;
+
+   if (png_get_rowbytes(png_ptr, info_ptr) != row_bytes)
+      png_error(png_ptr, "png_image_read_frame: invalid transformations");
+
+   /* Dispose of the previous frame; this is deferred to here so that the
+    * canvas returned to the application always holds a complete frame.
+    */
+   if (control->frame_index > 0)
+      png_image_dispose_frame(display);
+
+   else
+   {
+      /* The canvas starts as transparent black, so OVER is the same as SOURCE
+       * and there is nothing to go back to for DISPOSE_OP_PREVIOUS.
+       */
+      if (x != 0 || y != 0 || width != image->width || height != image->height)
+         png_image_canvas_region(display, PNG_CANVAS_CLEAR, NULL, 0, 0,
+             image->width, image->height);
+
+      blend_op = PNG_fcTL_BLEND_OP_SOURCE;
+
+      if (dispose_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)
+         dispose_op = PNG_fcTL_DISPOSE_OP_BACKGROUND;
+   }
+   if (dispose_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)
+      png_image_canvas_region(display, PNG_CANVAS_SAVE,
+          png_image_frame_buffer(png_ptr, &control->frame_restore,
+             &control->frame_restore_size,
+             (png_alloc_size_t)height * row_bytes),
+          x, y, width, height);
+
+   if (blend_op == PNG_fcTL_BLEND_OP_SOURCE && control->frame_local_scale == 0)
+   {
+      /* Decode straight into the canvas. */
+      while (--passes >= 0)
+      {
+         png_byte *row = png_image_canvas_pixel(display, x, y);
+         png_uint_32 i;
+
+         for (i = 0; i < height; ++i)
+         {
+            png_read_row(png_ptr, row, NULL);
+            row += display->row_step;
+         }
+      }
+   }
+
+   else
+   {
+      /* Interlaced frames need all the rows before they can be composited,
+       * otherwise one row is enough.
+       */
+      png_uint_32 rows = passes > 1 ? height : 1;
+      png_byte *frame_rows = png_image_frame_buffer(png_ptr,
+          &control->frame_rows, &control->frame_rows_size,
+          (png_alloc_size_t)rows * row_bytes);
+      png_byte *canvas = png_image_canvas_pixel(display, x, y);
+      png_uint_32 i;
+      int pass;
+
+      for (pass = 0; pass < passes; ++pass)
+      {
+         for (i = 0; i < height; ++i)
+         {
+            png_byte *row = frame_rows + (rows > 1 ? i * row_bytes : 0);
+
+            png_read_row(png_ptr, row, NULL);
+
+            if (rows == 1)
+            {
+               if (blend_op == PNG_fcTL_BLEND_OP_OVER)
+                  png_image_blend_row(canvas, row, width, channels, alpha);
+
+               else
+                  memcpy(canvas, row, row_bytes);
+
+               canvas += display->row_step;
+            }
+         }
+      }
+
+      for (i = 0; rows > 1 && i < height; ++i)
+      {
+         png_byte *row = frame_rows + i * row_bytes;
+
+         if (blend_op == PNG_fcTL_BLEND_OP_OVER)
+            png_image_blend_row(canvas, row, width, channels, alpha);
+
+         else
+            memcpy(canvas, row, row_bytes);
+
+         canvas += display->row_step;
+      }
+   }
+
+   control->dispose_x = x;
+   control->dispose_y = y;
+   control->dispose_width = width;
+   control->dispose_height = height;
+   control->dispose_op = dispose_op;
+
+   {
+      png_image_frame *frame = display->frame;
+
+      frame->index = control->frame_index++;
+      frame->x_offset = x;
+      frame->y_offset = y;
+      frame->width = width;
+      frame->height = height;
+      frame->delay_num = delay_num;
+      frame->delay_den = delay_den;
+   }
+}
+
+static int
+png_image_read_frame_main(void *argument)
+{
+   png_image_read_control *display = png_voidcast(png_image_read_control*,
+       argument);
+   png_image *image = display->image;
+   png_control *control = image->opaque;
+   png_struct *png_ptr = control->png_ptr;
+   png_info *info_ptr = control->info_ptr;
+   int animated = png_get_valid(png_ptr, info_ptr, PNG_INFO_acTL) != 0;
+   int hidden = animated &&
+      png_get_first_frame_is_hidden(png_ptr, info_ptr) != 0;
+   png_uint_32 num_frames = 1;
+   png_uint_32 num_plays = 0;
+
+   if (animated)
+   {
+      num_frames = png_get_num_frames(png_ptr, info_ptr) - (hidden != 0);
+      num_plays = png_get_num_plays(png_ptr, info_ptr);
+   }
+
+   if (control->seek_pending == 0 && control->frame_index >= num_frames)
+      png_error(png_ptr, "png_image_read_frame: no more frames");
+
+   if (control->frame_setup == 0)
+   {
+      int do_local_compose, do_local_background, do_local_scale;
+      int passes = png_image_set_direct_transforms(display, &do_local_compose,
+          &do_local_background, &do_local_scale);
+
+      /* The output has 8-bit, non-premultiplied alpha so libpng never leaves
+       * any composition to be done locally.
+       */
+      if (do_local_compose != 0 || do_local_background == 2)
+         png_error(png_ptr, "png_image_read_frame: invalid transformations");
+
+      control->frame_local_scale = do_local_scale != 0;
+      control->frame_setup = 1;
+
+      /* The default image is not part of the animation; decode and discard
+       * it, unless it is about to be skipped anyway.
+       */
+      if (hidden && control->seek_pending == 0)
+      {
+         png_byte *row = png_image_frame_buffer(png_ptr, &control->frame_rows,
+             &control->frame_rows_size, png_get_rowbytes(png_ptr, info_ptr));
+         int pass;
+
+         for (pass = 0; pass < passes; ++pass)
+         {
+            png_uint_32 i;
+
+            for (i = 0; i < image->height; ++i)
+               png_read_row(png_ptr, row, NULL);
+         }
+      }
+   }
+
+   if (control->seek_pending != 0)
+   {
+      /* Start from a transparent black canvas at the keyframe.  Of the frames
+       * between it and the target only those with DISPOSE_OP_NONE leave
+       * anything behind that has to be decoded.
+       */
+      png_uint_32 target = control->seek_frame;
+      png_uint_32 i;
+
+      control->seek_pending = 0;
+      control->dispose_op = PNG_fcTL_DISPOSE_OP_NONE;
+      png_image_canvas_region(display, PNG_CANVAS_CLEAR, NULL, 0, 0,
+          image->width, image->height);
+
+      for (i = png_get_keyframe(png_ptr, target); i < target; ++i)
+      {
+         const png_frame_index_entry *entry = png_ptr->frame_index + i;
+         png_byte dispose_op = entry->dispose_op;
+
+         if (i == 0 && dispose_op == PNG_fcTL_DISPOSE_OP_PREVIOUS)
+            dispose_op = PNG_fcTL_DISPOSE_OP_BACKGROUND;
+
+         control->frame_index = i;
+
+         if (dispose_op == PNG_fcTL_DISPOSE_OP_NONE)
+         {
+            png_seek_frame(png_ptr, info_ptr, i);
+            png_image_composite_frame(display);
+         }
+
+         else
+         {
+            png_image_dispose_frame(display);
+
+            control->dispose_x = entry->x_offset;
+            control->dispose_y = entry->y_offset;
+            control->dispose_width = entry->width;
+            control->dispose_height = entry->height;
+            control->dispose_op = dispose_op == PNG_fcTL_DISPOSE_OP_BACKGROUND ?
+               PNG_fcTL_DISPOSE_OP_BACKGROUND : PNG_fcTL_DISPOSE_OP_NONE;
+         }
+      }
+
+      control->frame_index = target;
+      png_seek_frame(png_ptr, info_ptr, target);
+   }
+
+   png_image_composite_frame(display);
+   display->frame->num_frames = num_frames;
+   display->frame->num_plays = num_plays;
+
+   return 1;
+}
+
+int
+png_image_read_frame(png_image *image, void *buffer, png_int_32 row_stride,
+    png_image_frame *frame)
+{
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(image->format);
+
+      /* Compositing is only supported on 8-bit non-premultiplied alpha. */
+      if ((image->format & (PNG_FORMAT_FLAG_ALPHA | PNG_FORMAT_FLAG_LINEAR |
+          PNG_FORMAT_FLAG_COLORMAP | PNG_FORMAT_FLAG_ASSOCIATED_ALPHA)) !=
+          PNG_FORMAT_FLAG_ALPHA)
+         return png_image_error(image,
+             "png_image_read_frame: format must be 8-bit with alpha");
+
+      /* As png_image_finish_read, but the components are always one byte. */
+      if (image->width <= 0x7fffffffU/channels) /* no overflow */
+      {
+         png_uint_32 check;
+         png_uint_32 png_row_stride = image->width * channels;
+
+         if (row_stride == 0)
+            row_stride = (png_int_32)/*SAFE*/png_row_stride;
+
+         if (row_stride < 0)
+            check = -(png_uint_32)row_stride;
+
+         else
+            check = (png_uint_32)row_stride;
+
+         if (image->opaque != NULL && buffer != NULL && frame != NULL &&
+             check >= png_row_stride)
+         {
+            if (image->height <= 0xffffffffU/check)
+            {
+               png_image_read_control display;
+               png_byte *first_row = png_voidcast(png_byte *, buffer);
+
+               if (row_stride < 0)
+                  first_row += (image->height - 1) * (size_t)check;
+
+               memset(&display, 0, (sizeof display));
+               display.image = image;
+               display.buffer = buffer;
+               display.row_stride = row_stride;
+               display.first_row = first_row;
+               display.row_step = row_stride;
+               display.frame = frame;
+
+               return png_safe_execute(image, png_image_read_frame_main,
+                   &display);
+            }
+
+            else
+               return png_image_error(image,
+                   "png_image_read_frame: image too large");
+         }
+
+         else
+            return png_image_error(image,
+                "png_image_read_frame: invalid argument");
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_read_frame: row_stride too large");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_read_frame: damaged PNG_IMAGE_VERSION");
+
+   return 0;
+}
+
+static int
+png_image_seek_frame_main(void *argument)
+{
+   png_image *image = png_voidcast(png_image *, argument);
+   png_control *control = image->opaque;
+   png_struct *png_ptr = control->png_ptr;
+   png_info *info_ptr = control->info_ptr;
+
+   if (png_get_valid(png_ptr, info_ptr, PNG_INFO_acTL) == 0)
+      png_error(png_ptr, "png_image_seek_frame: not an animation");
+
+   if (control->seek_frame >= png_read_frame_index(png_ptr, info_ptr))
+      png_error(png_ptr, "png_image_seek_frame: no such frame");
+
+   control->seek_pending = 1;
+
+   return 1;
+}
+
+int
+png_image_seek_frame(png_image *image, png_uint_32 index)
+{
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      if (image->opaque != NULL && image->opaque->png_ptr != NULL &&
+          image->opaque->for_write == 0)
+      {
+         image->opaque->seek_frame = index;
+         image->opaque->seek_pending = 0;
+
+         return png_safe_execute(image, png_image_seek_frame_main, image);
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_seek_frame: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_seek_frame: damaged PNG_IMAGE_VERSION");
+
+   return 0;
+}
+#endif /* READ_APNG */
 #endif /* SIMPLIFIED_READ */
 #endif /* READ */
@@ -27,18 +27,139 @@
  * buffering if you are using unbuffered reads.  This should never be asked
  * to read more than 64K on a 16-bit machine.
  */
+static void
+png_read_data_fn(png_struct *png_ptr, png_byte *data, size_t length)
+{
+   if (png_ptr->read_data_fn != NULL)
+      (*(png_ptr->read_data_fn))(png_ptr, data, length);
+
+   else
+      png_error(png_ptr, "Call to NULL read function");
+}
+
+#ifdef PNG_READ_AHEAD_SUPPORTED
+/* Serve 'length' bytes from the read-ahead buffer, refilling it with as much
+ * of the input as is known to exist, up to its size, when that is more than
+ * the request.  Otherwise the request goes straight to the read function.
+ */
+static void
+png_read_ahead_data(png_struct *png_ptr, png_byte *data, size_t length)
+{
+   size_t avail = png_ptr->read_ahead_end - png_ptr->read_ahead_next;
+   size_t position, fill;
+
+   if (avail > 0)
+   {
+      if (avail > length)
+         avail = length;
+
+      memcpy(data, png_ptr->read_ahead + png_ptr->read_ahead_next, avail);
+      png_ptr->read_ahead_next += avail;
+      data += avail;
+      length -= avail;
+
+      if (length == 0)
+         return;
+   }
+
+   /* The buffer is empty, so the input is at the logical position. */
+   position = png_ptr->read_offset + avail;
+   fill = 0;
+
+   if (png_ptr->read_known > position)
+   {
+      fill = png_ptr->read_known - position;
+
+      if (fill > png_ptr->read_ahead_size)
+         fill = png_ptr->read_ahead_size;
+   }
+
+   if (fill > length && png_ptr->read_ahead == NULL)
+      png_ptr->read_ahead = png_voidcast(png_byte *,
+          png_malloc_base(png_ptr, png_ptr->read_ahead_size));
+
+   if (fill > length && png_ptr->read_ahead != NULL)
+   {
+      png_read_data_fn(png_ptr, png_ptr->read_ahead, fill);
+      memcpy(data, png_ptr->read_ahead, length);
+      png_ptr->read_ahead_next = length;
+      png_ptr->read_ahead_end = fill;
+   }
+
+   else
+      png_read_data_fn(png_ptr, data, length);
+}
+#endif /* READ_AHEAD */
+
 void /* PRIVATE */
 png_read_data(png_struct *png_ptr, png_byte *data, size_t length)
 {
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   double perf_start = PNG_PERF_CLOCK();
+#endif
+
    png_debug1(4, "reading %d bytes", (int)length);
 
-   if (png_ptr->read_data_fn != NULL)
-      (*(png_ptr->read_data_fn))(png_ptr, data, length);
+#ifdef PNG_READ_AHEAD_SUPPORTED
+   if (png_ptr->read_ahead_size > 0)
+      png_read_ahead_data(png_ptr, data, length);
 
    else
-      png_error(png_ptr, "Call to NULL read function");
+#endif
+   png_read_data_fn(png_ptr, data, length);
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   png_perf_count(png_ptr, PNG_PERF_READ_DATA, perf_start, length);
+#endif
+
+   png_ptr->read_offset += length;
 }
 
+#ifdef PNG_READ_SEEK_SUPPORTED
+/* Try to move the input to 'offset' bytes from the start of the PNG signature
+ * and return 0 if the seek function failed.  A move within the read-ahead
+ * buffer needs no seek; otherwise the buffer is dropped first, so after a
+ * failure png_struct::read_offset is where the input really is.
+ */
+int /* PRIVATE */
+png_read_seek_data(png_struct *png_ptr, size_t offset)
+{
+#ifdef PNG_READ_AHEAD_SUPPORTED
+   size_t avail = png_ptr->read_ahead_end - png_ptr->read_ahead_next;
+
+   if (offset >= png_ptr->read_offset && offset - png_ptr->read_offset <= avail)
+   {
+      png_ptr->read_ahead_next += offset - png_ptr->read_offset;
+      png_ptr->read_offset = offset;
+      return 1;
+   }
+
+   png_ptr->read_offset += avail;
+   png_ptr->read_ahead_next = png_ptr->read_ahead_end = 0;
+#endif
+
+   if (png_ptr->seek_data_fn == NULL ||
+       (*(png_ptr->seek_data_fn))(png_ptr, offset) == 0)
+      return 0;
+
+   png_ptr->read_offset = offset;
+   return 1;
+}
+
+/* Move the input to 'offset' bytes from the start of the PNG signature. */
+void /* PRIVATE */
+png_read_seek(png_struct *png_ptr, size_t offset)
+{
+   png_debug1(4, "seeking to %lu", (unsigned long)offset);
+
+   if (png_ptr->seek_data_fn == NULL)
+      png_error(png_ptr, "Input is not seekable");
+
+   if (png_read_seek_data(png_ptr, offset) == 0)
+      png_error(png_ptr, "Seek Error");
+}
+#endif
+
 #ifdef PNG_STDIO_SUPPORTED
 /* This is the function that does the actual reading of data.  If you are
  * not reading from a standard C stream, you should create a replacement
@@ -61,6 +182,37 @@ png_default_read_data(png_struct *png_ptr, png_byte *data, size_t length)
    if (check != length)
       png_error(png_ptr, "Read Error");
 }
+
+#ifdef PNG_READ_SEEK_SUPPORTED
+/* The seek function to go with png_default_read_data.  The stream need not
+ * start at the beginning of the file, so the seek is relative.
+ */
+static int
+png_default_seek_data(png_struct *png_ptr, size_t offset)
+{
+   FILE *fp = png_voidcast(FILE *, png_ptr->io_ptr);
+   size_t current = png_ptr->read_offset;
+   long delta;
+
+   if (offset >= current)
+   {
+      if (offset - current > (size_t)LONG_MAX)
+         return 0;
+
+      delta = (long)(offset - current);
+   }
+
+   else
+   {
+      if (current - offset > (size_t)LONG_MAX)
+         return 0;
+
+      delta = -(long)(current - offset);
+   }
+
+   return fseek(fp, delta, SEEK_CUR) == 0;
+}
+#endif
 #endif
 
 /* This function allows the application to supply a new input function
@@ -101,6 +253,17 @@ png_set_read_fn(png_struct *png_ptr, void *io_ptr,
    png_ptr->read_data_fn = read_data_fn;
 #endif
 
+#ifdef PNG_READ_SEEK_SUPPORTED
+   /* A replacement read function needs its own seek function. */
+#  ifdef PNG_STDIO_SUPPORTED
+   if (read_data_fn == NULL)
+      png_ptr->seek_data_fn = png_default_seek_data;
+
+   else
+#  endif
+      png_ptr->seek_data_fn = NULL;
+#endif
+
 #ifdef PNG_WRITE_SUPPORTED
    /* It is an error to write to a read device */
    if (png_ptr->write_data_fn != NULL)
@@ -116,4 +279,45 @@ png_set_read_fn(png_struct *png_ptr, void *io_ptr,
    png_ptr->output_flush_fn = NULL;
 #endif
 }
+
+#ifdef PNG_READ_SEEK_SUPPORTED
+/* Set the function used to skip chunk data and move around the input; it is
+ * given the offset from the start of the PNG signature and returns 0 on
+ * failure.  Call this after png_set_read_fn, which removes any previous seek
+ * function.
+ */
+void
+png_set_read_seek_fn(png_struct *png_ptr, png_seek_ptr seek_data_fn)
+{
+   if (png_ptr == NULL)
+      return;
+
+   png_ptr->seek_data_fn = seek_data_fn;
+}
+#endif
+
+#ifdef PNG_READ_AHEAD_SUPPORTED
+/* Set the size of the read-ahead buffer, or turn read-ahead off with 0.  The
+ * buffer is allocated when first needed.
+ */
+void
+png_set_read_ahead(png_struct *png_ptr, size_t size)
+{
+   png_debug(1, "in png_set_read_ahead");
+
+   if (png_ptr == NULL)
+      return;
+
+   if (png_ptr->read_ahead_end > png_ptr->read_ahead_next)
+   {
+      png_app_warning(png_ptr, "read-ahead buffer in use");
+      return;
+   }
+
+   png_free(png_ptr, png_ptr->read_ahead);
+   png_ptr->read_ahead = NULL;
+   png_ptr->read_ahead_size = size;
+   png_ptr->read_ahead_next = png_ptr->read_ahead_end = 0;
+}
+#endif
 #endif /* READ */
@@ -641,8 +641,6 @@ png_set_quantize(png_struct *png_ptr, png_color *palette,
          png_dsort *t;
          png_dsort **hash;
 
-         t = NULL;
-
          /* Initialize palette index arrays */
          png_ptr->index_to_palette = (png_byte *)png_malloc(png_ptr,
              (png_alloc_size_t)num_palette);
@@ -673,6 +671,49 @@ png_set_quantize(png_struct *png_ptr, png_color *palette,
 
          while (num_new_palette > maximum_colors)
          {
+            png_dsort *pool;
+            png_alloc_size_t num_pairs = 0;
+
+            /* The pairs are allocated together, so count them first; there
+             * can be tens of thousands of them.  The scan stops at the first
+             * entry with no close enough partner if no pair has been found yet
+             * in this round; the entries merged depend on this.
+             */
+            for (i = 0; i < num_new_palette - 1; i++)
+            {
+               int j;
+
+               for (j = i + 1; j < num_new_palette; j++)
+               {
+                  if (PNG_COLOR_DIST(palette[i], palette[j]) <= max_d)
+                     num_pairs++;
+               }
+
+               if (num_pairs == 0)
+                  break;
+            }
+
+            if (num_pairs == 0)
+            {
+               max_d += 96;
+               continue;
+            }
+
+            pool = (png_dsort *)png_malloc_warn(png_ptr,
+                num_pairs * (sizeof (png_dsort)));
+
+            if (pool == NULL)
+            {
+               png_free(png_ptr, hash);
+               png_free(png_ptr, png_ptr->palette_to_index);
+               png_free(png_ptr, png_ptr->index_to_palette);
+               png_ptr->palette_to_index = NULL;
+               png_ptr->index_to_palette = NULL;
+               png_error(png_ptr, "Out of memory quantizing the palette");
+            }
+
+            t = pool;
+
             for (i = 0; i < num_new_palette - 1; i++)
             {
                int j;
@@ -685,25 +726,15 @@ png_set_quantize(png_struct *png_ptr, png_color *palette,
 
                   if (d <= max_d)
                   {
-
-                     t = (png_dsort *)png_malloc_warn(png_ptr,
-                         (png_alloc_size_t)(sizeof (png_dsort)));
-
-                     if (t == NULL)
-                         break;
-
                      t->next = hash[d];
                      t->left = png_ptr->palette_to_index[i];
                      t->right = png_ptr->palette_to_index[j];
-                     hash[d] = t;
+                     hash[d] = t++;
                   }
                }
-               if (t == NULL)
-                  break;
             }
 
-            if (t != NULL)
-            for (i = 0; i <= max_d; i++)
+            for (i = 0; i <= max_d && i < 769; i++)
             {
                if (hash[i] != NULL)
                {
@@ -771,19 +802,9 @@ png_set_quantize(png_struct *png_ptr, png_color *palette,
             }
 
             for (i = 0; i < 769; i++)
-            {
-               if (hash[i] != NULL)
-               {
-                  png_dsort *p = hash[i];
-                  while (p)
-                  {
-                     t = p->next;
-                     png_free(png_ptr, p);
-                     p = t;
-                  }
-               }
-               hash[i] = 0;
-            }
+               hash[i] = NULL;
+
+            png_free(png_ptr, pool);
             max_d += 96;
          }
          png_free(png_ptr, hash);
@@ -809,20 +830,30 @@ png_set_quantize(png_struct *png_ptr, png_color *palette,
    if (full_quantize != 0)
    {
       int i;
-      png_byte *distance;
+      png_uint_16 *distance;
       int total_bits = PNG_QUANTIZE_RED_BITS + PNG_QUANTIZE_GREEN_BITS +
           PNG_QUANTIZE_BLUE_BITS;
       int num_red = (1 << PNG_QUANTIZE_RED_BITS);
       int num_green = (1 << PNG_QUANTIZE_GREEN_BITS);
       int num_blue = (1 << PNG_QUANTIZE_BLUE_BITS);
       size_t num_entries = ((size_t)1 << total_bits);
+      size_t n;
 
       png_ptr->palette_lookup = (png_byte *)png_calloc(png_ptr,
           (png_alloc_size_t)(num_entries));
 
-      distance = (png_byte *)png_malloc(png_ptr, (png_alloc_size_t)num_entries);
+      /* Each entry holds the distance to the closest palette entry so far in
+       * the high byte and the index of that entry in the low byte.  Because
+       * the entries are visited in increasing index order the minimum of this
+       * value and that for the next entry selects the first of the closest
+       * entries; the inner loop is just an unsigned minimum, which compilers
+       * vectorize.  The distance is at most 4*31, so it fits in a byte.
+       */
+      distance = (png_uint_16 *)png_malloc(png_ptr,
+          (png_alloc_size_t)(num_entries * (sizeof *distance)));
 
-      memset(distance, 0xff, num_entries);
+      for (n = 0; n < num_entries; n++)
+         distance[n] = 0xffff;
 
       for (i = 0; i < num_palette; i++)
       {
@@ -844,26 +875,29 @@ png_set_quantize(png_struct *png_ptr, png_color *palette,
                int dg = ((ig > g) ? ig - g : g - ig);
                int dt = dr + dg;
                int dm = ((dr > dg) ? dr : dg);
-               int index_g = index_r | (ig << PNG_QUANTIZE_BLUE_BITS);
+               png_uint_16 *row = distance +
+                   (index_r | (ig << PNG_QUANTIZE_BLUE_BITS));
 
                for (ib = 0; ib < num_blue; ib++)
                {
-                  int d_index = index_g | ib;
                   /* int db = abs(ib - b); */
                   int db = ((ib > b) ? ib - b : b - ib);
                   int dmax = ((dm > db) ? dm : db);
-                  int d = dmax + dt + db;
+                  png_uint_16 d = (png_uint_16)(((dmax + dt + db) << 8) | i);
 
-                  if (d < (int)distance[d_index])
-                  {
-                     distance[d_index] = (png_byte)d;
-                     png_ptr->palette_lookup[d_index] = (png_byte)i;
-                  }
+                  row[ib] = d < row[ib] ? d : row[ib];
                }
             }
          }
       }
 
+      {
+         png_byte *lookup = png_ptr->palette_lookup;
+
+         for (n = 0; n < num_entries; n++)
+            lookup[n] = (png_byte)(distance[n] & 0xff);
+      }
+
       png_free(png_ptr, distance);
    }
 }
@@ -4839,6 +4873,10 @@ png_do_quantize(png_row_info *row_info, png_byte *row,
 void /* PRIVATE */
 png_do_read_transformations(png_struct *png_ptr, png_row_info *row_info)
 {
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   double perf_start = PNG_PERF_CLOCK();
+#endif
+
    png_debug(1, "in png_do_read_transformations");
 
    if (png_ptr->row_buf == NULL)
@@ -5128,6 +5166,11 @@ png_do_read_transformations(png_struct *png_ptr, png_row_info *row_info)
       row_info->rowbytes = PNG_ROWBYTES(row_info->pixel_depth, row_info->width);
    }
 #endif
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   png_perf_count(png_ptr, PNG_PERF_READ_TRANSFORM, perf_start,
+       row_info->rowbytes);
+#endif
 }
 
 #endif /* READ_TRANSFORMS */
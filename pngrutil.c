@@ -117,6 +117,9 @@ png_read_sig(png_struct *png_ptr, png_info *info_ptr)
 {
    size_t num_checked, num_to_check;
 
+   /* Offsets are counted from the start of the signature. */
+   png_ptr->read_offset = png_ptr->sig_bytes;
+
    /* Exit if the user application does not expect a signature. */
    if (png_ptr->sig_bytes >= 8)
       return;
@@ -189,6 +192,12 @@ png_read_chunk_header(png_struct *png_ptr)
    png_ptr->io_state = PNG_IO_READING | PNG_IO_CHUNK_HDR;
 #endif
 
+   /* PNG_LEAN_MEMORY: the data of the previous chunk is no longer needed,
+    * though the sequential reader keeps its IDAT buffer until the image ends.
+    */
+   if (png_lean_memory(png_ptr) && png_ptr->zowner != png_IDAT)
+      png_read_free_buffer(png_ptr);
+
    /* Read the length and the chunk name.  png_struct::chunk_name is immediately
     * updated even if they are detectably wrong.  This aids error message
     * handling by allowing png_chunk_error to be used.
@@ -218,9 +227,178 @@ png_read_chunk_header(png_struct *png_ptr)
    png_ptr->io_state = PNG_IO_READING | PNG_IO_CHUNK_DATA;
 #endif
 
+#ifdef PNG_READ_AHEAD_SUPPORTED
+   /* The chunk data and CRC must follow, then the next chunk header unless
+    * this is IEND.  The header after image data is not counted on because a
+    * file that stops after the image data can still be decoded.  The
+    * progressive reader has all its input already.
+    */
+   if (png_ptr->read_ahead_size > 0 &&
+#     ifdef PNG_PROGRESSIVE_READ_SUPPORTED
+         png_ptr->read_data_fn != png_push_fill_buffer &&
+#     endif
+       length <= (size_t)-1 - 12 - png_ptr->read_offset)
+   {
+      png_ptr->read_known = png_ptr->read_offset + length + 4;
+
+      if (chunk_name != png_IEND && chunk_name != png_IDAT
+#        ifdef PNG_READ_APNG_SUPPORTED
+            && chunk_name != png_fdAT
+#        endif
+         )
+         png_ptr->read_known += 8;
+   }
+#endif
+
+   png_read_trace(png_ptr, PNG_TRACE_CHUNK_START);
+
    return length;
 }
 
+int
+png_probe_header(png_probe *probe, const void *data, size_t size)
+{
+   static const png_uint_32 probe_chunks[PNG_PROBE_CHUNK_COUNT] =
+   {
+      png_PLTE, png_tRNS, png_gAMA, png_cHRM, png_sRGB, png_iCCP, png_cICP,
+      png_mDCV, png_cLLI, png_eXIf, png_pHYs, png_acTL, png_IDAT
+   };
+   static const png_byte png_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+   const png_byte *bytes = png_voidcast(const png_byte *, data);
+   size_t offset;
+
+   if (probe == NULL)
+      return PNG_PROBE_ERROR;
+
+   memset(probe, 0, (sizeof *probe));
+
+   if (bytes == NULL)
+   {
+      if (size > 0)
+         return PNG_PROBE_ERROR;
+
+      probe->bytes_needed = 33;
+      return PNG_PROBE_NEED_MORE;
+   }
+
+   /* The signature, then the IHDR: 4 length, 4 name, 13 data and 4 CRC bytes.
+    * Check as much of the signature as there is first so that non-PNG data is
+    * rejected without waiting for more.
+    */
+   if (memcmp(bytes, png_signature, size < 8 ? size : 8) != 0)
+      return PNG_PROBE_ERROR;
+
+   if (size < 33)
+   {
+      probe->bytes_needed = 33;
+      return PNG_PROBE_NEED_MORE;
+   }
+
+   if (png_get_uint_32(bytes + 8) != 13 ||
+       PNG_CHUNK_FROM_STRING(bytes + 12) != png_IHDR ||
+       (png_uint_32)crc32(crc32(0, Z_NULL, 0), bytes + 12, 17) !=
+       png_get_uint_32(bytes + 29))
+      return PNG_PROBE_ERROR;
+
+   probe->width = png_get_uint_32(bytes + 16);
+   probe->height = png_get_uint_32(bytes + 20);
+   probe->bit_depth = bytes[24];
+   probe->color_type = bytes[25];
+   probe->compression_method = bytes[26];
+   probe->filter_method = bytes[27];
+   probe->interlace_method = bytes[28];
+
+   /* The same checks as png_check_IHDR, except for the user limits. */
+   {
+      unsigned int depth = probe->bit_depth;
+      int ok;
+
+      switch (probe->color_type)
+      {
+         case PNG_COLOR_TYPE_GRAY:
+            ok = depth == 1 || depth == 2 || depth == 4 || depth == 8 ||
+               depth == 16;
+            break;
+
+         case PNG_COLOR_TYPE_PALETTE:
+            ok = depth == 1 || depth == 2 || depth == 4 || depth == 8;
+            break;
+
+         case PNG_COLOR_TYPE_RGB:
+         case PNG_COLOR_TYPE_GRAY_ALPHA:
+         case PNG_COLOR_TYPE_RGB_ALPHA:
+            ok = depth == 8 || depth == 16;
+            break;
+
+         default:
+            ok = 0;
+            break;
+      }
+
+      if (!ok || probe->width == 0 || probe->width > PNG_UINT_31_MAX ||
+          probe->height == 0 || probe->height > PNG_UINT_31_MAX ||
+          probe->compression_method != PNG_COMPRESSION_TYPE_BASE ||
+          probe->filter_method != PNG_FILTER_TYPE_BASE ||
+          probe->interlace_method >= PNG_INTERLACE_LAST)
+         return PNG_PROBE_ERROR;
+   }
+
+   /* Walk the chunk headers up to the first IDAT. */
+   for (offset = 33;;)
+   {
+      png_uint_32 length, chunk_name;
+      int i;
+
+      if (offset > size || size - offset < 8)
+      {
+         probe->bytes_needed = offset + 8;
+         return PNG_PROBE_HEADER;
+      }
+
+      length = png_get_uint_32(bytes + offset);
+      chunk_name = PNG_CHUNK_FROM_STRING(bytes + offset + 4);
+
+      if (length > PNG_UINT_31_MAX || !check_chunk_name(chunk_name) ||
+          chunk_name == png_IHDR || chunk_name == png_IEND)
+         return PNG_PROBE_ERROR;
+
+      for (i = 0; i < PNG_PROBE_CHUNK_COUNT; ++i)
+      {
+         if (chunk_name == probe_chunks[i])
+         {
+            if (probe->chunk_offset[i] == 0)
+               probe->chunk_offset[i] = offset;
+            break;
+         }
+      }
+
+      if (chunk_name == png_IDAT)
+         return PNG_PROBE_COMPLETE;
+
+      if (chunk_name == png_acTL && probe->num_frames == 0)
+      {
+         if (length != 8)
+            return PNG_PROBE_ERROR;
+
+         if (size - offset < 16)
+         {
+            probe->chunk_offset[PNG_PROBE_CHUNK_acTL] = 0;
+            probe->bytes_needed = offset + 16;
+            return PNG_PROBE_HEADER;
+         }
+
+         probe->num_frames = png_get_uint_32(bytes + offset + 8);
+         probe->num_plays = png_get_uint_32(bytes + offset + 12);
+      }
+
+      /* Skip the chunk; the next header may be beyond the end of the data. */
+      if (length > (size_t)-1 - 20 - offset)
+         return PNG_PROBE_ERROR;
+
+      offset += length + (size_t)12;
+   }
+}
+
 /* Read data, and (optionally) run it through the CRC. */
 void /* PRIVATE */
 png_crc_read(png_struct *png_ptr, png_byte *buf, png_uint_32 length)
@@ -232,16 +410,12 @@ png_crc_read(png_struct *png_ptr, png_byte *buf, png_uint_32 length)
    png_calculate_crc(png_ptr, buf, length);
 }
 
-/* Compare the CRC stored in the PNG file with that calculated by libpng from
- * the data it has read thus far.
+/* Return 0 if the CRC of the current chunk is not checked, in which case the
+ * chunk data need not be read at all unless it is used.
  */
 static int
-png_crc_error(png_struct *png_ptr, int handle_as_ancillary)
+png_crc_needed(png_struct *png_ptr, int handle_as_ancillary)
 {
-   png_byte crc_bytes[4];
-   png_uint_32 crc;
-   int need_crc = 1;
-
    /* There are four flags two for ancillary and two for critical chunks.  The
     * default setting of these flags is all zero.
     *
@@ -269,17 +443,22 @@ png_crc_error(png_struct *png_ptr, int handle_as_ancillary)
     * something comprehensible.
     */
    if (handle_as_ancillary || PNG_CHUNK_ANCILLARY(png_ptr->chunk_name) != 0)
-   {
-      if ((png_ptr->flags & PNG_FLAG_CRC_ANCILLARY_MASK) ==
-          (PNG_FLAG_CRC_ANCILLARY_USE | PNG_FLAG_CRC_ANCILLARY_NOWARN))
-         need_crc = 0;
-   }
+      return (png_ptr->flags & PNG_FLAG_CRC_ANCILLARY_MASK) !=
+          (PNG_FLAG_CRC_ANCILLARY_USE | PNG_FLAG_CRC_ANCILLARY_NOWARN);
 
    else /* critical */
-   {
-      if ((png_ptr->flags & PNG_FLAG_CRC_CRITICAL_IGNORE) != 0)
-         need_crc = 0;
-   }
+      return (png_ptr->flags & PNG_FLAG_CRC_CRITICAL_IGNORE) == 0;
+}
+
+/* Compare the CRC stored in the PNG file with that calculated by libpng from
+ * the data it has read thus far.
+ */
+static int
+png_crc_error(png_struct *png_ptr, int handle_as_ancillary)
+{
+   png_byte crc_bytes[4];
+   png_uint_32 crc;
+   int need_crc = png_crc_needed(png_ptr, handle_as_ancillary);
 
 #ifdef PNG_IO_STATE_SUPPORTED
    png_ptr->io_state = PNG_IO_READING | PNG_IO_CHUNK_CRC;
@@ -312,6 +491,38 @@ static int
 png_crc_finish_critical(png_struct *png_ptr, png_uint_32 skip,
       int handle_as_ancillary)
 {
+   int crc_error;
+
+   /* If 'handle_as_ancillary' has been requested and this is a critical chunk
+    * but PNG_FLAG_CRC_CRITICAL_IGNORE was set then png_read_crc did not, in
+    * fact, calculate the CRC so the ANCILLARY settings should not be used
+    * instead.
+    */
+   if (handle_as_ancillary &&
+       (png_ptr->flags & PNG_FLAG_CRC_CRITICAL_IGNORE) != 0)
+      handle_as_ancillary = 0;
+
+#ifdef PNG_READ_SEEK_SUPPORTED
+   /* Data which is not CRC checked need not be read; seek over it if that
+    * saves more than one read into the buffer below.  The input may not be
+    * seekable after all (a FILE may be a pipe) so if the seek fails just read
+    * the data.
+    */
+   if (skip > PNG_INFLATE_BUF_SIZE && png_ptr->seek_data_fn != NULL &&
+       skip <= (size_t)-1 - png_ptr->read_offset &&
+       png_crc_needed(png_ptr, handle_as_ancillary) == 0)
+   {
+      size_t offset = png_ptr->read_offset + skip;
+
+      /* A failed seek may still have used up read-ahead data. */
+      if (png_read_seek_data(png_ptr, offset) != 0)
+         skip = 0;
+
+      else
+         skip = (png_uint_32)(offset - png_ptr->read_offset);
+   }
+#endif
+
    /* The size of the local buffer for inflate is a good guess as to a
     * reasonable size to use for buffering reads from the application.
     */
@@ -328,18 +539,12 @@ png_crc_finish_critical(png_struct *png_ptr, png_uint_32 skip,
       png_crc_read(png_ptr, tmpbuf, len);
    }
 
-   /* If 'handle_as_ancillary' has been requested and this is a critical chunk
-    * but PNG_FLAG_CRC_CRITICAL_IGNORE was set then png_read_crc did not, in
-    * fact, calculate the CRC so the ANCILLARY settings should not be used
-    * instead.
-    */
-   if (handle_as_ancillary &&
-       (png_ptr->flags & PNG_FLAG_CRC_CRITICAL_IGNORE) != 0)
-      handle_as_ancillary = 0;
-
    /* TODO: this might be more comprehensible if png_crc_error was inlined here.
     */
-   if (png_crc_error(png_ptr, handle_as_ancillary) != 0)
+   crc_error = png_crc_error(png_ptr, handle_as_ancillary);
+   png_read_trace(png_ptr, PNG_TRACE_CHUNK_END);
+
+   if (crc_error != 0)
    {
       /* See above for the explanation of how the flags work. */
       if (handle_as_ancillary || PNG_CHUNK_ANCILLARY(png_ptr->chunk_name) != 0 ?
@@ -389,6 +594,7 @@ png_read_buffer(png_struct *png_ptr, png_alloc_size_t new_size)
 
    if (buffer == NULL)
    {
+      png_alloc_owner(png_ptr, PNG_ALLOC_CHUNK_DATA);
       buffer = png_voidcast(png_byte *, png_malloc_base(png_ptr, new_size));
 
       if (buffer != NULL)
@@ -506,6 +712,12 @@ png_inflate_claim(png_struct *png_ptr, png_uint_32 owner)
 int /* PRIVATE */
 png_zlib_inflate(png_struct *png_ptr, int flush)
 {
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   double perf_start;
+   uInt avail_out;
+   int ret;
+#endif
+
    if (png_ptr->zstream_start && png_ptr->zstream.avail_in > 0)
    {
       if ((*png_ptr->zstream.next_in >> 4) > 7)
@@ -517,7 +729,16 @@ png_zlib_inflate(png_struct *png_ptr, int flush)
       png_ptr->zstream_start = 0;
    }
 
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   perf_start = PNG_PERF_CLOCK();
+   avail_out = png_ptr->zstream.avail_out;
+   ret = inflate(&png_ptr->zstream, flush);
+   png_perf_count(png_ptr, PNG_PERF_INFLATE, perf_start,
+       avail_out - png_ptr->zstream.avail_out);
+   return ret;
+#else
    return inflate(&png_ptr->zstream, flush);
+#endif
 }
 
 #ifdef PNG_READ_COMPRESSED_TEXT_SUPPORTED
@@ -712,7 +933,10 @@ png_decompress_chunk(png_struct *png_ptr,
                png_alloc_size_t new_size = *newlength;
                png_alloc_size_t buffer_size = prefix_size + new_size +
                    (terminate != 0);
-               png_byte *text = png_voidcast(png_byte *,
+               png_byte *text;
+
+               png_alloc_owner(png_ptr, PNG_ALLOC_CHUNK_DATA);
+               text = png_voidcast(png_byte *,
                    png_malloc_base(png_ptr, buffer_size));
 
                if (text != NULL)
@@ -790,7 +1014,7 @@ png_decompress_chunk(png_struct *png_ptr,
             ret = PNG_UNEXPECTED_ZLIB_RETURN;
 
          /* Release the claimed stream */
-         png_ptr->zowner = 0;
+         png_inflate_release(png_ptr);
       }
 
       else /* the claim failed */ if (ret == Z_STREAM_END) /* impossible! */
@@ -876,6 +1100,269 @@ png_inflate_read(png_struct *png_ptr, png_byte *read_buffer, uInt read_size,
 }
 #endif /* READ_iCCP */
 
+#if defined(PNG_READ_DEFER_DECOMPRESSION_SUPPORTED) ||\
+    defined(PNG_READ_ICC_CACHE_SUPPORTED)
+/* Inflate 'input_size' bytes with a z_stream of its own, writing at most
+ * *output_size bytes to 'output', or just counting them if 'output' is NULL.
+ * On return *output_size is the number of bytes produced.  The result is
+ * Z_STREAM_END if the whole stream fitted, otherwise a zlib error code;
+ * Z_BUF_ERROR when the output was filled first.
+ */
+static int
+png_inflate_private(png_struct *png_ptr, const png_byte *input,
+    png_alloc_size_t input_size, png_byte *output,
+    png_alloc_size_t *output_size)
+{
+   z_stream zstream;
+   Byte local_buffer[PNG_INFLATE_BUF_SIZE];
+   png_alloc_size_t avail_out = *output_size;
+   int ret;
+
+   memset(&zstream, 0, (sizeof zstream));
+   zstream.zalloc = png_zalloc;
+   zstream.zfree = png_zfree;
+   zstream.opaque = png_ptr;
+
+   ret = inflateInit(&zstream);
+   if (ret != Z_OK)
+      return ret;
+
+   zstream.next_in = input;
+   zstream.next_out = output;
+
+   do
+   {
+      if (zstream.avail_in == 0)
+      {
+         uInt avail = ZLIB_IO_MAX;
+
+         if (avail > input_size)
+            avail = (uInt)input_size;
+
+         input_size -= avail;
+         zstream.avail_in = avail;
+      }
+
+      if (zstream.avail_out == 0)
+      {
+         uInt avail = ZLIB_IO_MAX;
+
+         if (output == NULL)
+         {
+            zstream.next_out = local_buffer;
+            if ((sizeof local_buffer) < avail)
+               avail = (sizeof local_buffer);
+         }
+
+         if (avail > avail_out)
+            avail = (uInt)avail_out;
+
+         avail_out -= avail;
+         zstream.avail_out = avail;
+      }
+
+      /* This returns Z_BUF_ERROR once no progress is possible, either because
+       * the input is exhausted or because the output is full.
+       */
+      ret = inflate(&zstream, Z_NO_FLUSH);
+   }
+   while (ret == Z_OK);
+
+   *output_size -= avail_out + zstream.avail_out;
+   inflateEnd(&zstream);
+   return ret;
+}
+#endif /* READ_DEFER_DECOMPRESSION || READ_ICC_CACHE */
+
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+#if defined(PNG_READ_zTXt_SUPPORTED) || defined(PNG_READ_iTXt_SUPPORTED)
+/* Add a zTXt or iTXt chunk to info_ptr with its data still compressed.  'text'
+ * gives the keyword, language, translated keyword and compression.  The entry
+ * is made by png_set_text_2, with empty text, then the compressed data is
+ * appended to the single allocation that holds the strings.
+ */
+static int
+png_set_text_deferred(png_struct *png_ptr, png_info *info_ptr,
+    png_text *text, const png_byte *data, png_uint_32 size)
+{
+   int num_text = info_ptr->num_text;
+   int compression = text->compression;
+   png_text *textp;
+   png_byte *block;
+   size_t prefix;
+
+   text->text = NULL;
+
+   if (png_set_text_2(png_ptr, info_ptr, text, 1) != 0 ||
+       info_ptr->num_text != num_text + 1)
+      return 1;
+
+   /* The strings up to and including the '\0' of the empty text. */
+   textp = info_ptr->text + num_text;
+   prefix = (size_t)(textp->text - textp->key) + 1;
+   block = png_voidcast(png_byte *, png_malloc_base(png_ptr, prefix + size));
+
+   if (block == NULL)
+   {
+      png_free(png_ptr, textp->key);
+      info_ptr->num_text = num_text;
+      return 1;
+   }
+
+   memcpy(block, textp->key, prefix);
+   memcpy(block + prefix, data, size);
+
+   if (textp->lang != NULL)
+   {
+      textp->lang = (char *)block + (textp->lang - textp->key);
+      textp->lang_key = (char *)block + (textp->lang_key - textp->key);
+   }
+
+   textp->text = (char *)block + (prefix - 1);
+   png_free(png_ptr, textp->key);
+   textp->key = (char *)block;
+
+   textp->compression = compression + PNG_TEXT_DEFERRED;
+   if (compression > 0)
+      textp->itxt_length = size;
+
+   else
+      textp->text_length = size;
+
+   info_ptr->deferred = 1;
+   return 0;
+}
+
+/* Inflate a text entry stored by png_set_text_deferred, replacing its block.
+ * Returns 0 if the data is damaged or too large.
+ */
+static int
+png_inflate_deferred_text(png_struct *png_ptr, png_text *textp)
+{
+   int compression = textp->compression - PNG_TEXT_DEFERRED;
+   size_t prefix = (size_t)(textp->text - textp->key); /* without the '\0' */
+   const png_byte *data = (const png_byte *)textp->text + 1;
+   png_alloc_size_t size = compression > 0 ? textp->itxt_length :
+      textp->text_length;
+   png_alloc_size_t limit = png_chunk_max(png_ptr);
+   png_alloc_size_t length, check;
+   png_byte *block;
+
+   if (limit <= prefix)
+      return 0;
+
+   length = limit - prefix - 1;
+
+   if (png_inflate_private(png_ptr, data, size, NULL, &length) != Z_STREAM_END)
+      return 0;
+
+   block = png_voidcast(png_byte *, png_malloc_base(png_ptr,
+       prefix + length + 1));
+
+   if (block == NULL)
+      return 0;
+
+   check = length;
+
+   if (png_inflate_private(png_ptr, data, size, block + prefix, &check) !=
+       Z_STREAM_END || check != length)
+   {
+      png_free(png_ptr, block);
+      return 0;
+   }
+
+   memcpy(block, textp->key, prefix);
+   block[prefix + length] = 0;
+
+   if (textp->lang != NULL)
+   {
+      textp->lang = (char *)block + (textp->lang - textp->key);
+      textp->lang_key = (char *)block + (textp->lang_key - textp->key);
+   }
+
+   png_free(png_ptr, textp->key);
+   textp->key = (char *)block;
+   textp->text = (char *)block + prefix;
+   textp->compression = compression;
+
+   if (compression > 0)
+   {
+      textp->text_length = 0;
+      textp->itxt_length = length;
+   }
+
+   else
+   {
+      textp->text_length = length;
+      textp->itxt_length = 0;
+   }
+
+   return 1;
+}
+#endif /* READ_zTXt || READ_iTXt */
+
+void /* PRIVATE */
+png_inflate_deferred(png_struct *png_ptr, png_info *info_ptr)
+{
+   if (png_ptr == NULL || info_ptr == NULL || info_ptr->deferred == 0)
+      return;
+
+   png_debug(1, "in png_inflate_deferred");
+
+   info_ptr->deferred = 0;
+
+#if defined(PNG_READ_zTXt_SUPPORTED) || defined(PNG_READ_iTXt_SUPPORTED)
+   {
+      int i, j;
+
+      for (i = j = 0; i < info_ptr->num_text; ++i)
+      {
+         png_text *textp = info_ptr->text + i;
+
+         if (textp->key != NULL &&
+             textp->compression >= PNG_TEXT_DEFERRED &&
+             png_inflate_deferred_text(png_ptr, textp) == 0)
+         {
+            png_warning(png_ptr, "damaged compressed text dropped");
+            png_free(png_ptr, textp->key);
+            continue;
+         }
+
+         info_ptr->text[j++] = *textp;
+      }
+
+      info_ptr->num_text = j;
+   }
+#endif
+
+#ifdef PNG_READ_iCCP_SUPPORTED
+   if (info_ptr->iccp_deferred != 0)
+   {
+      png_alloc_size_t size = info_ptr->iccp_proflen;
+      png_byte *profile = png_voidcast(png_byte *,
+          png_malloc_base(png_ptr, size));
+
+      if (profile != NULL &&
+          png_inflate_private(png_ptr, info_ptr->iccp_profile,
+             info_ptr->iccp_deferred, profile, &size) == Z_STREAM_END &&
+          size == info_ptr->iccp_proflen)
+      {
+         png_free(png_ptr, info_ptr->iccp_profile);
+         info_ptr->iccp_profile = profile;
+         info_ptr->iccp_deferred = 0;
+      }
+
+      else
+      {
+         png_free(png_ptr, profile);
+         png_warning(png_ptr, "damaged iCCP profile dropped");
+         png_free_data(png_ptr, info_ptr, PNG_FREE_ICCP, 0);
+      }
+   }
+#endif
+}
+#endif /* READ_DEFER_DECOMPRESSION */
+
 /* CHUNK HANDLING */
 /* Read and check the IDHR chunk */
 static png_handle_result_code
@@ -1309,6 +1796,225 @@ png_handle_sRGB(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
 #endif /* READ_sRGB */
 
 #ifdef PNG_READ_iCCP_SUPPORTED
+#if defined(PNG_READ_DEFER_DECOMPRESSION_SUPPORTED) ||\
+    defined(PNG_READ_ICC_CACHE_SUPPORTED)
+/* Check the header and tag table of the profile compressed in 'data' and
+ * return its length, or 0 after reporting an error.
+ */
+static png_uint_32
+png_check_iCCP_compressed(png_struct *png_ptr, const char *name,
+    const png_byte *data, png_uint_32 size)
+{
+   png_byte profile_header[132];
+   png_alloc_size_t header_size = (sizeof profile_header);
+
+   (void)png_inflate_private(png_ptr, data, size, profile_header,
+       &header_size);
+
+   if (header_size == (sizeof profile_header))
+   {
+      png_uint_32 profile_length = png_get_uint_32(profile_header);
+
+      if (png_icc_check_length(png_ptr, name, profile_length) != 0 &&
+          png_icc_check_header(png_ptr, name, profile_length,
+             profile_header, png_ptr->color_type) != 0)
+      {
+         /* png_icc_check_header checked that the tag table fits. */
+         png_alloc_size_t table_size = (sizeof profile_header) +
+            12 * (png_alloc_size_t)png_get_uint_32(profile_header + 128);
+         png_byte *table = png_read_buffer(png_ptr, table_size);
+
+         if (table != NULL)
+         {
+            png_alloc_size_t check = table_size;
+
+            (void)png_inflate_private(png_ptr, data, size, table, &check);
+
+            if (check != table_size)
+               png_chunk_benign_error(png_ptr, "profile truncated");
+
+            else if (png_icc_check_tag_table(png_ptr, name, profile_length,
+                table) != 0)
+               return profile_length;
+
+            /* else png_icc_check_tag_table output an error */
+         }
+
+         else
+            png_chunk_benign_error(png_ptr, "out of memory");
+      }
+
+      /* else png_icc_check_length or png_icc_check_header output an error */
+   }
+
+   else
+      png_chunk_benign_error(png_ptr, "profile truncated");
+
+   return 0;
+}
+
+/* png_handle_iCCP for png_set_defer_decompression and png_set_icc_cache: the
+ * whole chunk is read first so that the compressed profile can be looked up in
+ * the cache and, when deferring, stored for png_inflate_deferred.  The profile
+ * header and tag table are checked as usual unless the cache has seen the
+ * profile before; the length is always checked against this png_struct's
+ * limits.
+ */
+static png_handle_result_code
+png_handle_iCCP_buffered(png_struct *png_ptr, png_info *info_ptr,
+    png_uint_32 length)
+{
+   const char *errmsg = NULL;
+   png_byte *buffer;
+   png_uint_32 keyword_length;
+
+   buffer = png_read_buffer(png_ptr, length);
+
+   if (buffer == NULL)
+   {
+      png_crc_finish(png_ptr, length);
+      png_chunk_benign_error(png_ptr, "out of memory");
+      return handled_error;
+   }
+
+   png_crc_read(png_ptr, buffer, length);
+
+   if (png_crc_finish(png_ptr, 0) != 0)
+      return handled_error;
+
+   for (keyword_length = 0;
+      keyword_length < length && keyword_length < 80 &&
+      buffer[keyword_length] != 0;
+      ++keyword_length)
+      /* Empty loop */ ;
+
+   if (keyword_length < 1 || keyword_length > 79 || keyword_length >= length)
+      errmsg = "bad keyword";
+
+   else if (keyword_length+1 >= length ||
+       buffer[keyword_length+1] != PNG_COMPRESSION_TYPE_BASE)
+      errmsg = "bad compression method"; /* or missing */
+
+   else if (length - (keyword_length+2) < LZ77Min)
+      errmsg = "too short";
+
+   else
+   {
+      png_uint_32 size = length - (keyword_length+2);
+      png_byte *data = png_voidcast(png_byte *, png_malloc_base(png_ptr, size));
+      char *name = png_voidcast(char *,
+          png_malloc_base(png_ptr, keyword_length+1));
+
+      if (data != NULL && name != NULL)
+      {
+         png_uint_32 profile_length = 0;
+
+         memcpy(data, buffer + keyword_length+2, size);
+         memcpy(name, buffer, keyword_length+1);
+
+         /* The read buffer is free from here on. */
+#        ifdef PNG_READ_ICC_CACHE_SUPPORTED
+            if (png_ptr->icc_cache != NULL)
+               profile_length = png_icc_cache_find(png_ptr->icc_cache, data,
+                   size, png_ptr->color_type);
+
+            if (profile_length != 0)
+            {
+               /* The cache may be shared with a png_struct that accepts longer
+                * profiles, so png_chunk_max must still be checked here.
+                */
+               if (png_icc_check_length(png_ptr, name, profile_length) == 0)
+                  profile_length = 0;
+            }
+
+            else
+#        endif
+         {
+            profile_length = png_check_iCCP_compressed(png_ptr, name, data,
+                size);
+
+#           ifdef PNG_READ_ICC_CACHE_SUPPORTED
+               if (profile_length != 0 && png_ptr->icc_cache != NULL)
+                  png_icc_cache_add(png_ptr->icc_cache, data, size,
+                      png_ptr->color_type, profile_length);
+#           endif
+         }
+
+         if (profile_length != 0)
+         {
+            png_uint_32 deferred = size;
+
+#           ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+               if (png_ptr->defer_decompression == 0)
+#           endif
+            {
+               /* Inflate the profile now, as png_handle_iCCP would. */
+               png_alloc_size_t check = profile_length;
+               png_byte *profile = png_voidcast(png_byte *,
+                   png_malloc_base(png_ptr, profile_length));
+
+               if (profile == NULL)
+                  errmsg = "out of memory";
+
+               else if (png_inflate_private(png_ptr, data, size, profile,
+                   &check) != Z_STREAM_END || check != profile_length)
+               {
+                  png_free(png_ptr, profile);
+                  errmsg = "damaged profile";
+               }
+
+               else
+               {
+                  png_free(png_ptr, data);
+                  data = profile;
+                  deferred = 0;
+               }
+            }
+
+            if (errmsg == NULL)
+            {
+               if (info_ptr != NULL)
+               {
+                  png_free_data(png_ptr, info_ptr, PNG_FREE_ICCP, 0);
+
+                  info_ptr->iccp_name = name;
+                  info_ptr->iccp_profile = data;
+                  info_ptr->iccp_proflen = profile_length;
+                  info_ptr->free_me |= PNG_FREE_ICCP;
+                  info_ptr->valid |= PNG_INFO_iCCP;
+#                 ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+                     info_ptr->iccp_deferred = deferred;
+                     if (deferred != 0)
+                        info_ptr->deferred = 1;
+#                 endif
+                  return handled_ok;
+               }
+
+               png_free(png_ptr, data);
+               png_free(png_ptr, name);
+               return handled_ok;
+            }
+         }
+
+         /* else png_check_iCCP_compressed or png_icc_check_length output an
+          * error
+          */
+      }
+
+      else
+         errmsg = "out of memory";
+
+      png_free(png_ptr, data);
+      png_free(png_ptr, name);
+   }
+
+   if (errmsg != NULL)
+      png_chunk_benign_error(png_ptr, errmsg);
+
+   return handled_error;
+}
+#endif /* READ_DEFER_DECOMPRESSION || READ_ICC_CACHE */
+
 static png_handle_result_code /* PRIVATE */
 png_handle_iCCP(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
 /* Note: this does not properly handle profiles that are > 64K under DOS */
@@ -1318,6 +2024,15 @@ png_handle_iCCP(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
 
    png_debug(1, "in png_handle_iCCP");
 
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+   if (png_ptr->defer_decompression != 0)
+      return png_handle_iCCP_buffered(png_ptr, info_ptr, length);
+#endif
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+   if (png_ptr->icc_cache != NULL)
+      return png_handle_iCCP_buffered(png_ptr, info_ptr, length);
+#endif
+
    /* PNGv3: allow PNG files with both sRGB and iCCP because the PNG spec only
     * ever said that there "should" be only one, not "shall" and the PNGv3
     * colour chunk precedence rules give a handling for this case anyway.
@@ -1477,7 +2192,7 @@ png_handle_iCCP(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
 
                                     if (errmsg == NULL)
                                     {
-                                       png_ptr->zowner = 0;
+                                       png_inflate_release(png_ptr);
                                        return handled_ok;
                                     }
                                  }
@@ -1504,7 +2219,7 @@ png_handle_iCCP(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
                   errmsg = png_ptr->zstream.msg;
 
                /* Release the stream */
-               png_ptr->zowner = 0;
+               png_inflate_release(png_ptr);
             }
 
             else /* png_inflate_claim failed */
@@ -2493,6 +3208,24 @@ png_handle_zTXt(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
    else if (buffer[keyword_length+1] != PNG_COMPRESSION_TYPE_BASE)
       errmsg = "unknown compression type";
 
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+   else if (png_ptr->defer_decompression != 0)
+   {
+      png_text text;
+
+      text.compression = PNG_TEXT_COMPRESSION_zTXt;
+      text.key = (char *)buffer;
+      text.lang = NULL;
+      text.lang_key = NULL;
+
+      if (png_set_text_deferred(png_ptr, info_ptr, &text,
+          buffer + keyword_length+2, length - (keyword_length+2)) == 0)
+         return handled_ok;
+
+      errmsg = "out of memory";
+   }
+#endif
+
    else
    {
       png_alloc_size_t uncompressed_length = PNG_SIZE_MAX;
@@ -2636,6 +3369,26 @@ png_handle_iTXt(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
       if (compressed == 0 && prefix_length <= length)
          uncompressed_length = length - prefix_length;
 
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+      else if (compressed != 0 && prefix_length < length &&
+          png_ptr->defer_decompression != 0)
+      {
+         png_text text;
+
+         text.compression = PNG_ITXT_COMPRESSION_zTXt;
+         text.key = (char *)buffer;
+         text.lang = (char *)buffer + language_offset;
+         text.lang_key = (char *)buffer + translated_keyword_offset;
+
+         if (png_set_text_deferred(png_ptr, info_ptr, &text,
+             buffer + prefix_length, length - prefix_length) == 0)
+            return handled_ok;
+
+         png_chunk_benign_error(png_ptr, "out of memory");
+         return handled_error;
+      }
+#endif
+
       else if (compressed != 0 && prefix_length < length)
       {
          uncompressed_length = PNG_SIZE_MAX;
@@ -2816,6 +3569,7 @@ png_handle_fcTL(png_struct *png_ptr, png_info *info_ptr, png_uint_32 length)
       png_read_reinit(png_ptr, info_ptr);
 
       png_ptr->mode |= PNG_HAVE_fcTL;
+      png_read_trace(png_ptr, PNG_TRACE_FRAME_START);
    }
 }
 
@@ -2897,6 +3651,7 @@ png_cache_unknown_chunk(png_struct *png_ptr, png_uint_32 length)
       else
       {
          /* Do a 'warn' here - it is handled below. */
+         png_alloc_owner(png_ptr, PNG_ALLOC_CHUNK_DATA);
          png_ptr->unknown_chunk.data = png_voidcast(png_byte *,
              png_malloc_warn(png_ptr, length));
       }
@@ -4312,10 +5067,19 @@ png_read_filter_row(png_struct *pp, png_row_info *row_info, png_byte *row,
 {
    if (filter > PNG_FILTER_VALUE_NONE && filter < PNG_FILTER_VALUE_LAST)
    {
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+      double perf_start = PNG_PERF_CLOCK();
+#endif
+
       if (pp->read_filter[0] == NULL)
          png_init_filter_functions(pp);
 
       pp->read_filter[filter-1](row_info, row, prev_row);
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+      png_perf_count(pp, PNG_PERF_UNFILTER_SUB + filter - 1, perf_start,
+          row_info->rowbytes);
+#endif
    }
 }
 
@@ -4537,6 +5301,8 @@ png_read_finish_IDAT(png_struct *png_ptr)
        */
       (void)png_crc_finish(png_ptr, png_ptr->idat_size);
    }
+
+   png_read_image_end(png_ptr);
 }
 
 void /* PRIVATE */
@@ -4599,7 +5365,16 @@ png_read_start_row(png_struct *png_ptr)
    png_debug(1, "in png_read_start_row");
 
 #ifdef PNG_READ_TRANSFORMS_SUPPORTED
+#  ifdef PNG_READ_APNG_SUPPORTED
+   /* The transformations are set up once, for the first frame; doing it again
+    * would, for example, apply gamma correction to the palette a second time.
+    */
+   if ((png_ptr->apng_flags & PNG_APNG_TRANSFORMS_SET) == 0)
+#  endif
    png_init_read_transformations(png_ptr);
+#  ifdef PNG_READ_APNG_SUPPORTED
+   png_ptr->apng_flags |= PNG_APNG_TRANSFORMS_SET;
+#  endif
 #endif
    if (png_ptr->interlaced != 0)
    {
@@ -4792,6 +5567,8 @@ defined(PNG_USER_TRANSFORM_PTR_SUPPORTED)
       png_free(png_ptr, png_ptr->big_prev_row);
       png_ptr->big_row_buf = png_ptr->big_prev_row = NULL;
 
+      png_alloc_owner(png_ptr, PNG_ALLOC_ROWS);
+
       if (png_ptr->interlaced != 0)
          png_ptr->big_row_buf = (png_byte *)png_calloc(png_ptr,
              row_bytes + 48);
@@ -4799,6 +5576,7 @@ defined(PNG_USER_TRANSFORM_PTR_SUPPORTED)
       else
          png_ptr->big_row_buf = (png_byte *)png_malloc(png_ptr, row_bytes + 48);
 
+      png_alloc_owner(png_ptr, PNG_ALLOC_ROWS);
       png_ptr->big_prev_row = (png_byte *)png_malloc(png_ptr, row_bytes + 48);
 
 #if PNG_TARGET_ROW_ALIGNMENT > 1
@@ -4848,14 +5626,7 @@ defined(PNG_USER_TRANSFORM_PTR_SUPPORTED)
     * does not, so free the read buffer now regardless; the sequential reader
     * reallocates it on demand.
     */
-   if (png_ptr->read_buffer != NULL)
-   {
-      png_byte *buffer = png_ptr->read_buffer;
-
-      png_ptr->read_buffer_size = 0;
-      png_ptr->read_buffer = NULL;
-      png_free(png_ptr, buffer);
-   }
+   png_read_free_buffer(png_ptr);
 
    /* Finally claim the zstream for the inflate of the IDAT data, use the bits
     * value from the stream (note that this will result in a fatal error if the
@@ -4868,6 +5639,133 @@ defined(PNG_USER_TRANSFORM_PTR_SUPPORTED)
    png_ptr->flags |= PNG_FLAG_ROW_INIT;
 }
 
+void /* PRIVATE */
+png_inflate_release(png_struct *png_ptr)
+{
+   png_ptr->zowner = 0;
+
+   if (png_lean_memory(png_ptr) &&
+       (png_ptr->flags & PNG_FLAG_ZSTREAM_INITIALIZED) != 0)
+   {
+      /* The next png_inflate_claim calls inflateInit2 again. */
+      (void)inflateEnd(&png_ptr->zstream);
+      png_ptr->flags &= ~PNG_FLAG_ZSTREAM_INITIALIZED;
+   }
+}
+
+#ifdef PNG_READ_TRACE_SUPPORTED
+static void
+png_trace_emit(png_struct *png_ptr, int event, size_t offset)
+{
+   png_trace_event ev;
+
+   ev.event = event;
+   ev.chunk_name = png_ptr->chunk_name;
+   ev.row = png_ptr->row_number;
+   ev.pass = png_ptr->pass;
+   ev.frame = png_ptr->trace_frame;
+   ev.offset = offset;
+
+   (*(png_ptr->trace_fn))(png_ptr, &ev);
+}
+
+void /* PRIVATE */
+png_trace(png_struct *png_ptr, int event)
+{
+   size_t offset = png_ptr->read_offset;
+   int image_data = png_ptr->chunk_name == png_IDAT;
+
+#ifdef PNG_READ_APNG_SUPPORTED
+   image_data |= png_ptr->chunk_name == png_fdAT;
+#endif
+
+#ifdef PNG_PROGRESSIVE_READ_SUPPORTED
+   /* The progressive reader consumes most input without png_read_data. */
+   if (png_ptr->read_data_fn == png_push_fill_buffer)
+      offset = png_ptr->push_offset - png_ptr->buffer_size;
+#endif
+
+   switch (event)
+   {
+      case PNG_TRACE_CHUNK_START:
+         offset -= 8; /* the header has been read */
+         png_trace_emit(png_ptr, event, offset);
+
+         if (image_data && (png_ptr->trace_state &
+             (PNG_TRACE_IN_IDAT | PNG_TRACE_IDAT_DONE)) == 0)
+         {
+            png_ptr->trace_state |= PNG_TRACE_IN_IDAT;
+            png_trace_emit(png_ptr, PNG_TRACE_IDAT_START, offset);
+         }
+         return;
+
+      case PNG_TRACE_CHUNK_END:
+         if (image_data)
+            png_ptr->trace_idat_end = offset;
+         break;
+
+      case PNG_TRACE_IDAT_END:
+         /* Both events happened at the end of the last image data chunk,
+          * though the progressive reader only finds that out later.
+          */
+         offset = png_ptr->trace_idat_end;
+
+         if ((png_ptr->trace_state & PNG_TRACE_IN_IDAT) != 0)
+            png_trace_emit(png_ptr, event, offset);
+
+         if ((png_ptr->trace_state & PNG_TRACE_IN_FRAME) != 0)
+            png_trace_emit(png_ptr, PNG_TRACE_FRAME_END, offset);
+
+         png_ptr->trace_state = PNG_TRACE_IDAT_DONE;
+         return;
+
+#ifdef PNG_READ_APNG_SUPPORTED
+      case PNG_TRACE_FRAME_START:
+         png_ptr->trace_frame = png_ptr->num_frames_read;
+         png_ptr->trace_state = PNG_TRACE_IN_FRAME;
+         break;
+#endif
+
+      default:
+         break;
+   }
+
+   png_trace_emit(png_ptr, event, offset);
+}
+#endif /* READ_TRACE */
+
+void /* PRIVATE */
+png_read_free_buffer(png_struct *png_ptr)
+{
+   if (png_ptr->read_buffer != NULL)
+   {
+      png_byte *buffer = png_ptr->read_buffer;
+
+      png_ptr->read_buffer_size = 0;
+      png_ptr->read_buffer = NULL;
+      png_free(png_ptr, buffer);
+   }
+}
+
+void /* PRIVATE */
+png_read_image_end(png_struct *png_ptr)
+{
+   png_read_trace(png_ptr, PNG_TRACE_IDAT_END);
+
+   if (!png_lean_memory(png_ptr))
+      return;
+
+   /* png_read_start_row allocates these again for the next APNG frame. */
+   png_free(png_ptr, png_ptr->big_row_buf);
+   png_free(png_ptr, png_ptr->big_prev_row);
+   png_ptr->big_row_buf = png_ptr->big_prev_row = NULL;
+   png_ptr->row_buf = png_ptr->prev_row = NULL;
+   png_ptr->old_big_row_buf_size = 0;
+
+   if (png_ptr->zowner == 0)
+      png_inflate_release(png_ptr);
+}
+
 #ifdef PNG_READ_APNG_SUPPORTED
 /* This function should be called after the main IDAT sequence has been read
  * and before a new fdAT is about to be read. It resets some parts of png_ptr
@@ -4878,6 +5776,7 @@ png_read_reset(png_struct *png_ptr)
 {
    png_ptr->mode &= ~PNG_HAVE_IDAT;
    png_ptr->mode &= ~PNG_AFTER_IDAT;
+   png_ptr->flags &= ~PNG_FLAG_ZSTREAM_ENDED;
    png_ptr->row_number = 0;
    png_ptr->pass = 0;
 }
@@ -4900,6 +5799,13 @@ png_read_reinit(png_struct *png_ptr, png_info *info_ptr)
 void /* PRIVATE */
 png_progressive_read_reset(png_struct *png_ptr)
 {
+   /* PNG_LEAN_MEMORY freed the buffers at the end of the previous frame. */
+   if (png_ptr->big_row_buf == NULL)
+   {
+      png_read_start_row(png_ptr);
+      return;
+   }
+
 #ifdef PNG_READ_INTERLACING_SUPPORTED
    /* Arrays to facilitate easy interlacing - use pass (0 - 6) as index */
 
@@ -2104,6 +2104,32 @@ png_set_check_for_invalid_index(png_struct *png_ptr, int allowed)
 }
 #endif
 
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+void
+png_set_defer_decompression(png_struct *png_ptr, int defer)
+{
+   png_debug(1, "in png_set_defer_decompression");
+
+   if (png_ptr == NULL)
+      return;
+
+   png_ptr->defer_decompression = (png_byte)(defer != 0);
+}
+#endif
+
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+void PNGAPI
+png_set_icc_cache(png_struct *png_ptr, png_icc_cache *cache)
+{
+   png_debug(1, "in png_set_icc_cache");
+
+   if (png_ptr == NULL)
+      return;
+
+   png_ptr->icc_cache = cache;
+}
+#endif
+
 #if defined(PNG_TEXT_SUPPORTED) || defined(PNG_pCAL_SUPPORTED) || \
     defined(PNG_iCCP_SUPPORTED) || defined(PNG_sPLT_SUPPORTED)
 /* Check that the tEXt or zTXt keyword is valid per PNG 1.0 specification,
@@ -54,6 +54,74 @@ typedef struct png_compression_buffer
    (offsetof(png_compression_buffer, output) + (pp)->zbuffer_size)
 #endif
 
+#ifdef PNG_READ_APNG_SUPPORTED
+/* An entry in the frame index built by png_read_frame_index. */
+typedef struct png_frame_index_entry
+{
+   size_t offset;               /* of the fcTL chunk */
+   png_uint_32 sequence_number; /* of the fcTL chunk */
+   png_uint_32 keyframe;        /* the nearest keyframe at or before this one */
+   png_uint_32 width;
+   png_uint_32 height;
+   png_uint_32 x_offset;
+   png_uint_32 y_offset;
+   png_uint_16 delay_num;
+   png_uint_16 delay_den;
+   png_byte dispose_op;
+   png_byte blend_op;
+   png_byte is_idat;            /* the frame is the default image */
+} png_frame_index_entry;
+#endif
+
+#if defined(PNG_WRITE_APNG_SUPPORTED) && defined(PNG_SETJMP_SUPPORTED)
+/* A frame from png_compress_frame; the zlib stream follows the structure in
+ * the same allocation.
+ */
+struct png_compressed_frame_def
+{
+   png_byte *data;              /* the IDAT/fdAT payload */
+   size_t size;
+   png_uint_32 width;
+   png_uint_32 height;
+   png_byte bit_depth;          /* of the png_struct it was compressed for */
+   png_byte color_type;
+   png_byte interlace_type;
+   png_byte malloced;           /* from malloc, not the png_struct */
+};
+#endif
+
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+#ifndef PNG_ICC_CACHE_SIZE
+#  define PNG_ICC_CACHE_SIZE 8
+#endif
+
+/* A profile that passed png_icc_check_length, png_icc_check_header and
+ * png_icc_check_tag_table.  The key is the compressed data of the iCCP chunk,
+ * which is copied so that a match can be confirmed byte for byte, and whether
+ * the image was colour or grayscale, which the header check depends on.
+ */
+typedef struct
+{
+   png_byte *data;              /* compressed profile, from malloc */
+   png_uint_32 size;
+   png_uint_32 hash;            /* crc32 of data */
+   png_uint_32 profile_length;  /* the uncompressed length */
+   png_byte color;              /* PNG_COLOR_MASK_COLOR of the color type */
+} png_icc_cache_entry;
+
+struct png_icc_cache_def
+{
+   png_icc_cache_entry entry[PNG_ICC_CACHE_SIZE];
+   unsigned int next;           /* the entry replaced by the next miss */
+   png_uint_32 hits;
+};
+#endif
+
+#ifdef PNG_USER_MEM_SUPPORTED
+/* Allocator state of png_create_*_struct_arena, private to pngmem.c. */
+typedef struct png_arena_def png_arena;
+#endif
+
 /* Colorspace support; structures used in png_struct, png_info and in internal
  * functions to hold and communicate information about the color space.
  */
@@ -122,6 +190,9 @@ struct png_struct_def
 #endif
    void *error_ptr;       /* user supplied struct for error functions */
    png_rw_ptr write_data_fn;  /* function for writing output data */
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+   png_write_v_ptr write_v_fn; /* vectored output, overrides write_data_fn */
+#endif
    png_rw_ptr read_data_fn;   /* function for reading input data */
    void *io_ptr;          /* ptr to application struct for I/O functions */
 
@@ -149,6 +220,16 @@ struct png_struct_def
 
    png_uint_32 zowner;        /* ID (chunk type) of zstream owner, 0 if none */
    z_stream    zstream;       /* decompression structure */
+   png_alloc_size_t zstream_memory; /* allocated by zlib for zstream */
+#ifdef PNG_ALLOC_STATS_SUPPORTED
+   png_alloc_stats alloc_stats; /* for png_get_alloc_stats */
+   png_byte alloc_owner;      /* PNG_ALLOC_ owner of the next allocation */
+#endif
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   png_perf_counter perf_counters[PNG_PERF_STAGES];
+   double perf_filter_start;  /* PNG_PERF_CLOCK() at png_write_find_filter */
+#endif
 
 #ifdef PNG_WRITE_SUPPORTED
    png_compression_buffer *zbuffer_list; /* Created on demand during write */
@@ -177,6 +258,9 @@ struct png_struct_def
    int zlib_set_mem_level;
    int zlib_set_strategy;
 #endif
+#ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+   png_byte encode_speed;     /* png_set_encode_speed value + 1, 0 if unset */
+#endif
 
    png_uint_32 chunks; /* PNG_CF_ for every chunk read or (NYI) written */
 #  define png_has_chunk(png_ptr, cHNK)\
@@ -296,6 +380,13 @@ struct png_struct_def
 
    png_read_status_ptr read_row_fn;   /* called after each row is decoded */
    png_write_status_ptr write_row_fn; /* called after each row is encoded */
+#ifdef PNG_READ_TRACE_SUPPORTED
+   png_trace_ptr trace_fn;           /* called at each chunk, row and frame */
+   void *trace_ptr;                  /* user supplied struct for trace_fn */
+   size_t trace_idat_end;            /* after the last image data chunk */
+   png_uint_32 trace_frame;          /* frame number of the last fcTL */
+   png_byte trace_state;             /* PNG_TRACE_IN_IDAT etc, in pngpriv.h */
+#endif
 #ifdef PNG_PROGRESSIVE_READ_SUPPORTED
    png_progressive_info_ptr info_fn; /* called after header data fully read */
    png_progressive_row_ptr row_fn;   /* called after a prog. row is decoded */
@@ -310,6 +401,7 @@ struct png_struct_def
    size_t save_buffer_max;           /* total size of save_buffer */
    size_t buffer_size;               /* total amount of available input data */
    size_t current_buffer_size;       /* amount of data now in current_buffer */
+   size_t push_offset;               /* input supplied, from the signature */
    int process_mode;                 /* what push library is currently doing */
    int cur_palette;                  /* current push library palette index */
 #endif /* PROGRESSIVE_READ */
@@ -371,6 +463,10 @@ struct png_struct_def
 #ifdef PNG_READ_APNG_SUPPORTED
    png_uint_32 num_frames_read;      /* incremented after all image data of */
                                      /* a frame is read */
+   png_frame_index_entry *frame_index;
+   png_uint_32 frame_index_size;     /* number of frames in frame_index */
+   png_uint_32 idat_length;          /* of the first IDAT chunk */
+   size_t idat_offset;               /* of the first IDAT chunk data */
 #ifdef PNG_PROGRESSIVE_READ_SUPPORTED
    png_progressive_frame_ptr frame_info_fn; /* frame info read callback */
    png_progressive_frame_ptr frame_end_fn;  /* frame data read callback */
@@ -380,6 +476,25 @@ struct png_struct_def
 #ifdef PNG_WRITE_APNG_SUPPORTED
    png_uint_32 num_frames_to_write;
    png_uint_32 num_frames_written;
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   png_byte frame_do_filter;         /* do_filter before the frame started */
+#endif
+
+   /* png_write_canvas_frame: the canvas as a decoder will have it before the
+    * pending frame is shown, the pending frame itself (both in the user row
+    * format) and the part of the canvas the pending frame changes.
+    */
+   png_byte *canvas_start;
+   png_byte *canvas_pending;
+   png_byte *canvas_row;
+   size_t canvas_rowbytes;
+   png_uint_32 pending_x_offset;
+   png_uint_32 pending_y_offset;
+   png_uint_32 pending_width;        /* 0 if there is no pending frame */
+   png_uint_32 pending_height;
+   png_uint_16 pending_delay_num;
+   png_uint_16 pending_delay_den;
+   png_byte pending_blend_op;
 #endif
 #endif /* PNG_APNG_SUPPORTED */
 
@@ -390,6 +505,7 @@ struct png_struct_def
    void *mem_ptr;             /* user supplied struct for mem functions */
    png_malloc_ptr malloc_fn;      /* function for allocating memory */
    png_free_ptr free_fn;          /* function for freeing memory */
+   png_arena *arena;              /* set by png_create_*_struct_arena */
 #endif
 
 /* New member added in libpng-1.0.13 and 1.2.0 */
@@ -436,6 +552,23 @@ struct png_struct_def
 /* New member added in libpng-1.2.30 */
   png_byte *        read_buffer;      /* buffer for reading chunk data */
   png_alloc_size_t read_buffer_size; /* current size of the buffer */
+  size_t           read_offset;      /* from the start of the signature */
+#endif
+#ifdef PNG_READ_SEEK_SUPPORTED
+  png_seek_ptr     seek_data_fn;     /* to skip chunk data and seek frames */
+#endif
+#ifdef PNG_READ_AHEAD_SUPPORTED
+  png_byte *        read_ahead;       /* input read but not yet used */
+  size_t           read_ahead_size;  /* its size, 0 if read-ahead is off */
+  size_t           read_ahead_next;  /* the unused bytes are next..end */
+  size_t           read_ahead_end;
+  size_t           read_known;       /* input up to here is known to exist */
+#endif
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+  png_byte         defer_decompression; /* keep zTXt, iTXt, iCCP compressed */
+#endif
+#ifdef PNG_READ_ICC_CACHE_SUPPORTED
+  png_icc_cache *  icc_cache;        /* checked iCCP profiles, not owned */
 #endif
 #ifdef PNG_SEQUENTIAL_READ_SUPPORTED
   uInt             IDAT_read_size;   /* limit on read buffer size for IDAT */
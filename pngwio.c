@@ -31,6 +31,18 @@
 void /* PRIVATE */
 png_write_data(png_struct *png_ptr, const png_byte *data, size_t length)
 {
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+   if (png_ptr->write_v_fn != NULL)
+   {
+      png_iovec vec;
+
+      vec.data = data;
+      vec.length = length;
+      (*(png_ptr->write_v_fn))(png_ptr, &vec, 1);
+      return;
+   }
+#endif
+
    /* NOTE: write_data_fn must not change the buffer! */
    if (png_ptr->write_data_fn != NULL )
       (*(png_ptr->write_data_fn))(png_ptr, png_constcast(png_byte *,data),
@@ -40,6 +52,23 @@ png_write_data(png_struct *png_ptr, const png_byte *data, size_t length)
       png_error(png_ptr, "Call to NULL write function");
 }
 
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+void /* PRIVATE */
+png_write_data_v(png_struct *png_ptr, const png_iovec *vec, int count)
+{
+   if (png_ptr->write_v_fn != NULL)
+      (*(png_ptr->write_v_fn))(png_ptr, vec, count);
+
+   else
+   {
+      int i;
+
+      for (i = 0; i < count; ++i)
+         png_write_data(png_ptr, vec[i].data, vec[i].length);
+   }
+}
+#endif
+
 #ifdef PNG_STDIO_SUPPORTED
 /* This is the function that does the actual writing of data.  If you are
  * not writing to a standard C stream, you should create a replacement
@@ -126,6 +155,10 @@ png_set_write_fn(png_struct *png_ptr, void *io_ptr,
 
    png_ptr->io_ptr = io_ptr;
 
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+   png_ptr->write_v_fn = NULL;
+#endif
+
 #ifdef PNG_STDIO_SUPPORTED
    if (write_data_fn != NULL)
       png_ptr->write_data_fn = write_data_fn;
@@ -164,4 +197,29 @@ png_set_write_fn(png_struct *png_ptr, void *io_ptr,
    }
 #endif
 }
+
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+/* As png_set_write_fn, but the output goes to a function that takes several
+ * pieces at once; png_write_complete_chunk uses this to pass a whole chunk in
+ * one call.  A NULL write_v_fn is the same as png_set_write_fn with NULL.
+ */
+void
+png_set_write_fn_v(png_struct *png_ptr, void *io_ptr,
+    png_write_v_ptr write_v_fn, png_flush_ptr output_flush_fn)
+{
+   if (png_ptr == NULL)
+      return;
+
+   png_set_write_fn(png_ptr, io_ptr, NULL, output_flush_fn);
+
+   if (write_v_fn == NULL)
+      return;
+
+   png_ptr->write_v_fn = write_v_fn;
+
+   /* Larger IDAT chunks, unless the application chose a size already. */
+   if (png_ptr->zbuffer_size == PNG_ZBUF_SIZE && png_ptr->zowner == 0)
+      png_set_compression_buffer_size(png_ptr, PNG_WRITE_VECTOR_ZBUF_SIZE);
+}
+#endif /* WRITE_VECTOR */
 #endif /* WRITE */
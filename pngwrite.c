@@ -87,6 +87,13 @@ png_write_info_before_PLTE(png_struct *png_ptr, const png_info *info_ptr)
    if (png_ptr == NULL || info_ptr == NULL)
       return;
 
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+   /* The png_info may come from a reader that deferred decompression; the
+    * data is inflated in place despite the const, as documented in png.h.
+    */
+   png_inflate_deferred(png_ptr, png_constcast(png_info *, info_ptr));
+#endif
+
    if ((png_ptr->mode & PNG_WROTE_INFO_BEFORE_PLTE) == 0)
    {
       /* Write PNG signature */
@@ -401,6 +408,17 @@ png_write_end(png_struct *png_ptr, png_info *info_ptr)
    if (png_ptr == NULL)
       return;
 
+#ifdef PNG_WRITE_APNG_SUPPORTED
+   /* The last frame given to png_write_canvas_frame is still pending. */
+   if (png_ptr->pending_width != 0)
+   {
+      if (info_ptr == NULL)
+         png_error(png_ptr, "png_write_end: info_ptr needed for APNG frame");
+
+      png_write_canvas_pending(png_ptr, info_ptr, PNG_fcTL_DISPOSE_OP_NONE);
+   }
+#endif
+
    if ((png_ptr->mode & PNG_HAVE_IDAT) == 0)
       png_error(png_ptr, "No IDATs written into file");
 
@@ -421,6 +439,9 @@ png_write_end(png_struct *png_ptr, png_info *info_ptr)
 #ifdef PNG_WRITE_TEXT_SUPPORTED
       int i; /* local index variable */
 #endif
+#ifdef PNG_READ_DEFER_DECOMPRESSION_SUPPORTED
+      png_inflate_deferred(png_ptr, info_ptr);
+#endif
 #ifdef PNG_WRITE_tIME_SUPPORTED
       /* Check to see if user has supplied a time chunk */
       if ((info_ptr->valid & PNG_INFO_tIME) != 0 &&
@@ -627,6 +648,24 @@ png_create_write_struct_2,(const char *user_png_ver, void *error_ptr,
    return png_ptr;
 }
 
+#ifdef PNG_USER_MEM_SUPPORTED
+/* Create a write structure that allocates everything from an arena. */
+PNG_FUNCTION(png_struct *,
+png_create_write_struct_arena,(const char *user_png_ver, void *error_ptr,
+    png_error_ptr error_fn, png_error_ptr warn_fn, void *arena,
+    size_t arena_size),
+    PNG_ALLOCATED)
+{
+   png_arena *state = png_arena_create(arena, arena_size);
+
+   if (state == NULL)
+      return NULL;
+
+   return png_arena_attach(png_create_write_struct_2(user_png_ver, error_ptr,
+       error_fn, warn_fn, state, png_arena_malloc, png_arena_free), state);
+}
+#endif /* USER_MEM */
+
 
 /* Write a few rows of image data.  If the image is interlaced,
  * either you will have to write the 7 sub images, or, if you
@@ -1015,6 +1054,15 @@ png_write_destroy(png_struct *png_ptr)
    png_ptr->tst_row = NULL;
 #endif
 
+#ifdef PNG_WRITE_APNG_SUPPORTED
+   png_free(png_ptr, png_ptr->canvas_start);
+   png_free(png_ptr, png_ptr->canvas_pending);
+   png_free(png_ptr, png_ptr->canvas_row);
+   png_ptr->canvas_start = NULL;
+   png_ptr->canvas_pending = NULL;
+   png_ptr->canvas_row = NULL;
+#endif
+
 #ifdef PNG_SET_UNKNOWN_CHUNKS_SUPPORTED
    png_free(png_ptr, png_ptr->chunk_list);
    png_ptr->chunk_list = NULL;
@@ -1275,6 +1323,122 @@ png_set_compression_method(png_struct *png_ptr, int method)
 
    png_ptr->zlib_method = method;
 }
+
+/* The encode speed presets.  These were determined by timing the write of
+ * 24-bit and 32-bit photographic and synthetic (screen capture) images with
+ * every combination of filters, level and strategy and keeping the ones on the
+ * size/time Pareto front.  The main results are:
+ *
+ * 1) Z_FILTERED only differs from Z_DEFAULT_STRATEGY at levels 4 and above,
+ *    where it gives smaller output on photographic images for a modest cost.
+ * 2) Z_RLE ignores the level, is the fastest strategy with filtered data and
+ *    compresses photographic images about as well as level 6; it does badly on
+ *    unfiltered data and on synthetic images, but is still the fastest.
+ * 3) The UP filter on its own is both the fastest filter and typically the
+ *    best single filter; adding SUB, and then PAETH, helps at the higher
+ *    levels.  AVG rarely helps except at the highest levels.
+ *
+ * Images which are palette mapped or have less than 8 bits per pixel are not
+ * filtered by libpng (see png_write_IHDR) so a separate set of presets is used
+ * for these which only varies the zlib parameters.
+ */
+#ifndef Z_RLE
+#  define Z_RLE Z_DEFAULT_STRATEGY /* zlib versions before 1.2.0.1 */
+#endif
+
+typedef struct
+{
+   png_byte filters;
+   png_byte level;
+   png_byte strategy;
+   png_byte mem_level;
+} png_encode_preset;
+
+static const png_encode_preset png_encode_filtered[10] =
+{
+   { PNG_ALL_FILTERS, 9, Z_FILTERED, 9 },
+   { PNG_ALL_FILTERS, 7, Z_FILTERED, 9 },
+   { PNG_ALL_FILTERS, 6, Z_FILTERED, 8 }, /* libpng defaults */
+   { PNG_FILTER_SUB|PNG_FILTER_UP|PNG_FILTER_PAETH, 6, Z_FILTERED, 8 },
+   { PNG_FILTER_SUB|PNG_FILTER_UP|PNG_FILTER_PAETH, 5, Z_FILTERED, 8 },
+   { PNG_FILTER_SUB|PNG_FILTER_UP, 4, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_SUB|PNG_FILTER_UP, 2, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_UP, 2, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_UP, 1, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_UP, 1, Z_RLE, 8 }
+};
+
+static const png_encode_preset png_encode_unfiltered[10] =
+{
+   { PNG_FILTER_NONE, 9, Z_DEFAULT_STRATEGY, 9 },
+   { PNG_FILTER_NONE, 8, Z_DEFAULT_STRATEGY, 9 },
+   { PNG_FILTER_NONE, 6, Z_DEFAULT_STRATEGY, 8 }, /* libpng defaults */
+   { PNG_FILTER_NONE, 5, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_NONE, 4, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_NONE, 3, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_NONE, 2, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_NONE, 1, Z_DEFAULT_STRATEGY, 8 },
+   { PNG_FILTER_NONE, 1, Z_DEFAULT_STRATEGY, 7 },
+   { PNG_FILTER_NONE, 1, Z_RLE, 8 }
+};
+
+void
+png_set_encode_speed(png_struct *png_ptr, int speed)
+{
+   png_debug(1, "in png_set_encode_speed");
+
+   if (png_ptr == NULL)
+      return;
+
+   if (speed == PNG_ENCODE_SPEED_DEFAULT)
+   {
+      png_ptr->encode_speed = 0;
+      return;
+   }
+
+   if (speed < PNG_ENCODE_SPEED_SMALLEST || speed > PNG_ENCODE_SPEED_FASTEST)
+   {
+      png_app_error(png_ptr, "png_set_encode_speed: invalid speed");
+      return;
+   }
+
+   png_ptr->encode_speed = (png_byte)(speed + 1);
+
+   /* If the IHDR has already been written the color type and bit depth are
+    * known, so the preset can be applied now.
+    */
+   if ((png_ptr->mode & PNG_HAVE_IHDR) != 0)
+      png_write_encode_speed(png_ptr);
+}
+
+void /* PRIVATE */
+png_write_encode_speed(png_struct *png_ptr)
+{
+   const png_encode_preset *preset;
+
+   if (png_ptr->encode_speed == 0)
+      return;
+
+   if (png_ptr->color_type == PNG_COLOR_TYPE_PALETTE ||
+       png_ptr->bit_depth < 8)
+      preset = png_encode_unfiltered;
+
+   else
+      preset = png_encode_filtered;
+
+   preset += png_ptr->encode_speed - 1;
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, preset->filters);
+#else
+   png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+#endif
+
+   png_ptr->zlib_level = preset->level;
+   png_ptr->zlib_mem_level = preset->mem_level;
+   png_ptr->zlib_strategy = preset->strategy;
+   png_ptr->flags |= PNG_FLAG_ZLIB_CUSTOM_STRATEGY;
+}
 #endif /* WRITE_CUSTOMIZE_COMPRESSION */
 
 /* The following were added to libpng-1.5.4 */
@@ -1525,6 +1689,13 @@ png_write_frame_head(png_struct *png_ptr, png_info *info_ptr,
 
    png_write_reset(png_ptr);
 
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   /* png_write_start_row removes filters that cannot be used on a frame one
+    * pixel wide or high; restore them for the next frame in the tail.
+    */
+   png_ptr->frame_do_filter = png_ptr->do_filter;
+#endif
+
    png_write_reinit(png_ptr, info_ptr, width, height);
 
    if (!(png_ptr->num_frames_written == 0 &&
@@ -1540,192 +1711,978 @@ png_write_frame_tail(png_struct *png_ptr, png_info *info_ptr)
 {
    png_debug(1, "in png_write_frame_tail");
 
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   png_ptr->do_filter = png_ptr->frame_do_filter;
+#endif
+
    png_ptr->num_frames_written++;
 
    PNG_UNUSED(info_ptr)
 }
-#endif /* PNG_WRITE_APNG_SUPPORTED */
 
-#ifdef PNG_SIMPLIFIED_WRITE_SUPPORTED
-/* Initialize the write structure - general purpose utility. */
-static int
-png_image_write_init(png_image *image)
+/* png_write_canvas_frame support.  Differences between canvases are found a
+ * byte at a time, so with pixels of less than 8 bits a box may include a few
+ * unchanged pixels at either end.  That is harmless because such frames are
+ * always written with APNG_BLEND_OP_SOURCE.
+ */
+typedef struct
 {
-   png_struct *png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, image,
-       png_safe_error, png_safe_warning);
+   size_t left, right;          /* bytes [left,right) of a canvas row */
+   png_uint_32 top, bottom;     /* rows [top,bottom), empty if top == bottom */
+} png_canvas_box;
 
-   if (png_ptr != NULL)
+static void
+png_canvas_box_add(png_canvas_box *box, size_t left, size_t right,
+    png_uint_32 top, png_uint_32 bottom)
+{
+   if (box->top == box->bottom)
    {
-      png_info *info_ptr = png_create_info_struct(png_ptr);
+      box->left = left;
+      box->right = right;
+      box->top = top;
+      box->bottom = bottom;
+   }
 
-      if (info_ptr != NULL)
-      {
-         png_control *control = png_voidcast(png_control *,
-             png_malloc_warn(png_ptr, (sizeof *control)));
+   else
+   {
+      if (left < box->left)
+         box->left = left;
+      if (right > box->right)
+         box->right = right;
+      if (top < box->top)
+         box->top = top;
+      if (bottom > box->bottom)
+         box->bottom = bottom;
+   }
+}
 
-         if (control != NULL)
-         {
-            memset(control, 0, (sizeof *control));
+/* Add to 'box' the bytes in [start,end) of row 'y' where 'a' and 'b' differ;
+ * a NULL 'b' stands for a row of zero (transparent black) bytes.
+ */
+static void
+png_canvas_diff(png_canvas_box *box, png_uint_32 y, const png_byte *a,
+    const png_byte *b, size_t start, size_t end)
+{
+   size_t first = start, last = end;
 
-            control->png_ptr = png_ptr;
-            control->info_ptr = info_ptr;
-            control->for_write = 1;
+   if (b != NULL)
+   {
+      if (memcmp(a + start, b + start, end - start) == 0)
+         return;
 
-            image->opaque = control;
-            return 1;
-         }
+      while (a[first] == b[first])
+         ++first;
 
-         /* Error clean up */
-         png_destroy_info_struct(png_ptr, &info_ptr);
-      }
+      while (a[last-1] == b[last-1])
+         --last;
+   }
 
-      png_destroy_write_struct(&png_ptr, NULL);
+   else
+   {
+      while (first < last && a[first] == 0)
+         ++first;
+
+      while (last > first && a[last-1] == 0)
+         --last;
+
+      if (first == last)
+         return;
    }
 
-   return png_image_error(image, "png_image_write_: out of memory");
+   png_canvas_box_add(box, first, last, y, y+1);
 }
 
-/* Arguments to png_image_write_main: */
-typedef struct
+/* The number of pixels in the frame written for 'box'; a frame cannot be
+ * empty so an empty box costs one pixel.
+ */
+static png_alloc_size_t
+png_canvas_box_area(const png_canvas_box *box)
 {
-   /* Arguments */
-   png_image *image;
-   const void *buffer;
-   png_int_32 row_stride;
-   const void *colormap;
-   int convert_to_8bit;
+   if (box->top == box->bottom)
+      return 1;
 
-   /* Instance variables */
-   const void *first_row;
-   void *local_row;
-   ptrdiff_t row_step;
-
-   /* Byte count for memory writing */
-   png_byte *memory;
-   png_alloc_size_t memory_bytes; /* not used for STDIO */
-   png_alloc_size_t output_bytes; /* running total */
-} png_image_write_control;
+   return (png_alloc_size_t)(box->right - box->left) *
+      (box->bottom - box->top);
+}
 
-/* Write png_uint_16 input to a 16-bit PNG; the png_ptr has already been set to
- * do any necessary byte swapping.  The component order is defined by the
- * png_image format value.
+/* BLEND_OP_OVER can be used for the pending frame if every changed pixel is
+ * opaque; the unchanged pixels are then written as transparent black, which
+ * deflate handles far better than the original pixels.  This relies on the
+ * alpha channel being the last one in the user rows.
  */
-static int
-png_write_image_16bit(void *argument)
+static png_byte
+png_canvas_blend_op(png_struct *png_ptr)
 {
-   png_image_write_control *display = png_voidcast(png_image_write_control*,
-       argument);
-   png_image *image = display->image;
-   png_struct *png_ptr = image->opaque->png_ptr;
+   size_t rowbytes = png_ptr->canvas_rowbytes;
+   unsigned int bpp, alpha_bytes;
+   int unchanged = 0;
+   png_uint_32 y;
 
-   const png_uint_16 *input_row = png_voidcast(const png_uint_16 *,
-       display->first_row);
-   png_uint_16 *output_row = png_voidcast(png_uint_16 *, display->local_row);
-   png_uint_16 *row_end;
-   unsigned int channels = (image->format & PNG_FORMAT_FLAG_COLOR) != 0 ?
-       3 : 1;
-   int aindex = 0;
-   png_uint_32 y = image->height;
+   if ((png_ptr->color_type & PNG_COLOR_MASK_ALPHA) == 0 ||
+       (png_ptr->transformations &
+        ~(PNG_INTERLACE | PNG_BGR | PNG_SWAP_BYTES)) != 0)
+      return PNG_fcTL_BLEND_OP_SOURCE;
 
-   if ((image->format & PNG_FORMAT_FLAG_ALPHA) != 0)
+   bpp = (png_ptr->usr_channels * png_ptr->usr_bit_depth) >> 3;
+   alpha_bytes = png_ptr->bit_depth >> 3;
+
+   for (y = 0; y < png_ptr->pending_height; ++y)
    {
-#   ifdef PNG_SIMPLIFIED_WRITE_AFIRST_SUPPORTED
-      if ((image->format & PNG_FORMAT_FLAG_AFIRST) != 0)
+      size_t offset = (png_ptr->pending_y_offset + y) * rowbytes +
+         png_ptr->pending_x_offset * bpp;
+      const png_byte *cp = png_ptr->canvas_pending + offset;
+      const png_byte *sp = png_ptr->canvas_start + offset;
+      png_uint_32 x;
+
+      for (x = 0; x < png_ptr->pending_width; ++x, cp += bpp, sp += bpp)
       {
-         aindex = -1;
-         ++input_row; /* To point to the first component */
-         ++output_row;
-      }
-         else
-            aindex = (int)channels;
-#     else
-         aindex = (int)channels;
-#     endif
-   }
+         if (memcmp(cp, sp, bpp) == 0)
+            unchanged = 1;
 
-   else
-      png_error(png_ptr, "png_write_image: internal call error");
+         else
+         {
+            unsigned int i;
 
-   /* Work out the output row end and count over this, note that the increment
-    * above to 'row' means that row_end can actually be beyond the end of the
-    * row; this is correct.
-    */
-   row_end = output_row + image->width * (channels+1);
+            for (i = bpp - alpha_bytes; i < bpp; ++i)
+               if (cp[i] != 0xff)
+                  return PNG_fcTL_BLEND_OP_SOURCE;
+         }
+      }
+   }
 
-   for (; y > 0; --y)
-   {
-      const png_uint_16 *in_ptr = input_row;
-      png_uint_16 *out_ptr = output_row;
+   return unchanged != 0 ? PNG_fcTL_BLEND_OP_OVER : PNG_fcTL_BLEND_OP_SOURCE;
+}
 
-      while (out_ptr < row_end)
-      {
-         png_uint_16 alpha = in_ptr[aindex];
-         png_uint_32 reciprocal = 0;
-         int c;
+/* Make the current contents of canvas_pending the pending frame, covering
+ * 'box', which holds the differences from canvas_start.
+ */
+static void
+png_canvas_set_pending(png_struct *png_ptr, const png_canvas_box *box,
+    png_uint_16 delay_num, png_uint_16 delay_den)
+{
+   unsigned int pixel_depth = png_ptr->usr_channels * png_ptr->usr_bit_depth;
 
-         out_ptr[aindex] = alpha;
+   png_ptr->pending_delay_num = delay_num;
+   png_ptr->pending_delay_den = delay_den;
+   png_ptr->pending_blend_op = PNG_fcTL_BLEND_OP_SOURCE;
 
-         /* Calculate a reciprocal.  The correct calculation is simply
-          * component/alpha*65535 << 15. (I.e. 15 bits of precision); this
-          * allows correct rounding by adding .5 before the shift.  'reciprocal'
-          * is only initialized when required.
-          */
-         if (alpha > 0 && alpha < 65535)
-            reciprocal = ((0xffff<<15)+(alpha>>1))/alpha;
+   /* The first frame is the IDAT and always covers the whole canvas. */
+   if (png_ptr->num_frames_written == 0)
+   {
+      png_ptr->pending_x_offset = 0;
+      png_ptr->pending_y_offset = 0;
+      png_ptr->pending_width = png_ptr->first_frame_width;
+      png_ptr->pending_height = png_ptr->first_frame_height;
+      return;
+   }
 
-         c = (int)channels;
-         do /* always at least one channel */
-         {
-            png_uint_16 component = *in_ptr++;
+   /* Nothing changed: repeat the top left pixel. */
+   if (box->top == box->bottom)
+   {
+      png_ptr->pending_x_offset = 0;
+      png_ptr->pending_y_offset = 0;
+      png_ptr->pending_width = 1;
+      png_ptr->pending_height = 1;
+      return;
+   }
 
-            /* The following gives 65535 for an alpha of 0, which is fine,
-             * otherwise if 0/0 is represented as some other value there is more
-             * likely to be a discontinuity which will probably damage
-             * compression when moving from a fully transparent area to a
-             * nearly transparent one.  (The assumption here is that opaque
-             * areas tend not to be 0 intensity.)
-             */
-            if (component >= alpha)
-               component = 65535;
+   if (pixel_depth >= 8)
+   {
+      unsigned int bpp = pixel_depth >> 3;
 
-            /* component<alpha, so component/alpha is less than one and
-             * component*reciprocal is less than 2^31.
-             */
-            else if (component > 0 && alpha < 65535)
-            {
-               png_uint_32 calc = component * reciprocal;
-               calc += 16384; /* round to nearest */
-               component = (png_uint_16)(calc >> 15);
-            }
+      png_ptr->pending_x_offset = (png_uint_32)(box->left / bpp);
+      png_ptr->pending_width = (png_uint_32)((box->right + bpp - 1) / bpp) -
+         png_ptr->pending_x_offset;
+   }
 
-            *out_ptr++ = component;
-         }
-         while (--c > 0);
+   else
+   {
+      unsigned int ppb = 8 / pixel_depth; /* pixels per byte */
+      png_uint_32 right = (png_uint_32)(box->right * ppb);
 
-         /* Skip to next component (skip the intervening alpha channel) */
-         ++in_ptr;
-         ++out_ptr;
-      }
+      if (right > png_ptr->first_frame_width)
+         right = png_ptr->first_frame_width;
 
-      png_write_row(png_ptr,
-          png_voidcast(const png_byte *, display->local_row));
-      input_row += display->row_step / 2;
+      png_ptr->pending_x_offset = (png_uint_32)(box->left * ppb);
+      png_ptr->pending_width = right - png_ptr->pending_x_offset;
    }
 
-   return 1;
+   png_ptr->pending_y_offset = box->top;
+   png_ptr->pending_height = box->bottom - box->top;
+   png_ptr->pending_blend_op = png_canvas_blend_op(png_ptr);
 }
 
-/* Given 16-bit input (1 to 4 channels) write 8-bit output.  If an alpha channel
- * is present it must be removed from the components, the components are then
- * written in sRGB encoding.  No components are added or removed.
- *
- * Calculate an alpha reciprocal to reverse pre-multiplication.  As above the
- * calculation can be done to 15 bits of accuracy; however, the output needs to
- * be scaled in the range 0..255*65535, so include that scaling here.
- */
-#   define UNP_RECIPROCAL(alpha) ((((0xffff*0xff)<<7)+((alpha)>>1))/(alpha))
+/* Write the pending frame with the given dispose_op. */
+void /* PRIVATE */
+png_write_canvas_pending(png_struct *png_ptr, png_info *info_ptr,
+    png_byte dispose_op)
+{
+   size_t rowbytes = png_ptr->canvas_rowbytes;
+   unsigned int pixel_depth = png_ptr->usr_channels * png_ptr->usr_bit_depth;
+   size_t offset;
+   int num_pass, pass;
 
-static png_byte
+   if (pixel_depth >= 8)
+      offset = png_ptr->pending_x_offset * (pixel_depth >> 3);
+   else
+      offset = png_ptr->pending_x_offset / (8 / pixel_depth);
+
+   png_write_frame_head(png_ptr, info_ptr, NULL, png_ptr->pending_width,
+       png_ptr->pending_height, png_ptr->pending_x_offset,
+       png_ptr->pending_y_offset, png_ptr->pending_delay_num,
+       png_ptr->pending_delay_den, dispose_op, png_ptr->pending_blend_op);
+
+#ifdef PNG_WRITE_INTERLACING_SUPPORTED
+   num_pass = png_set_interlace_handling(png_ptr);
+#else
+   num_pass = 1;
+#endif
+
+   for (pass = 0; pass < num_pass; ++pass)
+   {
+      png_uint_32 y;
+
+      for (y = 0; y < png_ptr->pending_height; ++y)
+      {
+         size_t start = (png_ptr->pending_y_offset + y) * rowbytes + offset;
+         const png_byte *row = png_ptr->canvas_pending + start;
+
+         if (png_ptr->pending_blend_op == PNG_fcTL_BLEND_OP_OVER)
+         {
+            unsigned int bpp = pixel_depth >> 3;
+            const png_byte *sp = png_ptr->canvas_start + start;
+            png_byte *dp = png_ptr->canvas_row;
+            png_uint_32 x;
+
+            for (x = 0; x < png_ptr->pending_width;
+                 ++x, row += bpp, sp += bpp, dp += bpp)
+            {
+               if (memcmp(row, sp, bpp) == 0)
+                  memset(dp, 0, bpp);
+               else
+                  memcpy(dp, row, bpp);
+            }
+
+            row = png_ptr->canvas_row;
+         }
+
+         png_write_row(png_ptr, row);
+      }
+   }
+
+   png_write_frame_tail(png_ptr, info_ptr);
+
+   png_ptr->pending_width = 0;
+}
+
+void PNGAPI
+png_write_canvas_frame(png_struct *png_ptr, png_info *info_ptr,
+    png_byte **row_pointers, png_uint_16 delay_num, png_uint_16 delay_den)
+{
+   png_uint_32 height, y;
+   size_t rowbytes;
+   png_canvas_box box;
+
+   png_debug(1, "in png_write_canvas_frame");
+
+   if (png_ptr == NULL || info_ptr == NULL)
+      return;
+
+   if (row_pointers == NULL)
+      png_error(png_ptr, "png_write_canvas_frame: no rows");
+
+   if ((info_ptr->valid & PNG_INFO_acTL) == 0)
+      png_error(png_ptr, "Cannot write APNG frame: missing acTL");
+
+   if (png_ptr->num_frames_written == 0 &&
+       (png_ptr->apng_flags & PNG_FIRST_FRAME_HIDDEN) != 0)
+      png_error(png_ptr,
+          "png_write_canvas_frame: hidden default image not written");
+
+   if (png_ptr->num_frames_written + (png_ptr->pending_width != 0) >=
+       png_ptr->num_frames_to_write)
+      png_error(png_ptr, "Too many APNG frames");
+
+   height = png_ptr->first_frame_height;
+
+   if (png_ptr->canvas_pending == NULL)
+   {
+      rowbytes = PNG_ROWBYTES(png_ptr->usr_channels * png_ptr->usr_bit_depth,
+          png_ptr->first_frame_width);
+
+      if (height > PNG_SIZE_MAX / rowbytes)
+         png_error(png_ptr, "APNG canvas too large");
+
+      /* The canvas starts out transparent black. */
+      png_ptr->canvas_start = png_voidcast(png_byte *,
+          png_calloc(png_ptr, rowbytes * height));
+      png_ptr->canvas_pending = png_voidcast(png_byte *,
+          png_malloc(png_ptr, rowbytes * height));
+      png_ptr->canvas_row = png_voidcast(png_byte *,
+          png_malloc(png_ptr, rowbytes));
+      png_ptr->canvas_rowbytes = rowbytes;
+   }
+
+   rowbytes = png_ptr->canvas_rowbytes;
+   memset(&box, 0, sizeof box);
+
+   if (png_ptr->pending_width != 0)
+   {
+      /* Choose the dispose_op of the pending frame which leaves the least to
+       * write for this one.  Outside the pending frame's area all three leave
+       * canvas_start, which equals canvas_pending there; inside, NONE leaves
+       * canvas_pending, BACKGROUND transparent black and PREVIOUS
+       * canvas_start.  The first displayed frame cannot use PREVIOUS.
+       */
+      png_canvas_box boxes[3];
+      png_uint_32 top = png_ptr->pending_y_offset;
+      png_uint_32 bottom = top + png_ptr->pending_height;
+      size_t left, right;
+      png_alloc_size_t best_area;
+      png_byte dispose_op;
+      int i, ncandidates = 3;
+      unsigned int pixel_depth =
+         png_ptr->usr_channels * png_ptr->usr_bit_depth;
+
+      if (pixel_depth >= 8)
+      {
+         left = png_ptr->pending_x_offset * (pixel_depth >> 3);
+         right = left + png_ptr->pending_width * (pixel_depth >> 3);
+      }
+
+      else
+      {
+         left = png_ptr->pending_x_offset / (8 / pixel_depth);
+         right = PNG_ROWBYTES(pixel_depth,
+             png_ptr->pending_x_offset + png_ptr->pending_width);
+      }
+
+      if (png_ptr->num_frames_written ==
+          ((png_ptr->apng_flags & PNG_FIRST_FRAME_HIDDEN) != 0))
+         ncandidates = 2;
+
+      memset(boxes, 0, sizeof boxes);
+
+      for (y = 0; y < height; ++y)
+      {
+         const png_byte *row = row_pointers[y];
+         const png_byte *start = png_ptr->canvas_start + y * rowbytes;
+
+         if (y < top || y >= bottom)
+            png_canvas_diff(&box, y, row, start, 0, rowbytes);
+
+         else
+         {
+            if (left > 0)
+               png_canvas_diff(&box, y, row, start, 0, left);
+
+            if (right < rowbytes)
+               png_canvas_diff(&box, y, row, start, right, rowbytes);
+
+            png_canvas_diff(boxes + 0, y, row,
+                png_ptr->canvas_pending + y * rowbytes, left, right);
+            png_canvas_diff(boxes + 1, y, row, NULL, left, right);
+
+            if (ncandidates > 2)
+               png_canvas_diff(boxes + 2, y, row, start, left, right);
+         }
+      }
+
+      dispose_op = PNG_fcTL_DISPOSE_OP_NONE;
+      best_area = 0;
+
+      for (i = 0; i < ncandidates; ++i)
+      {
+         png_alloc_size_t area;
+
+         if (box.top != box.bottom)
+            png_canvas_box_add(boxes + i, box.left, box.right, box.top,
+                box.bottom);
+
+         area = png_canvas_box_area(boxes + i);
+
+         if (i == 0 || area < best_area)
+         {
+            dispose_op = (png_byte)i; /* PNG_fcTL_DISPOSE_OP_ values */
+            best_area = area;
+         }
+      }
+
+      box = boxes[dispose_op];
+      png_write_canvas_pending(png_ptr, info_ptr, dispose_op);
+
+      /* Bring canvas_start up to date for the new pending frame. */
+      for (y = top; y < bottom; ++y)
+      {
+         png_byte *sp = png_ptr->canvas_start + y * rowbytes;
+
+         if (dispose_op == PNG_fcTL_DISPOSE_OP_NONE)
+            memcpy(sp + left, png_ptr->canvas_pending + y * rowbytes + left,
+                right - left);
+
+         else if (dispose_op == PNG_fcTL_DISPOSE_OP_BACKGROUND)
+            memset(sp + left, 0, right - left);
+      }
+   }
+
+   else if (png_ptr->num_frames_written > 0)
+   {
+      /* The first displayed frame after a hidden default image. */
+      for (y = 0; y < height; ++y)
+         png_canvas_diff(&box, y, row_pointers[y], NULL, 0, rowbytes);
+   }
+
+   for (y = 0; y < height; ++y)
+      memcpy(png_ptr->canvas_pending + y * rowbytes, row_pointers[y],
+          rowbytes);
+
+   png_canvas_set_pending(png_ptr, &box, delay_num, delay_den);
+}
+
+#ifdef PNG_SETJMP_SUPPORTED
+/* png_compress_frame support.  The frame is written as the IHDR and IDAT
+ * chunks of a PNG on a private png_struct; the write function below keeps just
+ * the IDAT data, which is the frame's zlib stream.
+ */
+typedef struct
+{
+   png_byte *data;
+   size_t size;
+   size_t allocated;
+   png_byte header[8];          /* chunk length and type */
+   unsigned int header_bytes;
+   unsigned int crc_bytes;      /* of the current chunk still to come */
+   png_uint_32 data_bytes;      /* of the current chunk still to come */
+   int keep;                    /* the current chunk is an IDAT */
+} png_frame_sink;
+
+static void
+png_frame_sink_append(png_struct *png_ptr, png_frame_sink *sink,
+    const png_byte *data, size_t length)
+{
+   if (length > sink->allocated - sink->size)
+   {
+      size_t allocated = sink->allocated > 0 ? sink->allocated : 4096;
+      png_byte *buffer;
+
+      while (length > allocated - sink->size)
+      {
+         if (allocated > PNG_SIZE_MAX/2)
+            png_error(png_ptr, "compressed frame too large");
+
+         allocated *= 2;
+      }
+
+      buffer = png_voidcast(png_byte *, png_malloc(png_ptr, allocated));
+
+      if (sink->size > 0)
+         memcpy(buffer, sink->data, sink->size);
+
+      png_free(png_ptr, sink->data);
+      sink->data = buffer;
+      sink->allocated = allocated;
+   }
+
+   memcpy(sink->data + sink->size, data, length);
+   sink->size += length;
+}
+
+static void
+png_frame_sink_write(png_struct *png_ptr, png_byte *data, size_t length)
+{
+   png_frame_sink *sink = png_voidcast(png_frame_sink *, png_ptr->io_ptr);
+
+   while (length > 0)
+   {
+      size_t n;
+
+      if (sink->header_bytes < 8)
+      {
+         n = 8 - sink->header_bytes;
+         if (n > length)
+            n = length;
+
+         memcpy(sink->header + sink->header_bytes, data, n);
+         sink->header_bytes += (unsigned int)n;
+
+         if (sink->header_bytes == 8)
+         {
+            sink->data_bytes = png_get_uint_32(sink->header);
+            sink->crc_bytes = 4;
+            sink->keep = png_get_uint_32(sink->header+4) == png_IDAT;
+         }
+      }
+
+      else if (sink->data_bytes > 0)
+      {
+         n = sink->data_bytes;
+         if (n > length)
+            n = length;
+
+         if (sink->keep)
+            png_frame_sink_append(png_ptr, sink, data, n);
+
+         sink->data_bytes -= (png_uint_32)n;
+      }
+
+      else
+      {
+         n = sink->crc_bytes;
+         if (n > length)
+            n = length;
+
+         sink->crc_bytes -= (unsigned int)n;
+
+         if (sink->crc_bytes == 0)
+            sink->header_bytes = 0;
+      }
+
+      data += n;
+      length -= n;
+   }
+}
+
+static PNG_FUNCTION(void, png_frame_error,
+   (png_struct *png_ptr, const char *error_message), PNG_NORETURN)
+{
+   PNG_UNUSED(error_message)
+   png_longjmp(png_ptr, 1);
+}
+
+static void
+png_frame_warning(png_struct *png_ptr, const char *warning_message)
+{
+   PNG_UNUSED(png_ptr)
+   PNG_UNUSED(warning_message)
+}
+
+static png_compressed_frame *
+png_compress_frame_rows(const png_struct *png_ptr, png_struct *worker,
+    png_frame_sink *sink, png_byte **row_pointers,
+    png_uint_32 width, png_uint_32 height)
+{
+   png_compressed_frame *frame;
+
+   png_set_write_fn(worker, sink, png_frame_sink_write, NULL);
+
+   worker->zlib_level = png_ptr->zlib_level;
+   worker->zlib_method = png_ptr->zlib_method;
+   worker->zlib_window_bits = png_ptr->zlib_window_bits;
+   worker->zlib_mem_level = png_ptr->zlib_mem_level;
+   worker->zlib_strategy = png_ptr->zlib_strategy;
+   worker->flags |= png_ptr->flags & PNG_FLAG_ZLIB_CUSTOM_STRATEGY;
+
+   png_write_IHDR(worker, width, height, png_ptr->bit_depth,
+       png_ptr->color_type, PNG_COMPRESSION_TYPE_BASE, png_ptr->filter_type,
+       png_ptr->interlaced);
+
+   /* Nothing else goes before the image data. */
+   worker->mode |= PNG_WROTE_INFO_BEFORE_PLTE;
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   worker->do_filter = png_ptr->do_filter;
+#endif
+
+   png_write_image(worker, row_pointers);
+
+   if (sink->size == 0)
+      png_error(worker, "no image data");
+
+#ifdef PNG_USER_MEM_SUPPORTED
+   /* The worker of an arena png_struct uses malloc, so the frame does too and
+    * png_free_compressed_frame gives it back to free, not to the arena.
+    */
+   if (png_ptr->arena != NULL)
+   {
+      frame = png_voidcast(png_compressed_frame *,
+          malloc((sizeof *frame) + sink->size));
+
+      if (frame == NULL)
+         png_error(worker, "out of memory");
+
+      frame->malloced = 1;
+   }
+
+   else
+#endif
+   {
+      frame = png_voidcast(png_compressed_frame *,
+          png_malloc(worker, (sizeof *frame) + sink->size));
+      frame->malloced = 0;
+   }
+
+   frame->data = (png_byte *)(frame + 1);
+   frame->size = sink->size;
+   frame->width = width;
+   frame->height = height;
+   frame->bit_depth = png_ptr->bit_depth;
+   frame->color_type = png_ptr->color_type;
+   frame->interlace_type = png_ptr->interlaced;
+   memcpy(frame->data, sink->data, sink->size);
+
+   return frame;
+}
+
+png_compressed_frame * PNGAPI
+png_compress_frame(const png_struct *png_ptr, png_byte **row_pointers,
+    png_uint_32 width, png_uint_32 height)
+{
+   png_frame_sink sink;
+   png_struct *worker;
+   png_compressed_frame *frame = NULL;
+
+   png_debug(1, "in png_compress_frame");
+
+   if (png_ptr == NULL || row_pointers == NULL || png_ptr->bit_depth == 0 ||
+       (png_ptr->transformations & ~PNG_INTERLACE) != 0)
+      return NULL;
+
+   memset(&sink, 0, (sizeof sink));
+
+#ifdef PNG_USER_MEM_SUPPORTED
+   /* An arena is not thread safe, so a worker of an arena png_struct uses
+    * malloc.
+    */
+   if (png_ptr->arena != NULL)
+      worker = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,
+          png_frame_error, png_frame_warning);
+
+   else
+      worker = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL,
+          png_frame_error, png_frame_warning, png_ptr->mem_ptr,
+          png_ptr->malloc_fn, png_ptr->free_fn);
+#else
+   worker = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,
+       png_frame_error, png_frame_warning);
+#endif
+
+   if (worker == NULL)
+      return NULL;
+
+   if (setjmp(png_jmpbuf(worker)) == 0)
+      frame = png_compress_frame_rows(png_ptr, worker, &sink, row_pointers,
+          width, height);
+
+   png_free(worker, sink.data);
+   png_destroy_write_struct(&worker, NULL);
+
+   return frame;
+}
+
+void PNGAPI
+png_write_compressed_frame(png_struct *png_ptr, png_info *info_ptr,
+    const png_compressed_frame *frame,
+    png_uint_32 x_offset, png_uint_32 y_offset,
+    png_uint_16 delay_num, png_uint_16 delay_den,
+    png_byte dispose_op, png_byte blend_op)
+{
+   static const png_byte png_IDAT_string[4] = { 73, 68, 65, 84 };
+   const png_byte *data;
+   size_t remaining;
+
+   png_debug(1, "in png_write_compressed_frame");
+
+   if (png_ptr == NULL || info_ptr == NULL)
+      return;
+
+   if (frame == NULL)
+      png_error(png_ptr, "png_write_compressed_frame: no frame");
+
+   if (!(info_ptr->valid & PNG_INFO_acTL))
+      png_error(png_ptr, "Cannot write APNG frame: missing acTL");
+
+   if (png_ptr->num_frames_written >= png_ptr->num_frames_to_write)
+      png_error(png_ptr, "Too many APNG frames");
+
+   if (png_ptr->pending_width != 0)
+      png_error(png_ptr,
+          "png_write_compressed_frame: png_write_canvas_frame in use");
+
+   if (frame->bit_depth != png_ptr->bit_depth ||
+       frame->color_type != png_ptr->color_type ||
+       frame->interlace_type != png_ptr->interlaced)
+      png_error(png_ptr, "Compressed frame does not match IHDR");
+
+   /* The first frame is written as IDAT, so whether or not it is part of the
+    * animation it is the default image and covers the whole canvas.  Check
+    * this before anything is written, as png_write_reinit does for
+    * png_write_frame_head.
+    */
+   if (png_ptr->num_frames_written == 0)
+   {
+      if (frame->width != png_ptr->first_frame_width ||
+          frame->height != png_ptr->first_frame_height)
+         png_error(png_ptr, "Incorrect frame size in leading fcTL");
+
+      if ((png_ptr->apng_flags & PNG_FIRST_FRAME_HIDDEN) == 0 &&
+          (x_offset != 0 || y_offset != 0))
+         png_error(png_ptr, "Non-zero frame offset in leading fcTL");
+   }
+
+   if (png_ptr->num_frames_written > 0 ||
+       (png_ptr->apng_flags & PNG_FIRST_FRAME_HIDDEN) == 0)
+      png_write_fcTL(png_ptr, frame->width, frame->height, x_offset, y_offset,
+          delay_num, delay_den, dispose_op, blend_op);
+
+   /* The data is split into chunks of the same size as the ones written from
+    * png_write_row.
+    */
+   for (data = frame->data, remaining = frame->size; remaining > 0;)
+   {
+      size_t length = png_ptr->zbuffer_size;
+
+      if (length > remaining)
+         length = remaining;
+
+      if (png_ptr->num_frames_written == 0)
+         png_write_chunk(png_ptr, png_IDAT_string, data, length);
+
+      else
+         png_write_fdAT(png_ptr, data, length);
+
+      data += length;
+      remaining -= length;
+   }
+
+   png_ptr->mode |= PNG_HAVE_IDAT;
+   png_ptr->num_frames_written++;
+}
+
+void PNGAPI
+png_free_compressed_frame(const png_struct *png_ptr,
+    png_compressed_frame *frame)
+{
+   if (png_ptr == NULL || frame == NULL)
+      return;
+
+   if (frame->malloced != 0)
+      free(frame);
+
+   else
+      png_free(png_ptr, frame);
+}
+#endif /* SETJMP */
+#endif /* PNG_WRITE_APNG_SUPPORTED */
+
+#ifdef PNG_SIMPLIFIED_WRITE_SUPPORTED
+/* Initialize the write structure - general purpose utility. */
+static int
+png_image_write_init(png_image *image)
+{
+   png_struct *png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, image,
+       png_safe_error, png_safe_warning);
+
+   if (png_ptr != NULL)
+   {
+      png_info *info_ptr = png_create_info_struct(png_ptr);
+
+      if (info_ptr != NULL)
+      {
+         png_control *control = png_voidcast(png_control *,
+             png_malloc_warn(png_ptr, (sizeof *control)));
+
+         if (control != NULL)
+         {
+            memset(control, 0, (sizeof *control));
+
+            control->png_ptr = png_ptr;
+            control->info_ptr = info_ptr;
+            control->for_write = 1;
+
+            image->opaque = control;
+            return 1;
+         }
+
+         /* Error clean up */
+         png_destroy_info_struct(png_ptr, &info_ptr);
+      }
+
+      png_destroy_write_struct(&png_ptr, NULL);
+   }
+
+   return png_image_error(image, "png_image_write_: out of memory");
+}
+
+/* The result of the PNG_IMAGE_FLAG_REDUCE analysis; the colors are held in a
+ * small open hash table keyed on the packed RGBA value, which maps each color
+ * to its palette index.
+ */
+#define PNG_REDUCE_HASH_SIZE 512 /* at least twice 257 */
+#define PNG_REDUCE_HASH(color) ((unsigned int)\
+   (((png_uint_32)(color) * 0x9e3779b1U) >> 23))
+
+typedef struct
+{
+   int color_type;                /* PNG color type written */
+   int bit_depth;                 /* PNG bit depth written */
+   int num_colors;                /* number of distinct colors, up to 257 */
+   int num_trans;                 /* length of the palette tRNS */
+   png_uint_32 color[PNG_REDUCE_HASH_SIZE];
+   png_int_16 index[PNG_REDUCE_HASH_SIZE]; /* palette index or -1 if unused */
+   png_uint_32 order[256];        /* the colors in the order found */
+} png_image_write_reduce;
+
+/* Arguments to png_image_write_main: */
+typedef struct
+{
+   /* Arguments */
+   png_image *image;
+   const void *buffer;
+   png_int_32 row_stride;
+   const void *colormap;
+   int convert_to_8bit;
+
+   /* Instance variables */
+   const void *first_row;
+   void *local_row;
+   ptrdiff_t row_step;
+   png_uint_32 row_count;         /* rows to write from first_row */
+   int linear;                    /* input is 16-bit linear */
+   int write_16bit;               /* output is 16-bit */
+   int transform_rows;            /* rows are converted in local_row */
+   const png_byte *sRGB_table;    /* opaque linear to sRGB, may be NULL */
+   png_image_write_reduce *reduce; /* PNG_IMAGE_FLAG_REDUCE result or NULL */
+
+   /* Byte count for memory writing */
+   png_byte *memory;
+   png_alloc_size_t memory_bytes; /* not used for STDIO */
+   png_alloc_size_t output_bytes; /* running total */
+
+   /* Set to grow 'memory' as required, for png_image_write_to_memory_alloc */
+   png_image_realloc_ptr realloc_fn;
+   void *realloc_context;
+} png_image_write_control;
+
+/* Write png_uint_16 input to a 16-bit PNG; the png_ptr has already been set to
+ * do any necessary byte swapping.  The component order is defined by the
+ * png_image format value.
+ */
+static int
+png_write_image_16bit(void *argument)
+{
+   png_image_write_control *display = png_voidcast(png_image_write_control*,
+       argument);
+   png_image *image = display->image;
+   png_struct *png_ptr = image->opaque->png_ptr;
+
+   const png_uint_16 *input_row = png_voidcast(const png_uint_16 *,
+       display->first_row);
+   png_uint_16 *output_row = png_voidcast(png_uint_16 *, display->local_row);
+   png_uint_16 *row_end;
+   unsigned int channels = (image->format & PNG_FORMAT_FLAG_COLOR) != 0 ?
+       3 : 1;
+   int aindex = 0;
+   png_uint_32 y = display->row_count;
+   png_uint_32 last_alpha = 0, last_reciprocal = 0;
+
+   if ((image->format & PNG_FORMAT_FLAG_ALPHA) != 0)
+   {
+#   ifdef PNG_SIMPLIFIED_WRITE_AFIRST_SUPPORTED
+      if ((image->format & PNG_FORMAT_FLAG_AFIRST) != 0)
+      {
+         aindex = -1;
+         ++input_row; /* To point to the first component */
+         ++output_row;
+      }
+         else
+            aindex = (int)channels;
+#     else
+         aindex = (int)channels;
+#     endif
+   }
+
+   else
+      png_error(png_ptr, "png_write_image: internal call error");
+
+   /* Work out the output row end and count over this, note that the increment
+    * above to 'row' means that row_end can actually be beyond the end of the
+    * row; this is correct.
+    */
+   row_end = output_row + image->width * (channels+1);
+
+   for (; y > 0; --y)
+   {
+      const png_uint_16 *in_ptr = input_row;
+      png_uint_16 *out_ptr = output_row;
+
+      while (out_ptr < row_end)
+      {
+         png_uint_16 alpha = in_ptr[aindex];
+         png_uint_32 reciprocal = 0;
+         int c;
+
+         out_ptr[aindex] = alpha;
+
+         /* Calculate a reciprocal.  The correct calculation is simply
+          * component/alpha*65535 << 15. (I.e. 15 bits of precision); this
+          * allows correct rounding by adding .5 before the shift.  'reciprocal'
+          * is only initialized when required and is reused while alpha does
+          * not change, avoiding the division.
+          */
+         if (alpha > 0 && alpha < 65535)
+         {
+            if (alpha != last_alpha)
+            {
+               last_alpha = alpha;
+               last_reciprocal = ((0xffff<<15)+(alpha>>1))/alpha;
+            }
+
+            reciprocal = last_reciprocal;
+         }
+
+         c = (int)channels;
+         do /* always at least one channel */
+         {
+            png_uint_16 component = *in_ptr++;
+
+            /* The following gives 65535 for an alpha of 0, which is fine,
+             * otherwise if 0/0 is represented as some other value there is more
+             * likely to be a discontinuity which will probably damage
+             * compression when moving from a fully transparent area to a
+             * nearly transparent one.  (The assumption here is that opaque
+             * areas tend not to be 0 intensity.)
+             */
+            if (component >= alpha)
+               component = 65535;
+
+            /* component<alpha, so component/alpha is less than one and
+             * component*reciprocal is less than 2^31.
+             */
+            else if (component > 0 && alpha < 65535)
+            {
+               png_uint_32 calc = component * reciprocal;
+               calc += 16384; /* round to nearest */
+               component = (png_uint_16)(calc >> 15);
+            }
+
+            *out_ptr++ = component;
+         }
+         while (--c > 0);
+
+         /* Skip to next component (skip the intervening alpha channel) */
+         ++in_ptr;
+         ++out_ptr;
+      }
+
+      png_write_row(png_ptr,
+          png_voidcast(const png_byte *, display->local_row));
+      input_row += display->row_step / 2;
+   }
+
+   return 1;
+}
+
+/* Given 16-bit input (1 to 4 channels) write 8-bit output.  If an alpha channel
+ * is present it must be removed from the components, the components are then
+ * written in sRGB encoding.  No components are added or removed.
+ *
+ * Calculate an alpha reciprocal to reverse pre-multiplication.  As above the
+ * calculation can be done to 15 bits of accuracy; however, the output needs to
+ * be scaled in the range 0..255*65535, so include that scaling here.
+ */
+#   define UNP_RECIPROCAL(alpha) ((((0xffff*0xff)<<7)+((alpha)>>1))/(alpha))
+
+static png_byte
 png_unpremultiply(png_uint_32 component, png_uint_32 alpha,
     png_uint_32 reciprocal/*from the above macro*/)
 {
@@ -1781,14 +2738,16 @@ png_write_image_8bit(void *argument)
    const png_uint_16 *input_row = png_voidcast(const png_uint_16 *,
        display->first_row);
    png_byte *output_row = png_voidcast(png_byte *, display->local_row);
-   png_uint_32 y = image->height;
+   png_uint_32 y = display->row_count;
    unsigned int channels = (image->format & PNG_FORMAT_FLAG_COLOR) != 0 ?
        3 : 1;
+   const png_byte *sRGB_table = display->sRGB_table;
 
    if ((image->format & PNG_FORMAT_FLAG_ALPHA) != 0)
    {
       png_byte *row_end;
       int aindex;
+      png_uint_32 last_alpha = 0, last_reciprocal = 0;
 
 #   ifdef PNG_SIMPLIFIED_WRITE_AFIRST_SUPPORTED
       if ((image->format & PNG_FORMAT_FLAG_AFIRST) != 0)
@@ -1821,7 +2780,35 @@ png_write_image_8bit(void *argument)
             out_ptr[aindex] = alphabyte;
 
             if (alphabyte > 0 && alphabyte < 255)
-               reciprocal = UNP_RECIPROCAL(alpha);
+            {
+               if (alpha != last_alpha)
+               {
+                  last_alpha = alpha;
+                  last_reciprocal = UNP_RECIPROCAL(alpha);
+               }
+
+               reciprocal = last_reciprocal;
+            }
+
+            /* An opaque pixel is not unpremultiplied, so when there is a table
+             * this is the same as png_unpremultiply.
+             */
+            else if (alphabyte == 255 && sRGB_table != NULL)
+            {
+               c = (int)channels;
+               do
+               {
+                  png_uint_16 component = *in_ptr++;
+
+                  *out_ptr++ = component >= alpha ? 255 :
+                     sRGB_table[component];
+               }
+               while (--c > 0);
+
+               ++in_ptr;
+               ++out_ptr;
+               continue;
+            }
 
             c = (int)channels;
             do /* always at least one channel */
@@ -1851,12 +2838,21 @@ png_write_image_8bit(void *argument)
          const png_uint_16 *in_ptr = input_row;
          png_byte *out_ptr = output_row;
 
-         while (out_ptr < row_end)
+         if (sRGB_table != NULL)
+         {
+            while (out_ptr < row_end)
+               *out_ptr++ = sRGB_table[*in_ptr++];
+         }
+
+         else
          {
-            png_uint_32 component = *in_ptr++;
+            while (out_ptr < row_end)
+            {
+               png_uint_32 component = *in_ptr++;
 
-            component *= 255;
-            *out_ptr++ = (png_byte)PNG_sRGB_FROM_LINEAR(component);
+               component *= 255;
+               *out_ptr++ = (png_byte)PNG_sRGB_FROM_LINEAR(component);
+            }
          }
 
          png_write_row(png_ptr, output_row);
@@ -1923,101 +2919,436 @@ png_image_set_PLTE(png_image_write_control *display)
                    entry[bgr]);
             }
 
-            else /* Gray */
-               palette[i].blue = palette[i].red = palette[i].green =
-                  (png_byte)PNG_sRGB_FROM_LINEAR(255 * *entry);
-         }
+            else /* Gray */
+               palette[i].blue = palette[i].red = palette[i].green =
+                  (png_byte)PNG_sRGB_FROM_LINEAR(255 * *entry);
+         }
+
+         else /* alpha */
+         {
+            png_uint_16 alpha = entry[afirst ? 0 : channels-1];
+            png_byte alphabyte = (png_byte)PNG_DIV257(alpha);
+            png_uint_32 reciprocal = 0;
+
+            /* Calculate a reciprocal, as in the png_write_image_8bit code above
+             * this is designed to produce a value scaled to 255*65535 when
+             * divided by 128 (i.e. asr 7).
+             */
+            if (alphabyte > 0 && alphabyte < 255)
+               reciprocal = (((0xffff*0xff)<<7)+(alpha>>1))/alpha;
+
+            tRNS[i] = alphabyte;
+            if (alphabyte < 255)
+               num_trans = i+1;
+
+            if (channels >= 3) /* RGB */
+            {
+               palette[i].blue = png_unpremultiply(entry[afirst + (2 ^ bgr)],
+                   alpha, reciprocal);
+               palette[i].green = png_unpremultiply(entry[afirst + 1], alpha,
+                   reciprocal);
+               palette[i].red = png_unpremultiply(entry[afirst + bgr], alpha,
+                   reciprocal);
+            }
+
+            else /* gray */
+               palette[i].blue = palette[i].red = palette[i].green =
+                   png_unpremultiply(entry[afirst], alpha, reciprocal);
+         }
+      }
+
+      else /* Color-map has sRGB values */
+      {
+         const png_byte *entry = png_voidcast(const png_byte *, cmap);
+
+         entry += (unsigned int)i * channels;
+
+         switch (channels)
+         {
+            case 4:
+               tRNS[i] = entry[afirst ? 0 : 3];
+               if (tRNS[i] < 255)
+                  num_trans = i+1;
+               /* FALLTHROUGH */
+            case 3:
+               palette[i].blue = entry[afirst + (2 ^ bgr)];
+               palette[i].green = entry[afirst + 1];
+               palette[i].red = entry[afirst + bgr];
+               break;
+
+            case 2:
+               tRNS[i] = entry[1 ^ afirst];
+               if (tRNS[i] < 255)
+                  num_trans = i+1;
+               /* FALLTHROUGH */
+            case 1:
+               palette[i].blue = palette[i].red = palette[i].green =
+                  entry[afirst];
+               break;
+
+            default:
+               break;
+         }
+      }
+   }
+
+#   ifdef afirst
+#     undef afirst
+#   endif
+#   ifdef bgr
+#     undef bgr
+#   endif
+
+   png_set_PLTE(image->opaque->png_ptr, image->opaque->info_ptr, palette,
+       entries);
+
+   if (num_trans > 0)
+      png_set_tRNS(image->opaque->png_ptr, image->opaque->info_ptr, tRNS,
+          num_trans, NULL);
+
+   image->colormap_entries = (png_uint_32)entries;
+}
+
+/* Find the slot of 'color' in the PNG_IMAGE_FLAG_REDUCE hash table, or the
+ * empty slot where it belongs.  The table is never more than half full.
+ */
+static unsigned int
+png_image_reduce_slot(const png_image_write_reduce *reduce, png_uint_32 color)
+{
+   unsigned int slot = PNG_REDUCE_HASH(color);
+
+   while (reduce->index[slot] >= 0 && reduce->color[slot] != color)
+      slot = (slot + 1) & (PNG_REDUCE_HASH_SIZE - 1);
+
+   return slot;
+}
+
+/* Return the byte offsets of red, green, blue and alpha in an 8-bit pixel of
+ * the given format; gray is returned as red, green and blue.
+ */
+static void
+png_image_reduce_offsets(png_uint_32 format, unsigned int offsets[4])
+{
+   unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(format);
+   unsigned int first = 0;
+   int bgr = 0;
+
+#   ifdef PNG_SIMPLIFIED_WRITE_AFIRST_SUPPORTED
+      if ((format & PNG_FORMAT_FLAG_AFIRST) != 0 &&
+          (format & PNG_FORMAT_FLAG_ALPHA) != 0)
+         first = 1;
+#   endif
+
+#   ifdef PNG_SIMPLIFIED_WRITE_BGR_SUPPORTED
+      bgr = (format & PNG_FORMAT_FLAG_BGR) != 0;
+#   endif
+
+   if ((format & PNG_FORMAT_FLAG_COLOR) != 0)
+   {
+      offsets[0] = first + (bgr ? 2 : 0);
+      offsets[1] = first + 1;
+      offsets[2] = first + (bgr ? 0 : 2);
+   }
+
+   else
+      offsets[0] = offsets[1] = offsets[2] = first;
+
+   /* Not used if there is no alpha channel: */
+   offsets[3] = (format & PNG_FORMAT_FLAG_ALPHA) != 0 ?
+      (first ? 0 : channels-1) : 0;
+}
+
+/* For PNG_IMAGE_FLAG_REDUCE scan the whole 8-bit image and work out the
+ * smallest PNG format that stores it losslessly.  Returns 0 if the format
+ * given by the application is already the smallest.
+ */
+static int
+png_image_write_analyze(png_image_write_control *display,
+    png_image_write_reduce *reduce)
+{
+   png_image *image = display->image;
+   png_uint_32 format = image->format;
+   int has_alpha = (format & PNG_FORMAT_FLAG_ALPHA) != 0;
+   int has_color = (format & PNG_FORMAT_FLAG_COLOR) != 0;
+   unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(format);
+   unsigned int offsets[4];
+   const png_byte *row = png_voidcast(const png_byte *, display->first_row);
+   png_uint_32 y;
+   png_uint_32 last = 0;
+   int opaque = 1, gray = 1, gray_depth = 1, too_many = 0;
+   unsigned int in_bits, out_bits, palette_depth;
+
+   png_image_reduce_offsets(format, offsets);
+   memset(reduce->index, 0xff, (sizeof reduce->index));
+   reduce->num_colors = 0;
+
+   for (y = 0; y < image->height; ++y, row += display->row_step)
+   {
+      const png_byte *in_ptr = row;
+      const png_byte *row_end = row + image->width * channels;
+
+      for (; in_ptr < row_end; in_ptr += channels)
+      {
+         unsigned int r = in_ptr[offsets[0]];
+         unsigned int g = in_ptr[offsets[1]];
+         unsigned int b = in_ptr[offsets[2]];
+         unsigned int a = has_alpha ? in_ptr[offsets[3]] : 255;
+         png_uint_32 color;
+
+         if (a != 255)
+            opaque = 0;
+
+         if (r != g || g != b)
+            gray = 0;
+
+         /* Gray values that are multiples of 17, 85 or 255 can be stored in
+          * 4, 2 or 1 bits without loss.
+          */
+         else if (gray_depth < 8)
+         {
+            if (r % 17 != 0)
+               gray_depth = 8;
+
+            else if (r % 85 != 0 && gray_depth < 4)
+               gray_depth = 4;
+
+            else if (r % 255 != 0 && gray_depth < 2)
+               gray_depth = 2;
+         }
+
+         color = (r << 24) | (g << 16) | (b << 8) | a;
+
+         if (too_many == 0 && (color != last || reduce->num_colors == 0))
+         {
+            unsigned int slot = png_image_reduce_slot(reduce, color);
+
+            if (reduce->index[slot] < 0)
+            {
+               if (reduce->num_colors < 256)
+               {
+                  reduce->color[slot] = color;
+                  reduce->index[slot] = (png_int_16)reduce->num_colors;
+                  reduce->order[reduce->num_colors++] = color;
+               }
+
+               else
+                  too_many = 1;
+            }
+
+            last = color;
+         }
+      }
+
+      /* Stop when nothing can be reduced: there are too many colors for a
+       * palette, color input is not gray and gray input needs all 8 bits (or
+       * an alpha channel), and there is no opaque alpha channel to remove.
+       */
+      if (too_many != 0 &&
+          (has_color ? gray == 0 : (gray_depth == 8 || opaque == 0)) &&
+          (has_alpha == 0 || opaque == 0))
+         return 0;
+   }
+
+   /* Choose the smallest of the non-palette and palette formats by the size of
+    * the image data; the palette is only used if it saves more than the PLTE
+    * and tRNS chunks cost, this also keeps the output within
+    * PNG_IMAGE_PNG_SIZE_MAX.
+    */
+   in_bits = channels * 8;
+
+   if (gray != 0)
+   {
+      reduce->color_type = opaque ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_GA;
+      reduce->bit_depth = opaque ? gray_depth : 8;
+      out_bits = opaque ? (unsigned int)gray_depth : 16;
+   }
+
+   else
+   {
+      reduce->color_type = opaque ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGBA;
+      reduce->bit_depth = 8;
+      out_bits = opaque ? 24 : 32;
+   }
+
+   palette_depth = reduce->num_colors > 16 ? 8 :
+      (reduce->num_colors > 4 ? 4 : (reduce->num_colors > 2 ? 2 : 1));
+
+   if (too_many == 0 && palette_depth < out_bits &&
+       (png_alloc_size_t)image->height *
+       (PNG_ROWBYTES(out_bits, image->width) -
+        PNG_ROWBYTES(palette_depth, image->width)) >
+       24U + 4U * (unsigned int)reduce->num_colors)
+   {
+      /* The translucent entries go first to keep the tRNS chunk short. */
+      int i, pass, n = 0;
+      png_uint_32 order[256];
+
+      for (pass = 0; pass < 2; ++pass)
+      {
+         for (i = 0; i < reduce->num_colors; ++i)
+         {
+            png_uint_32 color = reduce->order[i];
+
+            if (((color & 0xff) != 0xff) == (pass == 0))
+            {
+               reduce->index[png_image_reduce_slot(reduce, color)] =
+                  (png_int_16)n;
+               order[n++] = color;
+            }
+         }
+
+         if (pass == 0)
+            reduce->num_trans = n;
+      }
+
+      memcpy(reduce->order, order, (sizeof order));
+      reduce->color_type = PNG_COLOR_TYPE_PALETTE;
+      reduce->bit_depth = (int)palette_depth;
+      out_bits = palette_depth;
+   }
+
+   return out_bits < in_bits;
+}
+
+/* Set the PLTE and tRNS of a color-mapped image from the analysis. */
+static void
+png_image_write_reduced_PLTE(png_image_write_control *display)
+{
+   png_image_write_reduce *reduce = display->reduce;
+   png_color palette[256];
+   png_byte tRNS[256];
+   int i;
+
+   for (i = 0; i < reduce->num_colors; ++i)
+   {
+      png_uint_32 color = reduce->order[i];
+
+      palette[i].red = (png_byte)(color >> 24);
+      palette[i].green = (png_byte)(color >> 16);
+      palette[i].blue = (png_byte)(color >> 8);
+      tRNS[i] = (png_byte)color;
+   }
+
+   png_set_PLTE(display->image->opaque->png_ptr,
+       display->image->opaque->info_ptr, palette, reduce->num_colors);
+
+   if (reduce->num_trans > 0)
+      png_set_tRNS(display->image->opaque->png_ptr,
+          display->image->opaque->info_ptr, tRNS, reduce->num_trans, NULL);
+}
+
+/* Write 8-bit rows in the format chosen by png_image_write_analyze. */
+static int
+png_write_image_reduced(void *argument)
+{
+   png_image_write_control *display = png_voidcast(png_image_write_control*,
+       argument);
+   png_image *image = display->image;
+   png_struct *png_ptr = image->opaque->png_ptr;
+   const png_image_write_reduce *reduce = display->reduce;
+   int color_type = reduce->color_type;
+   unsigned int depth = (unsigned int)reduce->bit_depth;
+   unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(image->format);
+   int has_alpha = (image->format & PNG_FORMAT_FLAG_ALPHA) != 0;
+   unsigned int offsets[4];
+   const png_byte *input_row = png_voidcast(const png_byte *,
+       display->first_row);
+   png_byte *output_row = png_voidcast(png_byte *, display->local_row);
+   png_uint_32 y = display->row_count;
+   png_uint_32 last = 0;
+   unsigned int last_index;
+
+   png_image_reduce_offsets(image->format, offsets);
+
+   /* Start the one entry cache with color 0; if it is not in the palette it
+    * does not occur in the image so the (invalid) index is never used.
+    */
+   last_index = (unsigned int)reduce->index[png_image_reduce_slot(reduce, 0)];
+
+   for (; y > 0; --y)
+   {
+      const png_byte *in_ptr = input_row;
+      const png_byte *row_end = input_row + image->width * channels;
+      png_byte *out_ptr = output_row;
+
+      if (color_type == PNG_COLOR_TYPE_PALETTE ||
+          color_type == PNG_COLOR_TYPE_GRAY)
+      {
+         unsigned int shift = 8 - depth;
+         unsigned int byte = 0;
 
-         else /* alpha */
+         for (; in_ptr < row_end; in_ptr += channels)
          {
-            png_uint_16 alpha = entry[afirst ? 0 : channels-1];
-            png_byte alphabyte = (png_byte)PNG_DIV257(alpha);
-            png_uint_32 reciprocal = 0;
+            unsigned int value = in_ptr[offsets[0]];
 
-            /* Calculate a reciprocal, as in the png_write_image_8bit code above
-             * this is designed to produce a value scaled to 255*65535 when
-             * divided by 128 (i.e. asr 7).
-             */
-            if (alphabyte > 0 && alphabyte < 255)
-               reciprocal = (((0xffff*0xff)<<7)+(alpha>>1))/alpha;
+            if (color_type == PNG_COLOR_TYPE_PALETTE)
+            {
+               png_uint_32 color = ((png_uint_32)value << 24) |
+                  ((png_uint_32)in_ptr[offsets[1]] << 16) |
+                  ((png_uint_32)in_ptr[offsets[2]] << 8) |
+                  (has_alpha ? in_ptr[offsets[3]] : 255U);
 
-            tRNS[i] = alphabyte;
-            if (alphabyte < 255)
-               num_trans = i+1;
+               if (color != last)
+               {
+                  last = color;
+                  last_index = (unsigned int)
+                     reduce->index[png_image_reduce_slot(reduce, color)];
+               }
 
-            if (channels >= 3) /* RGB */
+               value = last_index;
+            }
+
+            else
+               value >>= 8 - depth;
+
+            byte |= value << shift;
+
+            if (shift == 0)
             {
-               palette[i].blue = png_unpremultiply(entry[afirst + (2 ^ bgr)],
-                   alpha, reciprocal);
-               palette[i].green = png_unpremultiply(entry[afirst + 1], alpha,
-                   reciprocal);
-               palette[i].red = png_unpremultiply(entry[afirst + bgr], alpha,
-                   reciprocal);
+               *out_ptr++ = (png_byte)byte;
+               byte = 0;
+               shift = 8 - depth;
             }
 
-            else /* gray */
-               palette[i].blue = palette[i].red = palette[i].green =
-                   png_unpremultiply(entry[afirst], alpha, reciprocal);
+            else
+               shift -= depth;
          }
+
+         if (shift != 8 - depth)
+            *out_ptr = (png_byte)byte;
       }
 
-      else /* Color-map has sRGB values */
+      else
       {
-         const png_byte *entry = png_voidcast(const png_byte *, cmap);
-
-         entry += (unsigned int)i * channels;
-
-         switch (channels)
+         for (; in_ptr < row_end; in_ptr += channels)
          {
-            case 4:
-               tRNS[i] = entry[afirst ? 0 : 3];
-               if (tRNS[i] < 255)
-                  num_trans = i+1;
-               /* FALLTHROUGH */
-            case 3:
-               palette[i].blue = entry[afirst + (2 ^ bgr)];
-               palette[i].green = entry[afirst + 1];
-               palette[i].red = entry[afirst + bgr];
-               break;
+            *out_ptr++ = in_ptr[offsets[0]];
 
-            case 2:
-               tRNS[i] = entry[1 ^ afirst];
-               if (tRNS[i] < 255)
-                  num_trans = i+1;
-               /* FALLTHROUGH */
-            case 1:
-               palette[i].blue = palette[i].red = palette[i].green =
-                  entry[afirst];
-               break;
+            if (color_type == PNG_COLOR_TYPE_RGB ||
+                color_type == PNG_COLOR_TYPE_RGBA)
+            {
+               *out_ptr++ = in_ptr[offsets[1]];
+               *out_ptr++ = in_ptr[offsets[2]];
+            }
 
-            default:
-               break;
+            if ((color_type & PNG_COLOR_MASK_ALPHA) != 0)
+               *out_ptr++ = in_ptr[offsets[3]];
          }
       }
-   }
-
-#   ifdef afirst
-#     undef afirst
-#   endif
-#   ifdef bgr
-#     undef bgr
-#   endif
-
-   png_set_PLTE(image->opaque->png_ptr, image->opaque->info_ptr, palette,
-       entries);
 
-   if (num_trans > 0)
-      png_set_tRNS(image->opaque->png_ptr, image->opaque->info_ptr, tRNS,
-          num_trans, NULL);
+      png_write_row(png_ptr, output_row);
+      input_row += display->row_step;
+   }
 
-   image->colormap_entries = (png_uint_32)entries;
+   return 1;
 }
 
-static int
-png_image_write_main(void *argument)
+/* Set up the png_struct for the image format, write the PNG header and set
+ * the transforms; the rows are written afterwards.
+ */
+static void
+png_image_write_header(png_image_write_control *display)
 {
-   png_image_write_control *display = png_voidcast(png_image_write_control*,
-       argument);
    png_image *image = display->image;
    png_struct *png_ptr = image->opaque->png_ptr;
    png_info *info_ptr = image->opaque->info_ptr;
@@ -2034,45 +3365,7 @@ png_image_write_main(void *argument)
       png_set_benign_errors(png_ptr, 0/*error*/);
 #   endif
 
-   /* Default the 'row_stride' parameter if required, also check the row stride
-    * and total image size to ensure that they are within the system limits.
-    */
-   {
-      unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(image->format);
-
-      if (image->width <= 0x7fffffffU/channels) /* no overflow */
-      {
-         png_uint_32 check;
-         png_uint_32 png_row_stride = image->width * channels;
-
-         if (display->row_stride == 0)
-            display->row_stride = (png_int_32)/*SAFE*/png_row_stride;
-
-         if (display->row_stride < 0)
-            check = -(png_uint_32)display->row_stride;
-
-         else
-            check = (png_uint_32)display->row_stride;
-
-         if (check >= png_row_stride)
-         {
-            /* Now check for overflow of the image buffer calculation; this
-             * limits the whole image size to 32 bits for API compatibility with
-             * the current, 32-bit, PNG_IMAGE_BUFFER_SIZE macro.
-             */
-            if (image->height > 0xffffffffU/png_row_stride)
-               png_error(image->opaque->png_ptr, "memory image too large");
-         }
-
-         else
-            png_error(image->opaque->png_ptr, "supplied row stride too small");
-      }
-
-      else
-         png_error(image->opaque->png_ptr, "image row stride too large");
-   }
-
-   /* Set the required transforms then write the rows in the correct order. */
+   /* Set the required transforms. */
    if ((format & PNG_FORMAT_FLAG_COLORMAP) != 0)
    {
       if (display->colormap != NULL && image->colormap_entries > 0)
@@ -2092,6 +3385,16 @@ png_image_write_main(void *argument)
              "no color-map for color-mapped image");
    }
 
+   else if (display->reduce != NULL)
+   {
+      png_set_IHDR(png_ptr, info_ptr, image->width, image->height,
+          display->reduce->bit_depth, display->reduce->color_type,
+          PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+      if (display->reduce->color_type == PNG_COLOR_TYPE_PALETTE)
+         png_image_write_reduced_PLTE(display);
+   }
+
    else
       png_set_IHDR(png_ptr, info_ptr, image->width, image->height,
           write_16bit ? 16 : 8,
@@ -2129,6 +3432,15 @@ png_image_write_main(void *argument)
    else
       png_set_gAMA_fixed(png_ptr, info_ptr, PNG_GAMMA_sRGB_INVERSE);
 
+#   ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+      /* Select the encode speed preset, if any; this must be done before the
+       * IHDR is written because the preset depends on the IHDR values.
+       */
+      if ((image->flags & PNG_IMAGE_FLAG_ENCODE_SPEED_MASK) != 0)
+         png_set_encode_speed(png_ptr,
+             (int)((image->flags & PNG_IMAGE_FLAG_ENCODE_SPEED_MASK) >> 4) - 1);
+#   endif
+
    /* Write the file header. */
    png_write_info(png_ptr, info_ptr);
 
@@ -2141,44 +3453,200 @@ png_image_write_main(void *argument)
    {
       png_uint_16 le = 0x0001;
 
-      if ((*(const png_byte *) & le) != 0)
-         png_set_swap(png_ptr);
-   }
+      if ((*(const png_byte *) & le) != 0)
+         png_set_swap(png_ptr);
+   }
+
+#   ifdef PNG_SIMPLIFIED_WRITE_BGR_SUPPORTED
+      if ((format & PNG_FORMAT_FLAG_BGR) != 0)
+      {
+         if (colormap == 0 && (format & PNG_FORMAT_FLAG_COLOR) != 0 &&
+             display->reduce == NULL)
+            png_set_bgr(png_ptr);
+         format &= ~PNG_FORMAT_FLAG_BGR;
+      }
+#   endif
+
+#   ifdef PNG_SIMPLIFIED_WRITE_AFIRST_SUPPORTED
+      if ((format & PNG_FORMAT_FLAG_AFIRST) != 0)
+      {
+         if (colormap == 0 && (format & PNG_FORMAT_FLAG_ALPHA) != 0 &&
+             display->reduce == NULL)
+            png_set_swap_alpha(png_ptr);
+         format &= ~PNG_FORMAT_FLAG_AFIRST;
+      }
+#   endif
+
+   /* If there are 16 or fewer color-map entries we wrote a lower bit depth
+    * above, but the application data is still byte packed.
+    */
+   if (colormap != 0 && image->colormap_entries <= 16)
+      png_set_packing(png_ptr);
+
+   /* That should have handled all (both) the transforms. */
+   if ((format & ~(png_uint_32)(PNG_FORMAT_FLAG_COLOR | PNG_FORMAT_FLAG_LINEAR |
+         PNG_FORMAT_FLAG_ALPHA | PNG_FORMAT_FLAG_COLORMAP)) != 0)
+      png_error(png_ptr, "png_write_image: unsupported transformation");
+
+   /* Apply 'fast' options if the flag is set; an explicit encode speed has
+    * already been handled above.
+    */
+   if ((image->flags & PNG_IMAGE_FLAG_FAST) != 0
+#   ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+       && (image->flags & PNG_IMAGE_FLAG_ENCODE_SPEED_MASK) == 0
+#   endif
+      )
+   {
+      png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_NO_FILTERS);
+      /* NOTE: determined by experiment using pngstest, this reflects some
+       * balance between the time to write the image once and the time to read
+       * it about 50 times.  The speed-up in pngstest was about 10-20% of the
+       * total (user) time on a heavily loaded system.
+       */
+#   ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+      png_set_compression_level(png_ptr, 3);
+#   endif
+   }
+
+   /* Check for the cases that currently require a pre-transform on the row
+    * before it is written.  This applies when the input is 16-bit and either
+    * there is an alpha channel or it is converted to 8-bit, and when the
+    * format has been reduced.
+    */
+   display->linear = linear;
+   display->write_16bit = write_16bit;
+   display->transform_rows = display->reduce != NULL ||
+      (linear != 0 && (alpha != 0 || display->convert_to_8bit != 0));
+}
+
+/* Allocate the row buffer for transformed rows.  When 16-bit linear data is
+ * written as 8-bit sRGB and the image has at least 65536 components the buffer
+ * is followed by a table of the sRGB encoding of every opaque linear value,
+ * which replaces the PNG_sRGB_FROM_LINEAR arithmetic with a single look-up.
+ */
+static png_byte *
+png_image_write_alloc_row(png_image_write_control *display)
+{
+   png_image *image = display->image;
+   png_struct *png_ptr = image->opaque->png_ptr;
+   size_t row_bytes = png_get_rowbytes(png_ptr, image->opaque->info_ptr);
+   unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(image->format);
+   png_byte *row;
+
+   display->sRGB_table = NULL;
+
+   if (display->linear == 0 || display->write_16bit != 0 ||
+       image->height <= 0xffffU / (image->width * channels))
+      return png_voidcast(png_byte *, png_malloc(png_ptr, row_bytes));
+
+   row = png_voidcast(png_byte *, png_malloc(png_ptr, row_bytes + 65536U));
+
+   {
+      png_byte *table = row + row_bytes;
+      png_uint_32 i;
+
+      for (i = 0; i < 65536U; ++i)
+         table[i] = (png_byte)PNG_sRGB_FROM_LINEAR(i * 255);
+
+      display->sRGB_table = table;
+   }
+
+   return row;
+}
+
+/* Write display->row_count rows starting at display->first_row.  When the rows
+ * are transformed display->local_row must be a buffer of png_get_rowbytes.
+ */
+static int
+png_image_write_rows_internal(png_image_write_control *display)
+{
+   png_image *image = display->image;
+   png_struct *png_ptr = image->opaque->png_ptr;
+
+   if (display->transform_rows != 0)
+   {
+      if (display->reduce != NULL)
+         return png_safe_execute(image, png_write_image_reduced, display);
+      else if (display->write_16bit != 0)
+         return png_safe_execute(image, png_write_image_16bit, display);
+      else
+         return png_safe_execute(image, png_write_image_8bit, display);
+   }
+
+   /* Otherwise this is the case where the input is in a format currently
+    * supported by the rest of the libpng write code; call it directly.
+    */
+   else
+   {
+      const png_byte *row = png_voidcast(const png_byte *, display->first_row);
+      ptrdiff_t row_step = display->row_step;
+      png_uint_32 y = display->row_count;
+
+      for (; y > 0; --y)
+      {
+         png_write_row(png_ptr, row);
+         row += row_step;
+      }
+   }
+
+   return 1;
+}
+
+static int
+png_image_write_main(void *argument)
+{
+   png_image_write_control *display = png_voidcast(png_image_write_control*,
+       argument);
+   png_image *image = display->image;
+   png_struct *png_ptr = image->opaque->png_ptr;
+   png_info *info_ptr = image->opaque->info_ptr;
+   png_image_write_reduce reduce;
+
+   /* Default the 'row_stride' parameter if required, also check the row stride
+    * and total image size to ensure that they are within the system limits.
+    */
+   {
+      unsigned int channels = PNG_IMAGE_PIXEL_CHANNELS(image->format);
+
+      if (image->width <= 0x7fffffffU/channels) /* no overflow */
+      {
+         png_uint_32 check;
+         png_uint_32 png_row_stride = image->width * channels;
+
+         if (display->row_stride == 0)
+            display->row_stride = (png_int_32)/*SAFE*/png_row_stride;
+
+         if (display->row_stride < 0)
+            check = -(png_uint_32)display->row_stride;
 
-#   ifdef PNG_SIMPLIFIED_WRITE_BGR_SUPPORTED
-      if ((format & PNG_FORMAT_FLAG_BGR) != 0)
-      {
-         if (colormap == 0 && (format & PNG_FORMAT_FLAG_COLOR) != 0)
-            png_set_bgr(png_ptr);
-         format &= ~PNG_FORMAT_FLAG_BGR;
-      }
-#   endif
+         else
+            check = (png_uint_32)display->row_stride;
 
-#   ifdef PNG_SIMPLIFIED_WRITE_AFIRST_SUPPORTED
-      if ((format & PNG_FORMAT_FLAG_AFIRST) != 0)
-      {
-         if (colormap == 0 && (format & PNG_FORMAT_FLAG_ALPHA) != 0)
-            png_set_swap_alpha(png_ptr);
-         format &= ~PNG_FORMAT_FLAG_AFIRST;
-      }
-#   endif
+         if (check >= png_row_stride)
+         {
+            /* Now check for overflow of the image buffer calculation; this
+             * limits the whole image size to 32 bits for API compatibility with
+             * the current, 32-bit, PNG_IMAGE_BUFFER_SIZE macro.
+             */
+            if (image->height > 0xffffffffU/png_row_stride)
+               png_error(image->opaque->png_ptr, "memory image too large");
+         }
 
-   /* If there are 16 or fewer color-map entries we wrote a lower bit depth
-    * above, but the application data is still byte packed.
-    */
-   if (colormap != 0 && image->colormap_entries <= 16)
-      png_set_packing(png_ptr);
+         else
+            png_error(image->opaque->png_ptr, "supplied row stride too small");
+      }
 
-   /* That should have handled all (both) the transforms. */
-   if ((format & ~(png_uint_32)(PNG_FORMAT_FLAG_COLOR | PNG_FORMAT_FLAG_LINEAR |
-         PNG_FORMAT_FLAG_ALPHA | PNG_FORMAT_FLAG_COLORMAP)) != 0)
-      png_error(png_ptr, "png_write_image: unsupported transformation");
+      else
+         png_error(image->opaque->png_ptr, "image row stride too large");
+   }
 
+   /* Find the rows in the correct order. */
    {
       const png_byte *row = png_voidcast(const png_byte *, display->buffer);
       ptrdiff_t row_step = display->row_stride;
 
-      if (linear != 0)
+      if ((image->format & (PNG_FORMAT_FLAG_COLORMAP|PNG_FORMAT_FLAG_LINEAR))
+          == PNG_FORMAT_FLAG_LINEAR)
          row_step *= 2;
 
       if (row_step < 0)
@@ -2186,37 +3654,24 @@ png_image_write_main(void *argument)
 
       display->first_row = row;
       display->row_step = row_step;
+      display->row_count = image->height;
    }
 
-   /* Apply 'fast' options if the flag is set. */
-   if ((image->flags & PNG_IMAGE_FLAG_FAST) != 0)
-   {
-      png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_NO_FILTERS);
-      /* NOTE: determined by experiment using pngstest, this reflects some
-       * balance between the time to write the image once and the time to read
-       * it about 50 times.  The speed-up in pngstest was about 10-20% of the
-       * total (user) time on a heavily loaded system.
-       */
-#   ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
-      png_set_compression_level(png_ptr, 3);
-#   endif
-   }
+   /* Only 8-bit images which are not color-mapped are reduced. */
+   if ((image->flags & PNG_IMAGE_FLAG_REDUCE) != 0 &&
+       (image->format & (PNG_FORMAT_FLAG_COLORMAP|PNG_FORMAT_FLAG_LINEAR)) == 0
+       && png_image_write_analyze(display, &reduce) != 0)
+      display->reduce = &reduce;
 
-   /* Check for the cases that currently require a pre-transform on the row
-    * before it is written.  This only applies when the input is 16-bit and
-    * either there is an alpha channel or it is converted to 8-bit.
-    */
-   if (linear != 0 && (alpha != 0 || display->convert_to_8bit != 0))
+   png_image_write_header(display);
+
+   if (display->transform_rows != 0)
    {
-      png_byte *row = png_voidcast(png_byte *, png_malloc(png_ptr,
-          png_get_rowbytes(png_ptr, info_ptr)));
+      png_byte *row = png_image_write_alloc_row(display);
       int result;
 
       display->local_row = row;
-      if (write_16bit != 0)
-         result = png_safe_execute(image, png_write_image_16bit, display);
-      else
-         result = png_safe_execute(image, png_write_image_8bit, display);
+      result = png_image_write_rows_internal(display);
       display->local_row = NULL;
 
       png_free(png_ptr, row);
@@ -2226,24 +3681,44 @@ png_image_write_main(void *argument)
          return 0;
    }
 
-   /* Otherwise this is the case where the input is in a format currently
-    * supported by the rest of the libpng write code; call it directly.
-    */
    else
+      (void)png_image_write_rows_internal(display);
+
+   png_write_end(png_ptr, info_ptr);
+   return 1;
+}
+
+/* Make room for at least 'needed' bytes of output.  The buffer at least
+ * doubles each time so that the total copying done by the realloc function is
+ * linear in the size of the PNG.
+ */
+static void
+image_memory_grow(png_struct *png_ptr, png_image_write_control *display,
+    png_alloc_size_t needed)
+{
+   png_alloc_size_t size = display->memory_bytes;
+   void *memory;
+
+   if (size < 8192)
+      size = 8192;
+
+   while (size < needed)
    {
-      const png_byte *row = png_voidcast(const png_byte *, display->first_row);
-      ptrdiff_t row_step = display->row_step;
-      png_uint_32 y = image->height;
+      if (size > ((png_alloc_size_t)-1) / 2)
+         size = needed;
 
-      for (; y > 0; --y)
-      {
-         png_write_row(png_ptr, row);
-         row += row_step;
-      }
+      else
+         size *= 2;
    }
 
-   png_write_end(png_ptr, info_ptr);
-   return 1;
+   memory = display->realloc_fn(display->realloc_context, display->memory,
+       size);
+
+   if (memory == NULL)
+      png_error(png_ptr, "png_image_write_to_memory_alloc: out of memory");
+
+   display->memory = png_voidcast(png_byte *, memory);
+   display->memory_bytes = size;
 }
 
 static void
@@ -2259,6 +3734,9 @@ image_memory_write(png_struct *png_ptr, png_byte *data, size_t size)
       /* I don't think libpng ever does this, but just in case: */
       if (size > 0)
       {
+         if (display->memory_bytes < ob+size && display->realloc_fn != NULL)
+            image_memory_grow(png_ptr, display, ob+size);
+
          if (display->memory_bytes >= ob+size) /* writing */
             memcpy(display->memory+ob, data, size);
 
@@ -2359,6 +3837,306 @@ png_image_write_to_memory(png_image *image, void *memory,
       return 0;
 }
 
+/* The default for png_image_write_to_memory_alloc: the C library allocator. */
+static void * PNGCBAPI
+image_memory_realloc(void *context, void *memory, png_alloc_size_t size)
+{
+   PNG_UNUSED(context)
+
+   if (size == 0)
+   {
+      free(memory);
+      return NULL;
+   }
+
+   return realloc(memory, size);
+}
+
+int
+png_image_write_to_memory_alloc(png_image *image, void **memory,
+    png_alloc_size_t *memory_bytes, int convert_to_8bit, const void *buffer,
+    png_int_32 row_stride, const void *colormap,
+    png_image_realloc_ptr realloc_fn, void *realloc_context)
+{
+   /* Write the image in one pass to memory which is grown as required. */
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      if (memory != NULL && memory_bytes != NULL && buffer != NULL)
+      {
+         *memory = NULL;
+         *memory_bytes = 0;
+
+         if (png_image_write_init(image) != 0)
+         {
+            png_image_write_control display;
+            int result;
+
+            memset(&display, 0, (sizeof display));
+            display.image = image;
+            display.buffer = buffer;
+            display.row_stride = row_stride;
+            display.colormap = colormap;
+            display.convert_to_8bit = convert_to_8bit;
+            display.realloc_fn =
+               realloc_fn != NULL ? realloc_fn : image_memory_realloc;
+            display.realloc_context = realloc_context;
+
+            result = png_safe_execute(image, png_image_write_memory, &display);
+            png_image_free(image);
+
+            if (result)
+            {
+               *memory = display.memory;
+               *memory_bytes = display.output_bytes;
+            }
+
+            else if (display.memory != NULL)
+               (void)display.realloc_fn(display.realloc_context,
+                   display.memory, 0);
+
+            return result;
+         }
+
+         else
+            return 0;
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_write_to_memory_alloc: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_write_to_memory_alloc: incorrect PNG_IMAGE_VERSION");
+
+   else
+      return 0;
+}
+
+/* State kept in png_control::write_stream between png_image_write_begin and
+ * png_image_write_end.
+ */
+typedef struct
+{
+   png_image_write_control display;
+   png_image_write_ptr write_fn;
+   void *write_context;
+   png_uint_32 rows_written;
+} png_image_write_stream;
+
+static void
+image_stream_write(png_struct *png_ptr, png_byte *data, size_t size)
+{
+   png_image_write_stream *stream = png_voidcast(png_image_write_stream*,
+       png_ptr->io_ptr/*backdoor: png_get_io_ptr(png_ptr)*/);
+
+   if (size > 0 && stream->write_fn(stream->write_context, data, size) == 0)
+      png_error(png_ptr, "png_image_write: write failed");
+}
+
+static int
+png_image_write_begin_function(void *argument)
+{
+   png_image_write_stream *stream = png_voidcast(png_image_write_stream*,
+       argument);
+   png_image *image = stream->display.image;
+   png_control *control = image->opaque;
+   png_struct *png_ptr = control->png_ptr;
+
+   if (image->width > 0x7fffffffU/PNG_IMAGE_PIXEL_CHANNELS(image->format))
+      png_error(png_ptr, "image row stride too large");
+
+   if (stream->write_fn != NULL)
+      png_set_write_fn(png_ptr, stream, image_stream_write,
+          image_memory_flush);
+
+   else /* write_context is a FILE, as in png_image_write_to_stdio */
+      png_ptr->io_ptr = stream->write_context;
+
+   png_image_write_header(&stream->display);
+
+   if (stream->display.transform_rows != 0)
+      control->write_row = png_image_write_alloc_row(&stream->display);
+
+   return 1;
+}
+
+int
+png_image_write_begin(png_image *image, png_image_write_ptr write_fn,
+    void *write_context, int convert_to_8bit, const void *colormap)
+{
+   /* Write the header and prepare to accept rows. */
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+#ifdef PNG_STDIO_SUPPORTED
+      if (write_fn != NULL || write_context != NULL)
+#else
+      if (write_fn != NULL)
+#endif
+      {
+         if (png_image_write_init(image) != 0)
+         {
+            png_control *control = image->opaque;
+            png_image_write_stream *stream =
+               png_voidcast(png_image_write_stream*,
+                  png_malloc_warn(control->png_ptr, (sizeof *stream)));
+
+            if (stream == NULL)
+               return png_image_error(image,
+                   "png_image_write_begin: out of memory");
+
+            memset(stream, 0, (sizeof *stream));
+            control->write_stream = stream;
+            stream->display.image = image;
+            stream->display.colormap = colormap;
+            stream->display.convert_to_8bit = convert_to_8bit;
+            stream->write_fn = write_fn;
+            stream->write_context = write_context;
+
+            return png_safe_execute(image, png_image_write_begin_function,
+                stream);
+         }
+
+         else
+            return 0;
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_write_begin: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_write_begin: incorrect PNG_IMAGE_VERSION");
+
+   else
+      return 0;
+}
+
+static int
+png_image_write_rows_function(void *argument)
+{
+   png_image_write_control *display = png_voidcast(png_image_write_control*,
+       argument);
+
+   return png_image_write_rows_internal(display);
+}
+
+int
+png_image_write_rows(png_image *image, const void *rows,
+    png_int_32 row_stride, png_uint_32 count)
+{
+   /* Write the next 'count' rows, rows is the first (top) row. */
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      png_image_write_stream *stream = image->opaque != NULL ?
+         png_voidcast(png_image_write_stream*, image->opaque->write_stream) :
+         NULL;
+
+      if (stream != NULL && rows != NULL)
+      {
+         png_image_write_control *display = &stream->display;
+         png_uint_32 png_row_stride =
+            image->width * PNG_IMAGE_PIXEL_CHANNELS(image->format);
+         png_uint_32 check;
+         ptrdiff_t row_step;
+
+         if (row_stride == 0)
+            row_stride = (png_int_32)/*SAFE*/png_row_stride;
+
+         if (row_stride < 0)
+            check = -(png_uint_32)row_stride;
+
+         else
+            check = (png_uint_32)row_stride;
+
+         if (check < png_row_stride)
+            return png_image_error(image,
+                "png_image_write_rows: supplied row stride too small");
+
+         if (count > image->height - stream->rows_written)
+            return png_image_error(image,
+                "png_image_write_rows: too many rows");
+
+         row_step = row_stride;
+
+         if (display->linear != 0)
+            row_step *= 2;
+
+         display->image = image;
+         display->first_row = rows;
+         display->row_step = row_step;
+         display->row_count = count;
+         display->local_row = image->opaque->write_row;
+
+         if (png_safe_execute(image, png_image_write_rows_function, display))
+         {
+            stream->rows_written += count;
+            return 1;
+         }
+
+         return 0;
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_write_rows: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_write_rows: incorrect PNG_IMAGE_VERSION");
+
+   else
+      return 0;
+}
+
+static int
+png_image_write_end_function(void *argument)
+{
+   png_image *image = png_voidcast(png_image*, argument);
+
+   png_write_end(image->opaque->png_ptr, image->opaque->info_ptr);
+   return 1;
+}
+
+int
+png_image_write_end(png_image *image)
+{
+   /* Finish the PNG and free the image. */
+   if (image != NULL && image->version == PNG_IMAGE_VERSION)
+   {
+      png_image_write_stream *stream = image->opaque != NULL ?
+         png_voidcast(png_image_write_stream*, image->opaque->write_stream) :
+         NULL;
+
+      if (stream != NULL)
+      {
+         int result;
+
+         if (stream->rows_written < image->height)
+            return png_image_error(image, "png_image_write_end: missing rows");
+
+         result = png_safe_execute(image, png_image_write_end_function, image);
+         png_image_free(image);
+         return result;
+      }
+
+      else
+         return png_image_error(image,
+             "png_image_write_end: invalid argument");
+   }
+
+   else if (image != NULL)
+      return png_image_error(image,
+          "png_image_write_end: incorrect PNG_IMAGE_VERSION");
+
+   else
+      return 0;
+}
+
 #ifdef PNG_SIMPLIFIED_WRITE_STDIO_SUPPORTED
 int
 png_image_write_to_stdio(png_image *image, FILE *file, int convert_to_8bit,
@@ -499,6 +499,10 @@ png_do_write_invert_alpha(png_row_info *row_info, png_byte *row)
 void /* PRIVATE */
 png_do_write_transformations(png_struct *png_ptr, png_row_info *row_info)
 {
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   double perf_start = PNG_PERF_CLOCK();
+#endif
+
    png_debug(1, "in png_do_write_transformations");
 
    if (png_ptr == NULL)
@@ -569,6 +573,11 @@ png_do_write_transformations(png_struct *png_ptr, png_row_info *row_info)
    if ((png_ptr->transformations & PNG_INVERT_MONO) != 0)
       png_do_invert(row_info, png_ptr->row_buf + 1);
 #endif
+
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   png_perf_count(png_ptr, PNG_PERF_WRITE_TRANSFORM, perf_start,
+       row_info->rowbytes);
+#endif
 }
 #endif /* WRITE_TRANSFORMS */
 #endif /* WRITE */
@@ -179,6 +179,56 @@ png_write_chunk_end(png_struct *png_ptr)
    png_write_data(png_ptr, buf, 4);
 }
 
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+/* Write a whole chunk with one call to the vectored write function.  'prefix'
+ * is at most 4 bytes to go before 'data' in the chunk (the fdAT sequence
+ * number); it is sent with the header.
+ */
+static void
+png_write_chunk_v(png_struct *png_ptr, png_uint_32 chunk_name,
+    const png_byte *prefix, size_t prefix_length, const png_byte *data,
+    size_t length)
+{
+   png_byte head[12];
+   png_byte crc[4];
+   png_iovec vec[3];
+   int count = 0;
+
+   png_save_uint_32(head, (png_uint_32)(prefix_length + length));
+   png_save_uint_32(head + 4, chunk_name);
+
+   if (prefix_length > 0)
+      memcpy(head + 8, prefix, prefix_length);
+
+   png_ptr->chunk_name = chunk_name;
+   png_reset_crc(png_ptr);
+   png_calculate_crc(png_ptr, head + 4, 4 + prefix_length);
+
+   if (data != NULL && length > 0)
+      png_calculate_crc(png_ptr, data, length);
+
+   png_save_uint_32(crc, png_ptr->crc);
+
+#ifdef PNG_IO_STATE_SUPPORTED
+   png_ptr->io_state = PNG_IO_WRITING | PNG_IO_CHUNK_HDR;
+#endif
+
+   vec[count].data = head;
+   vec[count++].length = 8 + prefix_length;
+
+   if (data != NULL && length > 0)
+   {
+      vec[count].data = data;
+      vec[count++].length = length;
+   }
+
+   vec[count].data = crc;
+   vec[count++].length = 4;
+
+   png_write_data_v(png_ptr, vec, count);
+}
+#endif /* WRITE_VECTOR */
+
 /* Write a PNG chunk all at once.  The type is an array of ASCII characters
  * representing the chunk name.  The array must be at least 4 bytes in
  * length, and does not need to be null terminated.  To be safe, pass the
@@ -199,6 +249,14 @@ png_write_complete_chunk(png_struct *png_ptr, png_uint_32 chunk_name,
    if (length > PNG_UINT_31_MAX)
       png_error(png_ptr, "length exceeds PNG maximum");
 
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+   if (png_ptr->write_v_fn != NULL)
+   {
+      png_write_chunk_v(png_ptr, chunk_name, NULL, 0, data, length);
+      return;
+   }
+#endif
+
    png_write_chunk_header(png_ptr, chunk_name, (png_uint_32)length);
    png_write_chunk_data(png_ptr, data, length);
    png_write_chunk_end(png_ptr);
@@ -571,6 +629,7 @@ png_text_compress(png_struct *png_ptr, png_uint_32 chunk_name,
             next = *end;
             if (next == NULL)
             {
+               png_alloc_owner(png_ptr, PNG_ALLOC_ZLIB);
                next = png_voidcast(png_compression_buffer *, png_malloc_base
                   (png_ptr, PNG_COMPRESSION_BUFFER_SIZE(png_ptr)));
 
@@ -843,6 +902,10 @@ png_write_IHDR(png_struct *png_ptr, png_uint_32 width, png_uint_32 height,
    png_ptr->first_frame_height = height;
 #endif
 
+#ifdef PNG_WRITE_CUSTOMIZE_COMPRESSION_SUPPORTED
+   png_write_encode_speed(png_ptr);
+#endif
+
    if ((png_ptr->do_filter) == PNG_NO_FILTERS)
    {
       if (png_ptr->color_type == PNG_COLOR_TYPE_PALETTE ||
@@ -946,6 +1009,7 @@ png_compress_IDAT(png_struct *png_ptr, const png_byte *input,
        */
       if (png_ptr->zbuffer_list == NULL)
       {
+         png_alloc_owner(png_ptr, PNG_ALLOC_ZLIB);
          png_ptr->zbuffer_list = png_voidcast(png_compression_buffer *,
              png_malloc(png_ptr, PNG_COMPRESSION_BUFFER_SIZE(png_ptr)));
          png_ptr->zbuffer_list->next = NULL;
@@ -984,7 +1048,17 @@ png_compress_IDAT(png_struct *png_ptr, const png_byte *input,
       png_ptr->zstream.avail_in = avail;
       input_len -= avail;
 
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+      {
+         double perf_start = PNG_PERF_CLOCK();
+
+         ret = deflate(&png_ptr->zstream, input_len > 0 ? Z_NO_FLUSH : flush);
+         png_perf_count(png_ptr, PNG_PERF_DEFLATE, perf_start,
+             avail - png_ptr->zstream.avail_in);
+      }
+#else
       ret = deflate(&png_ptr->zstream, input_len > 0 ? Z_NO_FLUSH : flush);
+#endif
 
       /* Include as-yet unconsumed input */
       input_len += png_ptr->zstream.avail_in;
@@ -2012,14 +2086,20 @@ png_write_fdAT(png_struct *png_ptr,
 {
    png_byte buf[4];
 
-   png_write_chunk_header(png_ptr, png_fdAT, (png_uint_32)(4 + length));
-
    png_save_uint_32(buf, png_ptr->next_seq_num);
-   png_write_chunk_data(png_ptr, buf, 4);
 
-   png_write_chunk_data(png_ptr, data, length);
+#ifdef PNG_WRITE_VECTOR_SUPPORTED
+   if (png_ptr->write_v_fn != NULL)
+      png_write_chunk_v(png_ptr, png_fdAT, buf, 4, data, length);
 
-   png_write_chunk_end(png_ptr);
+   else
+#endif
+   {
+      png_write_chunk_header(png_ptr, png_fdAT, (png_uint_32)(4 + length));
+      png_write_chunk_data(png_ptr, buf, 4);
+      png_write_chunk_data(png_ptr, data, length);
+      png_write_chunk_end(png_ptr);
+   }
 
    png_ptr->next_seq_num++;
 }
@@ -2046,6 +2126,7 @@ png_write_start_row(png_struct *png_ptr)
    png_ptr->maximum_pixel_depth = (png_byte)usr_pixel_depth;
 
    /* Set up row buffer */
+   png_alloc_owner(png_ptr, PNG_ALLOC_ROWS);
    png_ptr->row_buf = png_voidcast(png_byte *, png_malloc(png_ptr, buf_size));
 
    png_ptr->row_buf[0] = PNG_FILTER_VALUE_NONE;
@@ -2069,6 +2150,7 @@ png_write_start_row(png_struct *png_ptr)
    {
       int num_filters = 0;
 
+      png_alloc_owner(png_ptr, PNG_ALLOC_ROWS);
       png_ptr->try_row = png_voidcast(png_byte *,
           png_malloc(png_ptr, buf_size));
 
@@ -2085,16 +2167,22 @@ png_write_start_row(png_struct *png_ptr)
          num_filters++;
 
       if (num_filters > 1)
+      {
+         png_alloc_owner(png_ptr, PNG_ALLOC_ROWS);
          png_ptr->tst_row = png_voidcast(png_byte *, png_malloc(png_ptr,
              buf_size));
+      }
    }
 
    /* We only need to keep the previous row if we are using one of the following
     * filters.
     */
    if ((filters & (PNG_FILTER_AVG | PNG_FILTER_UP | PNG_FILTER_PAETH)) != 0)
+   {
+      png_alloc_owner(png_ptr, PNG_ALLOC_ROWS);
       png_ptr->prev_row = png_voidcast(png_byte *,
           png_calloc(png_ptr, buf_size));
+   }
 #endif /* WRITE_FILTER */
 
 #ifdef PNG_WRITE_INTERLACING_SUPPORTED
@@ -2651,6 +2739,9 @@ void /* PRIVATE */
 png_write_find_filter(png_struct *png_ptr, png_row_info *row_info)
 {
 #ifndef PNG_WRITE_FILTER_SUPPORTED
+#  ifdef PNG_PERF_COUNTERS_SUPPORTED
+      png_ptr->perf_filter_start = PNG_PERF_CLOCK();
+#  endif
    png_write_filtered_row(png_ptr, png_ptr->row_buf, row_info->rowbytes+1);
 #else
    unsigned int filter_to_do = png_ptr->do_filter;
@@ -2662,9 +2753,55 @@ png_write_find_filter(png_struct *png_ptr, png_row_info *row_info)
 
    png_debug(1, "in png_write_find_filter");
 
+#  ifdef PNG_PERF_COUNTERS_SUPPORTED
+      png_ptr->perf_filter_start = PNG_PERF_CLOCK();
+#  endif
+
    /* Find out how many bytes offset each pixel is */
    bpp = (row_info->pixel_depth + 7) >> 3;
 
+   if (PNG_SIZE_MAX/128 <= row_bytes)
+   {
+      /* Overflow can occur in the calculation, just select the lowest set
+       * filter.
+       */
+      filter_to_do &= 0U-filter_to_do;
+   }
+
+   /* When only one filter is selected there is nothing to choose, so the row
+    * is filtered directly without any of the heuristic machinery below.  This
+    * is the path taken by the fast png_set_encode_speed presets.
+    */
+   switch (filter_to_do)
+   {
+      case PNG_FILTER_NONE:
+         png_write_filtered_row(png_ptr, png_ptr->row_buf, row_bytes+1);
+         return;
+
+      case PNG_FILTER_SUB:
+         png_setup_sub_row_only(png_ptr, bpp, row_bytes);
+         png_write_filtered_row(png_ptr, png_ptr->try_row, row_bytes+1);
+         return;
+
+      case PNG_FILTER_UP:
+         png_setup_up_row_only(png_ptr, row_bytes);
+         png_write_filtered_row(png_ptr, png_ptr->try_row, row_bytes+1);
+         return;
+
+      case PNG_FILTER_AVG:
+         png_setup_avg_row_only(png_ptr, bpp, row_bytes);
+         png_write_filtered_row(png_ptr, png_ptr->try_row, row_bytes+1);
+         return;
+
+      case PNG_FILTER_PAETH:
+         png_setup_paeth_row_only(png_ptr, bpp, row_bytes);
+         png_write_filtered_row(png_ptr, png_ptr->try_row, row_bytes+1);
+         return;
+
+      default:
+         break;
+   }
+
    row_buf = png_ptr->row_buf;
    mins = PNG_SIZE_MAX - 256/* so we can detect potential overflow of the
                                running sum */;
@@ -2698,15 +2835,7 @@ png_write_find_filter(png_struct *png_ptr, png_row_info *row_info)
     */
    best_row = png_ptr->row_buf;
 
-   if (PNG_SIZE_MAX/128 <= row_bytes)
-   {
-      /* Overflow can occur in the calculation, just select the lowest set
-       * filter.
-       */
-      filter_to_do &= 0U-filter_to_do;
-   }
-   else if ((filter_to_do & PNG_FILTER_NONE) != 0 &&
-         filter_to_do != PNG_FILTER_NONE)
+   if ((filter_to_do & PNG_FILTER_NONE) != 0)
    {
       /* Overflow not possible and multiple filters in the list, including the
        * 'none' filter.
@@ -2732,14 +2861,7 @@ png_write_find_filter(png_struct *png_ptr, png_row_info *row_info)
    }
 
    /* Sub filter */
-   if (filter_to_do == PNG_FILTER_SUB)
-   /* It's the only filter so no testing is needed */
-   {
-      png_setup_sub_row_only(png_ptr, bpp, row_bytes);
-      best_row = png_ptr->try_row;
-   }
-
-   else if ((filter_to_do & PNG_FILTER_SUB) != 0)
+   if ((filter_to_do & PNG_FILTER_SUB) != 0)
    {
       size_t sum;
       size_t lmins = mins;
@@ -2759,13 +2881,7 @@ png_write_find_filter(png_struct *png_ptr, png_row_info *row_info)
    }
 
    /* Up filter */
-   if (filter_to_do == PNG_FILTER_UP)
-   {
-      png_setup_up_row_only(png_ptr, row_bytes);
-      best_row = png_ptr->try_row;
-   }
-
-   else if ((filter_to_do & PNG_FILTER_UP) != 0)
+   if ((filter_to_do & PNG_FILTER_UP) != 0)
    {
       size_t sum;
       size_t lmins = mins;
@@ -2785,13 +2901,7 @@ png_write_find_filter(png_struct *png_ptr, png_row_info *row_info)
    }
 
    /* Avg filter */
-   if (filter_to_do == PNG_FILTER_AVG)
-   {
-      png_setup_avg_row_only(png_ptr, bpp, row_bytes);
-      best_row = png_ptr->try_row;
-   }
-
-   else if ((filter_to_do & PNG_FILTER_AVG) != 0)
+   if ((filter_to_do & PNG_FILTER_AVG) != 0)
    {
       size_t sum;
       size_t lmins = mins;
@@ -2811,13 +2921,7 @@ png_write_find_filter(png_struct *png_ptr, png_row_info *row_info)
    }
 
    /* Paeth filter */
-   if (filter_to_do == PNG_FILTER_PAETH)
-   {
-      png_setup_paeth_row_only(png_ptr, bpp, row_bytes);
-      best_row = png_ptr->try_row;
-   }
-
-   else if ((filter_to_do & PNG_FILTER_PAETH) != 0)
+   if ((filter_to_do & PNG_FILTER_PAETH) != 0)
    {
       size_t sum;
       size_t lmins = mins;
@@ -2851,6 +2955,14 @@ png_write_filtered_row(png_struct *png_ptr, png_byte *filtered_row,
 
    png_debug1(2, "filter = %d", filtered_row[0]);
 
+#ifdef PNG_PERF_COUNTERS_SUPPORTED
+   /* Filter selection ends here; this is reached from every path through
+    * png_write_find_filter.
+    */
+   png_perf_count(png_ptr, PNG_PERF_FILTER, png_ptr->perf_filter_start,
+       full_row_length);
+#endif
+
    png_compress_IDAT(png_ptr, filtered_row, full_row_length, Z_NO_FLUSH);
 
 #ifdef PNG_WRITE_FILTER_SUPPORTED
@@ -2886,6 +2998,20 @@ png_write_reset(png_struct *png_ptr)
    png_ptr->row_number = 0;
    png_ptr->pass = 0;
    png_ptr->mode &= ~PNG_HAVE_IDAT;
+
+   /* png_write_start_row allocates the row buffers for the size of the frame;
+    * release those of the previous frame, which may be smaller.
+    */
+   png_free(png_ptr, png_ptr->row_buf);
+   png_ptr->row_buf = NULL;
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   png_free(png_ptr, png_ptr->prev_row);
+   png_free(png_ptr, png_ptr->try_row);
+   png_free(png_ptr, png_ptr->tst_row);
+   png_ptr->prev_row = NULL;
+   png_ptr->try_row = NULL;
+   png_ptr->tst_row = NULL;
+#endif
 }
 
 void /* PRIVATE */